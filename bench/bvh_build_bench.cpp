@@ -0,0 +1,106 @@
+// BVHビルダの構築速度（Mprims/s）と木の質（SAHコスト）の比較
+//
+//   ./build/bvh_build_bench [--min <n>] [--max <n>] [--repeat <k>]
+//
+// プリミティブ数を --min から --max まで10倍ずつ増やしながら、各ビルダで構築する。
+// `recursive`は`bvh_node`そのもの（シーンの読み込みで使われる直列ビルダ）で、
+// 同じ分割をする`median`のSAHコストを基準（1.00）として他のビルダの質を示す。
+#include "rtweekend.hpp"
+
+#include "bvh.hpp"
+#include "bvh_build.hpp"
+#include "sphere.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+    using clock_type = std::chrono::steady_clock;
+
+    /** 一辺1000の立方体内に、大きさのばらついた球のバウンディングボックスを固定シードで並べる */
+    std::vector<aabb> random_bounds(int64_t n) {
+        std::mt19937_64 rng(12345);
+        std::uniform_real_distribution<double> position(0, 1000);
+        std::lognormal_distribution<double> radius(0.0, 0.7);
+        std::vector<aabb> bounds;
+        bounds.reserve(n);
+        for (int64_t i = 0; i < n; i++) {
+            point3 c{position(rng), position(rng), position(rng)};
+            double r = radius(rng);
+            vec3 rvec{r, r, r};
+            bounds.emplace_back(c - rvec, c + rvec);
+        }
+        return bounds;
+    }
+
+    template<class F>
+    double best_time_ms(int32_t repeat, F&& f) {
+        double best = infinity;
+        for (int32_t k = 0; k < repeat; k++) {
+            auto begin = clock_type::now();
+            f();
+            std::chrono::duration<double, std::milli> elapsed = clock_type::now() - begin;
+            best = std::min(best, elapsed.count());
+        }
+        return best;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int64_t min_count = 1000;
+    int64_t max_count = 1000000;
+    int32_t repeat = 3;
+    for (int32_t i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--min") == 0)         { min_count = std::atoll(argv[i + 1]); }
+        else if (std::strcmp(argv[i], "--max") == 0)    { max_count = std::atoll(argv[i + 1]); }
+        else if (std::strcmp(argv[i], "--repeat") == 0) { repeat = std::atoi(argv[i + 1]); }
+    }
+
+    std::cout << "threads: " << hardware_threads() << '\n';
+    std::cout << std::setw(10) << "prims" << std::setw(11) << "builder"
+              << std::setw(12) << "time[ms]" << std::setw(12) << "Mprims/s"
+              << std::setw(10) << "SAH" << std::setw(12) << "SAH ratio" << '\n';
+
+    for (int64_t n = min_count; n <= max_count; n *= 10) {
+        std::vector<aabb> bounds = random_bounds(n);
+
+        auto report = [&](const char* name, double ms, double sah, double reference_sah) {
+            std::cout << std::setw(10) << n << std::setw(11) << name
+                      << std::setw(12) << std::fixed << std::setprecision(2) << ms
+                      << std::setw(12) << std::setprecision(2) << (n / ms / 1000.0);
+            if (sah > 0) {
+                std::cout << std::setw(10) << std::setprecision(1) << sah
+                          << std::setw(12) << std::setprecision(3) << sah / reference_sah;
+            }
+            std::cout << '\n';
+        };
+
+        // `bvh_node`は`shared_ptr<hittable>`を並べ替えながら構築するので、球を実際に作って測る
+        {
+            std::vector<shared_ptr<hittable>> objects;
+            objects.reserve(n);
+            for (const aabb& box : bounds) {
+                objects.push_back(make_shared<sphere>(box.centroid(), box.x.size() / 2, nullptr));
+            }
+            double ms = best_time_ms(repeat, [&] {
+                auto copy = objects;
+                bvh_node root(copy, 0, copy.size());
+            });
+            report("recursive", ms, 0, 1);
+        }
+
+        double reference_sah = 0;
+        for (auto builder : {bvh_builder::median, bvh_builder::binned, bvh_builder::lbvh30, bvh_builder::lbvh63}) {
+            bvh_layout layout;
+            double ms = best_time_ms(repeat, [&] { layout = build_bvh_layout(builder, bounds); });
+            double sah = bvh_sah_cost(layout.nodes);
+            if (builder == bvh_builder::median) { reference_sah = sah; }
+            report(bvh_builder_name(builder), ms, sah, reference_sah);
+        }
+    }
+}
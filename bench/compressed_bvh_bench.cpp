@@ -0,0 +1,138 @@
+// 子の箱を8bitに量子化したBVH（compressed_bvh）のメモリ量と走査速度の比較
+//
+//   ./build/compressed_bvh_bench [--prims <n>] [--rays <n>] [--builder <name>]
+//
+// 一辺1000の立方体内に向きと大きさのばらついた三角形を固定シードで並べ、同じビルダの構造から`flat_bvh`と`compressed_bvh`を作る。
+// ノード配列のバイト数と、立方体内のランダムなレイ（キャッシュに収まらない走査になる）の速度を比べる。
+// 両者の交差結果（最も近い交点の距離）が一致することも確かめる。
+#include "rtweekend.hpp"
+
+#include "bvh_build.hpp"
+#include "compressed_bvh.hpp"
+#include "quad.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+    using clock_type = std::chrono::steady_clock;
+
+    /** 一辺1000の立方体内に、向きと大きさのばらついた三角形を固定シードで並べる */
+    std::vector<shared_ptr<hittable>> random_triangles(int64_t n) {
+        std::mt19937_64 rng(12345);
+        std::uniform_real_distribution<double> position(0, 1000);
+        std::uniform_real_distribution<double> direction(-1, 1);
+        std::lognormal_distribution<double> size(2.0, 0.5);
+        auto random_edge = [&] { return size(rng) * vec3{direction(rng), direction(rng), direction(rng)}; };
+        std::vector<shared_ptr<hittable>> objects;
+        objects.reserve(n);
+        for (int64_t i = 0; i < n; i++) {
+            point3 q{position(rng), position(rng), position(rng)};
+            vec3 u = random_edge();
+            vec3 v = random_edge();
+            objects.push_back(make_shared<triangle>(q, u, v, nullptr));
+        }
+        return objects;
+    }
+
+    std::vector<ray> random_rays(const aabb& bounds, int64_t count) {
+        std::mt19937_64 rng(2024);
+        std::uniform_real_distribution<double> unit(0, 1);
+        auto random_point = [&] {
+            return point3(
+                bounds.x.min + unit(rng) * bounds.x.size(),
+                bounds.y.min + unit(rng) * bounds.y.size(),
+                bounds.z.min + unit(rng) * bounds.z.size()
+            );
+        };
+        std::vector<ray> rays;
+        rays.reserve(count);
+        for (int64_t i = 0; i < count; i++) {
+            point3 origin = random_point();
+            rays.emplace_back(origin, unit_vector(random_point() - origin));
+        }
+        return rays;
+    }
+
+    struct trace_result {
+        double ms;
+        int64_t hits;
+        std::vector<double> distances;
+    };
+
+    trace_result trace(const hittable& bvh, const std::vector<ray>& rays) {
+        trace_result result{0, 0, {}};
+        result.distances.reserve(rays.size());
+        auto begin = clock_type::now();
+        for (const ray& r : rays) {
+            hit_record rec;
+            bool hit = bvh.hit(r, interval(0.001, infinity), rec);
+            result.hits += hit;
+            result.distances.push_back(hit ? rec.t : infinity);
+        }
+        std::chrono::duration<double, std::milli> elapsed = clock_type::now() - begin;
+        result.ms = elapsed.count();
+        return result;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int64_t prim_count = 2000000;
+    int64_t ray_count = 100000;
+    bvh_builder builder = bvh_builder::binned;
+    for (int32_t i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--prims") == 0)     { prim_count = std::atoll(argv[i + 1]); }
+        else if (std::strcmp(argv[i], "--rays") == 0) { ray_count = std::atoll(argv[i + 1]); }
+        else if (std::strcmp(argv[i], "--builder") == 0) {
+            auto parsed = parse_bvh_builder(argv[i + 1]);
+            if (not parsed) {
+                std::cerr << "ERROR: Unknown BVH builder '" << argv[i + 1] << "'.\n";
+                return 1;
+            }
+            builder = *parsed;
+        }
+    }
+    if (builder == bvh_builder::recursive) { builder = bvh_builder::median; }
+
+    std::vector<shared_ptr<hittable>> objects = random_triangles(prim_count);
+    const bvh_layout layout = build_bvh_layout(builder, primitive_bounds(objects));
+    flat_bvh flat(objects, layout);
+    compressed_bvh compressed(objects, layout);
+
+    std::vector<ray> rays = random_rays(flat.bounding_box(), ray_count);
+    trace_result flat_result = trace(flat, rays);
+    trace_result compressed_result = trace(compressed, rays);
+
+    int64_t mismatches = 0;
+    for (size_t i = 0; i < rays.size(); i++) {
+        if (flat_result.distances[i] != compressed_result.distances[i]) { mismatches++; }
+    }
+
+    const double flat_bytes = double(flat.node_array().size_bytes());
+    const double compressed_bytes = double(compressed.node_array().size_bytes());
+    std::cout << "primitives: " << objects.size() << ", rays: " << rays.size()
+              << ", builder: " << bvh_builder_name(builder) << '\n';
+    std::cout << std::setw(12) << "bvh" << std::setw(10) << "nodes" << std::setw(12) << "node[MB]"
+              << std::setw(12) << "time[ms]" << std::setw(12) << "Mrays/s" << std::setw(10) << "hits" << '\n';
+    auto report = [&](const char* name, size_t nodes, double bytes, const trace_result& result) {
+        std::cout << std::setw(12) << name << std::setw(10) << nodes
+                  << std::setw(12) << std::fixed << std::setprecision(1) << bytes / (1 << 20)
+                  << std::setw(12) << result.ms
+                  << std::setw(12) << std::setprecision(2) << rays.size() / result.ms / 1000.0
+                  << std::setw(10) << result.hits << '\n';
+    };
+    report("flat", flat.node_array().size(), flat_bytes, flat_result);
+    report("compressed", compressed.node_array().size(), compressed_bytes, compressed_result);
+    std::cout << "node memory: " << std::setprecision(1) << 100.0 * (1.0 - compressed_bytes / flat_bytes) << "% smaller, "
+              << "throughput: " << std::showpos << 100.0 * (flat_result.ms / compressed_result.ms - 1.0) << std::noshowpos << "%\n";
+    if (mismatches > 0) {
+        std::cerr << "ERROR: " << mismatches << " rays hit differently.\n";
+        return 1;
+    }
+    return 0;
+}
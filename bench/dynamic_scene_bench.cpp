@@ -0,0 +1,127 @@
+// 物体を追加・削除・移動したときの`dynamic_scene`の更新時間と、BVHを作り直す時間の比較
+//
+//   ./build/dynamic_scene_bench [--min <n>] [--max <n>] [--edits <k>]
+//
+// 物体数を --min から --max まで10倍ずつ増やしながら、一辺1000の立方体内の球でシーンを作り、
+// 追加・削除・小さな移動・大きな移動をそれぞれ --edits 回ずつ行って1回あたりの時間を測る。
+// 編集の後のSAHコストを、同じ物体から`binned`で作り直したBVHと比べ、両者の交差結果が一致することも確かめる。
+#include "rtweekend.hpp"
+
+#include "bvh_build.hpp"
+#include "dynamic_scene.hpp"
+#include "sphere.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+    using clock_type = std::chrono::steady_clock;
+
+    double elapsed_ms(clock_type::time_point begin) {
+        std::chrono::duration<double, std::milli> elapsed = clock_type::now() - begin;
+        return elapsed.count();
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int64_t min_count = 1000;
+    int64_t max_count = 1000000;
+    int32_t edits = 10000;
+    for (int32_t i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--min") == 0)        { min_count = std::atoll(argv[i + 1]); }
+        else if (std::strcmp(argv[i], "--max") == 0)   { max_count = std::atoll(argv[i + 1]); }
+        else if (std::strcmp(argv[i], "--edits") == 0) { edits = std::atoi(argv[i + 1]); }
+    }
+
+    std::cout << std::setw(10) << "objects" << std::setw(12) << "build[ms]"
+              << std::setw(12) << "insert[us]" << std::setw(12) << "remove[us]"
+              << std::setw(12) << "nudge[us]" << std::setw(12) << "move[us]"
+              << std::setw(8) << "height" << std::setw(10) << "SAH" << std::setw(12) << "SAH ratio" << '\n';
+
+    for (int64_t n = min_count; n <= max_count; n *= 10) {
+        std::mt19937_64 rng(12345);
+        std::uniform_real_distribution<double> position(0, 1000);
+        std::uniform_real_distribution<double> offset(-1, 1);
+        std::lognormal_distribution<double> radius(0.0, 0.7);
+        std::vector<point3> centers;
+        std::vector<double> radii;
+        std::vector<shared_ptr<hittable>> objects;
+        auto random_sphere = [&](const point3& center, double r) {
+            centers.push_back(center);
+            radii.push_back(r);
+            return make_shared<sphere>(center, r, nullptr);
+        };
+        for (int64_t i = 0; i < n; i++) {
+            objects.push_back(random_sphere(point3{position(rng), position(rng), position(rng)}, radius(rng)));
+        }
+
+        dynamic_scene scene;
+        auto begin = clock_type::now();
+        std::vector<object_handle> handles = scene.insert(objects);
+        const double build_ms = elapsed_ms(begin);
+
+        auto pick = [&] { return size_t(rng() % handles.size()); };
+        auto time_edits = [&](auto&& edit) {
+            auto edit_begin = clock_type::now();
+            for (int32_t e = 0; e < edits; e++) { edit(); }
+            return elapsed_ms(edit_begin) * 1000 / edits;
+        };
+        const double insert_us = time_edits([&] {
+            objects.push_back(random_sphere(point3{position(rng), position(rng), position(rng)}, radius(rng)));
+            handles.push_back(scene.insert(objects.back()));
+        });
+        const double remove_us = time_edits([&] {
+            const size_t k = pick();
+            scene.remove(handles[k]);
+            std::swap(handles[k], handles.back());
+            std::swap(objects[k], objects.back());
+            std::swap(centers[k], centers.back());
+            std::swap(radii[k], radii.back());
+            handles.pop_back();
+            objects.pop_back();
+            centers.pop_back();
+            radii.pop_back();
+        });
+        // 半径程度の移動と、立方体内の任意の位置への移動
+        auto move_edit = [&](bool far) {
+            const size_t k = pick();
+            const point3 center = far ? point3{position(rng), position(rng), position(rng)}
+                                      : centers[k] + radii[k] * vec3{offset(rng), offset(rng), offset(rng)};
+            centers[k] = center;
+            objects[k] = make_shared<sphere>(center, radii[k], nullptr);
+            scene.update(handles[k], objects[k]);
+        };
+        const double nudge_us = time_edits([&] { move_edit(false); });
+        const double move_us = time_edits([&] { move_edit(true); });
+
+        flat_bvh rebuilt(objects, build_bvh_layout(bvh_builder::binned, objects));
+        const double rebuilt_sah = bvh_sah_cost(rebuilt.node_array());
+        std::cout << std::setw(10) << n
+                  << std::setw(12) << std::fixed << std::setprecision(2) << build_ms
+                  << std::setw(12) << insert_us << std::setw(12) << remove_us
+                  << std::setw(12) << nudge_us << std::setw(12) << move_us
+                  << std::setw(8) << scene.height()
+                  << std::setw(10) << std::setprecision(1) << scene.sah_cost()
+                  << std::setw(12) << std::setprecision(3) << scene.sah_cost() / rebuilt_sah << '\n';
+
+        int64_t mismatches = 0;
+        for (int32_t i = 0; i < 10000; i++) {
+            const point3 origin{position(rng), position(rng), position(rng)};
+            const ray r(origin, vec3{offset(rng), offset(rng), offset(rng)});
+            hit_record a, b;
+            const bool hit_a = scene.hit(r, interval(0.001, infinity), a);
+            const bool hit_b = rebuilt.hit(r, interval(0.001, infinity), b);
+            if (hit_a != hit_b or (hit_a and a.t != b.t)) { mismatches++; }
+        }
+        if (mismatches > 0) {
+            std::cerr << "ERROR: " << mismatches << " rays hit differently.\n";
+            return 1;
+        }
+    }
+    return 0;
+}
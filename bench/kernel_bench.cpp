@@ -0,0 +1,385 @@
+// 交差判定・走査・シェーディングの各カーネルのマイクロベンチマーク
+//
+//   ./build/kernel_bench [--rays <n>] [--min-time <ms>] [--filter <substring>] [--json]
+//
+// 固定シードのレイ集合（coherent: 1点から狭い範囲へ / incoherent: 周囲のランダムな位置から、
+// hit: 対象に向かう / miss: 対象の脇を通る）を各カーネルに与え、1回あたりの時間（ns/op）と
+// 1秒あたりのレイ数（Mrays/s）、実際にヒットした割合を表示する。
+// --json を付けると同じ結果をJSONで出力するので、コミット間で結果を比較できる。
+#include "rtweekend.hpp"
+
+#include "aabb.hpp"
+#include "bvh.hpp"
+#include "bvh_build.hpp"
+#include "material.hpp"
+#include "perlin.hpp"
+#include "quad.hpp"
+#include "ray_packet.hpp"
+#include "axis_aligned.hpp"
+#include "sphere.hpp"
+
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+    using clock_type = std::chrono::steady_clock;
+
+    enum class coherence { coherent, incoherent };
+    enum class target { hit, miss };
+
+    /**
+     * @brief `bounds`に対するレイ集合を固定シードで作る。
+     * coherentは+z方向の1点から、incoherentは`bounds`を囲む球面上のランダムな点から撃つ。
+     * hitは`bounds`の中心付近（各軸で半分の幅）へ、missは`bounds`から外れた点へ向ける。
+     */
+    std::vector<ray> make_rays(const aabb& bounds, coherence c, target t, int64_t count, uint64_t seed) {
+        std::mt19937_64 rng(seed);
+        std::uniform_real_distribution<double> unit(0, 1);
+        std::normal_distribution<double> normal(0, 1);
+
+        const point3 center = bounds.centroid();
+        const vec3 extent{bounds.x.size(), bounds.y.size(), bounds.z.size()};
+        const double radius = 2 * extent.length();
+
+        auto aim = [&] {
+            vec3 offset{unit(rng) - 0.5, unit(rng) - 0.5, unit(rng) - 0.5};
+            if (t == target::hit) { return center + 0.5 * vec3(offset.x() * extent.x(), offset.y() * extent.y(), offset.z() * extent.z()); }
+            // 各軸で箱の外側に1辺分ずらした点を狙う
+            vec3 shift{offset.x() < 0 ? -1.0 : 1.0, offset.y() < 0 ? -1.0 : 1.0, 0.0};
+            return center + vec3(shift.x() * extent.x(), shift.y() * extent.y(), offset.z() * extent.z());
+        };
+
+        std::vector<ray> rays;
+        rays.reserve(count);
+        const point3 eye = center + vec3(0, 0, radius);
+        for (int64_t i = 0; i < count; i++) {
+            point3 origin = eye;
+            if (c == coherence::incoherent) {
+                vec3 d{normal(rng), normal(rng), normal(rng)};
+                origin = center + radius * unit_vector(d);
+            }
+            rays.emplace_back(origin, aim() - origin, unit(rng));
+        }
+        return rays;
+    }
+
+    const char* coherence_name(coherence c) { return c == coherence::coherent ? "coherent" : "incoherent"; }
+    const char* target_name(target t) { return t == target::hit ? "hit" : "miss"; }
+
+    struct result {
+        std::string kernel;
+        std::string ray_set;
+        double ns_per_op;
+        // レイを扱わないカーネルでは0
+        double mrays_per_s;
+        // ヒットした（あるいは屈折・反射した）割合。該当しなければ負
+        double hit_rate;
+    };
+
+    /**
+     * @brief `op_count`回の操作を行う`run`を、合計`min_time_ms`以上になるまで繰り返し、最も速かった1回の時間を返す。
+     * `run`の戻り値は最適化で処理が消えないように集計するためのもの。
+     */
+    double best_ns_per_op(int64_t op_count, double min_time_ms, const std::function<int64_t()>& run, int64_t& sink) {
+        double best = infinity;
+        double total_ms = 0;
+        int32_t repeat = 0;
+        while (total_ms < min_time_ms or repeat < 3) {
+            auto begin = clock_type::now();
+            sink += run();
+            std::chrono::duration<double, std::milli> elapsed = clock_type::now() - begin;
+            total_ms += elapsed.count();
+            best = std::min(best, elapsed.count() * 1e6 / double(op_count));
+            repeat++;
+        }
+        return best;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int64_t ray_count = 1 << 16;
+    double min_time_ms = 200;
+    std::string filter;
+    bool json = false;
+    for (int32_t i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--json") == 0) { json = true; }
+        else if (i + 1 < argc and std::strcmp(argv[i], "--rays") == 0)     { ray_count = std::atoll(argv[++i]); }
+        else if (i + 1 < argc and std::strcmp(argv[i], "--min-time") == 0) { min_time_ms = std::atof(argv[++i]); }
+        else if (i + 1 < argc and std::strcmp(argv[i], "--filter") == 0)   { filter = argv[++i]; }
+        else {
+            std::cerr << "usage: kernel_bench [--rays <n>] [--min-time <ms>] [--filter <substring>] [--json]\n";
+            return 1;
+        }
+    }
+
+    std::vector<result> results;
+    int64_t sink = 0;
+    const interval ray_t{0.001, infinity};
+
+    /** レイ集合の4通りの組み合わせそれぞれについて、1本ずつ`hit`を呼ぶカーネルを測る */
+    auto bench_hits = [&](const std::string& kernel, const aabb& bounds, const std::function<bool(const ray&)>& hit) {
+        if (kernel.find(filter) == std::string::npos) { return; }
+        for (coherence c : {coherence::coherent, coherence::incoherent}) {
+            for (target t : {target::hit, target::miss}) {
+                std::vector<ray> rays = make_rays(bounds, c, t, ray_count, 42);
+                int64_t hits = 0;
+                for (const ray& r : rays) { hits += hit(r); }
+                double ns = best_ns_per_op(int64_t(rays.size()), min_time_ms, [&] {
+                    int64_t count = 0;
+                    for (const ray& r : rays) { count += hit(r); }
+                    return count;
+                }, sink);
+                results.push_back({
+                    kernel, std::string(coherence_name(c)) + "_" + target_name(t),
+                    ns, 1e3 / ns, double(hits) / double(rays.size())
+                });
+            }
+        }
+    };
+
+    // aabb::hit
+    const aabb unit_box{point3(-1, -1, -1), point3(1, 1, 1)};
+    bench_hits("aabb::hit", unit_box, [&](const ray& r) { return unit_box.hit(r, ray_t); });
+
+    // sphere::hit
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    const sphere ball{point3(0, 0, 0), 1, mat};
+    bench_hits("sphere::hit", ball.bounding_box(), [&](const ray& r) {
+        hit_record rec;
+        return ball.hit(r, ray_t, rec);
+    });
+
+    // plane_figure::hit（quad）。XY平面上にあるので+z方向からのレイが正面から当たる
+    const quad square{point3(-1, -1, 0), vec3(2, 0, 0), vec3(0, 2, 0), mat};
+    bench_hits("plane_figure::hit", aabb(point3(-1, -1, -1), point3(1, 1, 1)), [&](const ray& r) {
+        hit_record rec;
+        return square.hit(r, ray_t, rec);
+    });
+
+    // aa_rect::hit（上と同じ長方形）
+    const aa_rect aligned_square{point3(-1, -1, 0), vec3(2, 0, 0), vec3(0, 2, 0), mat};
+    bench_hits("aa_rect::hit", aabb(point3(-1, -1, -1), point3(1, 1, 1)), [&](const ray& r) {
+        hit_record rec;
+        return aligned_square.hit(r, ray_t, rec);
+    });
+
+    // 立方体: `box`（6枚のquadのリスト）とaa_box::hit
+    const auto quad_box = box(point3(-1, -1, -1), point3(1, 1, 1), mat);
+    bench_hits("box (6 quads)", unit_box, [&](const ray& r) {
+        hit_record rec;
+        return quad_box->hit(r, ray_t, rec);
+    });
+    const aa_box slab_box{point3(-1, -1, -1), point3(1, 1, 1), mat};
+    bench_hits("aa_box::hit", unit_box, [&](const ray& r) {
+        hit_record rec;
+        return slab_box.hit(r, ray_t, rec);
+    });
+
+    // bvh_node::hit（一辺100の立方体内に固定シードで置いた半径0.5〜1.5の球 10^4 個）
+    {
+        std::mt19937_64 rng(7);
+        std::uniform_real_distribution<double> position(-50, 50);
+        std::uniform_real_distribution<double> size(0.5, 1.5);
+        hittable_list spheres;
+        for (int32_t i = 0; i < 10000; i++) {
+            spheres.add(make_shared<sphere>(point3(position(rng), position(rng), position(rng)), size(rng), mat));
+        }
+        const bvh_node tree{spheres};
+        bench_hits("bvh_node::hit", tree.bounding_box(), [&](const ray& r) {
+            hit_record rec;
+            return tree.hit(r, ray_t, rec);
+        });
+
+        // カメラからのレイ（立方体の手前の1点から256x256ピクセル）の最初の交差。
+        // 1本ずつと、4x4・8x8ピクセルのパケット（ray_packet）での走査を比べる
+        const flat_bvh flat{spheres.objects, build_bvh_layout(bvh_builder::binned, primitive_bounds(spheres.objects))};
+        constexpr int32_t grid = 256;
+        auto camera_ray = [](int32_t i, int32_t j) {
+            const point3 eye{0, 0, 150};
+            const point3 target{-60 + 120 * (i + 0.5) / grid, 60 - 120 * (j + 0.5) / grid, 50};
+            return ray{eye, target - eye, 0};
+        };
+        auto trace_packets = [&]<int32_t N>(const hittable& world, int32_t side) {
+            int64_t count = 0;
+            for (int32_t pj = 0; pj < grid; pj += side) {
+                for (int32_t pi = 0; pi < grid; pi += side) {
+                    ray_packet<N> packet;
+                    for (int32_t k = 0; k < N; k++) { packet.set(k, camera_ray(pi + k % side, pj + k / side)); }
+                    packet.finish_setup();
+                    hit_packet(world, packet, packet.active);
+                    count += std::popcount(packet.hits);
+                }
+            }
+            return count;
+        };
+        auto bench_primary = [&](const std::string& structure, const hittable& world) {
+            for (int32_t side : {1, 4, 8}) {
+                const std::string kernel = side == 1 ? "primary single" : side == 4 ? "primary packet 4x4" : "primary packet 8x8";
+                if (kernel.find(filter) == std::string::npos) { continue; }
+                auto run = [&]() -> int64_t {
+                    if (side == 4) { return trace_packets.template operator()<16>(world, side); }
+                    if (side == 8) { return trace_packets.template operator()<64>(world, side); }
+                    int64_t count = 0;
+                    for (int32_t j = 0; j < grid; j++) {
+                        for (int32_t i = 0; i < grid; i++) {
+                            hit_record rec;
+                            count += world.hit(camera_ray(i, j), ray_t, rec);
+                        }
+                    }
+                    return count;
+                };
+                const int64_t hits = run();
+                double ns = best_ns_per_op(int64_t(grid) * grid, min_time_ms, run, sink);
+                results.push_back({kernel, structure + "_256x256", ns, 1e3 / ns, double(hits) / (grid * grid)});
+            }
+        };
+        bench_primary("bvh_node", tree);
+        bench_primary("flat_bvh", flat);
+    }
+
+    // perlin::turb（7オクターブ）
+    if (std::string("perlin::turb").find(filter) != std::string::npos) {
+        const perlin noise;
+        std::mt19937_64 rng(11);
+        std::uniform_real_distribution<double> position(-10, 10);
+        std::vector<point3> points(ray_count);
+        for (point3& p : points) { p = point3(position(rng), position(rng), position(rng)); }
+        double ns = best_ns_per_op(int64_t(points.size()), min_time_ms, [&] {
+            double sum = 0;
+            for (const point3& p : points) { sum += noise.turb(p, 7); }
+            return int64_t(sum);
+        }, sink);
+        results.push_back({"perlin::turb", "random_points", ns, 0, -1});
+    }
+
+    // dielectric::scatter（球に当たったレイの交点で屈折または反射させる）
+    if (std::string("dielectric::scatter").find(filter) != std::string::npos) {
+        const dielectric glass{1.5};
+        for (coherence c : {coherence::coherent, coherence::incoherent}) {
+            std::vector<ray> rays;
+            std::vector<hit_record> records;
+            for (const ray& r : make_rays(ball.bounding_box(), c, target::hit, ray_count, 42)) {
+                hit_record rec;
+                if (ball.hit(r, ray_t, rec)) {
+                    rays.push_back(r);
+                    records.push_back(rec);
+                }
+            }
+            if (rays.empty()) { continue; }
+            double ns = best_ns_per_op(int64_t(rays.size()), min_time_ms, [&] {
+                int64_t count = 0;
+                color attenuation;
+                ray scattered;
+                for (size_t i = 0; i < rays.size(); i++) {
+                    count += glass.scatter(rays[i], records[i], attenuation, scattered);
+                    count += scattered.direction().z() > 0;
+                }
+                return count;
+            }, sink);
+            results.push_back({"dielectric::scatter", std::string(coherence_name(c)) + "_hit", ns, 1e3 / ns, -1});
+        }
+    }
+
+    // シェーディングの分岐: 仮想呼び出し（material::emitted/scatter, texture::value）と、
+    // 種類で分岐して直接呼ぶもの（material_emitted/scatter, texture_value）。
+    // uniformは全ての交点が同じマテリアル、mixedは6種類のマテリアルを固定シードでランダムに割り当てる
+    {
+        auto checker = make_shared<checker_texture>(0.32, color{.2, .3, .1}, color{.9, .9, .9});
+        const std::vector<shared_ptr<material>> palette{
+            make_shared<lambertian>(checker),
+            make_shared<lambertian>(color{0.4, 0.2, 0.1}),
+            make_shared<metal>(color{0.7, 0.6, 0.5}, 0.1),
+            make_shared<dielectric>(1.5),
+            make_shared<diffuse_light>(color{4, 4, 4}),
+            make_shared<isotropic>(color{0.2, 0.4, 0.9}),
+        };
+        std::vector<ray> rays;
+        std::vector<hit_record> records;
+        for (const ray& r : make_rays(ball.bounding_box(), coherence::incoherent, target::hit, ray_count, 42)) {
+            hit_record rec;
+            if (ball.hit(r, ray_t, rec)) {
+                rays.push_back(r);
+                records.push_back(rec);
+            }
+        }
+
+        auto bench_shading = [&](const std::string& kernel, const std::function<bool(const ray&, const hit_record&, color&)>& shade) {
+            if (kernel.find(filter) == std::string::npos or rays.empty()) { return; }
+            for (bool mixed : {false, true}) {
+                std::mt19937_64 rng(7);
+                for (hit_record& rec : records) { rec.mat = mixed ? palette[rng() % palette.size()] : palette[0]; }
+                double ns = best_ns_per_op(int64_t(rays.size()), min_time_ms, [&] {
+                    int64_t count = 0;
+                    color c;
+                    for (size_t i = 0; i < rays.size(); i++) {
+                        count += shade(rays[i], records[i], c);
+                        count += c.x() > 0.5;
+                    }
+                    return count;
+                }, sink);
+                results.push_back({kernel, mixed ? "mixed_materials" : "uniform_lambertian", ns, 1e3 / ns, -1});
+            }
+        };
+        bench_shading("material::scatter", [](const ray& r, const hit_record& rec, color& c) {
+            ray scattered;
+            color emission = rec.mat->emitted(rec.u, rec.v, rec.p);
+            bool scatters = rec.mat->scatter(r, rec, c, scattered);
+            c += emission;
+            return scatters;
+        });
+        bench_shading("material_scatter", [](const ray& r, const hit_record& rec, color& c) {
+            ray scattered;
+            color emission = material_emitted(*rec.mat, rec.u, rec.v, rec.p);
+            bool scatters = material_scatter(*rec.mat, r, rec, c, scattered);
+            c += emission;
+            return scatters;
+        });
+
+        // チェッカー（子は単色）の色を交点で引く
+        auto bench_texture = [&](const std::string& kernel, const std::function<color(const hit_record&)>& value) {
+            if (kernel.find(filter) == std::string::npos or records.empty()) { return; }
+            double ns = best_ns_per_op(int64_t(records.size()), min_time_ms, [&] {
+                int64_t count = 0;
+                for (const hit_record& rec : records) { count += value(rec).x() > 0.5; }
+                return count;
+            }, sink);
+            results.push_back({kernel, "checker_hit", ns, 1e3 / ns, -1});
+        };
+        const texture& tex = *checker;
+        bench_texture("texture::value", [&](const hit_record& rec) { return tex.value(rec.u, rec.v, rec.p); });
+        bench_texture("texture_value", [&](const hit_record& rec) { return texture_value(tex, rec.u, rec.v, rec.p); });
+    }
+
+    if (json) {
+        std::cout << "[\n";
+        for (size_t i = 0; i < results.size(); i++) {
+            const result& r = results[i];
+            std::cout << "  {\"kernel\": \"" << r.kernel << "\", \"rays\": \"" << r.ray_set << "\""
+                      << ", \"ns_per_op\": " << r.ns_per_op
+                      << ", \"mrays_per_s\": " << r.mrays_per_s;
+            if (r.hit_rate >= 0) { std::cout << ", \"hit_rate\": " << r.hit_rate; }
+            std::cout << "}" << (i + 1 < results.size() ? "," : "") << '\n';
+        }
+        std::cout << "]\n";
+    } else {
+        std::cout << std::left << std::setw(22) << "kernel" << std::setw(18) << "rays" << std::right
+                  << std::setw(10) << "ns/op" << std::setw(12) << "Mrays/s" << std::setw(10) << "hit rate" << '\n';
+        for (const result& r : results) {
+            std::cout << std::left << std::setw(22) << r.kernel << std::setw(18) << r.ray_set << std::right
+                      << std::setw(10) << std::fixed << std::setprecision(2) << r.ns_per_op;
+            if (r.mrays_per_s > 0) { std::cout << std::setw(12) << r.mrays_per_s; } else { std::cout << std::setw(12) << "-"; }
+            if (r.hit_rate >= 0) { std::cout << std::setw(10) << r.hit_rate; }
+            std::cout << '\n';
+        }
+    }
+    // 最適化で計測対象が消えないように、集計値を使ったことにする
+    if (sink == 42) { std::cerr << '\n'; }
+    return 0;
+}
@@ -0,0 +1,136 @@
+// 遮蔽の多いシーンでの、遅延構築BVH（--lazy-bvh）と先に全体を構築するBVHの、最初の画素までの時間と全体の時間の比較
+//
+//   ./build/lazy_bvh_bench [<scene-file>] [--prims <n>] [--width <pixels>] [--spp <n>] [--depth <n>] [--threads <n>]
+//
+// シーンを指定しなければ、一辺100の立方体に半径0.5の球を固定シードで詰め（既定は100万個）、外側から1つの面を見る。
+// 平均自由行程は約1.3なので、レイはほぼ手前の層で止まり、奥の球は見えない。
+// シーンを指定したら、インスタンスを展開した全プリミティブ（`--flatten`と同じ）とシーンのカメラを使う。
+// どちらのBVHも`make_bvh`で巨大なプリミティブを分けずに作り、構築・最初のタイル・描画の時間と、
+// 遅延構築で分割されたノードの数・葉に入ったプリミティブの割合、2つの画像の差（RMSE）を表示する。
+#include "rtweekend.hpp"
+
+#include "bvh_build.hpp"
+#include "camera.hpp"
+#include "material.hpp"
+#include "scene_compiler.hpp"
+#include "scene_file.hpp"
+#include "scene_loader.hpp"
+#include "sphere.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+    using clock_type = std::chrono::steady_clock;
+
+    /** 一辺100の立方体に半径0.5の球を固定シードで並べる */
+    std::vector<shared_ptr<hittable>> sphere_cloud(int64_t n) {
+        std::mt19937_64 rng(12345);
+        std::uniform_real_distribution<double> position(0, 100);
+        std::uniform_real_distribution<double> unit(0, 1);
+        std::vector<shared_ptr<hittable>> objects;
+        objects.reserve(n);
+        for (int64_t i = 0; i < n; i++) {
+            auto albedo = make_shared<lambertian>(color(0.3 + 0.5 * unit(rng), 0.3 + 0.5 * unit(rng), 0.3 + 0.5 * unit(rng)));
+            objects.push_back(make_shared<sphere>(point3{position(rng), position(rng), position(rng)}, 0.5, albedo));
+        }
+        return objects;
+    }
+
+    double rmse(const image_buffer& a, const image_buffer& b) {
+        double sum = 0;
+        for (size_t i = 0; i < a.pixels.size(); i++) {
+            for (int32_t c = 0; c < 3; c++) {
+                double d = to_display_byte(a.pixels[i][c]) / 255.0 - to_display_byte(b.pixels[i][c]) / 255.0;
+                sum += d * d;
+            }
+        }
+        return std::sqrt(sum / double(3 * a.pixels.size()));
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int64_t prim_count = 1000000;
+    std::optional<int32_t> width, spp, depth;
+    int32_t threads = 0;
+    int32_t first_option = 1;
+    std::optional<std::string> scene_path;
+    if (argc >= 2 and argv[1][0] != '-') {
+        scene_path = argv[1];
+        first_option = 2;
+    }
+    for (int32_t i = first_option; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--prims") == 0)        { prim_count = std::atoll(argv[i + 1]); }
+        else if (std::strcmp(argv[i], "--width") == 0)   { width = std::atoi(argv[i + 1]); }
+        else if (std::strcmp(argv[i], "--spp") == 0)     { spp = std::atoi(argv[i + 1]); }
+        else if (std::strcmp(argv[i], "--depth") == 0)   { depth = std::atoi(argv[i + 1]); }
+        else if (std::strcmp(argv[i], "--threads") == 0) { threads = std::atoi(argv[i + 1]); }
+    }
+
+    std::vector<shared_ptr<hittable>> objects;
+    camera cam;
+    scene_file::loaded_scene scene;
+    if (scene_path) {
+        if (not scene.open(*scene_path)) { return 1; }
+        scene_loader loader(scene.view());
+        scene_compiler compiler(scene.view(), loader);
+        objects = compiler.compile_primitives();
+        cam = loader.make_camera();
+    } else {
+        objects = sphere_cloud(prim_count);
+        cam.aspect_ratio = 1.5;
+        cam.vfov = 60;
+        cam.lookfrom = point3(50, 50, -80);
+        cam.lookat = point3(50, 50, 50);
+        cam.background = color(0.70, 0.80, 1.00);
+    }
+    if (objects.empty()) {
+        std::cerr << "ERROR: The scene has no primitives.\n";
+        return 1;
+    }
+    cam.image_width = width.value_or(320);
+    cam.samples_per_pixel = spp.value_or(4);
+    cam.max_depth = depth.value_or(4);
+    cam.thread_count = threads;
+
+    std::cout << "primitives: " << objects.size() << ", image: " << cam.image_width << " px, " << cam.samples_per_pixel << " spp\n";
+    std::cout << std::setw(8) << "BVH" << std::setw(12) << "build[ms]" << std::setw(16) << "first tile[ms]"
+              << std::setw(12) << "render[ms]" << std::setw(12) << "total[ms]" << std::setw(10) << "Mrays/s"
+              << std::setw(12) << "expanded" << std::setw(10) << "leaves%" << '\n';
+    std::vector<image_buffer> images;
+    for (bool lazy : {false, true}) {
+        bvh_options options;
+        options.builder = bvh_builder::binned;
+        options.separate_huge = false;
+        options.lazy = lazy;
+        auto begin = clock_type::now();
+        shared_ptr<hittable> bvh = make_bvh(objects, options, "world");
+        std::chrono::duration<double, std::milli> build_ms = clock_type::now() - begin;
+
+        hittable_list world(bvh);
+        auto render_begin = clock_type::now();
+        images.push_back(cam.render_to_buffer(world));
+        std::chrono::duration<double, std::milli> render_ms = clock_type::now() - render_begin;
+
+        std::cout << std::setw(8) << (lazy ? "lazy" : "eager")
+                  << std::setw(12) << std::fixed << std::setprecision(1) << build_ms.count()
+                  << std::setw(16) << build_ms.count() + 1000 * cam.first_tile_seconds
+                  << std::setw(12) << render_ms.count()
+                  << std::setw(12) << build_ms.count() + render_ms.count()
+                  << std::setw(10) << std::setprecision(2) << double(cam.ray_count) / render_ms.count() / 1000.0;
+        if (auto tree = std::dynamic_pointer_cast<lazy_bvh>(bvh)) {
+            std::cout << std::setw(12) << tree->expanded_nodes()
+                      << std::setw(10) << std::setprecision(1) << 100.0 * double(tree->leaf_primitives()) / double(tree->size());
+        }
+        std::cout << '\n';
+    }
+    std::cout << "image RMSE (eager vs lazy): " << std::setprecision(5) << rmse(images[0], images[1]) << '\n';
+    return 0;
+}
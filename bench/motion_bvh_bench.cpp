@@ -0,0 +1,154 @@
+// 動く物体を含むBVHの走査コストの比較
+//
+//   ./build/motion_bvh_bench <scene-file> [--rays <n>] [--builder <name>]
+//
+// シーン中で最も大きな`bvh`について、動きの全体を覆う箱で作った`flat_bvh`と、
+// 時刻0と1の箱を補間する`motion_bvh`を同じビルダで構築し、
+// カメラから撃った一次レイとシーン内のランダムなレイについて、1レイあたりの走査ノード数と時間を比べる。
+// 両者の交差結果（最も近い交点の距離）が一致することも確かめる。
+#include "rtweekend.hpp"
+
+#include "bvh_build.hpp"
+#include "motion_bvh.hpp"
+#include "scene_file.hpp"
+#include "scene_loader.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+    using clock_type = std::chrono::steady_clock;
+
+    /** 一次レイ（ピンホールカメラ）とシーンのバウンディングボックス内のランダムなレイを固定シードで作る */
+    std::vector<ray> make_rays(const camera_desc& c, const aabb& bounds, int64_t count) {
+        std::mt19937_64 rng(2024);
+        std::uniform_real_distribution<double> unit(0, 1);
+
+        vec3 w = unit_vector(c.lookfrom - c.lookat);
+        vec3 u = unit_vector(cross(c.vup, w));
+        vec3 v = cross(w, u);
+        double half_height = std::tan(degrees_to_radians(c.vfov) / 2);
+        double half_width = half_height * c.aspect_ratio;
+
+        std::vector<ray> rays;
+        rays.reserve(count);
+        for (int64_t i = 0; i < count / 2; i++) {
+            double s = 2 * unit(rng) - 1;
+            double t = 2 * unit(rng) - 1;
+            vec3 direction = s * half_width * u + t * half_height * v - w;
+            rays.emplace_back(c.lookfrom, direction, unit(rng));
+        }
+        auto random_point = [&] {
+            return point3(
+                bounds.x.min + unit(rng) * bounds.x.size(),
+                bounds.y.min + unit(rng) * bounds.y.size(),
+                bounds.z.min + unit(rng) * bounds.z.size()
+            );
+        };
+        while (int64_t(rays.size()) < count) {
+            point3 origin = random_point();
+            rays.emplace_back(origin, random_point() - origin, unit(rng));
+        }
+        return rays;
+    }
+
+    struct trace_result {
+        double ms;
+        int64_t visited;
+        int64_t hits;
+        std::vector<double> distances;
+    };
+
+    template<class Bvh>
+    trace_result trace(const Bvh& bvh, const std::vector<ray>& rays) {
+        trace_result result{0, 0, 0, {}};
+        result.distances.reserve(rays.size());
+        auto begin = clock_type::now();
+        for (const ray& r : rays) {
+            hit_record rec;
+            bool hit = bvh.hit_counted(r, interval(0.001, infinity), rec, result.visited);
+            result.hits += hit;
+            result.distances.push_back(hit ? rec.t : infinity);
+        }
+        std::chrono::duration<double, std::milli> elapsed = clock_type::now() - begin;
+        result.ms = elapsed.count();
+        return result;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 or argv[1][0] == '-') {
+        std::cerr << "usage: motion_bvh_bench <scene-file> [--rays <n>] [--builder <name>]\n";
+        return 1;
+    }
+    int64_t ray_count = 1000000;
+    bvh_builder builder = bvh_builder::median;
+    for (int32_t i = 2; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--rays") == 0) { ray_count = std::atoll(argv[i + 1]); }
+        else if (std::strcmp(argv[i], "--builder") == 0) {
+            auto parsed = parse_bvh_builder(argv[i + 1]);
+            if (not parsed) {
+                std::cerr << "ERROR: Unknown BVH builder '" << argv[i + 1] << "'.\n";
+                return 1;
+            }
+            builder = *parsed;
+        }
+    }
+    if (builder == bvh_builder::recursive) { builder = bvh_builder::median; }
+
+    scene_file::loaded_scene scene;
+    if (not scene.open(argv[1])) { return 1; }
+    const scene_view view = scene.view();
+
+    int32_t largest = -1;
+    for (int32_t i = 0; i < int32_t(view.shapes.size()); i++) {
+        if (view.shapes[i].kind != shape_kind::bvh) { continue; }
+        if (largest < 0 or view.shapes[i].child_count > view.shapes[largest].child_count) { largest = i; }
+    }
+    if (largest < 0) {
+        std::cerr << "ERROR: The scene has no bvh shape.\n";
+        return 1;
+    }
+
+    scene_loader loader(view);
+    std::vector<shared_ptr<hittable>> objects;
+    for (int32_t child : view.children_of(view.shapes[largest])) { objects.push_back(loader.shape(child)); }
+
+    flat_bvh sweep_bvh(objects, build_bvh_layout(builder, primitive_bounds(objects)));
+    motion_bvh interpolated_bvh(objects, build_bvh_layout(builder, primitive_bounds(objects)));
+
+    std::vector<ray> rays = make_rays(view.camera, sweep_bvh.bounding_box(), ray_count);
+    trace_result sweep = trace(sweep_bvh, rays);
+    trace_result interpolated = trace(interpolated_bvh, rays);
+
+    int64_t mismatches = 0;
+    for (size_t i = 0; i < rays.size(); i++) {
+        if (sweep.distances[i] != interpolated.distances[i]) { mismatches++; }
+    }
+
+    std::cout << "primitives: " << objects.size() << (has_moving_primitives(objects) ? " (moving)" : " (static)")
+              << ", rays: " << rays.size() << ", builder: " << bvh_builder_name(builder) << '\n';
+    std::cout << std::setw(8) << "bvh" << std::setw(14) << "nodes/ray"
+              << std::setw(12) << "time[ms]" << std::setw(12) << "Mrays/s" << std::setw(10) << "hits" << '\n';
+    auto report = [&](const char* name, const trace_result& result) {
+        std::cout << std::setw(8) << name
+                  << std::setw(14) << std::fixed << std::setprecision(2) << double(result.visited) / rays.size()
+                  << std::setw(12) << std::setprecision(1) << result.ms
+                  << std::setw(12) << std::setprecision(2) << rays.size() / result.ms / 1000.0
+                  << std::setw(10) << result.hits << '\n';
+    };
+    report("sweep", sweep);
+    report("motion", interpolated);
+    std::cout << "traversal steps: " << std::setprecision(1)
+              << 100.0 * (1.0 - double(interpolated.visited) / sweep.visited) << "% fewer\n";
+    if (mismatches > 0) {
+        std::cerr << "ERROR: " << mismatches << " rays hit differently.\n";
+        return 1;
+    }
+    return 0;
+}
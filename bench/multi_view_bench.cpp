@@ -0,0 +1,135 @@
+// 同じシーンの複数のビューを、ビューごとにシーンを組み立てて描く場合と、1度組み立てて`render_views`でまとめて描く場合の比較
+//
+//   ./build/multi_view_bench [<scene-file>] [--views <n>] [--width <pixels>] [--spp <n>] [--depth <n>] [--threads <n>]
+//
+// シーンを指定しなければ scenes/final_scene.rtscene を使う。ビューはシーンのカメラを注視点の周りに等間隔で回したもの（ターンテーブル）。
+// 別々に描く場合は、ビューごとにシーンファイルを開き、テクスチャ・マテリアル・形状・BVHを組み立て直してから描く（mainを繰り返し実行するのと同じ）。
+// それぞれの組み立て・描画・合計の時間を表示し、2つの方法の画像が一致することも確かめる。
+#include "rtweekend.hpp"
+
+#include "batch_render.hpp"
+#include "camera.hpp"
+#include "scene_compiler.hpp"
+#include "scene_file.hpp"
+#include "scene_loader.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace {
+    using clock_type = std::chrono::steady_clock;
+
+    double elapsed_ms(clock_type::time_point begin) {
+        std::chrono::duration<double, std::milli> elapsed = clock_type::now() - begin;
+        return elapsed.count();
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string scene_path = "scenes/final_scene.rtscene";
+    int32_t view_count = 8;
+    std::optional<int32_t> width, spp, depth;
+    int32_t threads = 0;
+    int32_t first_option = 1;
+    if (argc >= 2 and argv[1][0] != '-') {
+        scene_path = argv[1];
+        first_option = 2;
+    }
+    for (int32_t i = first_option; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--views") == 0)        { view_count = std::atoi(argv[i + 1]); }
+        else if (std::strcmp(argv[i], "--width") == 0)   { width = std::atoi(argv[i + 1]); }
+        else if (std::strcmp(argv[i], "--spp") == 0)     { spp = std::atoi(argv[i + 1]); }
+        else if (std::strcmp(argv[i], "--depth") == 0)   { depth = std::atoi(argv[i + 1]); }
+        else if (std::strcmp(argv[i], "--threads") == 0) { threads = std::atoi(argv[i + 1]); }
+    }
+    if (view_count <= 0) {
+        std::cerr << "ERROR: View count must be positive.\n";
+        return 1;
+    }
+
+    // ビューの一覧はシーンのカメラから作る
+    std::vector<view_desc> views;
+    {
+        scene_file::loaded_scene scene;
+        if (not scene.open(scene_path)) { return 1; }
+        camera_desc base = scene.view().camera;
+        base.image_width = width.value_or(160);
+        base.samples_per_pixel = spp.value_or(4);
+        base.max_depth = depth.value_or(8);
+        for (int32_t k = 0; k < view_count; k++) {
+            view_desc view{"", base};
+            const instance_transform turn{360.0 * k / view_count, vec3{0, 0, 0}};
+            view.camera.lookfrom = base.lookat + turn.apply_vector(base.lookfrom - base.lookat);
+            views.push_back(view);
+        }
+    }
+    camera settings;
+    settings.thread_count = threads;
+
+    // ビューごとにシーンを組み立てて描く
+    double separate_setup_ms = 0;
+    double separate_render_ms = 0;
+    std::vector<image_buffer> separate_images;
+    for (const view_desc& view : views) {
+        // ノイズのテクスチャは組み立てるときに乱数を使うので、別のプロセスで実行したときと同じ状態から組み立てる
+        random_generator().seed(std::mt19937::default_seed);
+        auto setup_begin = clock_type::now();
+        scene_file::loaded_scene scene;
+        if (not scene.open(scene_path)) { return 1; }
+        scene_loader loader(scene.view());
+        hittable_list world = loader.make_world();
+        separate_setup_ms += elapsed_ms(setup_begin);
+
+        camera cam = settings;
+        scene_loader::apply_camera(view.camera, cam);
+        auto render_begin = clock_type::now();
+        separate_images.push_back(cam.render_to_buffer(world));
+        separate_render_ms += elapsed_ms(render_begin);
+    }
+
+    // 1度組み立てて全ビューをまとめて描く
+    random_generator().seed(std::mt19937::default_seed);
+    auto setup_begin = clock_type::now();
+    scene_file::loaded_scene scene;
+    if (not scene.open(scene_path)) { return 1; }
+    scene_loader loader(scene.view());
+    hittable_list world = loader.make_world();
+    const double batch_setup_ms = elapsed_ms(setup_begin);
+    auto render_begin = clock_type::now();
+    std::vector<view_result> results = render_views(world, settings, views, false);
+    const double batch_render_ms = elapsed_ms(render_begin);
+
+    int32_t mismatches = 0;
+    for (int32_t k = 0; k < view_count; k++) {
+        const std::vector<color>& a = results[k].image.pixels;
+        const std::vector<color>& b = separate_images[k].pixels;
+        for (size_t i = 0; i < a.size(); i++) {
+            if (a[i].x() != b[i].x() or a[i].y() != b[i].y() or a[i].z() != b[i].z()) {
+                mismatches++;
+                break;
+            }
+        }
+    }
+
+    std::cout << "scene: " << scene_path << ", views: " << view_count << ", image: "
+              << views[0].camera.image_width << " px, " << views[0].camera.samples_per_pixel << " spp\n";
+    std::cout << std::setw(10) << "mode" << std::setw(12) << "setup[ms]" << std::setw(12) << "render[ms]"
+              << std::setw(12) << "total[ms]" << std::setw(14) << "ms per view" << '\n';
+    auto row = [&](const char* mode, double setup_ms, double render_ms) {
+        std::cout << std::setw(10) << mode << std::fixed << std::setprecision(1)
+                  << std::setw(12) << setup_ms << std::setw(12) << render_ms
+                  << std::setw(12) << setup_ms + render_ms << std::setw(14) << (setup_ms + render_ms) / view_count << '\n';
+    };
+    row("separate", separate_setup_ms, separate_render_ms);
+    row("batch", batch_setup_ms, batch_render_ms);
+    if (mismatches > 0) {
+        std::cerr << "ERROR: " << mismatches << " views differ from separate renders.\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,194 @@
+// 空間分割BVH（SBVH）と物体分割のビルダの、参照の増加・SAHコスト・走査ノード数の比較
+//
+//   ./build/sbvh_bench [<scene-file>] [--prims <n>] [--rays <n>] [--budget <f>]
+//
+// シーンを指定しなければ、一辺100の立方体内に細長い三角形（長さ20・幅0.3程度で向きはランダム）を固定シードで並べる。
+// シーンを指定したら、インスタンスを展開した全プリミティブ（`--flatten`と同じ）を使う。
+// ただし判定に乱数を使う媒質（`constant_medium`）と、バウンディングボックスが図形を覆いきらないことがある円板・円環は、
+// ビルダによって交差結果が変わるので除く。
+// 各ビルダの構造から`flat_bvh`を作り、カメラから撃った一次レイ（シーンのみ）と立方体内のランダムなレイについて、
+// 1レイあたりの走査ノード数と速度を比べる。全てのビルダで交差結果（最も近い交点の距離）が一致することも確かめる。
+#include "rtweekend.hpp"
+
+#include "bvh_build.hpp"
+#include "constant_medium.hpp"
+#include "quad.hpp"
+#include "scene_compiler.hpp"
+#include "scene_file.hpp"
+#include "scene_loader.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+    using clock_type = std::chrono::steady_clock;
+
+    /** 一辺100の立方体内に、向きのばらついた細長い三角形を固定シードで並べる */
+    std::vector<shared_ptr<hittable>> long_triangles(int64_t n) {
+        std::mt19937_64 rng(12345);
+        std::uniform_real_distribution<double> position(0, 100);
+        std::uniform_real_distribution<double> direction(-1, 1);
+        auto random_direction = [&] { return vec3{direction(rng), direction(rng), direction(rng)}; };
+        std::vector<shared_ptr<hittable>> objects;
+        objects.reserve(n);
+        for (int64_t i = 0; i < n; i++) {
+            point3 q{position(rng), position(rng), position(rng)};
+            vec3 u = 20 * random_direction();
+            vec3 v = 0.3 * random_direction();
+            objects.push_back(make_shared<triangle>(q, u, v, nullptr));
+        }
+        return objects;
+    }
+
+    /** 一次レイ（`camera`があればピンホールカメラから半分）とバウンディングボックス内のランダムなレイを固定シードで作る */
+    std::vector<ray> make_rays(const std::optional<camera_desc>& camera, const aabb& bounds, int64_t count) {
+        std::mt19937_64 rng(2024);
+        std::uniform_real_distribution<double> unit(0, 1);
+        std::vector<ray> rays;
+        rays.reserve(count);
+
+        if (camera) {
+            const camera_desc& c = *camera;
+            vec3 w = unit_vector(c.lookfrom - c.lookat);
+            vec3 u = unit_vector(cross(c.vup, w));
+            vec3 v = cross(w, u);
+            double half_height = std::tan(degrees_to_radians(c.vfov) / 2);
+            double half_width = half_height * c.aspect_ratio;
+            for (int64_t i = 0; i < count / 2; i++) {
+                double s = 2 * unit(rng) - 1;
+                double t = 2 * unit(rng) - 1;
+                rays.emplace_back(c.lookfrom, s * half_width * u + t * half_height * v - w, unit(rng));
+            }
+        }
+        auto random_point = [&] {
+            return point3(
+                bounds.x.min + unit(rng) * bounds.x.size(),
+                bounds.y.min + unit(rng) * bounds.y.size(),
+                bounds.z.min + unit(rng) * bounds.z.size()
+            );
+        };
+        while (int64_t(rays.size()) < count) {
+            point3 origin = random_point();
+            rays.emplace_back(origin, random_point() - origin, unit(rng));
+        }
+        return rays;
+    }
+
+    struct trace_result {
+        double ms;
+        int64_t visited;
+        int64_t hits;
+        std::vector<double> distances;
+    };
+
+    trace_result trace(const flat_bvh& bvh, const std::vector<ray>& rays) {
+        trace_result result{0, 0, 0, {}};
+        result.distances.reserve(rays.size());
+        auto begin = clock_type::now();
+        for (const ray& r : rays) {
+            hit_record rec;
+            bool hit = bvh.hit_counted(r, interval(0.001, infinity), rec, result.visited);
+            result.hits += hit;
+            result.distances.push_back(hit ? rec.t : infinity);
+        }
+        std::chrono::duration<double, std::milli> elapsed = clock_type::now() - begin;
+        result.ms = elapsed.count();
+        return result;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int64_t prim_count = 100000;
+    int64_t ray_count = 200000;
+    double budget = sbvh_default_budget;
+    int32_t first_option = 1;
+    std::optional<std::string> scene_path;
+    if (argc >= 2 and argv[1][0] != '-') {
+        scene_path = argv[1];
+        first_option = 2;
+    }
+    for (int32_t i = first_option; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--prims") == 0)       { prim_count = std::atoll(argv[i + 1]); }
+        else if (std::strcmp(argv[i], "--rays") == 0)   { ray_count = std::atoll(argv[i + 1]); }
+        else if (std::strcmp(argv[i], "--budget") == 0) { budget = std::atof(argv[i + 1]); }
+    }
+
+    std::vector<shared_ptr<hittable>> objects;
+    std::optional<camera_desc> camera;
+    scene_file::loaded_scene scene;
+    if (scene_path) {
+        if (not scene.open(*scene_path)) { return 1; }
+        scene_loader loader(scene.view());
+        scene_compiler compiler(scene.view(), loader);
+        for (auto& object : compiler.compile_primitives()) {
+            const hittable* p = object.get();
+            if (dynamic_cast<const constant_medium*>(p) or dynamic_cast<const disk*>(p) or dynamic_cast<const ring*>(p)) { continue; }
+            objects.push_back(std::move(object));
+        }
+        camera = scene.view().camera;
+    } else {
+        objects = long_triangles(prim_count);
+    }
+    if (objects.empty()) {
+        std::cerr << "ERROR: The scene has no primitives to compare.\n";
+        return 1;
+    }
+
+    const auto n = double(objects.size());
+    std::vector<ray> rays;
+    std::vector<double> reference_distances;
+    int64_t mismatches = 0;
+    double binned_sah = 0;
+    int64_t binned_visited = 0;
+
+    std::cout << "primitives: " << objects.size() << ", rays: " << ray_count << ", budget: " << budget << '\n';
+    std::cout << std::setw(8) << "builder" << std::setw(12) << "build[ms]" << std::setw(10) << "refs"
+              << std::setw(8) << "dup%" << std::setw(10) << "SAH" << std::setw(12) << "nodes/ray"
+              << std::setw(12) << "Mrays/s" << std::setw(10) << "hits" << '\n';
+    for (auto builder : {bvh_builder::median, bvh_builder::binned, bvh_builder::lbvh30, bvh_builder::sbvh}) {
+        auto begin = clock_type::now();
+        bvh_layout layout = build_bvh_layout(builder, objects, budget);
+        std::chrono::duration<double, std::milli> build_ms = clock_type::now() - begin;
+        const double sah = bvh_sah_cost(layout.nodes);
+        const auto refs = int64_t(layout.primitive_indices.size());
+        flat_bvh bvh(objects, std::move(layout));
+
+        if (rays.empty()) { rays = make_rays(camera, bvh.bounding_box(), ray_count); }
+        trace_result result = trace(bvh, rays);
+        if (reference_distances.empty()) {
+            reference_distances = result.distances;
+        } else {
+            for (size_t i = 0; i < rays.size(); i++) {
+                if (result.distances[i] != reference_distances[i]) { mismatches++; }
+            }
+        }
+        if (builder == bvh_builder::binned) {
+            binned_sah = sah;
+            binned_visited = result.visited;
+        }
+
+        std::cout << std::setw(8) << bvh_builder_name(builder)
+                  << std::setw(12) << std::fixed << std::setprecision(1) << build_ms.count()
+                  << std::setw(10) << refs
+                  << std::setw(8) << 100.0 * (double(refs) / n - 1.0)
+                  << std::setw(10) << sah
+                  << std::setw(12) << std::setprecision(2) << double(result.visited) / rays.size()
+                  << std::setw(12) << rays.size() / result.ms / 1000.0
+                  << std::setw(10) << result.hits << '\n';
+        if (builder == bvh_builder::sbvh) {
+            std::cout << "sbvh vs binned: SAH " << std::showpos << std::setprecision(1) << 100.0 * (sah / binned_sah - 1.0)
+                      << "%, traversal steps " << 100.0 * (double(result.visited) / binned_visited - 1.0) << std::noshowpos << "%\n";
+        }
+    }
+    if (mismatches > 0) {
+        std::cerr << "ERROR: " << mismatches << " rays hit differently.\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,301 @@
+// シーン全体の描画ベンチマークと性能回帰の検出
+//
+//   ./build/scene_bench [options] [scene-name...]
+//
+// 同梱のシーン（既定: bouncing_spheres earth cornell_box cornell_smoke final_scene）を縮小した解像度・サンプル数で
+// 複数回描画し、描画時間（中央値）、Mrays/s、ピークRSS、参照画像に対するRMSEを表示する。
+// ピークRSSはプロセスの生涯の最大値なので、シーンごと（参照画像の描画も）に別の子プロセスで描画して測る。
+//
+// --update を付けると、参照画像（--reference-spp のサンプル数で描画したもの）を --reference-dir に、
+// 今回の結果を --baseline に書き出す。それ以外では --baseline があればそれと比較し、
+// Mrays/sが --tolerance（割合）を超えて下がるか、RMSEが --rmse-tolerance（割合）を超えて上がったシーンがあれば
+// 終了コード1で終わる。スループットは計測したマシンに依存するので、ベースラインは比較に使うマシンで作ること。
+#include "rtweekend.hpp"
+
+#include "camera.hpp"
+#include "scene_file.hpp"
+#include "scene_loader.hpp"
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace {
+    using clock_type = std::chrono::steady_clock;
+
+    struct options {
+        std::string scene_dir = "scenes";
+        std::string reference_dir = "bench/reference";
+        std::string baseline = "bench/scene_baseline.txt";
+        int32_t width = 96;
+        int32_t spp = 8;
+        int32_t depth = 10;
+        int32_t reference_spp = 256;
+        int32_t repeat = 3;
+        double tolerance = 0.10;
+        double rmse_tolerance = 0.10;
+        bool update = false;
+        std::vector<std::string> scenes;
+    };
+
+    struct measurement {
+        double median_ms = 0;
+        double mrays_per_s = 0;
+        long peak_rss_kb = 0;
+        // 参照画像がなければ負
+        double rmse = -1;
+    };
+
+    /**
+     * @brief `f(m)`を子プロセスで実行し、`f`が埋めた`m`に子プロセスのピークRSS（KiB）を入れて返す。
+     * `f`が`false`を返すか子プロセスが異常終了すれば`std::nullopt`を返す。
+     * wait4のru_maxrssはその子プロセスだけの値（LinuxではKiB単位）で、それまでに測った他のシーンを含まない。
+     */
+    template<class F>
+    std::optional<measurement> run_in_child(F&& f) {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            std::perror("ERROR: pipe");
+            return std::nullopt;
+        }
+        // 出力待ちの内容を子プロセスが重ねて書かないよう、先に書き出しておく
+        std::cout.flush();
+        const pid_t pid = fork();
+        if (pid < 0) {
+            std::perror("ERROR: fork");
+            close(fds[0]);
+            close(fds[1]);
+            return std::nullopt;
+        }
+        if (pid == 0) {
+            close(fds[0]);
+            measurement m;
+            const bool ok = f(m) and write(fds[1], &m, sizeof(m)) == ssize_t(sizeof(m));
+            _exit(ok ? 0 : 1);
+        }
+        close(fds[1]);
+        measurement m;
+        const bool received = read(fds[0], &m, sizeof(m)) == ssize_t(sizeof(m));
+        close(fds[0]);
+        int status = 0;
+        rusage usage{};
+        if (wait4(pid, &status, 0, &usage) != pid or not WIFEXITED(status) or WEXITSTATUS(status) != 0 or not received) {
+            return std::nullopt;
+        }
+        m.peak_rss_kb = usage.ru_maxrss;
+        return m;
+    }
+
+    /** 表示用に量子化した画素値（P6形式のPPM） */
+    bool write_ppm(const std::string& path, const image_buffer& image) {
+        std::ofstream out(path, std::ios::binary);
+        if (not out) {
+            std::cerr << "ERROR: Could not write '" << path << "'.\n";
+            return false;
+        }
+        out << "P6\n" << image.width << ' ' << image.height << "\n255\n";
+        for (const color& pixel : image.pixels) {
+            for (int32_t c = 0; c < 3; c++) { out.put(char(to_display_byte(pixel[c]))); }
+        }
+        return bool(out);
+    }
+
+    /** `write_ppm`が書いたP6形式のPPMを[0, 1]の値として読む */
+    std::optional<std::vector<double>> read_ppm(const std::string& path, int32_t width, int32_t height) {
+        std::ifstream in(path, std::ios::binary);
+        if (not in) { return std::nullopt; }
+        std::string magic;
+        int32_t w = 0, h = 0, max_value = 0;
+        in >> magic >> w >> h >> max_value;
+        in.get();
+        if (magic != "P6" or w != width or h != height or max_value != 255) {
+            std::cerr << "ERROR: Reference image '" << path << "' does not match the benchmark resolution.\n";
+            return std::nullopt;
+        }
+        std::vector<double> values(size_t(width) * height * 3);
+        for (double& value : values) {
+            int byte = in.get();
+            if (byte == EOF) {
+                std::cerr << "ERROR: Reference image '" << path << "' is truncated.\n";
+                return std::nullopt;
+            }
+            value = byte / 255.0;
+        }
+        return values;
+    }
+
+    double rmse(const image_buffer& image, const std::vector<double>& reference) {
+        double sum = 0;
+        for (size_t i = 0; i < image.pixels.size(); i++) {
+            for (int32_t c = 0; c < 3; c++) {
+                double d = to_display_byte(image.pixels[i][c]) / 255.0 - reference[3 * i + c];
+                sum += d * d;
+            }
+        }
+        return std::sqrt(sum / double(reference.size()));
+    }
+
+    std::map<std::string, measurement> read_baseline(const std::string& path) {
+        std::map<std::string, measurement> baseline;
+        std::ifstream in(path);
+        std::string name;
+        measurement m;
+        while (in >> name >> m.median_ms >> m.mrays_per_s >> m.peak_rss_kb >> m.rmse) { baseline[name] = m; }
+        return baseline;
+    }
+
+    bool write_baseline(const std::string& path, const std::map<std::string, measurement>& results) {
+        std::ofstream out(path);
+        if (not out) {
+            std::cerr << "ERROR: Could not write '" << path << "'.\n";
+            return false;
+        }
+        out << std::setprecision(6);
+        for (const auto& [name, m] : results) {
+            out << name << ' ' << m.median_ms << ' ' << m.mrays_per_s << ' ' << m.peak_rss_kb << ' ' << m.rmse << '\n';
+        }
+        return bool(out);
+    }
+
+    struct bench_scene {
+        scene_file::loaded_scene file;
+        hittable_list world;
+        camera cam;
+    };
+
+    std::unique_ptr<bench_scene> load(const options& opt, const std::string& name, int32_t spp) {
+        auto scene = std::make_unique<bench_scene>();
+        if (not scene->file.open(opt.scene_dir + "/" + name + ".rtscene")) { return nullptr; }
+        scene_loader loader(scene->file.view());
+        scene->world = loader.make_world();
+        scene->cam = loader.make_camera();
+        scene->cam.image_width = opt.width;
+        scene->cam.samples_per_pixel = spp;
+        scene->cam.max_depth = opt.depth;
+        return scene;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    options opt;
+    for (int32_t i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--update")                             { opt.update = true; }
+        else if (arg == "--scene-dir" and has_value)       { opt.scene_dir = argv[++i]; }
+        else if (arg == "--reference-dir" and has_value)   { opt.reference_dir = argv[++i]; }
+        else if (arg == "--baseline" and has_value)        { opt.baseline = argv[++i]; }
+        else if (arg == "--width" and has_value)           { opt.width = std::atoi(argv[++i]); }
+        else if (arg == "--spp" and has_value)             { opt.spp = std::atoi(argv[++i]); }
+        else if (arg == "--depth" and has_value)           { opt.depth = std::atoi(argv[++i]); }
+        else if (arg == "--reference-spp" and has_value)   { opt.reference_spp = std::atoi(argv[++i]); }
+        else if (arg == "--repeat" and has_value)          { opt.repeat = std::max(1, std::atoi(argv[++i])); }
+        else if (arg == "--tolerance" and has_value)       { opt.tolerance = std::atof(argv[++i]); }
+        else if (arg == "--rmse-tolerance" and has_value)  { opt.rmse_tolerance = std::atof(argv[++i]); }
+        else if (arg[0] != '-')                            { opt.scenes.push_back(arg); }
+        else {
+            std::cerr << "usage: scene_bench [--update] [--scene-dir <dir>] [--reference-dir <dir>] [--baseline <file>]\n"
+                      << "                   [--width <px>] [--spp <n>] [--depth <n>] [--reference-spp <n>] [--repeat <n>]\n"
+                      << "                   [--tolerance <fraction>] [--rmse-tolerance <fraction>] [scene-name...]\n";
+            return 1;
+        }
+    }
+    if (opt.scenes.empty()) { opt.scenes = {"bouncing_spheres", "earth", "cornell_box", "cornell_smoke", "final_scene"}; }
+
+    const auto baseline = opt.update ? std::map<std::string, measurement>{} : read_baseline(opt.baseline);
+    std::map<std::string, measurement> results;
+    bool regressed = false;
+    if (opt.update) {
+        std::error_code error;
+        std::filesystem::create_directories(opt.reference_dir, error);
+    }
+
+    std::cout << "width " << opt.width << ", spp " << opt.spp << ", depth " << opt.depth << ", repeat " << opt.repeat << '\n';
+    std::cout << std::left << std::setw(18) << "scene" << std::right
+              << std::setw(12) << "time[ms]" << std::setw(10) << "Mrays/s"
+              << std::setw(12) << "peakRSS[MB]" << std::setw(10) << "RMSE" << "  status\n";
+
+    for (const std::string& name : opt.scenes) {
+        const std::string reference_path = opt.reference_dir + "/" + name + ".ppm";
+
+        if (opt.update) {
+            auto reference = run_in_child([&](measurement&) {
+                auto reference_scene = load(opt, name, opt.reference_spp);
+                return reference_scene and write_ppm(reference_path, reference_scene->cam.render_to_buffer(reference_scene->world));
+            });
+            if (not reference) { return 1; }
+        }
+
+        auto measured = run_in_child([&](measurement& m) {
+            auto scene = load(opt, name, opt.spp);
+            if (not scene) { return false; }
+            std::vector<double> times;
+            int64_t rays = 0;
+            image_buffer image;
+            for (int32_t k = 0; k < opt.repeat; k++) {
+                auto begin = clock_type::now();
+                image = scene->cam.render_to_buffer(scene->world);
+                std::chrono::duration<double, std::milli> elapsed = clock_type::now() - begin;
+                times.push_back(elapsed.count());
+                rays = scene->cam.ray_count;
+            }
+            std::sort(times.begin(), times.end());
+
+            m.median_ms = times[times.size() / 2];
+            m.mrays_per_s = double(rays) / m.median_ms / 1000.0;
+            if (auto reference = read_ppm(reference_path, image.width, image.height)) { m.rmse = rmse(image, *reference); }
+            return true;
+        });
+        if (not measured) { return 1; }
+        const measurement& m = *measured;
+        results[name] = m;
+
+        std::string status = "-";
+        if (auto it = baseline.find(name); it != baseline.end()) {
+            const measurement& base = it->second;
+            status = "ok";
+            if (m.mrays_per_s < base.mrays_per_s * (1 - opt.tolerance)) {
+                status = "SLOWER (baseline " + std::to_string(base.mrays_per_s) + " Mrays/s)";
+                regressed = true;
+            }
+            if (base.rmse >= 0 and m.rmse >= 0 and m.rmse > base.rmse * (1 + opt.rmse_tolerance)) {
+                status = "WORSE RMSE (baseline " + std::to_string(base.rmse) + ")";
+                regressed = true;
+            }
+        }
+
+        std::cout << std::left << std::setw(18) << name << std::right << std::fixed
+                  << std::setw(12) << std::setprecision(1) << m.median_ms
+                  << std::setw(10) << std::setprecision(3) << m.mrays_per_s
+                  << std::setw(12) << std::setprecision(1) << m.peak_rss_kb / 1024.0;
+        if (m.rmse >= 0) { std::cout << std::setw(10) << std::setprecision(4) << m.rmse; }
+        else             { std::cout << std::setw(10) << "-"; }
+        std::cout << "  " << status << std::endl;
+    }
+
+    if (opt.update) {
+        if (not write_baseline(opt.baseline, results)) { return 1; }
+        std::cout << "wrote " << opt.baseline << " and reference images to " << opt.reference_dir << '\n';
+        return 0;
+    }
+    if (baseline.empty()) { std::cout << "no baseline at " << opt.baseline << " (run with --update to create one)\n"; }
+    if (regressed) {
+        std::cerr << "ERROR: Performance or quality regressed beyond the tolerance.\n";
+        return 1;
+    }
+    return 0;
+}
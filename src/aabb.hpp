@@ -2,6 +2,7 @@
 #define AABB_H
 
 #include "rtweekend.hpp"
+#include "render_stats.hpp"
 #include <cassert>
 
 class aabb {
@@ -47,6 +48,7 @@ class aabb {
         }
 
         bool hit(const ray& r, interval ray_t) const {
+            render_stats::add(render_stats::counter::aabb_tests);
             const point3& ray_orig  = r.origin();
             const point3& ray_dir   = r.direction();
             
@@ -64,6 +66,13 @@ class aabb {
             }
             return true;
         }
+        double surface_area() const {
+            if (x.is_empty() or y.is_empty() or z.is_empty()) { return 0; }
+            return 2 * (x.size() * y.size() + y.size() * z.size() + z.size() * x.size());
+        }
+        point3 centroid() const {
+            return point3{(x.min + x.max) / 2, (y.min + y.max) / 2, (z.min + z.max) / 2};
+        }
         int32_t longest_axis() const {
             if (x.size() > y.size()) {
                 return x.size() > z.size() ? 0 : 2;
@@ -0,0 +1,108 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "rtweekend.hpp"
+
+#include "camera.hpp"
+#include "hittable_list.hpp"
+#include "refit_bvh.hpp"
+#include "scene_compiler.hpp"
+#include "scene_desc.hpp"
+#include "scene_loader.hpp"
+#include "tracer.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+/** 連番のフレームの動き。角度は全フレームを通しての回転量（度数法）で、フレーム`f`では`f / frames`倍だけ回す */
+struct animation_options {
+    int32_t frames = 1;
+    // カメラの視点を注視点を通る鉛直軸の周りに回す（ターンテーブル）
+    double orbit = 0;
+    // ワールド直下の各形状を、自身のバウンディングボックスの中心を通る鉛直軸の周りに回す
+    double spin = 0;
+    // 部分木のSAHのコストが構築直後の何倍を超えたら作り直すか（`refit_bvh`）
+    double rebuild_threshold = 1.25;
+};
+
+/**
+ * @brief シーンを`options.frames`枚のフレームとして描画し、PPMを続けて標準出力に書く。
+ *
+ * 各フレームでワールドを動かした位置に展開し（`scene_compiler`と同じく変換をプリミティブに焼き込む）、
+ * シーン全体の1つのBVHを`refit_bvh`で更新する。フレームごとにシーンの展開・BVHの更新・描画の時間を標準エラー出力に書く。
+ * 回転で直方体が`quad`に分解されるなど、プリミティブの数が変わったフレームではBVHを全体から作り直す。
+ * @return 全フレームで追跡したレイの本数
+ */
+inline int64_t render_animation(
+    const scene_view& scene,
+    scene_loader& loader,
+    const bvh_options& bvh,
+    camera cam,
+    const animation_options& options
+) {
+    using clock_type = std::chrono::steady_clock;
+    scene_compiler compiler(scene, loader, bvh);
+    refit_bvh accel(bvh.builder, options.rebuild_threshold);
+    const point3 lookfrom = cam.lookfrom;
+
+    // 回転の中心は動かす前の形状の中心
+    std::vector<point3> centers;
+    centers.reserve(scene.world.size());
+    for (int32_t object : scene.world) {
+        std::vector<shared_ptr<hittable>> leaves;
+        compiler.compile_object(object, instance_transform{}, leaves);
+        aabb box = aabb::empty;
+        for (const auto& leaf : leaves) { box = aabb(box, leaf->bounding_box()); }
+        centers.push_back(box.centroid());
+    }
+
+    double total_update_ms = 0;
+    double total_render_s = 0;
+    int64_t total_rays = 0;
+    int32_t update_counts[4] = {};
+    for (int32_t frame = 0; frame < options.frames; frame++) {
+        tracer::span span("frame", frame);
+        const double t = double(frame) / options.frames;
+
+        auto compile_begin = clock_type::now();
+        std::vector<shared_ptr<hittable>> leaves;
+        for (size_t k = 0; k < scene.world.size(); k++) {
+            // 中心cの周りの回転 p ↦ R(p - c) + c
+            instance_transform xf{options.spin * t, vec3{0, 0, 0}};
+            xf.offset = centers[k] - xf.apply_vector(centers[k]);
+            compiler.compile_object(scene.world[k], xf, leaves);
+        }
+        std::chrono::duration<double, std::milli> compile_ms = clock_type::now() - compile_begin;
+
+        const bvh_update_report update = accel.update(leaves);
+        total_update_ms += update.ms;
+        update_counts[int32_t(update.kind)]++;
+        hittable_list world;
+        if (not leaves.empty()) { world.add(accel.bvh()); }
+
+        const instance_transform orbit{options.orbit * t, vec3{0, 0, 0}};
+        cam.lookfrom = cam.lookat + orbit.apply_vector(lookfrom - cam.lookat);
+        auto render_begin = clock_type::now();
+        cam.render(world);
+        std::chrono::duration<double> render_s = clock_type::now() - render_begin;
+        total_render_s += render_s.count();
+        total_rays += cam.ray_count;
+
+        std::clog << "Frame " << frame + 1 << "/" << options.frames << ": " << leaves.size() << " primitives, "
+                  << "scene " << compile_ms.count() << " ms, BVH " << bvh_update_name(update.kind) << ' ' << update.ms << " ms";
+        if (update.kind == bvh_update_kind::partial_rebuild) {
+            std::clog << " (" << update.rebuilt_subtrees << " subtrees, " << update.rebuilt_primitives << " primitives)";
+        }
+        std::clog << ", SAH " << update.sah << " (x" << update.degradation << "), render " << render_s.count() << " s, "
+                  << double(cam.ray_count) / render_s.count() / 1e6 << " Mrays/s\n";
+    }
+    std::clog << "Animation: " << options.frames << " frames, BVH updates " << total_update_ms << " ms in total ("
+              << update_counts[int32_t(bvh_update_kind::build)] << " build, "
+              << update_counts[int32_t(bvh_update_kind::refit)] << " refit, "
+              << update_counts[int32_t(bvh_update_kind::partial_rebuild)] << " partial, "
+              << update_counts[int32_t(bvh_update_kind::full_rebuild)] << " full), render " << total_render_s << " s\n";
+    return total_rays;
+}
+
+#endif
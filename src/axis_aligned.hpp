@@ -0,0 +1,188 @@
+#ifndef AXIS_ALIGNED_H
+#define AXIS_ALIGNED_H
+
+#include "rtweekend.hpp"
+#include "aabb.hpp"
+#include "hittable.hpp"
+#include "material.hpp"
+#include "quad.hpp"
+#include "render_stats.hpp"
+
+#include <array>
+
+/**
+ * @brief 2辺が座標軸に沿った長方形。`quad`と同じ`Q`, `u`, `v`で表し、同じ法線とUVを返す。
+ * 平面との交差は1回の除算で求まり、UVも外積を使わずに求められる。
+ */
+class aa_rect : public hittable {
+    public:
+        aa_rect(
+            const point3& Q,
+            const vec3& u,
+            const vec3& v,
+            shared_ptr<material> mat
+        ) : Q(Q), mat(mat) {
+            u_axis = nonzero_axis(u);
+            v_axis = nonzero_axis(v);
+            axis = 3 - u_axis - v_axis;
+            inv_u = 1.0 / u[u_axis];
+            inv_v = 1.0 / v[v_axis];
+            normal = unit_vector(cross(u, v));
+            bbox = aabb{aabb{Q, Q + u + v}, aabb{Q + u, Q + v}};
+        }
+
+        /** `u`と`v`がそれぞれ1つの軸だけに成分を持ち、その軸が異なるか */
+        static bool is_axis_aligned(const vec3& u, const vec3& v) {
+            int32_t a = nonzero_axis(u);
+            int32_t b = nonzero_axis(v);
+            return a >= 0 and b >= 0 and a != b;
+        }
+
+        aabb bounding_box() const override { return bbox; }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            render_stats::add(render_stats::counter::quad_tests);
+            double denom = r.direction()[axis];
+            if (std::abs(denom) < 1e-8) { return false; }
+
+            double t = (Q[axis] - r.origin()[axis]) / denom;
+            if (not ray_t.contains(t)) { return false; }
+
+            point3 intersection = r.at(t);
+            double alpha = (intersection[u_axis] - Q[u_axis]) * inv_u;
+            double beta  = (intersection[v_axis] - Q[v_axis]) * inv_v;
+            const interval unit_interval{0, 1};
+            if (not unit_interval.contains(alpha) or not unit_interval.contains(beta)) { return false; }
+
+            rec.t = t;
+            rec.p = intersection;
+            rec.u = alpha;
+            rec.v = beta;
+            rec.mat = mat;
+            rec.set_face_normal(r, normal);
+            return true;
+        }
+
+    private:
+        point3 Q;
+        shared_ptr<material> mat;
+        // 法線の軸と、u・vが沿う軸
+        int32_t axis, u_axis, v_axis;
+        double inv_u, inv_v;
+        vec3 normal;
+        aabb bbox;
+
+        /** ちょうど1つの成分だけが0でなければその軸、そうでなければ-1 */
+        static int32_t nonzero_axis(const vec3& w) {
+            int32_t found = -1;
+            for (int32_t a = 0; a < 3; a++) {
+                if (w[a] == 0) { continue; }
+                if (found >= 0) { return -1; }
+                found = a;
+            }
+            return found;
+        }
+};
+
+/**
+ * @brief 座標軸に沿った直方体。`box`が作る6枚の`quad`と同じ法線とUVを、1回のスラブ判定で求める。
+ * 始点が内側にあるレイは出ていく面に当たる（`constant_medium`の境界にも使える）。
+ */
+class aa_box : public hittable {
+    public:
+        aa_box(const point3& a, const point3& b, shared_ptr<material> mat) : mat(mat), faces(box_faces(a, b)) {
+            bbox = aabb(a, b);
+            // `aabb`は薄い箱を広げるので、スラブには元の座標を使う
+            slabs = {interval(std::min(a.x(), b.x()), std::max(a.x(), b.x())),
+                     interval(std::min(a.y(), b.y()), std::max(a.y(), b.y())),
+                     interval(std::min(a.z(), b.z()), std::max(a.z(), b.z()))};
+            for (int32_t f = 0; f < 6; f++) {
+                normals[f] = unit_vector(cross(faces[f].u, faces[f].v));
+                inv_u_length_squared[f] = 1.0 / faces[f].u.length_squared();
+                inv_v_length_squared[f] = 1.0 / faces[f].v.length_squared();
+            }
+        }
+
+        /** どの辺の長さも0でない（6面がいずれも退化しない）か */
+        static bool is_solid(const point3& a, const point3& b) {
+            return a.x() != b.x() and a.y() != b.y() and a.z() != b.z();
+        }
+
+        aabb bounding_box() const override { return bbox; }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            render_stats::add(render_stats::counter::box_tests);
+            const point3& origin = r.origin();
+            const vec3& direction = r.direction();
+
+            double t_near = -infinity, t_far = infinity;
+            int32_t near_face = -1, far_face = -1;
+            for (int32_t axis = 0; axis < 3; axis++) {
+                const interval& slab = slabs[axis];
+                // 面と平行なレイは、その軸の面には当たらない
+                if (std::abs(direction[axis]) < 1e-8) {
+                    if (not slab.contains(origin[axis])) { return false; }
+                    continue;
+                }
+                double inv = 1.0 / direction[axis];
+                double t_min = (slab.min - origin[axis]) * inv;
+                double t_max = (slab.max - origin[axis]) * inv;
+                bool enter_at_max = inv < 0;
+                if (enter_at_max) { std::swap(t_min, t_max); }
+                if (t_min > t_near) {
+                    t_near = t_min;
+                    near_face = face_index(axis, enter_at_max);
+                }
+                if (t_max < t_far) {
+                    t_far = t_max;
+                    far_face = face_index(axis, not enter_at_max);
+                }
+            }
+            if (t_near > t_far) { return false; }
+
+            double t;
+            int32_t face;
+            if (near_face >= 0 and ray_t.contains(t_near))   { t = t_near; face = near_face; }
+            else if (far_face >= 0 and ray_t.contains(t_far)) { t = t_far; face = far_face; }
+            else { return false; }
+
+            rec.t = t;
+            rec.p = r.at(t);
+            const vec3 planar = rec.p - faces[face].Q;
+            rec.u = dot(planar, faces[face].u) * inv_u_length_squared[face];
+            rec.v = dot(planar, faces[face].v) * inv_v_length_squared[face];
+            rec.mat = mat;
+            rec.set_face_normal(r, normals[face]);
+            return true;
+        }
+
+    private:
+        shared_ptr<material> mat;
+        // `box_faces`の並び（+z, +x, -z, -x, +y, -y）
+        std::array<quad_frame, 6> faces;
+        std::array<vec3, 6> normals;
+        std::array<double, 6> inv_u_length_squared;
+        std::array<double, 6> inv_v_length_squared;
+        std::array<interval, 3> slabs;
+        aabb bbox;
+
+        /** `axis`軸の最大側（`at_max`）または最小側の面の`faces`での位置 */
+        static int32_t face_index(int32_t axis, bool at_max) {
+            static constexpr int32_t table[3][2] = {{3, 1}, {5, 4}, {2, 0}};
+            return table[axis][at_max ? 1 : 0];
+        }
+};
+
+/** 2辺が座標軸に沿っていれば`aa_rect`、そうでなければ`quad`を作る */
+inline shared_ptr<hittable> make_quad(const point3& Q, const vec3& u, const vec3& v, shared_ptr<material> mat) {
+    if (aa_rect::is_axis_aligned(u, v)) { return make_shared<aa_rect>(Q, u, v, mat); }
+    return make_shared<quad>(Q, u, v, mat);
+}
+
+/** 退化していなければ`aa_box`、そうでなければ6枚の`quad`のリスト（`box`）を作る */
+inline shared_ptr<hittable> make_box(const point3& a, const point3& b, shared_ptr<material> mat) {
+    if (aa_box::is_solid(a, b)) { return make_shared<aa_box>(a, b, mat); }
+    return box(a, b, mat);
+}
+
+#endif
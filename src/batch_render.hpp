@@ -0,0 +1,179 @@
+#ifndef BATCH_RENDER_H
+#define BATCH_RENDER_H
+
+#include "rtweekend.hpp"
+
+#include "camera.hpp"
+#include "color.hpp"
+#include "hittable.hpp"
+#include "parallel.hpp"
+#include "perf_counters.hpp"
+#include "render_stats.hpp"
+#include "scene_desc.hpp"
+#include "scene_file.hpp"
+#include "scene_loader.hpp"
+#include "tracer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+/** 同じワールドを描く1枚の画像。`camera`は元のカメラに`view`ファイルの`camera`行を重ねたもの */
+struct view_desc {
+    std::string output;
+    camera_desc camera;
+};
+
+/**
+ * @brief ビューの一覧のファイルを読む。
+ *
+ *     view <output-path>
+ *     camera <key> <value...>
+ *
+ * `view`行からの`camera`行（シーンファイルと同じ書式）で、そのビューだけ`base`から変える値を指定する。
+ * `#`以降はコメントとして無視する。エラーがあれば`std::cerr`に行番号付きで報告し、`std::nullopt`を返す。
+ */
+inline std::optional<std::vector<view_desc>> read_views(const std::string& path, const camera_desc& base) {
+    std::ifstream in(path);
+    if (not in) {
+        std::cerr << "ERROR: Cannot open view list '" << path << "'.\n";
+        return std::nullopt;
+    }
+    std::vector<view_desc> views;
+    std::string raw_line;
+    int32_t line_number = 0;
+    while (std::getline(in, raw_line)) {
+        line_number++;
+        scene_file::strip_comment(raw_line);
+
+        scene_file::line_reader line{raw_line, line_number};
+        std::string directive;
+        if (not line.next(directive)) { continue; }
+        if (directive == "view") {
+            view_desc view{"", base};
+            if (not line.next_string(view.output)) { line.fail("expected an output path"); return std::nullopt; }
+            views.push_back(view);
+        } else if (directive == "camera") {
+            if (views.empty()) { line.fail("camera parameters must follow a view"); return std::nullopt; }
+            if (not scene_file::parse_camera(line, views.back().camera)) { return std::nullopt; }
+        } else {
+            line.fail("unknown directive '" + directive + "'");
+            return std::nullopt;
+        }
+        if (not line.at_end()) {
+            line.fail("unexpected trailing tokens");
+            return std::nullopt;
+        }
+    }
+    if (views.empty()) {
+        std::cerr << "ERROR: View list '" << path << "' has no views.\n";
+        return std::nullopt;
+    }
+    return views;
+}
+
+/** 描画結果を`camera::render`と同じテキストのPPMで書く */
+inline bool write_ppm(const std::string& path, const image_buffer& image) {
+    std::ofstream out(path);
+    if (not out) {
+        std::cerr << "ERROR: Cannot write '" << path << "'.\n";
+        return false;
+    }
+    out << "P3\n" << image.width << ' ' << image.height << "\n255\n";
+    for (const color& pixel_color : image.pixels) { write_color(out, pixel_color); }
+    return bool(out);
+}
+
+/** `render_views`で描いた1枚 */
+struct view_result {
+    image_buffer image;
+    int32_t samples_per_pixel = 0;
+    int64_t rays = 0;
+    // 全ビューの描画を始めてから、このビューの最後のタイルを描き終えるまでの秒数
+    double finish_seconds = 0;
+};
+
+/**
+ * @brief `views`を1組のスレッドで描く。ワールドとそのBVHは全ビューで共有し、画像はビューごとに別に持つ。
+ *
+ * 全ビューのタイルをビューの順に1つの列に並べ、空いたスレッドが次のタイルを取る。
+ * ビューごとにスレッドを作り直さず、あるビューの最後のタイルを待つ間も他のスレッドは次のビューに進む。
+ * 各ビューの画像はビューだけを`camera::render`で描いたものと同じになる。
+ * スレッド数やパケットなどの描画方法は`settings`のものを全ビューで使う（`heatmap`と`wavefront`には対応しない）。
+ */
+inline std::vector<view_result> render_views(
+    const hittable& world,
+    const camera& settings,
+    const std::vector<view_desc>& views,
+    bool show_progress
+) {
+    using clock_type = std::chrono::steady_clock;
+    const auto view_count = int32_t(views.size());
+    std::vector<camera> cameras(view_count, settings);
+    std::vector<view_result> results(view_count);
+    // ビュー`k`のタイルは、全体の列の[first_tile[k], first_tile[k + 1])
+    std::vector<int32_t> first_tile(view_count + 1, 0);
+    for (int32_t k = 0; k < view_count; k++) {
+        scene_loader::apply_camera(views[k].camera, cameras[k]);
+        first_tile[k + 1] = first_tile[k] + cameras[k].prepare_tiles(results[k].image);
+        results[k].samples_per_pixel = cameras[k].samples_per_pixel;
+    }
+    const int32_t tile_count = first_tile[view_count];
+
+    std::vector<std::atomic<int32_t>> tiles_left(view_count);
+    std::vector<std::atomic<int64_t>> view_rays(view_count);
+    for (int32_t k = 0; k < view_count; k++) { tiles_left[k] = first_tile[k + 1] - first_tile[k]; }
+    std::atomic<int32_t> next_tile = 0;
+    std::atomic<int32_t> tiles_done = 0;
+    std::mutex progress_mutex;
+
+    tracer::span span("render views", view_count);
+    perf::phase phase("render");
+    const auto begin = clock_type::now();
+    run_workers(settings.thread_count > 0 ? settings.thread_count : hardware_threads(), [&](int32_t worker) {
+        if (worker > 0) { tracer::set_thread_name("worker " + std::to_string(worker)); }
+        for (int32_t tile = next_tile++; tile < tile_count; tile = next_tile++) {
+            const auto view = int32_t(std::upper_bound(first_tile.begin(), first_tile.end(), tile) - first_tile.begin()) - 1;
+            int64_t rays = 0;
+            cameras[view].render_tile(world, results[view].image, tile - first_tile[view], rays);
+            view_rays[view] += rays;
+            if (--tiles_left[view] == 0) {
+                std::chrono::duration<double> elapsed = clock_type::now() - begin;
+                results[view].finish_seconds = elapsed.count();
+            }
+
+            int32_t done = ++tiles_done;
+            if (show_progress and progress_mutex.try_lock()) {
+                std::clog << "\rTiles remaining: " << (tile_count - done) << "  " << std::flush;
+                progress_mutex.unlock();
+            }
+        }
+        render_stats::flush();
+    });
+    for (int32_t k = 0; k < view_count; k++) { results[k].rays = view_rays[k]; }
+    if (show_progress) { std::clog << "\rDone.                       \n"; }
+    return results;
+}
+
+/** 各ビューの画像を出力先に書き、ビューごとの大きさ・レイの本数・描き終えた時刻を標準エラー出力に書く */
+inline bool write_views(const std::vector<view_desc>& views, const std::vector<view_result>& results) {
+    tracer::span span("output");
+    perf::phase phase("output");
+    bool written = true;
+    for (size_t k = 0; k < views.size(); k++) {
+        const view_result& result = results[k];
+        written = write_ppm(views[k].output, result.image) and written;
+        std::clog << "View " << k + 1 << "/" << views.size() << ": " << views[k].output << ", "
+                  << result.image.width << "x" << result.image.height << " " << result.samples_per_pixel << " spp, "
+                  << result.rays << " rays, finished " << result.finish_seconds << " s after start\n";
+    }
+    return written;
+}
+
+#endif
@@ -6,6 +6,7 @@
 #include "aabb.hpp"
 #include "hittable.hpp"
 #include "hittable_list.hpp"
+#include "render_stats.hpp"
 
 #include <algorithm>
 
@@ -60,6 +61,7 @@ class bvh_node : public hittable {
         interval ray_t,
         hit_record& rec
     ) const override {
+        render_stats::add(render_stats::counter::bvh_nodes_visited);
         if (not bbox.hit(r, ray_t)) { return false; }
         
         const bool hit_left = left->hit(r, ray_t, rec);
@@ -71,6 +73,12 @@ class bvh_node : public hittable {
     aabb bounding_box() const override {
         return bbox;
     }
+    aabb bounding_box_at(double time) const override {
+        return aabb(left->bounding_box_at(time), right->bounding_box_at(time));
+    }
+
+    const shared_ptr<hittable>& left_child() const { return left; }
+    const shared_ptr<hittable>& right_child() const { return right; }
 
     private:
         shared_ptr<hittable> left;
@@ -0,0 +1,310 @@
+#ifndef BVH_ANALYSIS_H
+#define BVH_ANALYSIS_H
+
+#include "rtweekend.hpp"
+
+#include "axis_aligned.hpp"
+#include "bvh.hpp"
+#include "compressed_bvh.hpp"
+#include "constant_medium.hpp"
+#include "flat_bvh.hpp"
+#include "hittable.hpp"
+#include "hittable_list.hpp"
+#include "motion_bvh.hpp"
+#include "quad.hpp"
+#include "sphere.hpp"
+#include "typed_bvh.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include <span>
+#include <string>
+#include <vector>
+
+/**
+ * @brief 解析のために`flat_bvh_node`の並びに直したBVH。
+ * `primitive_bounds`は葉の並び順（葉が`[offset, offset + count)`で参照する順）のプリミティブの箱。
+ */
+struct bvh_tree_view {
+    // ワールドの中での位置（例: "world[2]/translate/bvh_node"）
+    std::string path;
+    std::vector<flat_bvh_node> nodes;
+    std::vector<aabb> primitive_bounds;
+};
+
+/** BVHの質の指標 */
+struct bvh_statistics {
+    int64_t node_count = 0;
+    int64_t leaf_count = 0;
+    int64_t primitive_count = 0;
+    double sah_cost = 0;
+    // 添字は葉の深さ（根が0）・葉のプリミティブ数
+    std::vector<int64_t> leaf_depths;
+    std::vector<int64_t> leaf_sizes;
+    double mean_leaf_depth = 0;
+    // 内部ノードについての、2つの子の箱の共通部分の表面積と親の表面積の比
+    double mean_sibling_overlap = 0;
+    double max_sibling_overlap = 0;
+    // 箱の表面積が根の`huge_primitive_ratio`倍以上のプリミティブの数と、最大の比
+    int64_t huge_primitives = 0;
+    double largest_primitive_ratio = 0;
+};
+
+/** 「巨大な」プリミティブとみなす、根に対する表面積の比 */
+constexpr double huge_primitive_ratio = 0.5;
+
+inline aabb aabb_intersection(const aabb& a, const aabb& b) {
+    auto overlap = [](const interval& p, const interval& q) {
+        return interval(std::max(p.min, q.min), std::min(p.max, q.max));
+    };
+    return aabb(overlap(a.x, b.x), overlap(a.y, b.y), overlap(a.z, b.z));
+}
+
+inline bvh_statistics analyze_bvh(std::span<const flat_bvh_node> nodes, std::span<const aabb> primitive_bounds) {
+    bvh_statistics stats;
+    stats.node_count = int64_t(nodes.size());
+    stats.primitive_count = int64_t(primitive_bounds.size());
+    stats.sah_cost = bvh_sah_cost(nodes);
+    if (nodes.empty()) { return stats; }
+
+    const double root_area = nodes[0].bbox.surface_area();
+    int64_t interior_count = 0;
+    double overlap_sum = 0;
+    double depth_sum = 0;
+
+    std::vector<std::pair<int32_t, int32_t>> stack{{0, 0}};
+    while (not stack.empty()) {
+        auto [index, depth] = stack.back();
+        stack.pop_back();
+        const flat_bvh_node& node = nodes[index];
+        if (node.is_leaf()) {
+            stats.leaf_count++;
+            depth_sum += depth;
+            if (int32_t(stats.leaf_depths.size()) <= depth) { stats.leaf_depths.resize(depth + 1); }
+            stats.leaf_depths[depth]++;
+            if (int32_t(stats.leaf_sizes.size()) <= node.count) { stats.leaf_sizes.resize(node.count + 1); }
+            stats.leaf_sizes[node.count]++;
+            continue;
+        }
+        const aabb& left = nodes[index + 1].bbox;
+        const aabb& right = nodes[node.offset].bbox;
+        double area = node.bbox.surface_area();
+        double overlap = area > 0 ? aabb_intersection(left, right).surface_area() / area : 0;
+        overlap_sum += overlap;
+        stats.max_sibling_overlap = std::max(stats.max_sibling_overlap, overlap);
+        interior_count++;
+        stack.push_back({index + 1, depth + 1});
+        stack.push_back({node.offset, depth + 1});
+    }
+    stats.mean_leaf_depth = depth_sum / double(stats.leaf_count);
+    stats.mean_sibling_overlap = interior_count > 0 ? overlap_sum / double(interior_count) : 0;
+
+    if (root_area > 0) {
+        for (const aabb& box : primitive_bounds) {
+            double ratio = box.surface_area() / root_area;
+            stats.largest_primitive_ratio = std::max(stats.largest_primitive_ratio, ratio);
+            if (ratio >= huge_primitive_ratio) { stats.huge_primitives++; }
+        }
+    }
+    return stats;
+}
+
+namespace bvh_analysis_detail {
+    /** `bvh_node`の木を深さ優先順に並べる。子が両方とも`bvh_node`でないノードは葉とする */
+    inline void flatten(const bvh_node& node, bvh_tree_view& view) {
+        auto left = std::dynamic_pointer_cast<const bvh_node>(node.left_child());
+        auto right = std::dynamic_pointer_cast<const bvh_node>(node.right_child());
+        int32_t index = int32_t(view.nodes.size());
+        view.nodes.emplace_back();
+        view.nodes[index].bbox = node.bounding_box();
+
+        auto add_leaf = [&](const shared_ptr<hittable>& primitive) {
+            flat_bvh_node leaf;
+            leaf.bbox = primitive->bounding_box();
+            leaf.offset = int32_t(view.primitive_bounds.size());
+            leaf.count = 1;
+            view.primitive_bounds.push_back(leaf.bbox);
+            view.nodes.push_back(leaf);
+        };
+
+        if (not left and not right) {
+            view.nodes[index].offset = int32_t(view.primitive_bounds.size());
+            view.primitive_bounds.push_back(node.left_child()->bounding_box());
+            // 1つのプリミティブしかないノードは左右に同じものを持つ
+            if (node.right_child() != node.left_child()) {
+                view.primitive_bounds.push_back(node.right_child()->bounding_box());
+            }
+            view.nodes[index].count = int32_t(view.primitive_bounds.size()) - view.nodes[index].offset;
+            return;
+        }
+        if (left) { flatten(*left, view); } else { add_leaf(node.left_child()); }
+        view.nodes[index].offset = int32_t(view.nodes.size());
+        if (right) { flatten(*right, view); } else { add_leaf(node.right_child()); }
+    }
+
+    /** `compressed_bvh`の`index`以下を、復元した（量子化で広がった）箱で深さ優先順に並べる。葉の子は葉のノードにする */
+    inline void flatten(const compressed_bvh& bvh, int32_t index, const aabb& box, bvh_tree_view& view) {
+        const compressed_bvh_node& node = bvh.node_array()[index];
+        int32_t out = int32_t(view.nodes.size());
+        view.nodes.emplace_back();
+        view.nodes[out].bbox = box;
+        for (int32_t child = 0; child < 2; child++) {
+            if (child == 1) { view.nodes[out].offset = int32_t(view.nodes.size()); }
+            const aabb child_box = compressed_bvh::child_box(node, child);
+            if (node.leaf_count(child) > 0) {
+                flat_bvh_node leaf;
+                leaf.bbox = child_box;
+                leaf.offset = node.first_primitive(child);
+                leaf.count = node.leaf_count(child);
+                view.nodes.push_back(leaf);
+            } else {
+                flatten(bvh, node.child_node(index, child), child_box, view);
+            }
+        }
+    }
+
+    inline void collect_leaves(const bvh_node& node, std::vector<shared_ptr<hittable>>& leaves) {
+        for (const auto& child : {node.left_child(), node.right_child()}) {
+            if (auto inner = std::dynamic_pointer_cast<const bvh_node>(child)) { collect_leaves(*inner, leaves); }
+            else if (leaves.empty() or leaves.back() != child) { leaves.push_back(child); }
+        }
+    }
+}
+
+/**
+ * @brief `object`以下（リスト・インスタンス・媒質の内側を含む）にあるBVHを全て`bvh_tree_view`にして`out`に加える。
+ */
+inline void collect_bvhs(const shared_ptr<hittable>& object, const std::string& path, std::vector<bvh_tree_view>& out) {
+    auto recurse = [&](const std::vector<shared_ptr<hittable>>& children) {
+        for (size_t i = 0; i < children.size(); i++) {
+            collect_bvhs(children[i], path + "[" + std::to_string(i) + "]", out);
+        }
+    };
+    if (auto list = std::dynamic_pointer_cast<const hittable_list>(object)) {
+        recurse(list->objects);
+    } else if (auto t = std::dynamic_pointer_cast<const translate>(object)) {
+        collect_bvhs(t->child(), path + "/translate", out);
+    } else if (auto r = std::dynamic_pointer_cast<const rotate_y>(object)) {
+        collect_bvhs(r->child(), path + "/rotate_y", out);
+    } else if (auto m = std::dynamic_pointer_cast<const constant_medium>(object)) {
+        collect_bvhs(m->child(), path + "/constant_medium", out);
+    } else if (auto node = std::dynamic_pointer_cast<const bvh_node>(object)) {
+        bvh_tree_view view{path + "/bvh_node", {}, {}};
+        bvh_analysis_detail::flatten(*node, view);
+        out.push_back(std::move(view));
+        std::vector<shared_ptr<hittable>> leaves;
+        bvh_analysis_detail::collect_leaves(*node, leaves);
+        recurse(leaves);
+    } else if (auto flat = std::dynamic_pointer_cast<const flat_bvh>(object)) {
+        auto nodes = flat->node_array();
+        out.push_back({path + "/flat_bvh", {nodes.begin(), nodes.end()}, primitive_bounds(flat->primitive_array())});
+        recurse(flat->primitive_array());
+    } else if (auto compressed = std::dynamic_pointer_cast<const compressed_bvh>(object)) {
+        bvh_tree_view view{path + "/compressed_bvh", {}, primitive_bounds(compressed->primitive_array())};
+        if (compressed->node_array().empty()) {
+            flat_bvh_node leaf;
+            leaf.bbox = compressed->bounding_box();
+            leaf.count = int32_t(compressed->primitive_array().size());
+            view.nodes.push_back(leaf);
+        } else {
+            bvh_analysis_detail::flatten(*compressed, 0, compressed->bounding_box(), view);
+        }
+        out.push_back(std::move(view));
+        recurse(compressed->primitive_array());
+    } else if (auto motion = std::dynamic_pointer_cast<const motion_bvh>(object)) {
+        bvh_tree_view view{path + "/motion_bvh", {}, primitive_bounds(motion->primitive_array())};
+        for (const motion_bvh_node& n : motion->node_array()) {
+            // 動きの全体を覆う箱で評価する
+            view.nodes.push_back({aabb(n.bbox0, n.bbox1), n.offset, n.count, n.axis, 0});
+        }
+        out.push_back(std::move(view));
+        recurse(motion->primitive_array());
+    } else if (auto typed = std::dynamic_pointer_cast<const typed_bvh>(object)) {
+        // 葉が指す種類ごとの範囲を、葉の並び順のプリミティブの並びに直す
+        bvh_tree_view view{path + "/typed_bvh", {}, {}};
+        for (flat_bvh_node node : typed->node_array()) {
+            if (node.is_leaf()) {
+                int32_t first = int32_t(view.primitive_bounds.size());
+                for (const primitive_run& run : typed->run_array().subspan(node.offset, node.count)) {
+                    for (int32_t i = run.begin; i < run.begin + run.count; i++) {
+                        view.primitive_bounds.push_back(typed->primitives().at(run.type, i).bounding_box());
+                    }
+                }
+                node.offset = first;
+                node.count = int32_t(view.primitive_bounds.size()) - first;
+            }
+            view.nodes.push_back(node);
+        }
+        out.push_back(std::move(view));
+        recurse(typed->primitives().others);
+    }
+}
+
+inline void print_bvh_statistics(std::ostream& out, const std::string& path, const bvh_statistics& s) {
+    out << "BVH " << path << '\n' << std::fixed;
+    out << "  nodes " << s.node_count << " (" << s.leaf_count << " leaves), primitives " << s.primitive_count << '\n';
+    out << "  SAH cost " << std::setprecision(2) << s.sah_cost << '\n';
+    out << "  sibling overlap: mean " << std::setprecision(1) << 100 * s.mean_sibling_overlap
+        << "%, max " << 100 * s.max_sibling_overlap << "%\n";
+    out << "  largest primitive: " << std::setprecision(1) << 100 * s.largest_primitive_ratio
+        << "% of the root surface area";
+    if (s.huge_primitives > 0) {
+        out << " (" << s.huge_primitives << " primitives >= " << std::setprecision(0) << 100 * huge_primitive_ratio << "%)";
+    }
+    out << '\n';
+    out << "  leaf depth: mean " << std::setprecision(2) << s.mean_leaf_depth
+        << ", max " << int64_t(s.leaf_depths.size()) - 1 << '\n';
+    for (size_t depth = 0; depth < s.leaf_depths.size(); depth++) {
+        if (s.leaf_depths[depth] == 0) { continue; }
+        out << "    depth " << std::setw(3) << depth << std::setw(10) << s.leaf_depths[depth] << '\n';
+    }
+    out << "  leaf sizes\n";
+    for (size_t size = 0; size < s.leaf_sizes.size(); size++) {
+        if (s.leaf_sizes[size] == 0) { continue; }
+        out << "    " << std::setw(3) << size << " prims" << std::setw(10) << s.leaf_sizes[size] << '\n';
+    }
+}
+
+/** 表示用の形状の種類 */
+inline const char* hittable_kind_name(const hittable& object) {
+    if (dynamic_cast<const sphere*>(&object))          { return "sphere"; }
+    if (dynamic_cast<const plane_figure*>(&object))    { return "plane figure"; }
+    if (dynamic_cast<const aa_rect*>(&object))         { return "aa_rect"; }
+    if (dynamic_cast<const aa_box*>(&object))          { return "aa_box"; }
+    if (dynamic_cast<const hittable_list*>(&object))   { return "list"; }
+    if (dynamic_cast<const translate*>(&object))       { return "translate"; }
+    if (dynamic_cast<const rotate_y*>(&object))        { return "rotate_y"; }
+    if (dynamic_cast<const constant_medium*>(&object)) { return "constant_medium"; }
+    if (dynamic_cast<const bvh_node*>(&object))        { return "bvh_node"; }
+    if (dynamic_cast<const flat_bvh*>(&object))        { return "flat_bvh"; }
+    if (dynamic_cast<const motion_bvh*>(&object))      { return "motion_bvh"; }
+    if (dynamic_cast<const typed_bvh*>(&object))       { return "typed_bvh"; }
+    if (dynamic_cast<const compressed_bvh*>(&object))  { return "compressed_bvh"; }
+    return "other";
+}
+
+/**
+ * @brief ワールドの直下のリスト（毎回線形に調べられる）と、ワールドにある全てのBVHの指標を表示する。
+ */
+inline void print_bvh_analysis(std::ostream& out, const hittable_list& world) {
+    const aabb world_box = world.bounding_box();
+    out << "World: " << world.objects.size() << " top-level objects (tested by every ray)\n";
+    for (size_t i = 0; i < world.objects.size(); i++) {
+        double ratio = world_box.surface_area() > 0
+            ? world.objects[i]->bounding_box().surface_area() / world_box.surface_area() : 0;
+        out << "  [" << i << "] " << std::left << std::setw(16) << hittable_kind_name(*world.objects[i])
+            << std::right << std::fixed << std::setprecision(1) << 100 * ratio << "% of the world surface area\n";
+    }
+
+    std::vector<bvh_tree_view> views;
+    for (size_t i = 0; i < world.objects.size(); i++) {
+        collect_bvhs(world.objects[i], "world[" + std::to_string(i) + "]", views);
+    }
+    if (views.empty()) { out << "No BVH in the world.\n"; }
+    for (const auto& view : views) {
+        print_bvh_statistics(out, view.path, analyze_bvh(view.nodes, view.primitive_bounds));
+    }
+}
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef BVH_BUILD_H
+#define BVH_BUILD_H
+
+#include "rtweekend.hpp"
+
+#include "bvh.hpp"
+#include "bvh_cache.hpp"
+#include "compressed_bvh.hpp"
+#include "flat_bvh.hpp"
+#include "hittable_list.hpp"
+#include "lazy_bvh.hpp"
+#include "memory_tracker.hpp"
+#include "motion_bvh.hpp"
+#include "parallel_bvh.hpp"
+#include "perf_counters.hpp"
+#include "sbvh.hpp"
+#include "tracer.hpp"
+#include "typed_bvh.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <vector>
+
+/** BVHの構築方法 */
+enum class bvh_builder {
+    // `bvh_node`の再帰的な構築（キャッシュを使う場合は同じ分割の`median`になる）
+    recursive,
+    // `bvh_node`と同じ中央値分割で`flat_bvh`を構築する
+    median,
+    // ビン分割SAHによる並列構築
+    binned,
+    // 30bitのMortonコードによるLBVH
+    lbvh30,
+    // 63bitのMortonコードによるLBVH
+    lbvh63,
+    // 空間分割を併用するSAH（SBVH）。プリミティブが複数の葉に入る（キャッシュは使わない）
+    sbvh
+};
+
+inline const char* bvh_builder_name(bvh_builder builder) {
+    switch (builder) {
+        case bvh_builder::recursive: return "recursive";
+        case bvh_builder::median:    return "median";
+        case bvh_builder::binned:    return "binned";
+        case bvh_builder::lbvh30:    return "lbvh30";
+        case bvh_builder::lbvh63:    return "lbvh63";
+        case bvh_builder::sbvh:      return "sbvh";
+    }
+    return "?";
+}
+
+inline std::optional<bvh_builder> parse_bvh_builder(const std::string& name) {
+    for (auto builder : {bvh_builder::recursive, bvh_builder::median, bvh_builder::binned, bvh_builder::lbvh30, bvh_builder::lbvh63, bvh_builder::sbvh}) {
+        if (name == bvh_builder_name(builder)) { return builder; }
+    }
+    return std::nullopt;
+}
+
+/** プリミティブのバウンディングボックス列から、指定した方法でBVHの構造を構築する */
+inline bvh_layout build_bvh_layout(bvh_builder builder, std::span<const aabb> bounds) {
+    switch (builder) {
+        case bvh_builder::binned: return binned_bvh_builder(bounds).build();
+        case bvh_builder::lbvh30: return lbvh_builder<uint32_t>(bounds).build();
+        case bvh_builder::lbvh63: return lbvh_builder<uint64_t>(bounds).build();
+        case bvh_builder::sbvh:   return sbvh_builder(bounds).build();
+        default:                  return median_bvh_builder(bounds).build();
+    }
+}
+
+/**
+ * @brief `objects`のBVHの構造を構築する。`sbvh`では参照をプリミティブの形に沿って切り取り、
+ * 参照を`spatial_split_budget`の割合まで増やす。
+ */
+inline bvh_layout build_bvh_layout(
+    bvh_builder builder,
+    const std::vector<shared_ptr<hittable>>& objects,
+    double spatial_split_budget = sbvh_default_budget
+) {
+    const std::vector<aabb> bounds = primitive_bounds(objects);
+    if (builder == bvh_builder::sbvh) { return sbvh_builder(bounds, spatial_split_budget, make_sbvh_clipper(objects)).build(); }
+    return build_bvh_layout(builder, bounds);
+}
+
+/** シーンの読み込み時にBVHをどう作るか */
+struct bvh_options {
+    bvh_builder builder = bvh_builder::recursive;
+    bvh_cache* cache = nullptr;
+    // 動くプリミティブを含むBVHを`motion_bvh`にする（キャッシュは使わない）
+    bool motion = false;
+    // 他の全体を覆うほど巨大なプリミティブを、BVHに入れず常に調べるリストに分ける
+    bool separate_huge = true;
+    // プリミティブを種類ごとの配列に分けた`typed_bvh`にする（キャッシュは使わない）
+    bool typed = false;
+    // 子の箱を8bitに量子化した`compressed_bvh`にする（キャッシュは使わない）
+    bool compressed = false;
+    // `sbvh`で空間分割によって増やしてよい参照の数（プリミティブ数に対する割合）
+    double spatial_split_budget = sbvh_default_budget;
+    // 上の方のノードだけを構築し、残りはレイが初めて入ったときに分割する`lazy_bvh`にする（`builder`とキャッシュは使わない）
+    bool lazy = false;
+};
+
+/**
+ * 巨大なプリミティブとみなす、残りのプリミティブ全体の箱に対する表面積の比。
+ * 地面の巨大な球のような箱はBVHの上の方のノードの箱を膨らませ、ほぼ全てのレイに走査させてしまう。
+ */
+constexpr double huge_primitive_factor = 8.0;
+
+/**
+ * @brief 表面積の大きい順に、残りのプリミティブ全体の箱の`huge_primitive_factor`倍以上の表面積を持つものを`huge`に分け、
+ * それ以外を`rest`に入れる。`rest`には少なくとも1つ残す。
+ */
+inline void split_huge_primitives(
+    const std::vector<shared_ptr<hittable>>& objects,
+    std::vector<shared_ptr<hittable>>& rest,
+    std::vector<shared_ptr<hittable>>& huge
+) {
+    const std::vector<aabb> bounds = primitive_bounds(objects);
+    std::vector<int32_t> order(objects.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](int32_t a, int32_t b) {
+        return bounds[a].surface_area() > bounds[b].surface_area();
+    });
+    // suffix[k]: 表面積がk番目以降のプリミティブ全体の箱
+    std::vector<aabb> suffix(order.size() + 1, aabb::empty);
+    for (size_t k = order.size(); k-- > 0;) { suffix[k] = aabb(suffix[k + 1], bounds[order[k]]); }
+
+    size_t huge_count = 0;
+    while (huge_count + 1 < order.size()
+           and bounds[order[huge_count]].surface_area() >= huge_primitive_factor * suffix[huge_count + 1].surface_area()) {
+        huge_count++;
+    }
+    std::vector<bool> is_huge(objects.size(), false);
+    for (size_t k = 0; k < huge_count; k++) { is_huge[order[k]] = true; }
+    for (size_t i = 0; i < objects.size(); i++) { (is_huge[i] ? huge : rest).push_back(objects[i]); }
+}
+
+/** `objects`の全てを入れたBVHを作る */
+inline shared_ptr<hittable> build_bvh_over(
+    const std::vector<shared_ptr<hittable>>& objects,
+    const bvh_options& options,
+    const std::string& slot
+) {
+    bvh_builder builder = options.builder;
+    if (options.motion and has_moving_primitives(objects)) {
+        if (builder == bvh_builder::recursive) { builder = bvh_builder::median; }
+        return make_shared<motion_bvh>(objects, build_bvh_layout(builder, objects, options.spatial_split_budget));
+    }
+    if (options.lazy) { return make_shared<lazy_bvh>(objects); }
+    if (options.compressed) {
+        if (builder == bvh_builder::recursive) { builder = bvh_builder::median; }
+        bvh_layout layout = build_bvh_layout(builder, objects, options.spatial_split_budget);
+        // 量子化できない（`float`の範囲を超える）箱は従来のノードで持つ
+        if (layout.nodes.empty() or compressed_bvh::can_quantize(layout.nodes[0].bbox)) {
+            return make_shared<compressed_bvh>(objects, layout);
+        }
+        return make_shared<flat_bvh>(objects, std::move(layout));
+    }
+    if (options.typed) {
+        if (builder == bvh_builder::recursive) { builder = bvh_builder::median; }
+        return make_shared<typed_bvh>(objects, build_bvh_layout(builder, objects, options.spatial_split_budget));
+    }
+    // SBVHの構造はプリミティブの形にもよるので、箱だけをキーにするキャッシュは使わない
+    if (options.cache != nullptr and builder != bvh_builder::sbvh) {
+        if (builder == bvh_builder::recursive) { builder = bvh_builder::median; }
+        return options.cache->get_or_build(
+            slot, objects, bvh_builder_name(builder),
+            [builder](const std::vector<aabb>& bounds) { return build_bvh_layout(builder, bounds); }
+        );
+    }
+    if (builder == bvh_builder::recursive) {
+        auto copy = objects;
+        return make_shared<bvh_node>(copy, 0, copy.size());
+    }
+    return make_shared<flat_bvh>(objects, build_bvh_layout(builder, objects, options.spatial_split_budget));
+}
+
+/**
+ * @brief `objects`を覆うBVHを作る。
+ * `options.separate_huge`なら巨大なプリミティブをBVHの外に出し、BVHとそれらを順に調べるリストを返す。
+ * @param slot キャッシュ内でこのBVHを区別する名前
+ */
+inline shared_ptr<hittable> make_bvh(
+    const std::vector<shared_ptr<hittable>>& objects,
+    const bvh_options& options,
+    const std::string& slot
+) {
+    if (objects.empty()) { return make_shared<hittable_list>(); }
+    tracer::span span("BVH build", int64_t(objects.size()));
+    perf::phase phase("BVH build");
+    memory_tracker::scope memory(memory_tracker::tag::acceleration);
+    if (options.separate_huge and objects.size() > 1) {
+        std::vector<shared_ptr<hittable>> rest, huge;
+        split_huge_primitives(objects, rest, huge);
+        if (not huge.empty()) {
+            // 近い交差が先に見つかりやすいBVHを先に調べ、巨大なプリミティブの判定の区間を縮める
+            auto list = make_shared<hittable_list>(build_bvh_over(rest, options, slot));
+            for (const auto& object : huge) { list->add(object); }
+            return list;
+        }
+    }
+    return build_bvh_over(objects, options, slot);
+}
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+#include "rtweekend.hpp"
+
+#include "flat_bvh.hpp"
+#include "mapped_file.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <span>
+#include <string>
+#include <vector>
+
+/**
+ * 構築済みBVHのディスクキャッシュ。
+ *
+ * BVHの形はプリミティブのバウンディングボックスの並びだけから決まるため、
+ * それらのハッシュをキーとする。キャッシュファイルはメモリマップし、ノード配列をコピーせずにそのまま走査に用いる。
+ * キーが一致しない（ジオメトリが変わった）場合は再構築して上書きする。
+ */
+class bvh_cache {
+    public:
+        /**
+         * @param directory キャッシュファイルを置くディレクトリ
+         * @param prefix キャッシュファイル名の接頭辞（シーンファイル名など）
+         */
+        bvh_cache(std::string directory, std::string prefix) :
+            directory(std::move(directory)), prefix(std::move(prefix)) {}
+
+        int32_t hits = 0;
+        int32_t misses = 0;
+
+        /**
+         * @brief キャッシュが有効であればそれを用い、そうでなければ`build`で構築してキャッシュに書き出す。
+         *
+         * @param slot 同じシーン内のBVHを区別するための名前
+         * @param builder_id ビルダの種類と設定。異なるビルダのキャッシュを取り違えないようキーに含める。
+         */
+        template<class Build>
+        shared_ptr<flat_bvh> get_or_build(
+            const std::string& slot,
+            const std::vector<shared_ptr<hittable>>& objects,
+            const std::string& builder_id,
+            Build&& build
+        ) {
+            std::vector<aabb> bounds = primitive_bounds(objects);
+            uint64_t key = geometry_key(bounds, builder_id);
+            std::string path = directory + "/" + prefix + "." + slot + ".bvh";
+
+            if (auto cached = load(path, key, objects)) {
+                hits++;
+                return cached;
+            }
+            misses++;
+            bvh_layout layout = build(bounds);
+            store(path, key, layout);
+            return make_shared<flat_bvh>(objects, std::move(layout));
+        }
+
+        /** FNV-1aによるバウンディングボックス列のハッシュ */
+        static uint64_t geometry_key(std::span<const aabb> bounds, const std::string& builder_id) {
+            uint64_t hash = 0xcbf29ce484222325ull;
+            auto mix = [&](const void* data, size_t size) {
+                auto bytes = static_cast<const unsigned char*>(data);
+                for (size_t i = 0; i < size; i++) {
+                    hash ^= bytes[i];
+                    hash *= 0x100000001b3ull;
+                }
+            };
+            mix(builder_id.data(), builder_id.size());
+            for (const aabb& box : bounds) {
+                const double extents[6] = {box.x.min, box.x.max, box.y.min, box.y.max, box.z.min, box.z.max};
+                mix(extents, sizeof(extents));
+            }
+            return hash;
+        }
+
+    private:
+        std::string directory;
+        std::string prefix;
+
+        static constexpr char magic[8] = {'R', 'T', 'B', 'V', 'H', '\0', '\0', '\0'};
+        static constexpr uint32_t version = 1;
+
+        struct header {
+            char magic[8];
+            uint32_t version;
+            // エンディアンの検出用
+            uint32_t byte_order;
+            uint64_t key;
+            uint64_t node_count;
+            uint64_t primitive_count;
+            uint64_t node_offset;
+            uint64_t index_offset;
+        };
+
+        static shared_ptr<flat_bvh> load(
+            const std::string& path,
+            uint64_t key,
+            const std::vector<shared_ptr<hittable>>& objects
+        ) {
+            auto file = make_shared<mapped_file>();
+            if (not file->open(path) or file->size() < sizeof(header)) { return nullptr; }
+
+            const header& h = *reinterpret_cast<const header*>(file->data());
+            if (std::memcmp(h.magic, magic, sizeof(magic)) != 0) { return nullptr; }
+            if (h.version != version or h.byte_order != 0x01020304) { return nullptr; }
+            if (h.key != key or h.primitive_count != objects.size()) { return nullptr; }
+            if (h.node_offset > file->size() or h.node_count > (file->size() - h.node_offset) / sizeof(flat_bvh_node)) { return nullptr; }
+            if (h.index_offset > file->size() or h.primitive_count > (file->size() - h.index_offset) / sizeof(int32_t)) { return nullptr; }
+
+            std::span<const flat_bvh_node> nodes{
+                reinterpret_cast<const flat_bvh_node*>(file->data() + h.node_offset), size_t(h.node_count)
+            };
+            std::span<const int32_t> indices{
+                reinterpret_cast<const int32_t*>(file->data() + h.index_offset), size_t(h.primitive_count)
+            };
+            if (not is_consistent(nodes, indices)) { return nullptr; }
+            return make_shared<flat_bvh>(objects, file, nodes, indices);
+        }
+
+        /** 壊れたファイルで範囲外を読まないよう、添字がすべて範囲内であることを確かめる */
+        static bool is_consistent(std::span<const flat_bvh_node> nodes, std::span<const int32_t> indices) {
+            auto node_count = int32_t(nodes.size());
+            auto primitive_count = int32_t(indices.size());
+            // 子は常に親より後ろにあるので、前から順に深さを伝播できる。
+            // 根以外のノードがちょうど1つの親から参照される（木である）ことも確かめ、共有された部分木や孤立したノードを拒む
+            std::vector<int32_t> depth(nodes.size(), 0);
+            std::vector<int32_t> parents(nodes.size(), 0);
+            for (int32_t i = 0; i < node_count; i++) {
+                const flat_bvh_node& node = nodes[i];
+                if (node.is_leaf()) {
+                    if (node.offset < 0 or node.offset > primitive_count - node.count) { return false; }
+                } else if (node.offset <= i + 1 or node.offset >= node_count or node.axis < 0 or node.axis > 2) {
+                    return false;
+                } else {
+                    if (depth[i] + 1 >= bvh_max_depth) { return false; }
+                    depth[i + 1] = depth[node.offset] = depth[i] + 1;
+                    if (++parents[i + 1] > 1 or ++parents[node.offset] > 1) { return false; }
+                }
+            }
+            for (int32_t i = 1; i < node_count; i++) {
+                if (parents[i] != 1) { return false; }
+            }
+            for (int32_t index : indices) {
+                if (index < 0 or index >= primitive_count) { return false; }
+            }
+            return true;
+        }
+
+        static void store(const std::string& path, uint64_t key, const bvh_layout& layout) {
+            header h{};
+            std::memcpy(h.magic, magic, sizeof(magic));
+            h.version = version;
+            h.byte_order = 0x01020304;
+            h.key = key;
+            h.node_count = layout.nodes.size();
+            h.primitive_count = layout.primitive_indices.size();
+            h.node_offset = sizeof(header);
+            h.index_offset = h.node_offset + layout.nodes.size() * sizeof(flat_bvh_node);
+
+            // 書き込み途中のファイルを読まないよう、一時ファイルに書いてから置き換える
+            std::string temporary = path + ".tmp";
+            std::ofstream out(temporary, std::ios::binary);
+            if (not out) {
+                std::cerr << "WARNING: Could not write BVH cache '" << path << "'.\n";
+                return;
+            }
+            out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+            out.write(reinterpret_cast<const char*>(layout.nodes.data()), std::streamsize(layout.nodes.size() * sizeof(flat_bvh_node)));
+            out.write(reinterpret_cast<const char*>(layout.primitive_indices.data()), std::streamsize(layout.primitive_indices.size() * sizeof(int32_t)));
+            out.close();
+            // 書き込みや置き換えに失敗したら、一時ファイルを残さない
+            if (not out or std::rename(temporary.c_str(), path.c_str()) != 0) {
+                std::remove(temporary.c_str());
+                std::cerr << "WARNING: Could not write BVH cache '" << path << "'.\n";
+            }
+        }
+};
+
+#endif
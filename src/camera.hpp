@@ -4,6 +4,45 @@
 #include "rtweekend.hpp"
 #include "hittable.hpp"
 #include "material.hpp"
+#include "memory_tracker.hpp"
+#include "parallel.hpp"
+#include "perf_counters.hpp"
+#include "ray_packet.hpp"
+#include "render_stats.hpp"
+#include "tracer.hpp"
+#include "wavefront.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <span>
+#include <string>
+#include <vector>
+
+/** 描画結果。`pixels`は左上から行ごとに並ぶ */
+struct image_buffer {
+    int32_t width = 0;
+    int32_t height = 0;
+    std::vector<color> pixels;
+};
+
+/** 色の代わりに描く、1サンプルあたりの走査コストの種類 */
+enum class heatmap_kind {
+    none,
+    // BVHのノードの訪問数
+    bvh_nodes,
+    // プリミティブの交差判定の回数
+    primitive_tests,
+};
+
+/** 経路の追跡方法 */
+enum class integrator_kind {
+    // 1本ずつ`ray_color`の再帰で追跡する
+    recursive,
+    // 多数の経路を段ごとにまとめて進める（`wavefront_integrator`）
+    wavefront,
+};
 
 /**
  * @brief 与えられたワールドの特定の位置からレイを発射し、それらの色を評価することで色を定める。
@@ -35,30 +74,74 @@ class camera {
     /** カメラの視点lookfromから焦点が完璧に写る平面までの距離 */
     double focus_dist = 10;
 
+    /** 描画に使うスレッド数。0ならハードウェアスレッド数 */
+    int32_t thread_count = 0;
+
+    /**
+     * `none`以外なら、各ピクセルの色の代わりに1サンプルあたりのコストを疑似カラーで描く。
+     * 少数の外れ値で全体が暗くならないよう、画像内の99パーセンタイルを赤とし、それ以上は同じ色にする。
+     * コストは`render_stats`の計数から求めるので、`RT_ENABLE_STATS`を有効にしてビルドする必要がある。
+     */
+    heatmap_kind heatmap = heatmap_kind::none;
+
+    /** `wavefront`は`heatmap`と併用できない */
+    integrator_kind integrator = integrator_kind::recursive;
+    /** `wavefront`で、散乱したレイを方向と始点で並べ替えてから交差判定する */
+    bool sort_rays = false;
+
+    /**
+     * 0でなければ、カメラからのレイを`packet_size`×`packet_size`ピクセル（4か8）のパケットにまとめてBVHを走査する。
+     * 散乱したレイは1本ずつ追跡する。`recursive`でだけ有効で、`heatmap`とは併用できない。
+     */
+    int32_t packet_size = 0;
+
     public:
+    /** 並列に描画する単位（タイル）の一辺のピクセル数 */
+    static constexpr int32_t tile_size = 16;
+
+    /** 波面方式で1バッチに追跡する経路の数の上限。キューの全体（約1MB）がL2キャッシュに収まる程度にする */
+    static constexpr int32_t wavefront_batch_size = 1 << 12;
+
+    /** 直前の描画で追跡したレイ（カメラからのレイと散乱したレイ）の本数 */
+    int64_t ray_count = 0;
+    /** 直前の描画で、描画を始めてから最初のタイルを描き終えるまでの秒数（`wavefront`では0） */
+    double first_tile_seconds = 0;
+
     void render(const hittable& world) {
-        initialize();
+        image_buffer image = render_pixels(world, true);
+        tracer::span span("output");
+        perf::phase phase("output");
         // Write ppm header
         std::cout << "P3" << std::endl;
-        std::cout << image_width << " " << image_height << std::endl;
+        std::cout << image.width << " " << image.height << std::endl;
         std::cout << 255 << std::endl;
-
-        // Rendering
-        for (int32_t j = 0; j < image_height; j++) {
-            std::clog << "\rScanlines remaining: " << (image_height - j) << " " << std::flush;
-            for (int32_t i = 0; i < image_width; i++) {
-                color pixel_color{0, 0, 0};
-                // 複数点をサンプリングしてレイを飛ばした上で、その色の平均を最終出力結果とする。
-                for (int32_t sample = 0; sample < samples_per_pixel; sample++) {
-                    ray r = get_ray(i, j);
-                    pixel_color += ray_color(r, world, max_depth - 1);
-                }
-                write_color(std::cout, pixel_samples_scale * pixel_color);
-            }
-        }
+        for (const color& pixel_color : image.pixels) { write_color(std::cout, pixel_color); }
         std::clog << "\rDone.                       \n" << std::flush;
     }
 
+    /** 描画結果を出力せずに返す。各ピクセルはサンプルの平均（ガンマ補正前）。 */
+    image_buffer render_to_buffer(const hittable& world) {
+        return render_pixels(world, false);
+    }
+
+    /**
+     * @brief タイルごとの描画の準備をし、`image`を画像の大きさで確保してタイルの数を返す。
+     * 複数のカメラのタイルを1組のスレッドで描くときに使う。各タイルは`render_tile`で任意の順に、別々のスレッドから描ける。
+     * `heatmap`と`wavefront`には対応しない。
+     */
+    int32_t prepare_tiles(image_buffer& image) {
+        initialize();
+        image = image_buffer{image_width, image_height, {}};
+        memory_tracker::scope memory(memory_tracker::tag::framebuffer);
+        image.pixels.resize(size_t(image_width) * image_height);
+        return count_tiles();
+    }
+
+    /** `prepare_tiles`で準備した画像のタイル`tile`を描き、追跡したレイの本数を`rays`に加える */
+    void render_tile(const hittable& world, image_buffer& image, int32_t tile, int64_t& rays) const {
+        draw_tile(world, image, {}, tile, rays);
+    }
+
     private:
     /** Rendered image height */
     int32_t image_height;
@@ -83,6 +166,200 @@ class camera {
     vec3 defocus_disk_u; // Defocus disk horizontal radius
     vec3 defocus_disk_v; // Defocus disk vertical radius
 
+    /**
+     * @brief 画像をタイルに分け、空いたスレッドが順にタイルを取って描画する。
+     * 乱数はタイルごとに番号から決まる種で初期化するので、結果はスレッド数によらない。
+     */
+    image_buffer render_pixels(const hittable& world, bool show_progress) {
+        initialize();
+        image_buffer image{image_width, image_height, {}};
+        std::vector<double> heat;
+        {
+            memory_tracker::scope memory(memory_tracker::tag::framebuffer);
+            image.pixels.resize(size_t(image_width) * image_height);
+            if (heatmap != heatmap_kind::none) { heat.resize(image.pixels.size()); }
+        }
+        const int32_t tile_count = count_tiles();
+
+        std::atomic<int32_t> next_tile = 0;
+        std::atomic<int32_t> tiles_done = 0;
+        std::atomic<int64_t> total_rays = 0;
+        std::mutex progress_mutex;
+
+        tracer::span span("render");
+        perf::phase phase("render");
+        const auto render_begin = std::chrono::steady_clock::now();
+        first_tile_seconds = 0;
+        if (integrator == integrator_kind::wavefront) {
+            ray_count = render_wavefront(world, image, show_progress);
+            return image;
+        }
+        run_workers(thread_count > 0 ? thread_count : hardware_threads(), [&](int32_t worker) {
+            if (worker > 0) { tracer::set_thread_name("worker " + std::to_string(worker)); }
+            int64_t rays = 0;
+            for (int32_t tile = next_tile++; tile < tile_count; tile = next_tile++) {
+                draw_tile(world, image, heat, tile, rays);
+
+                int32_t done = ++tiles_done;
+                if (done == 1) {
+                    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - render_begin;
+                    first_tile_seconds = elapsed.count();
+                }
+                if (show_progress and progress_mutex.try_lock()) {
+                    std::clog << "\rTiles remaining: " << (tile_count - done) << "  " << std::flush;
+                    progress_mutex.unlock();
+                }
+            }
+            total_rays += rays;
+            render_stats::flush();
+        });
+        ray_count = total_rays;
+        if (not heat.empty()) { paint_heatmap(image, heat); }
+        return image;
+    }
+
+    int32_t count_tiles() const {
+        const int32_t tiles_x = (image_width + tile_size - 1) / tile_size;
+        const int32_t tiles_y = (image_height + tile_size - 1) / tile_size;
+        return tiles_x * tiles_y;
+    }
+
+    /**
+     * タイルの番号から決まる種で乱数を初期化してタイルを描く。`heat`が空でなければ色の代わりに`heatmap`のコストを書く。
+     */
+    void draw_tile(const hittable& world, image_buffer& image, std::span<double> heat, int32_t tile, int64_t& rays) const {
+        tracer::span tile_span("tile", tile);
+        random_generator().seed(std::mt19937::result_type(tile + 1));
+        const int32_t tiles_x = (image_width + tile_size - 1) / tile_size;
+        const int32_t i0 = (tile % tiles_x) * tile_size;
+        const int32_t j0 = (tile / tiles_x) * tile_size;
+        if (packet_size == 8) { render_tile_packets<64>(world, image, i0, j0, rays); }
+        else if (packet_size > 0) { render_tile_packets<16>(world, image, i0, j0, rays); }
+        else {
+            for (int32_t j = j0; j < std::min(j0 + tile_size, image_height); j++) {
+                for (int32_t i = i0; i < std::min(i0 + tile_size, image_width); i++) {
+                    const size_t index = size_t(j) * image_width + i;
+                    if (heat.empty()) { image.pixels[index] = render_pixel(world, i, j, rays); }
+                    else { heat[index] = pixel_cost(world, i, j, rays); }
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief 全ピクセル・全サンプルの経路を、サンプルごとに全ピクセルを並べた順に番号付けし、
+     * `wavefront_batch_size`本ずつ（ただし画素数以下、1つのバッチに同じピクセルが2度現れないように）波面方式で追跡する。
+     * @return 追跡したレイの本数
+     */
+    int64_t render_wavefront(const hittable& world, image_buffer& image, bool show_progress) const {
+        const int64_t pixel_count = int64_t(image_width) * image_height;
+        const int64_t path_count = pixel_count * samples_per_pixel;
+        const int32_t batch_size = int32_t(std::min<int64_t>(wavefront_batch_size, pixel_count));
+        wavefront_integrator wavefront(world, background, max_depth, thread_count > 0 ? thread_count : hardware_threads());
+        wavefront.sort_secondary_rays = sort_rays;
+
+        int64_t rays = 0;
+        // キューは描画の作業領域として計上する
+        memory_tracker::scope memory(memory_tracker::tag::framebuffer);
+        // 全バッチを同じスレッドで処理する
+        wavefront.run([&] {
+            for (int64_t first = 0; first < path_count; first += batch_size) {
+                const int32_t count = int32_t(std::min<int64_t>(batch_size, path_count - first));
+                rays += wavefront.trace_batch(first, count,
+                    [&](int64_t path) {
+                        const int64_t pixel = path % pixel_count;
+                        return get_ray(int32_t(pixel % image_width), int32_t(pixel / image_width));
+                    },
+                    [&](int64_t path, const color& radiance) {
+                        image.pixels[size_t(path % pixel_count)] += pixel_samples_scale * radiance;
+                    }
+                );
+                if (show_progress) {
+                    std::clog << "\rPaths remaining: " << (path_count - first - count) << "  " << std::flush;
+                }
+            }
+        });
+        return rays;
+    }
+
+    /** 1ピクセルを描画し、1サンプルあたりの`heatmap`のコストを返す */
+    double pixel_cost(const hittable& world, int32_t i, int32_t j, int64_t& rays) const {
+        auto cost = [this] {
+            return heatmap == heatmap_kind::bvh_nodes
+                ? render_stats::local_count(render_stats::counter::bvh_nodes_visited)
+                : render_stats::local_primitive_tests();
+        };
+        const int64_t before = cost();
+        render_pixel(world, i, j, rays);
+        return double(cost() - before) / samples_per_pixel;
+    }
+
+    void paint_heatmap(image_buffer& image, const std::vector<double>& heat) const {
+        std::vector<double> sorted = heat;
+        std::sort(sorted.begin(), sorted.end());
+        double sum = 0;
+        for (double h : heat) { sum += h; }
+        const double scale = sorted[std::min(sorted.size() - 1, sorted.size() * 99 / 100)];
+        std::clog << "\rHeatmap: " << (heatmap == heatmap_kind::bvh_nodes ? "BVH nodes visited" : "primitive tests")
+                  << " per sample, mean " << sum / double(heat.size()) << ", 99th percentile " << scale
+                  << " (red), max " << sorted.back() << '\n';
+        for (size_t k = 0; k < heat.size(); k++) {
+            image.pixels[k] = heatmap_color(scale > 0 ? heat[k] / scale : 0);
+        }
+    }
+
+    color render_pixel(const hittable& world, int32_t i, int32_t j, int64_t& rays) const {
+        color pixel_color{0, 0, 0};
+        // 複数点をサンプリングしてレイを飛ばした上で、その色の平均を最終出力結果とする。
+        for (int32_t sample = 0; sample < samples_per_pixel; sample++) {
+            ray r = get_ray(i, j);
+            const int64_t traced_before = rays;
+            pixel_color += ray_color(r, world, max_depth - 1, rays);
+            render_stats::record_path_length(rays - traced_before);
+        }
+        return pixel_samples_scale * pixel_color;
+    }
+
+    /**
+     * @brief タイルを、サンプルごとに`N`本（一辺`side`ピクセル）のカメラレイのパケットに分けて描画する。
+     * パケットの交差判定の後は、各レイの交点から1本ずつ`shade`で追跡を続ける。
+     */
+    template<int32_t N>
+    void render_tile_packets(const hittable& world, image_buffer& image, int32_t i0, int32_t j0, int64_t& rays) const {
+        constexpr int32_t side = N == 64 ? 8 : 4;
+        static_assert(side * side == N and tile_size % side == 0);
+        const int32_t i_end = std::min(i0 + tile_size, image_width);
+        const int32_t j_end = std::min(j0 + tile_size, image_height);
+        if (max_depth - 1 <= 0) { return; }
+
+        for (int32_t sample = 0; sample < samples_per_pixel; sample++) {
+            for (int32_t pj = j0; pj < j_end; pj += side) {
+                for (int32_t pi = i0; pi < i_end; pi += side) {
+                    ray_packet<N> packet;
+                    for (int32_t k = 0; k < N; k++) {
+                        const int32_t i = pi + k % side;
+                        const int32_t j = pj + k / side;
+                        if (i < i_end and j < j_end) { packet.set(k, get_ray(i, j)); }
+                    }
+                    packet.finish_setup();
+                    hit_packet(world, packet, packet.active);
+
+                    for (int32_t k : ray_packet<N>::bits(packet.active)) {
+                        const int64_t traced_before = rays;
+                        rays++;
+                        render_stats::add(render_stats::counter::primary_rays);
+                        const color c = (packet.hits >> k) & 1
+                            ? shade(packet.rays[k], packet.records[k], world, max_depth - 1, rays)
+                            : background;
+                        render_stats::record_path_length(rays - traced_before);
+                        const size_t index = size_t(pj + k / side) * image_width + (pi + k % side);
+                        image.pixels[index] += pixel_samples_scale * c;
+                    }
+                }
+            }
+        }
+    }
+
     void initialize() {
         // Output Image Settings
         image_height = std::max(int32_t(image_width / aspect_ratio), 1);
@@ -154,24 +431,39 @@ class camera {
     color ray_color(
         const ray& r,
         const hittable& world,
-        const int32_t depth
+        const int32_t depth,
+        int64_t& traced
     ) const {
         if (depth <= 0) { return color{0, 0, 0}; }
+        traced++;
+        render_stats::add(depth == max_depth - 1 ? render_stats::counter::primary_rays : render_stats::counter::secondary_rays);
         
         // Hittableに衝突したときの、その位置に関する情報
         hit_record rec;
         if (not world.hit(r, interval{0.001, infinity}, rec)) {
             return background;
         }
+        return shade(r, rec, world, depth, traced);
+    }
+
+    /** `depth`の深さで追跡した光線`r`が`rec`で当たったときの色 */
+    color shade(
+        const ray& r,
+        const hit_record& rec,
+        const hittable& world,
+        const int32_t depth,
+        int64_t& traced
+    ) const {
+        render_stats::add_material_hit(*rec.mat);
         
         // 物体に衝突した場合には
         // その衝突点からさらにランダムな方向にレイを飛ばし、その飛ばしたレイの色を用いて評価する
         // 光線の逆進性を用いてこれを解釈すると、ある方向から飛んできたレイが反射率の影響を受けながらランダムな方向に飛んでいく過程だとみなせる。
         ray scattered;
         color attenuation;
-        color color_from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
-        if (not rec.mat->scatter(r, rec, attenuation, scattered)) { return color_from_emission; }
-        color color_from_scatter = attenuation * ray_color(scattered, world, depth - 1);
+        color color_from_emission = material_emitted(*rec.mat, rec.u, rec.v, rec.p);
+        if (not material_scatter(*rec.mat, r, rec, attenuation, scattered)) { return color_from_emission; }
+        color color_from_scatter = attenuation * ray_color(scattered, world, depth - 1, traced);
         return color_from_scatter + color_from_emission;
     }
 
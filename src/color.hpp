@@ -4,6 +4,9 @@
 #include "interval.hpp"
 #include "vec3.hpp"
 
+#include <algorithm>
+#include <iterator>
+
 using color = vec3;
 
 inline double linear_to_gamma(double x) {
@@ -11,23 +14,35 @@ inline double linear_to_gamma(double x) {
     return 0;
 }
 
-void write_color(std::ostream& out, const color& pixel_color) {
-    double r = pixel_color.x();
-    double g = pixel_color.y();
-    double b = pixel_color.z();
-    
+/** 物理的な強度の成分をガンマ補正し、[0, 255]の整数に変換する */
+inline int to_display_byte(double x) {
     // ここで受け渡されたrgbは物理的なエネルギーの強度を表しているが、
     // 実際に出力すべき値は人間が感じる明るさの強度である。
     // ガンマ空間に変換することで、エネルギーの強度から人間が感じる明るさの強度に変換する。
-    r = linear_to_gamma(r);
-    g = linear_to_gamma(g);
-    b = linear_to_gamma(b);
+    x = linear_to_gamma(x);
 
     // Translate the [0,1] component values to the byte range [0,255].
     static const interval intensity{0, (1 - 1e-3)};
-    int rbyte = int(256 * intensity.clamp(r));
-    int gbyte = int(256 * intensity.clamp(g));
-    int bbyte = int(256 * intensity.clamp(b));
+    return int(256 * intensity.clamp(x));
+}
+
+/**
+ * @brief [0, 1]の値を青（小）→シアン→緑→黄→赤（大）の疑似カラーにする。
+ * `write_color`のガンマ補正の後にこの色になるよう、2乗した値を返す。
+ */
+inline color heatmap_color(double t) {
+    static const color stops[] = {{0, 0, 0.25}, {0, 0, 1}, {0, 1, 1}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0}};
+    constexpr int32_t segments = int32_t(std::size(stops)) - 1;
+    t = interval{0, 1}.clamp(t) * segments;
+    int32_t k = std::min(int32_t(t), segments - 1);
+    color c = stops[k] + (t - k) * (stops[k + 1] - stops[k]);
+    return c * c;
+}
+
+void write_color(std::ostream& out, const color& pixel_color) {
+    int rbyte = to_display_byte(pixel_color.x());
+    int gbyte = to_display_byte(pixel_color.y());
+    int bbyte = to_display_byte(pixel_color.z());
 
     // Write out the pixel color components.
     out << rbyte << ' ' << gbyte << ' ' << bbyte << '\n';
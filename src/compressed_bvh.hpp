@@ -0,0 +1,343 @@
+#ifndef COMPRESSED_BVH_H
+#define COMPRESSED_BVH_H
+
+#include "rtweekend.hpp"
+
+#include "aabb.hpp"
+#include "flat_bvh.hpp"
+#include "hittable.hpp"
+#include "render_stats.hpp"
+
+#include <array>
+#include <bit>
+#include <cmath>
+#include <limits>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief 子の箱を8bitに量子化した、32バイトの内部ノード。深さ優先順に並べる。
+ *
+ * ノードは自身の箱を覆う座標系（軸ごとの`float`の原点と2のべき乗の目盛り）を持ち、2つの子の箱をその目盛りの整数（0〜255）で表す。
+ * 最小側は切り捨て、最大側は切り上げるので、復元した箱は元の子の箱を必ず含む。
+ * 葉はノードにせず、親が子の箱とプリミティブ数（4bit）を持つ。子への参照は`ref`の1つだけで、残りは並び順から決まる。
+ *  - 左が内部ノード: 左の子は直後のノード。右が内部ノードなら`ref`がその位置、葉なら`ref`が最初のプリミティブの位置
+ *  - 左が葉: `ref`が左の葉の最初のプリミティブの位置。右が内部ノードなら直後のノード、葉なら左の葉の直後のプリミティブから
+ */
+struct compressed_bvh_node {
+    std::array<float, 3> origin;
+    // 目盛りは 2^exponent
+    std::array<int8_t, 3> exponent;
+    // 下位4bit: 左の子の葉のプリミティブ数 / 上位4bit: 右の子の。0なら内部ノード
+    uint8_t leaf_counts;
+    // [子][最小のx, y, z, 最大のx, y, z]
+    std::array<std::array<uint8_t, 6>, 2> bounds;
+    int32_t ref;
+
+    int32_t leaf_count(int32_t child) const { return child == 0 ? leaf_counts & 0xf : leaf_counts >> 4; }
+
+    /** 子`child`が葉のとき、その最初のプリミティブの位置 */
+    int32_t first_primitive(int32_t child) const { return child == 1 and leaf_count(0) > 0 ? ref + leaf_count(0) : ref; }
+
+    /** このノードが`index`にあるとき、内部ノードである子`child`の位置 */
+    int32_t child_node(int32_t index, int32_t child) const { return child == 0 or leaf_count(0) > 0 ? index + 1 : ref; }
+
+    double scale(int32_t axis) const { return power_of_two(exponent[axis]); }
+
+    /** 2^e（-1022 <= e <= 1023）。指数部に直接書き込んで作る */
+    static double power_of_two(int32_t e) { return std::bit_cast<double>(uint64_t(1023 + e) << 52); }
+};
+
+static_assert(sizeof(compressed_bvh_node) == 32);
+static_assert(std::is_trivially_copyable_v<compressed_bvh_node>);
+
+/**
+ * @brief `compressed_bvh_node`の並びで表したBVH。`flat_bvh`のノード（64バイト・葉もノード）の代わりに
+ * 内部ノードだけを32バイトで持つので、ノード配列はおよそ1/4になる。子の箱は走査しながら復元する。
+ *
+ * 復元した箱は元より少し大きいので、辿るノードと交差判定はわずかに増える。
+ * 子は分割軸ではなくレイが箱に入る距離の近い順に辿る。判定の順序が`flat_bvh`と異なるので、
+ * `constant_medium`を含むシーンでは乱数の消費順が変わり、ノイズの出方が変わる。
+ */
+class compressed_bvh : public hittable {
+    public:
+        /** 葉に持てるプリミティブ数の上限。これを超える葉は半分ずつに分けて内部ノードにする */
+        static constexpr int32_t max_leaf_count = 15;
+
+        compressed_bvh(const std::vector<shared_ptr<hittable>>& objects, const bvh_layout& layout) {
+            const std::vector<aabb> bounds = primitive_bounds(objects);
+            builder b{objects, bounds, layout, *this};
+            if (not layout.nodes.empty()) {
+                bbox = layout.nodes[0].bbox;
+                const source root{0, 0, 0};
+                if (b.is_leaf(root)) {
+                    b.append_primitives(root);
+                } else {
+                    b.emit(root);
+                }
+            }
+        }
+
+        /** 全ての座標を`float`の範囲の目盛りで表せる（有限で十分小さい）か */
+        static bool can_quantize(const aabb& box) {
+            constexpr double limit = 1e30;
+            for (int32_t axis = 0; axis < 3; axis++) {
+                const interval& range = box.axis_interval(axis);
+                if (not (-limit < range.min and range.max < limit)) { return false; }
+            }
+            return true;
+        }
+
+        bool hit(
+            const ray& r,
+            interval ray_t,
+            hit_record& rec
+        ) const override {
+            if (primitives.empty() or not bbox.hit(r, ray_t)) { return false; }
+            if (nodes.empty()) { return hit_primitives(0, int32_t(primitives.size()), r, ray_t, rec); }
+
+            const point3& origin = r.origin();
+            const vec3 inv_direction{1.0 / r.direction().x(), 1.0 / r.direction().y(), 1.0 / r.direction().z()};
+            int32_t stack[max_depth];
+            int32_t stack_size = 0;
+            int32_t current = 0;
+            bool hit_anything = false;
+
+            while (true) {
+                const compressed_bvh_node& node = nodes[current];
+                render_stats::add(render_stats::counter::bvh_nodes_visited);
+                const std::array<double, 6> frame = decode_frame(node);
+                std::array<double, 2> t_enter{infinity, infinity};
+                std::array<bool, 2> hits;
+                for (int32_t child = 0; child < 2; child++) {
+                    hits[child] = hit_child(node, frame, child, origin, inv_direction, ray_t, t_enter[child]);
+                }
+
+                // 葉の子はここで（手前から）調べる
+                const int32_t near = t_enter[1] < t_enter[0] ? 1 : 0;
+                const int32_t far = 1 - near;
+                for (int32_t child : {near, far}) {
+                    const int32_t count = node.leaf_count(child);
+                    if (hits[child] and count > 0) {
+                        if (hit_primitives(node.first_primitive(child), count, r, ray_t, rec)) { hit_anything = true; }
+                        hits[child] = false;
+                    }
+                }
+
+                if (hits[near] and hits[far]) {
+                    stack[stack_size++] = node.child_node(current, far);
+                    current = node.child_node(current, near);
+                    continue;
+                }
+                if (hits[0] or hits[1]) {
+                    current = node.child_node(current, hits[0] ? 0 : 1);
+                    continue;
+                }
+                if (stack_size == 0) { break; }
+                current = stack[--stack_size];
+            }
+            return hit_anything;
+        }
+
+        aabb bounding_box() const override { return bbox; }
+        aabb bounding_box_at(double time) const override {
+            aabb box = aabb::empty;
+            for (const auto& primitive : primitives) { box = aabb(box, primitive->bounding_box_at(time)); }
+            return box;
+        }
+
+        std::span<const compressed_bvh_node> node_array() const { return nodes; }
+        const std::vector<shared_ptr<hittable>>& primitive_array() const { return primitives; }
+
+        /** `node`の子`child`の箱を復元する */
+        static aabb child_box(const compressed_bvh_node& node, int32_t child) {
+            const std::array<double, 6> frame = decode_frame(node);
+            std::array<interval, 3> axes;
+            for (int32_t axis = 0; axis < 3; axis++) {
+                axes[axis] = interval(
+                    frame[axis] + node.bounds[child][axis] * frame[3 + axis],
+                    frame[axis] + node.bounds[child][3 + axis] * frame[3 + axis]
+                );
+            }
+            aabb box;
+            box.x = axes[0];
+            box.y = axes[1];
+            box.z = axes[2];
+            return box;
+        }
+
+    private:
+        // 葉が大きすぎて分けたときに増える深さを見込んだ走査スタックの大きさ
+        static constexpr int32_t max_depth = bvh_max_depth + 32;
+
+        std::vector<compressed_bvh_node> nodes;
+        // 葉の並び順に並べ替えたプリミティブ
+        std::vector<shared_ptr<hittable>> primitives;
+        aabb bbox;
+
+        /** 各軸の原点と目盛り（原点x, y, z, 目盛りx, y, z） */
+        static std::array<double, 6> decode_frame(const compressed_bvh_node& node) {
+            return {node.origin[0], node.origin[1], node.origin[2], node.scale(0), node.scale(1), node.scale(2)};
+        }
+
+        /** `aabb::hit`と同じスラブ判定を、復元した子の箱について行う。`t_enter`は箱に入る距離 */
+        static bool hit_child(
+            const compressed_bvh_node& node,
+            const std::array<double, 6>& frame,
+            int32_t child,
+            const point3& origin,
+            const vec3& inv_direction,
+            interval ray_t,
+            double& t_enter
+        ) {
+            render_stats::add(render_stats::counter::aabb_tests);
+            for (int32_t axis = 0; axis < 3; axis++) {
+                const double lo = frame[axis] + node.bounds[child][axis] * frame[3 + axis];
+                const double hi = frame[axis] + node.bounds[child][3 + axis] * frame[3 + axis];
+                double t0 = (lo - origin[axis]) * inv_direction[axis];
+                double t1 = (hi - origin[axis]) * inv_direction[axis];
+                if (t0 > t1) { std::swap(t0, t1); }
+                if (t0 > ray_t.min) { ray_t.min = t0; }
+                if (t1 < ray_t.max) { ray_t.max = t1; }
+                if (ray_t.is_empty()) { return false; }
+            }
+            t_enter = ray_t.min;
+            return true;
+        }
+
+        /** `primitives[first, first + count)`を調べ、当たるたびに`ray_t.max`を縮める */
+        bool hit_primitives(int32_t first, int32_t count, const ray& r, interval& ray_t, hit_record& rec) const {
+            bool hit_anything = false;
+            for (int32_t i = first; i < first + count; i++) {
+                if (primitives[i]->hit(r, ray_t, rec)) {
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+            }
+            return hit_anything;
+        }
+
+        /**
+         * 変換元の部分木。`node >= 0`なら`bvh_layout`のノード、`node < 0`なら
+         * `primitive_indices[begin, end)`を半分ずつに分けて作る部分木（大きすぎる葉を分けたもの）。
+         */
+        struct source {
+            int32_t node;
+            int32_t begin;
+            int32_t end;
+        };
+
+        /** `bvh_layout`を深さ優先順にたどり、内部ノードを量子化して並べる */
+        struct builder {
+            const std::vector<shared_ptr<hittable>>& objects;
+            const std::vector<aabb>& bounds;
+            const bvh_layout& layout;
+            compressed_bvh& out;
+
+            /** 葉なら、その範囲に直したもの */
+            source as_range(const source& s) const {
+                if (s.node < 0) { return s; }
+                const flat_bvh_node& node = layout.nodes[s.node];
+                return node.is_leaf() ? source{-1, node.offset, node.offset + node.count} : s;
+            }
+
+            bool is_leaf(const source& s) const {
+                const source range = as_range(s);
+                return range.node < 0 and range.end - range.begin <= max_leaf_count;
+            }
+
+            aabb box(const source& s) const {
+                if (s.node >= 0) { return layout.nodes[s.node].bbox; }
+                aabb result = aabb::empty;
+                for (int32_t i = s.begin; i < s.end; i++) { result = aabb(result, bounds[layout.primitive_indices[i]]); }
+                return result;
+            }
+
+            std::array<source, 2> children(const source& s) const {
+                const source range = as_range(s);
+                if (range.node >= 0) {
+                    const flat_bvh_node& node = layout.nodes[range.node];
+                    return {source{range.node + 1, 0, 0}, source{node.offset, 0, 0}};
+                }
+                const int32_t mid = range.begin + (range.end - range.begin) / 2;
+                return {source{-1, range.begin, mid}, source{-1, mid, range.end}};
+            }
+
+            /** 葉のプリミティブを末尾に加え、その最初の位置を返す */
+            int32_t append_primitives(const source& s) {
+                const source range = as_range(s);
+                const int32_t first = int32_t(out.primitives.size());
+                for (int32_t i = range.begin; i < range.end; i++) {
+                    out.primitives.push_back(objects[layout.primitive_indices[i]]);
+                }
+                return first;
+            }
+
+            /** 内部ノード`s`（と、その下の部分木）を書き出し、その位置を返す */
+            int32_t emit(const source& s) {
+                const int32_t index = int32_t(out.nodes.size());
+                out.nodes.emplace_back();
+                const std::array<source, 2> child = children(s);
+                const aabb frame_box = box(s);
+                compressed_bvh_node node{};
+                quantize(node, frame_box, box(child[0]), box(child[1]));
+
+                const bool left_leaf = is_leaf(child[0]);
+                const bool right_leaf = is_leaf(child[1]);
+                const int32_t left_count = left_leaf ? leaf_size(child[0]) : 0;
+                const int32_t right_count = right_leaf ? leaf_size(child[1]) : 0;
+                node.leaf_counts = uint8_t(left_count | (right_count << 4));
+                if (left_leaf) {
+                    node.ref = append_primitives(child[0]);
+                    if (right_leaf) { append_primitives(child[1]); } else { emit(child[1]); }
+                } else {
+                    emit(child[0]);
+                    node.ref = right_leaf ? append_primitives(child[1]) : emit(child[1]);
+                }
+                out.nodes[index] = node;
+                return index;
+            }
+
+            int32_t leaf_size(const source& s) const {
+                const source range = as_range(s);
+                return range.end - range.begin;
+            }
+        };
+
+        /** `frame_box`を覆う座標系を決め、2つの子の箱を外側に丸めて量子化する */
+        static void quantize(compressed_bvh_node& node, const aabb& frame_box, const aabb& left, const aabb& right) {
+            for (int32_t axis = 0; axis < 3; axis++) {
+                const interval& range = frame_box.axis_interval(axis);
+                float origin = float(range.min);
+                if (double(origin) > range.min) { origin = std::nextafter(origin, -std::numeric_limits<float>::infinity()); }
+                node.origin[axis] = origin;
+
+                // 255目盛りで最大値に届く最小の2のべき乗
+                const double extent = range.max - double(origin);
+                int32_t exponent = -128;
+                if (extent > 0) {
+                    int32_t e;
+                    std::frexp(extent / 255, &e);
+                    exponent = std::max(-128, e - 1);
+                }
+                while (double(origin) + 255 * compressed_bvh_node::power_of_two(exponent) < range.max) { exponent++; }
+                node.exponent[axis] = int8_t(exponent);
+
+                const double scale = node.scale(axis);
+                const std::array<const aabb*, 2> boxes{&left, &right};
+                for (int32_t child = 0; child < 2; child++) {
+                    const interval& child_range = boxes[child]->axis_interval(axis);
+                    double lo = std::clamp(std::floor((child_range.min - origin) / scale), 0.0, 255.0);
+                    double hi = std::clamp(std::ceil((child_range.max - origin) / scale), 0.0, 255.0);
+                    // 復元の式で丸め誤差が出ても内側に入らないよう確かめる
+                    while (lo > 0 and origin + lo * scale > child_range.min) { lo--; }
+                    while (hi < 255 and origin + hi * scale < child_range.max) { hi++; }
+                    node.bounds[child][axis] = uint8_t(lo);
+                    node.bounds[child][3 + axis] = uint8_t(hi);
+                }
+            }
+        }
+};
+
+#endif
@@ -5,6 +5,7 @@
 
 #include "hittable.hpp"
 #include "material.hpp"
+#include "render_stats.hpp"
 #include "texture.hpp"
 
 class constant_medium : public hittable {
@@ -34,6 +35,7 @@ class constant_medium : public hittable {
             interval ray_t,
             hit_record& rec
         ) const override {
+            render_stats::add(render_stats::counter::medium_tests);
             // カメラ側の衝突点と反対側の衝突点の二つを取る。
             hit_record rec1, rec2;
             if (not boundary->hit(r, interval::universe, rec1)) { return false; }
@@ -56,11 +58,14 @@ class constant_medium : public hittable {
             rec.normal = vec3{1, 0, 0};
             rec.front_face = true;
             rec.mat = phase_function;
+            render_stats::add(render_stats::counter::medium_scatters);
 
             return true;
         }
 
         aabb bounding_box() const override { return boundary->bounding_box(); }
+        aabb bounding_box_at(double time) const override { return boundary->bounding_box_at(time); }
+        const shared_ptr<hittable>& child() const { return boundary; }
     private:
         shared_ptr<hittable> boundary;
         double neg_inv_density;
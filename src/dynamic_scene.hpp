@@ -0,0 +1,410 @@
+#ifndef DYNAMIC_SCENE_H
+#define DYNAMIC_SCENE_H
+
+#include "rtweekend.hpp"
+
+#include "aabb.hpp"
+#include "flat_bvh.hpp"
+#include "hittable.hpp"
+#include "parallel_bvh.hpp"
+#include "render_stats.hpp"
+
+#include <bit>
+#include <vector>
+
+/**
+ * `dynamic_scene`に加えた物体を指す。物体を取り除くまで、他の物体の追加・削除・更新の後も同じ物体を指す。
+ * 取り除いた物体のハンドルは無効になり、同じ場所に後から加えた物体とは区別される。
+ */
+struct object_handle {
+    int32_t node = -1;
+    uint32_t generation = 0;
+};
+
+/**
+ * @brief 物体の追加・削除・更新のたびにBVHを局所的に直すシーン。
+ *
+ * 葉に物体を1つずつ持つ2分木で、ノードは配列に置いて空いた場所を使い回す。
+ * - 追加: 兄弟にしたときのSAHのコストの増分が最小になる位置を根から下りながら選び、新しい親を挟む。
+ * - 削除: 親を取り除いて兄弟を祖父につなぐ。
+ * - 更新: 葉を外して、新しい箱で追加し直す（ハンドルはそのまま）。
+ * いずれも変わった葉から根までの箱を付け直し、途中のノードでは子と孫を入れ替える回転で表面積を減らす。
+ * 付け直した経路上で、高さが葉の数に対して偏りすぎた（2⌈log2 n⌉ + 2を超えた）部分木は、その部分木だけをSAHのビン分割で作り直す。
+ * 高さはこの上限に収まるので、走査のスタックは`bvh_max_depth`で足りる。
+ * したがって1回の編集の手間は、木の高さと作り直した部分木の大きさに比例し、シーン全体の大きさにはよらない。
+ */
+class dynamic_scene : public hittable {
+    public:
+        object_handle insert(shared_ptr<hittable> object) {
+            const int32_t leaf = allocate();
+            nodes[leaf].bbox = object->bounding_box();
+            objects[leaf] = std::move(object);
+            attach(leaf);
+            object_count++;
+            return {leaf, nodes[leaf].generation};
+        }
+
+        /** 複数の物体を加える。空のシーンに加えるときは、1つずつ挟み込む代わりにSAHのビン分割でまとめて構築する */
+        std::vector<object_handle> insert(const std::vector<shared_ptr<hittable>>& added) {
+            std::vector<object_handle> handles;
+            handles.reserve(added.size());
+            if (root >= 0 or added.empty()) {
+                for (const auto& object : added) { handles.push_back(insert(object)); }
+                return handles;
+            }
+            std::vector<int32_t> leaves;
+            leaves.reserve(added.size());
+            for (const auto& object : added) {
+                const int32_t leaf = allocate();
+                nodes[leaf].bbox = object->bounding_box();
+                objects[leaf] = object;
+                leaves.push_back(leaf);
+                handles.push_back({leaf, nodes[leaf].generation});
+            }
+            root = build(leaves);
+            nodes[root].parent = -1;
+            object_count += added.size();
+            return handles;
+        }
+
+        /** @return ハンドルが無効ならfalse */
+        bool remove(object_handle handle) {
+            if (not valid(handle)) { return false; }
+            detach(handle.node);
+            release(handle.node);
+            object_count--;
+            return true;
+        }
+
+        /** 物体を`object`に置き換える（動かした物体など）。@return ハンドルが無効ならfalse */
+        bool update(object_handle handle, shared_ptr<hittable> object) {
+            if (not valid(handle)) { return false; }
+            const aabb box = object->bounding_box();
+            objects[handle.node] = std::move(object);
+            if (same_box(nodes[handle.node].bbox, box)) { return true; }
+            detach(handle.node);
+            nodes[handle.node].bbox = box;
+            attach(handle.node);
+            return true;
+        }
+
+        bool valid(object_handle handle) const {
+            return handle.node >= 0 and handle.node < int32_t(nodes.size())
+                and nodes[handle.node].generation == handle.generation and nodes[handle.node].is_leaf()
+                and objects[handle.node] != nullptr;
+        }
+
+        shared_ptr<hittable> object(object_handle handle) const {
+            return valid(handle) ? objects[handle.node] : nullptr;
+        }
+
+        size_t size() const { return object_count; }
+
+        /** 木の高さ（葉だけなら0） */
+        int32_t height() const { return root < 0 ? 0 : nodes[root].height; }
+
+        /** SAHのコスト（`bvh_sah_cost`と同じく根の表面積で正規化する） */
+        double sah_cost() const {
+            if (root < 0 or nodes[root].bbox.surface_area() <= 0) { return 0; }
+            double cost = 0;
+            for_each_node(root, [&](int32_t i) { cost += nodes[i].bbox.surface_area(); });
+            return cost / nodes[root].bbox.surface_area();
+        }
+
+        /** 直前の編集までに、偏りのために作り直した部分木の数とその葉の数の合計 */
+        int64_t rebuilt_subtrees = 0;
+        int64_t rebuilt_leaves = 0;
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            if (root < 0) { return false; }
+            int32_t stack[bvh_max_depth];
+            int32_t stack_size = 0;
+            int32_t current = root;
+            bool hit_anything = false;
+            while (true) {
+                const node& n = nodes[current];
+                render_stats::add(render_stats::counter::bvh_nodes_visited);
+                if (n.bbox.hit(r, ray_t)) {
+                    if (n.is_leaf()) {
+                        if (objects[current]->hit(r, ray_t, rec)) {
+                            hit_anything = true;
+                            ray_t.max = rec.t;
+                        }
+                    } else {
+                        stack[stack_size++] = n.right;
+                        current = n.left;
+                        continue;
+                    }
+                }
+                if (stack_size == 0) { break; }
+                current = stack[--stack_size];
+            }
+            return hit_anything;
+        }
+
+        aabb bounding_box() const override { return root < 0 ? aabb::empty : nodes[root].bbox; }
+
+    private:
+        struct node {
+            aabb bbox = aabb::empty;
+            int32_t parent = -1;
+            // 内部ノードの子（葉では負）。空いたノードでは`right`が次の空きを指す
+            int32_t left = -1;
+            int32_t right = -1;
+            // 葉は0
+            int32_t height = 0;
+            // 部分木の葉の数
+            int32_t leaves = 1;
+            // 葉として使われるたびに増やす（古いハンドルを見分けるため）
+            uint32_t generation = 0;
+
+            bool is_leaf() const { return left < 0; }
+        };
+
+        std::vector<node> nodes;
+        // 葉の物体（ノードと同じ添字）
+        std::vector<shared_ptr<hittable>> objects;
+        int32_t root = -1;
+        int32_t free_list = -1;
+        size_t object_count = 0;
+
+        static bool same_box(const aabb& a, const aabb& b) {
+            return a.x.min == b.x.min and a.x.max == b.x.max
+                and a.y.min == b.y.min and a.y.max == b.y.max
+                and a.z.min == b.z.min and a.z.max == b.z.max;
+        }
+
+        int32_t allocate() {
+            int32_t index = free_list;
+            if (index >= 0) {
+                free_list = nodes[index].right;
+            } else {
+                index = int32_t(nodes.size());
+                nodes.emplace_back();
+                objects.emplace_back();
+            }
+            const uint32_t generation = nodes[index].generation + 1;
+            nodes[index] = node{};
+            nodes[index].generation = generation;
+            return index;
+        }
+
+        void release(int32_t index) {
+            objects[index].reset();
+            nodes[index].left = -1;
+            nodes[index].right = free_list;
+            nodes[index].parent = -1;
+            free_list = index;
+        }
+
+        template<class F>
+        void for_each_node(int32_t start, F&& f) const {
+            std::vector<int32_t> stack{start};
+            while (not stack.empty()) {
+                const int32_t i = stack.back();
+                stack.pop_back();
+                f(i);
+                if (not nodes[i].is_leaf()) {
+                    stack.push_back(nodes[i].right);
+                    stack.push_back(nodes[i].left);
+                }
+            }
+        }
+
+        /** 葉`leaf`を、兄弟にしたときのコストの増分が最小になりそうな位置に挟み込む */
+        void attach(int32_t leaf) {
+            if (root < 0) {
+                root = leaf;
+                nodes[leaf].parent = -1;
+                return;
+            }
+            const aabb box = nodes[leaf].bbox;
+            int32_t sibling = root;
+            while (not nodes[sibling].is_leaf()) {
+                const node& n = nodes[sibling];
+                const double area = n.bbox.surface_area();
+                const double combined = aabb(n.bbox, box).surface_area();
+                // ここに新しい親を作るコストと、下の階層へ持ち越すコストの増分
+                const double here = 2 * combined;
+                const double inherited = 2 * (combined - area);
+                auto descend_cost = [&](int32_t child) {
+                    const double enlarged = aabb(box, nodes[child].bbox).surface_area();
+                    return nodes[child].is_leaf() ? enlarged + inherited : enlarged - nodes[child].bbox.surface_area() + inherited;
+                };
+                const double left_cost = descend_cost(n.left);
+                const double right_cost = descend_cost(n.right);
+                if (here < left_cost and here < right_cost) { break; }
+                sibling = left_cost < right_cost ? n.left : n.right;
+            }
+
+            const int32_t old_parent = nodes[sibling].parent;
+            const int32_t parent = allocate();
+            nodes[parent].parent = old_parent;
+            nodes[parent].left = sibling;
+            nodes[parent].right = leaf;
+            nodes[sibling].parent = parent;
+            nodes[leaf].parent = parent;
+            replace_child(old_parent, sibling, parent);
+            refit_upwards(parent);
+        }
+
+        /** 葉`leaf`を木から外す（ノードは解放しない） */
+        void detach(int32_t leaf) {
+            if (leaf == root) {
+                root = -1;
+                return;
+            }
+            const int32_t parent = nodes[leaf].parent;
+            const int32_t grandparent = nodes[parent].parent;
+            const int32_t sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+            nodes[sibling].parent = grandparent;
+            replace_child(grandparent, parent, sibling);
+            release(parent);
+            nodes[leaf].parent = -1;
+            if (grandparent >= 0) { refit_upwards(grandparent); }
+        }
+
+        /** `parent`の子`from`を`to`に付け替える（`parent`が負なら根を付け替える） */
+        void replace_child(int32_t parent, int32_t from, int32_t to) {
+            if (parent < 0) {
+                root = to;
+            } else if (nodes[parent].left == from) {
+                nodes[parent].left = to;
+            } else {
+                nodes[parent].right = to;
+            }
+        }
+
+        void recompute(int32_t index) {
+            node& n = nodes[index];
+            const node& l = nodes[n.left];
+            const node& r = nodes[n.right];
+            n.bbox = aabb(l.bbox, r.bbox);
+            n.height = 1 + std::max(l.height, r.height);
+            n.leaves = l.leaves + r.leaves;
+        }
+
+        /** `index`から根までの箱を付け直して回転をかけ、偏りすぎた最も上の部分木を作り直す */
+        void refit_upwards(int32_t index) {
+            int32_t unbalanced = -1;
+            for (int32_t i = index; i >= 0; i = nodes[i].parent) {
+                recompute(i);
+                rotate(i);
+                if (nodes[i].height > height_limit(nodes[i].leaves)) { unbalanced = i; }
+            }
+            if (unbalanced >= 0) { rebuild(unbalanced); }
+        }
+
+        /**
+         * @brief `a`の子の一方を、もう一方の子の子（孫）と入れ替えて、孫の親の表面積が減るなら入れ替える。
+         * `a`の箱は変わらない。
+         */
+        void rotate(int32_t a) {
+            node& n = nodes[a];
+            if (n.height < 2) { return; }
+            const int32_t b = n.left;
+            const int32_t c = n.right;
+            double best = 0;
+            // 入れ替える子と孫
+            int32_t child = -1, grandchild = -1;
+            auto consider = [&](int32_t moved, int32_t parent_of_grandchild, int32_t swapped, int32_t kept) {
+                const double gain = aabb(nodes[moved].bbox, nodes[kept].bbox).surface_area()
+                                  - nodes[parent_of_grandchild].bbox.surface_area();
+                if (gain < best) {
+                    best = gain;
+                    child = moved;
+                    grandchild = swapped;
+                }
+            };
+            if (not nodes[c].is_leaf()) {
+                consider(b, c, nodes[c].left, nodes[c].right);
+                consider(b, c, nodes[c].right, nodes[c].left);
+            }
+            if (not nodes[b].is_leaf()) {
+                consider(c, b, nodes[b].left, nodes[b].right);
+                consider(c, b, nodes[b].right, nodes[b].left);
+            }
+            if (child < 0) { return; }
+
+            const int32_t middle = nodes[grandchild].parent;
+            replace_child(a, child, grandchild);
+            nodes[grandchild].parent = a;
+            replace_child(middle, grandchild, child);
+            nodes[child].parent = middle;
+            recompute(middle);
+            recompute(a);
+        }
+
+        /** 高さの上限。これを超えた部分木は作り直す */
+        static int32_t height_limit(int32_t leaves) { return 2 * int32_t(std::bit_width(uint32_t(leaves - 1))) + 2; }
+
+        /** 部分木`subtree`を、その葉だけから作り直す */
+        void rebuild(int32_t subtree) {
+            std::vector<int32_t> leaves;
+            std::vector<int32_t> internal;
+            for_each_node(subtree, [&](int32_t i) { (nodes[i].is_leaf() ? leaves : internal).push_back(i); });
+            const int32_t parent = nodes[subtree].parent;
+            for (int32_t i : internal) { release(i); }
+
+            const int32_t top = build(leaves);
+            nodes[top].parent = parent;
+            replace_child(parent, subtree, top);
+            for (int32_t i = parent; i >= 0; i = nodes[i].parent) { recompute(i); }
+            rebuilt_subtrees++;
+            rebuilt_leaves += int64_t(leaves.size());
+        }
+
+        /**
+         * 葉`leaves`の木をSAHのビン分割で作り、その根を返す。
+         * 高さが`height_limit`を超える（偏った配置でSAHが深い木を選ぶ）ときは、個数で二等分した釣り合った木にする。
+         */
+        int32_t build(const std::vector<int32_t>& leaves) {
+            std::vector<aabb> bounds;
+            bounds.reserve(leaves.size());
+            for (int32_t leaf : leaves) { bounds.push_back(nodes[leaf].bbox); }
+            bvh_layout layout = binned_bvh_builder(bounds, 1).build();
+            if (layout_height(layout) > height_limit(int32_t(leaves.size()))) { layout = median_bvh_builder(bounds, 1).build(); }
+            return link(layout, 0, leaves);
+        }
+
+        /** `link`でつないだときの高さ */
+        static int32_t layout_height(const bvh_layout& layout) {
+            std::vector<int32_t> depth(layout.nodes.size(), 0);
+            int32_t height = 0;
+            for (size_t i = 0; i < layout.nodes.size(); i++) {
+                const flat_bvh_node& n = layout.nodes[i];
+                if (n.is_leaf()) {
+                    height = std::max(height, depth[i] + int32_t(std::bit_width(uint32_t(n.count - 1))));
+                } else {
+                    depth[i + 1] = depth[n.offset] = depth[i] + 1;
+                }
+            }
+            return height;
+        }
+
+        /** 構築した`layout`のノード`index`以下を、葉`leaves`をつないだ木にして、その根を返す */
+        int32_t link(const bvh_layout& layout, int32_t index, const std::vector<int32_t>& leaves) {
+            const flat_bvh_node& n = layout.nodes[index];
+            if (n.is_leaf()) { return link_range(layout.primitive_indices, n.offset, n.offset + n.count, leaves); }
+            return join(link(layout, index + 1, leaves), link(layout, n.offset, leaves));
+        }
+
+        /** 葉が複数の物体を持つときは、その物体を2つずつ組にしてつなぐ */
+        int32_t link_range(const std::vector<int32_t>& indices, int32_t begin, int32_t end, const std::vector<int32_t>& leaves) {
+            if (end - begin == 1) { return leaves[indices[begin]]; }
+            const int32_t mid = begin + (end - begin) / 2;
+            return join(link_range(indices, begin, mid, leaves), link_range(indices, mid, end, leaves));
+        }
+
+        int32_t join(int32_t left, int32_t right) {
+            const int32_t parent = allocate();
+            nodes[parent].left = left;
+            nodes[parent].right = right;
+            nodes[left].parent = parent;
+            nodes[right].parent = parent;
+            recompute(parent);
+            return parent;
+        }
+};
+
+#endif
@@ -0,0 +1,256 @@
+#ifndef FLAT_BVH_H
+#define FLAT_BVH_H
+
+#include "rtweekend.hpp"
+
+#include "aabb.hpp"
+#include "hittable.hpp"
+#include "render_stats.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+/**
+ * 深さ優先順に並べたBVHのノード。
+ * 内部ノードの左の子は直後のノードで、右の子の位置を`offset`に持つ。
+ */
+struct flat_bvh_node {
+    aabb bbox;
+    // 葉: 最初のプリミティブの位置 / 内部ノード: 右の子の位置
+    int32_t offset = 0;
+    // 葉: プリミティブ数 / 内部ノード: 0
+    int32_t count = 0;
+    // 内部ノード: 分割軸。走査時に近い子から辿るために用いる。
+    int32_t axis = 0;
+    int32_t padding = 0;
+
+    bool is_leaf() const { return count > 0; }
+};
+
+static_assert(std::is_trivially_copyable_v<flat_bvh_node>);
+
+/**
+ * BVHの構造。`primitive_indices`は構築に与えたプリミティブの並びに対する添字で、
+ * 葉は`primitive_indices[offset, offset + count)`のプリミティブを持つ。
+ */
+struct bvh_layout {
+    std::vector<flat_bvh_node> nodes;
+    std::vector<int32_t> primitive_indices;
+};
+
+/**
+ * 走査スタックの深さの上限。ビルダはこれを超える深さの木を作らない。
+ * LBVHの木の深さは（Mortonコードのビット数）+（添字のビット数）で抑えられる。
+ */
+constexpr int32_t bvh_max_depth = 128;
+
+/**
+ * @brief `bvh_node`と同じ分割（最長軸上のバウンディングボックスの最小値による中央値分割）でBVHを構築する。
+ * 各レベルでソートする代わりに`std::nth_element`で分割する。
+ */
+class median_bvh_builder {
+    public:
+        median_bvh_builder(std::span<const aabb> bounds, int32_t max_leaf_size = 2) :
+            bounds(bounds), max_leaf_size(max_leaf_size) {}
+
+        bvh_layout build() {
+            bvh_layout layout;
+            layout.primitive_indices.resize(bounds.size());
+            std::iota(layout.primitive_indices.begin(), layout.primitive_indices.end(), 0);
+            if (not bounds.empty()) {
+                layout.nodes.reserve(2 * bounds.size());
+                build_recursive(layout, 0, int32_t(bounds.size()));
+            }
+            return layout;
+        }
+
+    private:
+        std::span<const aabb> bounds;
+        int32_t max_leaf_size;
+
+        int32_t build_recursive(bvh_layout& layout, int32_t start, int32_t end) {
+            auto& indices = layout.primitive_indices;
+            int32_t node_index = int32_t(layout.nodes.size());
+            layout.nodes.emplace_back();
+
+            aabb bbox = aabb::empty;
+            for (int32_t i = start; i < end; i++) { bbox = aabb(bbox, bounds[indices[i]]); }
+
+            if (end - start <= max_leaf_size) {
+                layout.nodes[node_index].bbox = bbox;
+                layout.nodes[node_index].offset = start;
+                layout.nodes[node_index].count = end - start;
+                return node_index;
+            }
+
+            int32_t axis = bbox.longest_axis();
+            int32_t mid = start + (end - start) / 2;
+            std::nth_element(
+                indices.begin() + start,
+                indices.begin() + mid,
+                indices.begin() + end,
+                [&](int32_t a, int32_t b) {
+                    return bounds[a].axis_interval(axis).min < bounds[b].axis_interval(axis).min;
+                }
+            );
+            build_recursive(layout, start, mid);
+            int32_t right = build_recursive(layout, mid, end);
+
+            flat_bvh_node& node = layout.nodes[node_index];
+            node.bbox = bbox;
+            node.offset = right;
+            node.count = 0;
+            node.axis = axis;
+            return node_index;
+        }
+};
+
+/**
+ * @brief 連続した配列に並べたBVH。
+ * ノード配列は自前で持つことも、キャッシュファイルのメモリマップのような外部の領域を参照することもできる。
+ */
+class flat_bvh : public hittable {
+    public:
+        flat_bvh(
+            std::vector<shared_ptr<hittable>> objects,
+            bvh_layout layout
+        ) {
+            auto owned = make_shared<bvh_layout>(std::move(layout));
+            set(objects, owned->nodes, owned->primitive_indices);
+            storage = owned;
+        }
+
+        /** `storage`は`nodes`と`primitive_indices`が指す領域の寿命を保つためのもの */
+        flat_bvh(
+            std::vector<shared_ptr<hittable>> objects,
+            shared_ptr<const void> storage,
+            std::span<const flat_bvh_node> nodes,
+            std::span<const int32_t> primitive_indices
+        ) : storage(storage) {
+            set(objects, nodes, primitive_indices);
+        }
+
+        bool hit(
+            const ray& r,
+            interval ray_t,
+            hit_record& rec
+        ) const override {
+            int64_t visited = 0;
+            return traverse<false>(r, ray_t, rec, visited);
+        }
+
+        /** `hit`と同じだが、箱との交差判定を行ったノード数を`visited`に加える */
+        bool hit_counted(
+            const ray& r,
+            interval ray_t,
+            hit_record& rec,
+            int64_t& visited
+        ) const {
+            return traverse<true>(r, ray_t, rec, visited);
+        }
+
+        aabb bounding_box() const override { return bbox; }
+        aabb bounding_box_at(double time) const override {
+            aabb box = aabb::empty;
+            for (const auto& primitive : primitives) { box = aabb(box, primitive->bounding_box_at(time)); }
+            return box;
+        }
+
+        std::span<const flat_bvh_node> node_array() const { return nodes; }
+        const std::vector<shared_ptr<hittable>>& primitive_array() const { return primitives; }
+
+        /** 葉`node`のプリミティブを調べ、当たるたびに`ray_t.max`を縮める */
+        bool hit_leaf(const flat_bvh_node& node, const ray& r, interval& ray_t, hit_record& rec) const {
+            bool hit_anything = false;
+            for (int32_t i = node.offset; i < node.offset + node.count; i++) {
+                if (primitives[i]->hit(r, ray_t, rec)) {
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+            }
+            return hit_anything;
+        }
+
+    private:
+        shared_ptr<const void> storage;
+        std::span<const flat_bvh_node> nodes;
+        // 葉の並び順に並べ替えたプリミティブ
+        std::vector<shared_ptr<hittable>> primitives;
+        aabb bbox;
+
+        template<bool count_visits>
+        bool traverse(
+            const ray& r,
+            interval ray_t,
+            hit_record& rec,
+            int64_t& visited
+        ) const {
+            if (nodes.empty()) { return false; }
+            int32_t stack[bvh_max_depth];
+            int32_t stack_size = 0;
+            int32_t current = 0;
+            bool hit_anything = false;
+
+            while (true) {
+                const flat_bvh_node& node = nodes[current];
+                if constexpr (count_visits) { visited++; }
+                render_stats::add(render_stats::counter::bvh_nodes_visited);
+                if (node.bbox.hit(r, ray_t)) {
+                    if (node.is_leaf()) {
+                        if (hit_leaf(node, r, ray_t, rec)) { hit_anything = true; }
+                    } else {
+                        // レイの向きから見て手前側の子を先に調べる
+                        if (r.direction()[node.axis] < 0) {
+                            stack[stack_size++] = current + 1;
+                            current = node.offset;
+                        } else {
+                            stack[stack_size++] = node.offset;
+                            current = current + 1;
+                        }
+                        continue;
+                    }
+                }
+                if (stack_size == 0) { break; }
+                current = stack[--stack_size];
+            }
+            return hit_anything;
+        }
+
+        void set(
+            const std::vector<shared_ptr<hittable>>& objects,
+            std::span<const flat_bvh_node> node_span,
+            std::span<const int32_t> primitive_indices
+        ) {
+            nodes = node_span;
+            primitives.reserve(primitive_indices.size());
+            for (int32_t index : primitive_indices) { primitives.push_back(objects[index]); }
+            bbox = nodes.empty() ? aabb::empty : nodes[0].bbox;
+        }
+};
+
+/**
+ * @brief 表面積ヒューリスティック（SAH）による木のコスト。ノードの走査と交差判定のコストを1とし、根の表面積で正規化する。
+ */
+inline double bvh_sah_cost(std::span<const flat_bvh_node> nodes) {
+    if (nodes.empty()) { return 0; }
+    double root_area = nodes[0].bbox.surface_area();
+    if (root_area <= 0) { return 0; }
+    double cost = 0;
+    for (const flat_bvh_node& node : nodes) {
+        cost += node.bbox.surface_area() * (node.is_leaf() ? node.count : 1);
+    }
+    return cost / root_area;
+}
+
+/** プリミティブのバウンディングボックスを並べる */
+inline std::vector<aabb> primitive_bounds(const std::vector<shared_ptr<hittable>>& objects) {
+    std::vector<aabb> bounds;
+    bounds.reserve(objects.size());
+    for (const auto& object : objects) { bounds.push_back(object->bounding_box()); }
+    return bounds;
+}
+
+#endif
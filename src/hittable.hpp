@@ -36,6 +36,12 @@ class hittable {
             hit_record& rec
         ) const = 0;
         virtual aabb bounding_box() const = 0;
+        /**
+         * @brief 時刻`time`における形状だけを覆うバウンディングボックス。
+         * `bounding_box()`は動きの全体を覆うが、こちらはモーションBVHが時刻0と1の箱を線形補間するために用いる。
+         * 線形に動く物体では、時刻tの箱は時刻0と1の箱の線形補間に含まれる必要がある。
+         */
+        virtual aabb bounding_box_at([[maybe_unused]] double time) const { return bounding_box(); }
 };
 
 class translate : public hittable {
@@ -43,14 +49,27 @@ class translate : public hittable {
         translate(
             shared_ptr<hittable> object,
             const vec3& offset
-        ) : object(object), offset(offset) {
-            bbox = object->bounding_box() + offset;
+        ) : translate(object, offset, offset) {}
+
+        /** 時刻0で`offset1`、時刻1で`offset2`だけ平行移動し、その間を線形に動く */
+        translate(
+            shared_ptr<hittable> object,
+            const vec3& offset1,
+            const vec3& offset2
+        ) :
+            object(object),
+            offset1(offset1),
+            offset_vec(offset2 - offset1),
+            is_moving(offset_vec.length_squared() > 0)
+        {
+            bbox = aabb(object->bounding_box() + offset1, object->bounding_box() + offset2);
         }
         bool hit(
             const ray& r,
             interval ray_t,
             hit_record& rec
         ) const override {
+            const vec3 offset = is_moving ? offset_at(r.time()) : offset1;
             ray offset_r{
                 r.origin() - offset,
                 r.direction(),
@@ -61,9 +80,17 @@ class translate : public hittable {
             return true;
         }
         aabb bounding_box() const override { return bbox; }
+        aabb bounding_box_at(double time) const override {
+            return object->bounding_box_at(time) + offset_at(time);
+        }
+
+        vec3 offset_at(double time) const { return offset1 + time * offset_vec; }
+        const shared_ptr<hittable>& child() const { return object; }
     private:
         shared_ptr<hittable> object;
-        vec3 offset;
+        vec3 offset1;
+        vec3 offset_vec;
+        bool is_moving;
         aabb bbox;
 };
 
@@ -76,28 +103,7 @@ class rotate_y : public hittable {
             double radians = degrees_to_radians(angle);
             sin_theta = std::sin(radians);
             cos_theta = std::cos(radians);
-            bbox = object->bounding_box();
-            
-            point3 min{infinity, infinity, infinity};
-            point3 max{-infinity, -infinity, -infinity};
-
-            for (int32_t i = 0; i < 2; i++) {
-                for (int32_t j = 0; j < 2; j++) {
-                    for (int32_t k = 0; k < 2; k++) {
-                        double x = (i == 0) ? bbox.x.max : bbox.x.min;
-                        double y = (j == 0) ? bbox.y.max : bbox.y.min;
-                        double z = (k == 0) ? bbox.z.max : bbox.z.min;
-                        vec3 vertex = rotate_vector_positive({x, y, z});
-
-                        for (int32_t l = 0; l < 3; l++) {
-                            min[l] = std::min(min[l], vertex[l]);
-                            max[l] = std::max(min[l], vertex[l]);
-                        }
-                    }
-                }
-            }
-            
-
+            bbox = rotate_box(object->bounding_box());
         }
         bool hit(
             const ray& r,
@@ -115,12 +121,38 @@ class rotate_y : public hittable {
             return true;
         }
         aabb bounding_box() const override { return bbox; }
-        
+        aabb bounding_box_at(double time) const override {
+            return rotate_box(object->bounding_box_at(time));
+        }
+        const shared_ptr<hittable>& child() const { return object; }
+
     private:
         shared_ptr<hittable> object;
         aabb bbox;
         double cos_theta;
         double sin_theta;
+        // 回転させた`box`の8頂点を覆うAABB
+        aabb rotate_box(const aabb& box) const {
+            point3 min{infinity, infinity, infinity};
+            point3 max{-infinity, -infinity, -infinity};
+
+            for (int32_t i = 0; i < 2; i++) {
+                for (int32_t j = 0; j < 2; j++) {
+                    for (int32_t k = 0; k < 2; k++) {
+                        double x = (i == 0) ? box.x.max : box.x.min;
+                        double y = (j == 0) ? box.y.max : box.y.min;
+                        double z = (k == 0) ? box.z.max : box.z.min;
+                        vec3 vertex = rotate_vector_positive({x, y, z});
+
+                        for (int32_t l = 0; l < 3; l++) {
+                            min[l] = std::min(min[l], vertex[l]);
+                            max[l] = std::max(max[l], vertex[l]);
+                        }
+                    }
+                }
+            }
+            return aabb(min, max);
+        }
         // θ負の方向にベクトルを回転させる（x,y,zが右手座標系をとっている）
         vec3 rotate_vector_negative(const vec3& p) const {
             vec3 result = p;
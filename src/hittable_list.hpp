@@ -43,6 +43,11 @@ class hittable_list: public hittable {
         }
 
         aabb bounding_box() const override { return bbox; }
+        aabb bounding_box_at(double time) const override {
+            aabb box = aabb::empty;
+            for (const auto& object : objects) { box = aabb(box, object->bounding_box_at(time)); }
+            return box;
+        }
     
     private:
         aabb bbox;
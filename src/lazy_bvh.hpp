@@ -0,0 +1,273 @@
+#ifndef LAZY_BVH_H
+#define LAZY_BVH_H
+
+#include "rtweekend.hpp"
+
+#include "aabb.hpp"
+#include "flat_bvh.hpp"
+#include "hittable.hpp"
+#include "memory_tracker.hpp"
+#include "parallel.hpp"
+#include "render_stats.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <vector>
+
+/**
+ * @brief レイが初めて入ったノードをその場で分割するBVH。
+ *
+ * 構築時には`eager_threshold`個を超えるプリミティブを持つ上の方のノードだけを分割し、
+ * 残りのノードはプリミティブの範囲と箱だけを持ったまま描画を始める。
+ * 走査中に未分割のノードの箱にレイが当たると、`binned_bvh_builder`と同じビン分割SAHでそのノードを1段だけ分割する
+ * （葉にするか、子を2つ作る）。遮られて見えない部分や画面外の部分は分割されないので、最初の画素までの時間と全体の構築量が減る。
+ *
+ * 分割はノードごとの`std::once_flag`で1度だけ行い、結果は状態の`release`書き込みで公開する。
+ * 他のスレッドは分割済みのノードを`acquire`読み込み1回で辿り、分割中のノードに入ったスレッドだけがその完了を待つ。
+ * 分割はノードのプリミティブの範囲だけを並べ替え、範囲は子の間で重ならないので、別々のノードの分割は同時に進められる。
+ */
+class lazy_bvh : public hittable {
+    public:
+        /** 構築時に分割するノードのプリミティブ数の下限の既定値。描画中にこれより大きなノードの分割を待つことはない */
+        static constexpr int32_t default_eager_threshold = 1 << 15;
+
+        lazy_bvh(std::vector<shared_ptr<hittable>> objects, int32_t eager_threshold = default_eager_threshold) :
+            objects(std::move(objects))
+        {
+            const auto n = int32_t(this->objects.size());
+            bounds = primitive_bounds(this->objects);
+            centroids.resize(n);
+            indices.resize(n);
+            parallel_for(0, n, 1 << 14, [&](int64_t i) {
+                centroids[i] = bounds[i].centroid();
+                indices[i] = int32_t(i);
+            });
+            root = std::make_unique<node>();
+            root->count = n;
+            for (const aabb& box : bounds) { root->bbox = aabb(root->bbox, box); }
+            bbox = root->bbox;
+
+            // 大きなノードを段ごとにまとめて分割する
+            std::vector<node*> level{root.get()};
+            while (not level.empty()) {
+                parallel_for(0, int64_t(level.size()), 1, [&](int64_t k) { ready(*level[k]); });
+                std::vector<node*> next;
+                for (node* parent : level) {
+                    if (parent->state.load(std::memory_order_relaxed) != node_state::inner) { continue; }
+                    for (int32_t c = 0; c < 2; c++) {
+                        if (parent->children[c].count > eager_threshold) { next.push_back(&parent->children[c]); }
+                    }
+                }
+                level = std::move(next);
+            }
+        }
+
+        bool hit(
+            const ray& r,
+            interval ray_t,
+            hit_record& rec
+        ) const override {
+            if (objects.empty()) { return false; }
+            node* stack[bvh_max_depth];
+            int32_t stack_size = 0;
+            node* current = root.get();
+            bool hit_anything = false;
+
+            while (true) {
+                render_stats::add(render_stats::counter::bvh_nodes_visited);
+                if (current->bbox.hit(r, ray_t)) {
+                    if (ready(*current) == node_state::leaf) {
+                        for (int32_t k = current->first; k < current->first + current->count; k++) {
+                            if (objects[indices[k]]->hit(r, ray_t, rec)) {
+                                hit_anything = true;
+                                ray_t.max = rec.t;
+                            }
+                        }
+                    } else {
+                        // レイの向きから見て手前側の子を先に調べる
+                        node* children = current->children.get();
+                        const bool reversed = r.direction()[current->axis] < 0;
+                        stack[stack_size++] = &children[reversed ? 0 : 1];
+                        current = &children[reversed ? 1 : 0];
+                        continue;
+                    }
+                }
+                if (stack_size == 0) { break; }
+                current = stack[--stack_size];
+            }
+            return hit_anything;
+        }
+
+        aabb bounding_box() const override { return bbox; }
+        aabb bounding_box_at(double time) const override {
+            aabb box = aabb::empty;
+            for (const auto& object : objects) { box = aabb(box, object->bounding_box_at(time)); }
+            return box;
+        }
+
+        /** これまでに分割した（葉と決めたものを含む）ノードの数 */
+        int64_t expanded_nodes() const { return expanded.load(std::memory_order_relaxed); }
+        /** これまでに葉と決まったノードが持つプリミティブの数 */
+        int64_t leaf_primitives() const { return reached.load(std::memory_order_relaxed); }
+        int64_t size() const { return int64_t(objects.size()); }
+
+    private:
+        static constexpr int32_t max_leaf_size = 4;
+        static constexpr int32_t bin_count = 16;
+        // この深さを超えたら中央値分割に切り替えて、木の深さを抑える
+        static constexpr int32_t median_split_depth = 64;
+
+        enum class node_state : uint8_t { unexpanded, leaf, inner };
+
+        struct node {
+            aabb bbox = aabb::empty;
+            // indices[first, first + count)
+            int32_t first = 0;
+            int32_t count = 0;
+            int32_t depth = 1;
+            int32_t axis = 0;
+            std::atomic<node_state> state{node_state::unexpanded};
+            std::once_flag once;
+            // 内部ノードの2つの子（`state`が`inner`になってから読む）
+            std::unique_ptr<node[]> children;
+        };
+
+        struct bin {
+            aabb bbox = aabb::empty;
+            int32_t count = 0;
+
+            void add(const aabb& box) {
+                bbox = aabb(bbox, box);
+                count++;
+            }
+            void merge(const bin& other) {
+                bbox = aabb(bbox, other.bbox);
+                count += other.count;
+            }
+        };
+
+        std::vector<shared_ptr<hittable>> objects;
+        std::vector<aabb> bounds;
+        std::vector<point3> centroids;
+        // 分割のたびにノードの範囲の中だけを並べ替える
+        mutable std::vector<int32_t> indices;
+        std::unique_ptr<node> root;
+        aabb bbox;
+        mutable std::atomic<int64_t> expanded{0};
+        mutable std::atomic<int64_t> reached{0};
+
+        /** ノードを分割済みにして、その状態を返す */
+        node_state ready(node& n) const {
+            const node_state state = n.state.load(std::memory_order_acquire);
+            if (state != node_state::unexpanded) { return state; }
+            std::call_once(n.once, [&] { expand(n); });
+            return n.state.load(std::memory_order_acquire);
+        }
+
+        void make_leaf(node& n) const {
+            reached.fetch_add(n.count, std::memory_order_relaxed);
+            n.state.store(node_state::leaf, std::memory_order_release);
+        }
+
+        /** `binned_bvh_builder::build_recursive`の1段分。子の箱はビンの集計から求める */
+        void expand(node& n) const {
+            memory_tracker::scope memory(memory_tracker::tag::acceleration);
+            expanded.fetch_add(1, std::memory_order_relaxed);
+            const int32_t start = n.first;
+            const int32_t end = n.first + n.count;
+            int32_t* const ids = indices.data();
+            if (n.count <= 1) {
+                make_leaf(n);
+                return;
+            }
+
+            aabb centroid_bounds = aabb::empty;
+            for (int32_t k = start; k < end; k++) {
+                const point3& c = centroids[ids[k]];
+                centroid_bounds.x = interval(centroid_bounds.x, interval(c.x(), c.x()));
+                centroid_bounds.y = interval(centroid_bounds.y, interval(c.y(), c.y()));
+                centroid_bounds.z = interval(centroid_bounds.z, interval(c.z(), c.z()));
+            }
+            const int32_t axis = centroid_bounds.longest_axis();
+            const interval& extent = centroid_bounds.axis_interval(axis);
+            int32_t mid = -1;
+            bin left_side, right_side;
+
+            if (n.depth < median_split_depth and extent.size() > 0) {
+                const int32_t bins_used = std::min(bin_count, n.count);
+                const double scale = bins_used / extent.size();
+                auto bin_of = [&](int32_t index) {
+                    return std::clamp(int32_t((centroids[index][axis] - extent.min) * scale), 0, bins_used - 1);
+                };
+                std::array<bin, bin_count> bins;
+                for (int32_t k = start; k < end; k++) { bins[bin_of(ids[k])].add(bounds[ids[k]]); }
+
+                std::array<double, bin_count> right_cost;
+                bin accumulated;
+                for (int32_t i = bins_used - 1; i > 0; i--) {
+                    accumulated.merge(bins[i]);
+                    right_cost[i] = accumulated.bbox.surface_area() * accumulated.count;
+                }
+                int32_t best_split = -1;
+                double best_cost = infinity;
+                accumulated = bin{};
+                for (int32_t i = 1; i < bins_used; i++) {
+                    accumulated.merge(bins[i - 1]);
+                    if (accumulated.count == 0 or accumulated.count == n.count) { continue; }
+                    double cost = accumulated.bbox.surface_area() * accumulated.count + right_cost[i];
+                    if (cost < best_cost) {
+                        best_cost = cost;
+                        best_split = i;
+                    }
+                }
+
+                if (best_split > 0) {
+                    const double leaf_cost = n.count;
+                    const double split_cost = 1 + best_cost / n.bbox.surface_area();
+                    if (n.count <= max_leaf_size and leaf_cost <= split_cost) {
+                        make_leaf(n);
+                        return;
+                    }
+                    for (int32_t i = 0; i < bins_used; i++) {
+                        (i < best_split ? left_side : right_side).merge(bins[i]);
+                    }
+                    int32_t* middle = std::partition(ids + start, ids + end, [&](int32_t index) {
+                        return bin_of(index) < best_split;
+                    });
+                    mid = int32_t(middle - ids);
+                }
+            }
+
+            if (mid < 0) {
+                // 重心が一致しているか深すぎる場合は個数で二等分する
+                if (n.count <= max_leaf_size) {
+                    make_leaf(n);
+                    return;
+                }
+                mid = start + n.count / 2;
+                std::nth_element(ids + start, ids + mid, ids + end, [&](int32_t a, int32_t b) {
+                    return centroids[a][axis] < centroids[b][axis];
+                });
+                for (int32_t k = start; k < mid; k++) { left_side.add(bounds[ids[k]]); }
+                for (int32_t k = mid; k < end; k++) { right_side.add(bounds[ids[k]]); }
+            }
+
+            auto children = std::make_unique<node[]>(2);
+            children[0].bbox = left_side.bbox;
+            children[0].first = start;
+            children[0].count = mid - start;
+            children[1].bbox = right_side.bbox;
+            children[1].first = mid;
+            children[1].count = end - mid;
+            children[0].depth = children[1].depth = n.depth + 1;
+            n.axis = axis;
+            n.children = std::move(children);
+            n.state.store(node_state::inner, std::memory_order_release);
+        }
+};
+
+#endif
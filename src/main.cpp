@@ -1,28 +1,366 @@
+// このプログラムの全ての確保を用途ごとに集計する（--memory で表示）
+#define RT_MEMORY_TRACKER_IMPLEMENTATION
+#include "memory_tracker.hpp"
+
 #include "rtweekend.hpp"
 
-#include "bvh.hpp"
+#include "animation.hpp"
+#include "batch_render.hpp"
+#include "bvh_analysis.hpp"
 #include "camera.hpp"
-#include "hittable.hpp"
 #include "hittable_list.hpp"
-#include "sphere.hpp"
-#include "quad.hpp"
-#include "material.hpp"
+#include "perf_counters.hpp"
+#include "render_stats.hpp"
+#include "scene_file.hpp"
+#include "scene_compiler.hpp"
+#include "scene_loader.hpp"
+#include "tracer.hpp"
 
 #include "world_setups.hpp"
 
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <optional>
+#include <string>
+
+namespace {
+    void print_usage() {
+        std::cerr
+            << "usage: main <scene-file> [options] > image.ppm\n"
+            << "       main --export <builtin-scene|all> <output-path|output-dir>\n"
+            << "       main --convert <input-scene> <output-scene>\n"
+            << "\n"
+            << "options:\n"
+            << "  --width <pixels>     override camera image_width\n"
+            << "  --spp <samples>      override camera samples_per_pixel\n"
+            << "  --depth <bounces>    override camera max_depth\n"
+            << "  --bvh-cache <dir>    reuse BVHs built by previous runs from <dir>\n"
+            << "  --bvh-builder <name> recursive (default), median, binned, lbvh30, lbvh63 or sbvh\n"
+            << "  --sbvh-budget <f>    let sbvh spatial splits add up to f x primitive count references (default 0.3)\n"
+            << "  --flatten            bake transforms into primitives and build one BVH over the whole scene\n"
+            << "  --keep-huge-in-bvh   keep primitives that dwarf the rest (e.g. ground spheres) inside the BVH\n"
+            << "  --motion-bvh         interpolate BVH node bounds over time for moving objects\n"
+            << "  --typed-bvh          store BVH primitives in per-type arrays and test each leaf type by type\n"
+            << "                       (built without the BVH cache)\n"
+            << "  --compressed-bvh     store BVH child bounds quantized to 8 bits (32-byte nodes, no BVH cache)\n"
+            << "  --lazy-bvh           build only the top BVH levels up front and split the other nodes the first\n"
+            << "                       time a ray enters them (binned SAH splits; ignores --bvh-builder)\n"
+            << "  --threads <n>        render with n threads (default: hardware threads)\n"
+            << "  --wavefront          trace batches of paths stage by stage, shading grouped by material type\n"
+            << "  --sort-rays          with --wavefront, reorder scattered rays by direction octant and origin\n"
+            << "  --packets <4|8>      trace camera rays as 4x4 or 8x8 pixel packets through the BVH\n"
+            << "  --trace <file>       write a Chrome trace-event timeline (open in Perfetto)\n"
+            << "  --perf               report hardware counters (IPC, cache misses per ray) per phase\n"
+            << "  --analyze-bvh        print BVH statistics (SAH cost, depth, leaf sizes, overlap) and exit\n"
+            << "  --heatmap <kind>     draw BVH nodes visited (nodes) or primitive tests (tests) per sample\n"
+            << "                       as false color; needs a build with -DRT_ENABLE_STATS=ON\n"
+            << "  --memory             report memory use per subsystem after scene setup and after rendering\n"
+            << "  --frames <n>         render n frames as consecutive PPM images, refitting one BVH over the scene\n"
+            << "  --orbit <degrees>    with --frames, turn the camera around lookat by this much over all frames\n"
+            << "  --spin <degrees>     with --frames, turn each top-level object around its own center likewise\n"
+            << "  --rebuild-threshold <r>\n"
+            << "                       with --frames, rebuild BVH subtrees whose SAH cost grew past r x (default 1.25)\n"
+            << "  --views <file>       build the scene once and render every view in <file> on one set of threads,\n"
+            << "                       each to its own PPM (lines: 'view <output>' then 'camera <key> <value...>')\n"
+            << "\n"
+            << "Scene files ending in .rtsb are written in the binary format; others as text.\n"
+            << "builtin scenes:";
+        for (const auto& [name, setup] : builtin_scenes()) { std::cerr << ' ' << name; }
+        std::cerr << '\n';
+    }
+
+    int export_scenes(const std::string& name, const std::string& output) {
+        if (name == "all") {
+            for (const auto& [builtin_name, setup] : builtin_scenes()) {
+                if (not scene_file::write(output + "/" + builtin_name + ".rtscene", setup().view())) { return 1; }
+            }
+            return 0;
+        }
+        for (const auto& [builtin_name, setup] : builtin_scenes()) {
+            if (builtin_name == name) { return scene_file::write(output, setup().view()) ? 0 : 1; }
+        }
+        std::cerr << "ERROR: Unknown builtin scene '" << name << "'.\n";
+        return 1;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc >= 4 and std::strcmp(argv[1], "--export") == 0) {
+        return export_scenes(argv[2], argv[3]);
+    }
+    if (argc >= 4 and std::strcmp(argv[1], "--convert") == 0) {
+        scene_file::loaded_scene scene;
+        if (not scene.open(argv[2])) { return 1; }
+        return scene_file::write(argv[3], scene.view()) ? 0 : 1;
+    }
+    if (argc < 2 or argv[1][0] == '-') {
+        print_usage();
+        return 1;
+    }
 
-int main() {
-    switch (9) {
-        case 1: bouncing_spheres(); break;
-        case 2: checkered_spheres(); break;
-        case 3: earth(); break;
-        case 4: perlin_spheres(); break;
-        case 5: quads(); break;
-        case 6: simple_light(); break;
-        case 7: cornell_box(); break;
-        case 8: cornell_smoke(); break;
-        case 9: final_scene(600, 5000, 30); break;
-        default: final_scene(300, 100, 20); break;
-    }
-}
\ No newline at end of file
+    const std::string scene_path = argv[1];
+    std::optional<int32_t> image_width, samples_per_pixel, max_depth, thread_count;
+    std::optional<std::string> trace_path;
+    std::optional<std::string> views_path;
+    bool use_perf = false;
+    bool show_memory = false;
+    bool analyze = false;
+    bool flatten = false;
+    bool wavefront = false;
+    bool sort_rays = false;
+    int32_t packet_size = 0;
+    heatmap_kind heatmap = heatmap_kind::none;
+    std::optional<bvh_cache> cache;
+    bvh_options bvh;
+    animation_options animation;
+    bool animate = false;
+    bool animation_option_given = false;
+
+    for (int32_t i = 2; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--motion-bvh") {
+            bvh.motion = true;
+            continue;
+        }
+        if (option == "--typed-bvh") {
+            bvh.typed = true;
+            continue;
+        }
+        if (option == "--compressed-bvh") {
+            bvh.compressed = true;
+            continue;
+        }
+        if (option == "--lazy-bvh") {
+            bvh.lazy = true;
+            continue;
+        }
+        if (option == "--wavefront") {
+            wavefront = true;
+            continue;
+        }
+        if (option == "--sort-rays") {
+            sort_rays = true;
+            continue;
+        }
+        if (option == "--flatten") {
+            flatten = true;
+            continue;
+        }
+        if (option == "--keep-huge-in-bvh") {
+            bvh.separate_huge = false;
+            continue;
+        }
+        if (option == "--perf") {
+            use_perf = true;
+            continue;
+        }
+        if (option == "--memory") {
+            show_memory = true;
+            continue;
+        }
+        if (option == "--analyze-bvh") {
+            analyze = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            print_usage();
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (option == "--width")          { image_width = std::atoi(value.c_str()); }
+        else if (option == "--spp")       { samples_per_pixel = std::atoi(value.c_str()); }
+        else if (option == "--depth")     { max_depth = std::atoi(value.c_str()); }
+        else if (option == "--threads")   { thread_count = std::atoi(value.c_str()); }
+        else if (option == "--trace")     { trace_path = value; }
+        else if (option == "--views")     { views_path = value; }
+        else if (option == "--packets") {
+            packet_size = std::atoi(value.c_str());
+            if (packet_size != 4 and packet_size != 8) {
+                std::cerr << "ERROR: Packet size must be 4 or 8 (got '" << value << "').\n";
+                return 1;
+            }
+        }
+        else if (option == "--heatmap") {
+            if (value == "nodes")      { heatmap = heatmap_kind::bvh_nodes; }
+            else if (value == "tests") { heatmap = heatmap_kind::primitive_tests; }
+            else {
+                std::cerr << "ERROR: Unknown heatmap kind '" << value << "' (expected nodes or tests).\n";
+                return 1;
+            }
+            if (not render_stats::enabled) {
+                std::cerr << "ERROR: --heatmap needs a build with -DRT_ENABLE_STATS=ON.\n";
+                return 1;
+            }
+        }
+        else if (option == "--frames") {
+            animation.frames = std::atoi(value.c_str());
+            animate = true;
+            if (animation.frames <= 0) {
+                std::cerr << "ERROR: Frame count must be positive (got '" << value << "').\n";
+                return 1;
+            }
+        }
+        else if (option == "--orbit" or option == "--spin" or option == "--rebuild-threshold") {
+            const double number = std::atof(value.c_str());
+            if (option == "--orbit")     { animation.orbit = number; }
+            else if (option == "--spin") { animation.spin = number; }
+            else                         { animation.rebuild_threshold = number; }
+            animation_option_given = true;
+        }
+        else if (option == "--bvh-cache") {
+            auto stem = scene_path.substr(scene_path.find_last_of('/') + 1);
+            cache.emplace(value, stem);
+        }
+        else if (option == "--bvh-builder") {
+            auto builder = parse_bvh_builder(value);
+            if (not builder) {
+                std::cerr << "ERROR: Unknown BVH builder '" << value << "'.\n";
+                return 1;
+            }
+            bvh.builder = *builder;
+        }
+        else if (option == "--sbvh-budget") {
+            bvh.spatial_split_budget = std::atof(value.c_str());
+            if (not (bvh.spatial_split_budget >= 0)) {
+                std::cerr << "ERROR: SBVH budget must be non-negative (got '" << value << "').\n";
+                return 1;
+            }
+        }
+        else {
+            std::cerr << "ERROR: Unknown option '" << option << "'.\n";
+            print_usage();
+            return 1;
+        }
+    }
+
+    if ((wavefront or packet_size > 0) and heatmap != heatmap_kind::none) {
+        std::cerr << "ERROR: --heatmap cannot be combined with --wavefront or --packets.\n";
+        return 1;
+    }
+    if (sort_rays and not wavefront) {
+        std::cerr << "ERROR: --sort-rays needs --wavefront.\n";
+        return 1;
+    }
+    if (wavefront and packet_size > 0) {
+        std::cerr << "ERROR: --packets cannot be combined with --wavefront.\n";
+        return 1;
+    }
+    if (animation_option_given and not animate) {
+        std::cerr << "ERROR: --orbit, --spin and --rebuild-threshold need --frames.\n";
+        return 1;
+    }
+    if (animate and (analyze or bvh.typed or bvh.compressed or bvh.motion)) {
+        std::cerr << "ERROR: --frames cannot be combined with --analyze-bvh, --typed-bvh, --compressed-bvh or --motion-bvh.\n";
+        return 1;
+    }
+    if (bvh.typed and bvh.compressed) {
+        std::cerr << "ERROR: --typed-bvh cannot be combined with --compressed-bvh.\n";
+        return 1;
+    }
+    if (views_path and (animate or analyze or wavefront or heatmap != heatmap_kind::none)) {
+        std::cerr << "ERROR: --views cannot be combined with --frames, --analyze-bvh, --wavefront or --heatmap.\n";
+        return 1;
+    }
+    if (bvh.lazy and (cache or analyze or animate or bvh.motion or bvh.typed or bvh.compressed)) {
+        std::cerr << "ERROR: --lazy-bvh cannot be combined with --bvh-cache, --analyze-bvh, --frames, --motion-bvh, --typed-bvh or --compressed-bvh.\n";
+        return 1;
+    }
+
+    if (trace_path) {
+        tracer::start();
+        tracer::set_thread_name("main");
+    }
+    if (use_perf) { perf::start(); }
+    std::optional<tracer::span> setup_span{std::in_place, "scene setup"};
+    std::optional<perf::phase> setup_phase{std::in_place, "scene setup"};
+    std::optional<memory_tracker::scope> setup_memory{std::in_place, memory_tracker::tag::scene};
+    auto startup_begin = std::chrono::steady_clock::now();
+    scene_file::loaded_scene scene;
+    if (not scene.open(scene_path)) { return 1; }
+    // ビューの一覧の誤りは、シーンを組み立てる前に報告する
+    std::optional<std::vector<view_desc>> views;
+    if (views_path) {
+        camera_desc view_base = scene.view().camera;
+        if (image_width)       { view_base.image_width = *image_width; }
+        if (samples_per_pixel) { view_base.samples_per_pixel = *samples_per_pixel; }
+        if (max_depth)         { view_base.max_depth = *max_depth; }
+        views = read_views(*views_path, view_base);
+        if (not views) { return 1; }
+    }
+    bvh.cache = cache ? &*cache : nullptr;
+    scene_loader loader(scene.view(), bvh);
+    camera cam = loader.make_camera();
+    if (image_width)       { cam.image_width = *image_width; }
+    if (samples_per_pixel) { cam.samples_per_pixel = *samples_per_pixel; }
+    if (max_depth)         { cam.max_depth = *max_depth; }
+    if (thread_count)      { cam.thread_count = *thread_count; }
+    cam.heatmap = heatmap;
+    if (wavefront) { cam.integrator = integrator_kind::wavefront; }
+    cam.packet_size = packet_size;
+    cam.sort_rays = sort_rays;
+
+    if (animate) {
+        setup_phase.reset();
+        setup_span.reset();
+        setup_memory.reset();
+        const int64_t rays = render_animation(scene.view(), loader, bvh, cam, animation);
+        perf::print_report(std::clog, "animation", rays);
+        if (trace_path and not tracer::write_chrome_trace(*trace_path)) { return 1; }
+        return 0;
+    }
+
+    hittable_list world;
+    if (flatten) {
+        scene_compiler compiler(scene.view(), loader, bvh);
+        world = compiler.compile_world();
+        std::clog << "Flattened scene: " << compiler.primitive_count << " primitives\n";
+    } else {
+        world = loader.make_world();
+    }
+    std::chrono::duration<double, std::milli> startup = std::chrono::steady_clock::now() - startup_begin;
+    std::clog << "Scene setup: " << startup.count() << " ms";
+    if (cache) { std::clog << " (BVH cache: " << cache->hits << " hit, " << cache->misses << " miss)"; }
+    std::clog << '\n';
+    setup_phase.reset();
+    setup_span.reset();
+    setup_memory.reset();
+    if (show_memory) { memory_tracker::print_report(std::clog, "after scene setup"); }
+    if (analyze) {
+        print_bvh_analysis(std::cout, world);
+        return 0;
+    }
+
+    if (views) {
+        std::clog << "Scene setup shared by " << views->size() << " views: "
+                  << startup.count() / double(views->size()) << " ms per view\n";
+        auto render_begin = std::chrono::steady_clock::now();
+        const std::vector<view_result> results = render_views(world, cam, *views, true);
+        std::chrono::duration<double> render_time = std::chrono::steady_clock::now() - render_begin;
+        int64_t rays = 0;
+        for (const view_result& result : results) { rays += result.rays; }
+        std::clog << "Render: " << views->size() << " views, " << render_time.count() << " s, "
+                  << double(rays) / render_time.count() / 1e6 << " Mrays/s\n";
+        if (not write_views(*views, results)) { return 1; }
+        perf::print_report(std::clog, "render", rays);
+        if (show_memory) { memory_tracker::print_report(std::clog, "after render"); }
+        if (trace_path and not tracer::write_chrome_trace(*trace_path)) { return 1; }
+        return 0;
+    }
+
+    auto render_begin = std::chrono::steady_clock::now();
+    cam.render(world);
+    std::chrono::duration<double> render_time = std::chrono::steady_clock::now() - render_begin;
+    std::clog << "Render: " << render_time.count() << " s, "
+              << double(cam.ray_count) / render_time.count() / 1e6 << " Mrays/s";
+    if (cam.first_tile_seconds > 0) {
+        std::clog << ", first tile " << startup.count() + 1000 * cam.first_tile_seconds << " ms after start";
+    }
+    std::clog << '\n';
+    if constexpr (render_stats::enabled) {
+        render_stats::print_summary(std::clog, render_stats::collect(), render_time.count());
+    }
+    perf::print_report(std::clog, "render", cam.ray_count);
+    if (show_memory) { memory_tracker::print_report(std::clog, "after render"); }
+    if (trace_path and not tracer::write_chrome_trace(*trace_path)) { return 1; }
+}
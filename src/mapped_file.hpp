@@ -0,0 +1,52 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** @brief 読み込み専用でメモリマップしたファイル。破棄時にアンマップする。 */
+class mapped_file {
+    public:
+        mapped_file() {}
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+        ~mapped_file() { close(); }
+
+        /** ファイルを開いてマップする。失敗すれば`false`を返す（メッセージは出力しない）。 */
+        bool open(const std::string& path) {
+            close();
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) { return false; }
+            struct stat st;
+            if (fstat(fd, &st) == 0 and st.st_size > 0) {
+                void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED) {
+                    mapped = static_cast<const char*>(p);
+                    mapped_size = size_t(st.st_size);
+                }
+            }
+            ::close(fd);
+            return mapped != nullptr;
+        }
+
+        void close() {
+            if (mapped != nullptr) { munmap(const_cast<char*>(mapped), mapped_size); }
+            mapped = nullptr;
+            mapped_size = 0;
+        }
+
+        const char* data() const { return mapped; }
+        size_t size() const { return mapped_size; }
+        bool is_open() const { return mapped != nullptr; }
+
+    private:
+        const char* mapped = nullptr;
+        size_t mapped_size = 0;
+};
+
+#endif
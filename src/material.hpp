@@ -3,13 +3,19 @@
 
 #include "rtweekend.hpp"
 
+#include "render_stats.hpp"
 #include "texture.hpp"
 
 using std::min;
 using std::max;
 
+/** 組み込みのマテリアルの種類。`material_scatter`と`material_emitted`はこれで分岐して、仮想呼び出しを経ずに評価する */
+enum class material_type : int32_t { custom, lambertian, metal, dielectric, diffuse_light, isotropic };
+
 class material {
     public:
+    /** 組み込み以外のマテリアルは`custom`のまま派生し、`scatter`と`emitted`を仮想呼び出しで評価される */
+    material() : type(material_type::custom) {}
     virtual ~material() = default;
 
     /**
@@ -39,12 +45,25 @@ class material {
         return color{0, 0, 0};
     }
 
+    /** 統計でこのマテリアルへのヒットを数える種類 */
+    virtual render_stats::counter hit_counter() const { return render_stats::counter::other_material_hits; }
+
+    const material_type type;
+
+    private:
+    // 種類の値は`material_scatter`などが`static_cast`する先を決めるので、組み込みのクラスだけが設定できる
+    friend class lambertian;
+    friend class metal;
+    friend class dielectric;
+    friend class diffuse_light;
+    friend class isotropic;
+    explicit material(material_type type) : type(type) {}
 };
 // ランバート反射に従うマテリアル
-class lambertian : public material {
+class lambertian final : public material {
     public:
-    lambertian(const color& albedo) : tex(make_shared<solid_color>(albedo)) {}
-    lambertian(shared_ptr<texture> tex) : tex(tex) {}
+    lambertian(const color& albedo) : lambertian(make_shared<solid_color>(albedo)) {}
+    lambertian(shared_ptr<texture> tex) : material(material_type::lambertian), tex(tex) {}
     bool scatter(
         const ray& r_in,
         const hit_record& rec,
@@ -57,20 +76,21 @@ class lambertian : public material {
         }
 
         scattered = ray{rec.p, scatter_direction, r_in.time()};
-        attenuation = tex->value(rec.u, rec.v, rec.p);
+        attenuation = texture_value(*tex, rec.u, rec.v, rec.p);
         return true;
     }
+    render_stats::counter hit_counter() const override { return render_stats::counter::lambertian_hits; }
     private:
         shared_ptr<texture> tex;
 };
 
 // 金属マテリアル
-class metal : public material {
+class metal final : public material {
     private:
         color albedo;
         double fuzz;
     public: 
-        metal(const color& albedo, double fuzz) : albedo(albedo), fuzz(std::max(std::min(fuzz, 1.0), 0.0)) {};
+        metal(const color& albedo, double fuzz) : material(material_type::metal), albedo(albedo), fuzz(std::max(std::min(fuzz, 1.0), 0.0)) {};
 
         bool scatter(
             const ray& r_in,
@@ -84,10 +104,11 @@ class metal : public material {
             attenuation = albedo;
             return (dot(scattered.direction(), rec.normal) > 0);
         }
+        render_stats::counter hit_counter() const override { return render_stats::counter::metal_hits; }
 };
 
 // 絶縁体
-class dielectric : public material { 
+class dielectric final : public material { 
     private:
         /**
          * Refractive index in vacuum or air,
@@ -96,7 +117,7 @@ class dielectric : public material {
          */
         double refraction_index;
     public:
-        dielectric(double refraction_index) : refraction_index(refraction_index) {}
+        dielectric(double refraction_index) : material(material_type::dielectric), refraction_index(refraction_index) {}
         bool scatter(
             const ray& r_in,
             const hit_record& rec,
@@ -123,6 +144,7 @@ class dielectric : public material {
             scattered = ray{rec.p, next_direction, r_in.time()};
             return true;
         }
+        render_stats::counter hit_counter() const override { return render_stats::counter::dielectric_hits; }
         /**
          * @brief Schlickの近似式を用いて反射係数（反射率）を求める
          * 
@@ -140,22 +162,23 @@ class dielectric : public material {
         }
 };
 
-class diffuse_light : public material {
+class diffuse_light final : public material {
     public: 
-        diffuse_light(shared_ptr<texture> tex) : tex(tex) {}
-        diffuse_light(const color& emit): tex(make_shared<solid_color>(emit)) {}
+        diffuse_light(shared_ptr<texture> tex) : material(material_type::diffuse_light), tex(tex) {}
+        diffuse_light(const color& emit): diffuse_light(make_shared<solid_color>(emit)) {}
         color emitted(double u, double v, const point3& p) const override {
-            return tex->value(u, v, p);
+            return texture_value(*tex, u, v, p);
         }
+        render_stats::counter hit_counter() const override { return render_stats::counter::diffuse_light_hits; }
     private:
         shared_ptr<texture> tex;
 };
 
 
-class isotropic : public material {
+class isotropic final : public material {
     public:
-        isotropic(const color& albedo) : tex(make_shared<solid_color>(albedo)) {}
-        isotropic(shared_ptr<texture> tex): tex(tex) {}
+        isotropic(const color& albedo) : isotropic(make_shared<solid_color>(albedo)) {}
+        isotropic(shared_ptr<texture> tex): material(material_type::isotropic), tex(tex) {}
         bool scatter(
             const ray& r_in,
             const hit_record& rec,
@@ -163,12 +186,53 @@ class isotropic : public material {
             ray& scattered
         ) const override {
             scattered = ray{rec.p, random_unit_vector(), r_in.time()};
-            attenuation = tex->value(rec.u, rec.v, rec.p);
+            attenuation = texture_value(*tex, rec.u, rec.v, rec.p);
             return true;
         }
+        render_stats::counter hit_counter() const override { return render_stats::counter::isotropic_hits; }
     private:
         shared_ptr<texture> tex;
  };
 
- 
+/**
+ * @brief `mat`の`scatter`を評価する。組み込みのマテリアルは種類で分岐して派生クラスの`scatter`を直接呼び、
+ * テクスチャも`texture_value`で引くので、シェーディング全体が仮想呼び出しなしにインライン展開できる。
+ * それ以外（`custom`）は仮想呼び出しに任せる。
+ */
+inline bool material_scatter(
+    const material& mat,
+    const ray& r_in,
+    const hit_record& rec,
+    color& attenuation,
+    ray& scattered
+) {
+    switch (mat.type) {
+        case material_type::lambertian:
+            return static_cast<const lambertian&>(mat).lambertian::scatter(r_in, rec, attenuation, scattered);
+        case material_type::metal:
+            return static_cast<const metal&>(mat).metal::scatter(r_in, rec, attenuation, scattered);
+        case material_type::dielectric:
+            return static_cast<const dielectric&>(mat).dielectric::scatter(r_in, rec, attenuation, scattered);
+        case material_type::diffuse_light:
+            return false;
+        case material_type::isotropic:
+            return static_cast<const isotropic&>(mat).isotropic::scatter(r_in, rec, attenuation, scattered);
+        case material_type::custom:
+            break;
+    }
+    return mat.scatter(r_in, rec, attenuation, scattered);
+}
+
+/** `mat`の`emitted`を評価する。発光する組み込みのマテリアルは`diffuse_light`だけなので、他は黒を返す */
+inline color material_emitted(const material& mat, double u, double v, const point3& p) {
+    switch (mat.type) {
+        case material_type::diffuse_light:
+            return static_cast<const diffuse_light&>(mat).diffuse_light::emitted(u, v, p);
+        case material_type::custom:
+            return mat.emitted(u, v, p);
+        default:
+            return color{0, 0, 0};
+    }
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,230 @@
+#ifndef MEMORY_TRACKER_H
+#define MEMORY_TRACKER_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+#include <ostream>
+
+/**
+ * 用途ごとのメモリ使用量（バイト数・確保回数）の集計。
+ *
+ * 確保は、確保したスレッドがその時点で入っている`scope`の用途に計上される（どの`scope`にも入っていなければ`other`）。
+ * 集計は置き換えた`operator new`/`operator delete`で行う。置き換えの定義は、
+ * 1つの翻訳単位でだけ`RT_MEMORY_TRACKER_IMPLEMENTATION`を定義してからこのファイルをincludeすると生成される。
+ * 定義しなければ`scope`は用途を切り替えるだけで、何も集計しない。
+ * `malloc`で確保される領域（stb_imageの画像など）は`add_external`で別途計上する。`mmap`したシーンファイルは含まない。
+ */
+namespace memory_tracker {
+    enum class tag : uint32_t { other, scene, geometry, acceleration, textures, materials, framebuffer, count };
+    constexpr int32_t tag_count = int32_t(tag::count);
+
+    inline const char* tag_name(tag t) {
+        switch (t) {
+            case tag::other:        return "other";
+            case tag::scene:        return "scene";
+            case tag::geometry:     return "geometry";
+            case tag::acceleration: return "acceleration";
+            case tag::textures:     return "textures";
+            case tag::materials:    return "materials";
+            case tag::framebuffer:  return "framebuffer";
+            case tag::count:        break;
+        }
+        return "?";
+    }
+
+    struct usage {
+        int64_t current = 0;
+        int64_t peak = 0;
+        // これまでの確保回数と、まだ解放されていない確保の数
+        int64_t allocations = 0;
+        int64_t live = 0;
+    };
+
+    namespace detail {
+        struct counters {
+            std::atomic<int64_t> current{0};
+            std::atomic<int64_t> peak{0};
+            std::atomic<int64_t> allocations{0};
+            std::atomic<int64_t> live{0};
+        };
+
+        // `operator new`から（静的初期化の前にも）呼ばれるので、全て定数初期化する
+        inline constinit std::array<counters, tag_count> per_tag{};
+        inline constinit counters total{};
+        inline thread_local constinit tag current_tag = tag::other;
+        inline constinit std::atomic<bool> hooked{false};
+
+        inline void raise_peak(std::atomic<int64_t>& peak, int64_t value) {
+            int64_t seen = peak.load(std::memory_order_relaxed);
+            while (value > seen and not peak.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+        }
+
+        inline void add(counters& c, int64_t bytes, int64_t count) {
+            int64_t now = c.current.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+            if (count > 0) { c.allocations.fetch_add(count, std::memory_order_relaxed); }
+            c.live.fetch_add(count, std::memory_order_relaxed);
+            raise_peak(c.peak, now);
+        }
+
+        /** `count`は確保なら1、解放なら-1 */
+        inline void record(tag t, int64_t bytes, int64_t count) {
+            add(per_tag[size_t(t)], bytes, count);
+            add(total, bytes, count);
+        }
+
+        inline usage load(const counters& c) {
+            return {
+                c.current.load(std::memory_order_relaxed),
+                c.peak.load(std::memory_order_relaxed),
+                c.allocations.load(std::memory_order_relaxed),
+                c.live.load(std::memory_order_relaxed),
+            };
+        }
+    }
+
+    /** `operator new`の置き換えが有効か */
+    inline bool is_hooked() { return detail::hooked.load(std::memory_order_relaxed); }
+
+    /** 呼び出したスレッドの確保が計上される用途 */
+    inline tag current() { return detail::current_tag; }
+
+    /** スコープの間、呼び出したスレッドの確保を`t`に計上する。入れ子にでき、抜けると元の用途に戻る */
+    class scope {
+        public:
+            explicit scope(tag t) : previous(detail::current_tag) { detail::current_tag = t; }
+            ~scope() { detail::current_tag = previous; }
+            scope(const scope&) = delete;
+            scope& operator=(const scope&) = delete;
+
+        private:
+            tag previous;
+    };
+
+    /** `operator new`を通らない確保を計上する。解放したときは負の`bytes`で呼ぶ */
+    inline void add_external(tag t, int64_t bytes) {
+        if (not is_hooked() or bytes == 0) { return; }
+        detail::record(t, bytes, bytes > 0 ? 1 : -1);
+    }
+
+    inline usage usage_of(tag t) { return detail::load(detail::per_tag[size_t(t)]); }
+    inline usage total_usage() { return detail::load(detail::total); }
+
+    /** 用途ごとの現在量・ピーク・確保回数と、全体のピークを表示する */
+    inline void print_report(std::ostream& out, const char* title) {
+        out << "Memory (" << title << ")\n";
+        if (not is_hooked()) {
+            out << "  allocation hooks are not installed in this executable\n";
+            return;
+        }
+        auto megabytes = [](int64_t bytes) { return double(bytes) / (1024.0 * 1024.0); };
+        auto line = [&](const char* name, const usage& u) {
+            out << "  " << std::left << std::setw(14) << name << std::right << std::fixed << std::setprecision(2)
+                << std::setw(12) << megabytes(u.current) << std::setw(12) << megabytes(u.peak)
+                << std::setw(14) << u.allocations << std::setw(12) << u.live << '\n';
+        };
+        out << "  " << std::left << std::setw(14) << "tag" << std::right << std::setw(12) << "current[MB]"
+            << std::setw(12) << "peak[MB]" << std::setw(14) << "allocations" << std::setw(12) << "live" << '\n';
+        for (int32_t i = 0; i < tag_count; i++) {
+            usage u = usage_of(tag(i));
+            if (u.allocations == 0) { continue; }
+            line(tag_name(tag(i)), u);
+        }
+        line("total", total_usage());
+    }
+}
+
+#ifdef RT_MEMORY_TRACKER_IMPLEMENTATION
+namespace memory_tracker::detail {
+    // 確保した領域の直前に置く情報。利用者に返すアドレスのアラインメントを保つため16バイト
+    struct header {
+        uint64_t size;
+        tag owner;
+        // 確保した領域の先頭から、利用者に返すアドレスまでのバイト数
+        uint32_t offset;
+    };
+    static_assert(sizeof(header) == 16);
+
+    inline void* allocate(size_t size, size_t alignment) noexcept {
+        const size_t offset = std::max(sizeof(header), alignment);
+        void* base = nullptr;
+        if (alignment <= alignof(std::max_align_t)) {
+            base = std::malloc(size + offset);
+        } else {
+            // aligned_allocのサイズはアラインメントの倍数でなければならない
+            base = std::aligned_alloc(alignment, (size + offset + alignment - 1) / alignment * alignment);
+        }
+        if (base == nullptr) { return nullptr; }
+        auto user = static_cast<unsigned char*>(base) + offset;
+        auto h = reinterpret_cast<header*>(user) - 1;
+        h->size = size;
+        h->owner = current_tag;
+        h->offset = uint32_t(offset);
+        record(h->owner, int64_t(size), 1);
+        return user;
+    }
+
+    inline void deallocate(void* p) noexcept {
+        if (p == nullptr) { return; }
+        auto h = static_cast<header*>(p) - 1;
+        record(h->owner, -int64_t(h->size), -1);
+        std::free(static_cast<unsigned char*>(p) - h->offset);
+    }
+
+    inline void* allocate_or_throw(size_t size, size_t alignment) {
+        void* p = allocate(size, alignment);
+        if (p == nullptr) { throw std::bad_alloc(); }
+        return p;
+    }
+
+    inline const bool installed = [] {
+        hooked.store(true);
+        return true;
+    }();
+}
+
+void* operator new(size_t size) {
+    return memory_tracker::detail::allocate_or_throw(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void* operator new[](size_t size) {
+    return memory_tracker::detail::allocate_or_throw(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void* operator new(size_t size, std::align_val_t alignment) {
+    return memory_tracker::detail::allocate_or_throw(size, size_t(alignment));
+}
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return memory_tracker::detail::allocate_or_throw(size, size_t(alignment));
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return memory_tracker::detail::allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return memory_tracker::detail::allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return memory_tracker::detail::allocate(size, size_t(alignment));
+}
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return memory_tracker::detail::allocate(size, size_t(alignment));
+}
+
+void operator delete(void* p) noexcept { memory_tracker::detail::deallocate(p); }
+void operator delete[](void* p) noexcept { memory_tracker::detail::deallocate(p); }
+void operator delete(void* p, size_t) noexcept { memory_tracker::detail::deallocate(p); }
+void operator delete[](void* p, size_t) noexcept { memory_tracker::detail::deallocate(p); }
+void operator delete(void* p, std::align_val_t) noexcept { memory_tracker::detail::deallocate(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { memory_tracker::detail::deallocate(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { memory_tracker::detail::deallocate(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { memory_tracker::detail::deallocate(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { memory_tracker::detail::deallocate(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { memory_tracker::detail::deallocate(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { memory_tracker::detail::deallocate(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { memory_tracker::detail::deallocate(p); }
+#endif
+
+#endif
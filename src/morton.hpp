@@ -0,0 +1,54 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <cstdint>
+
+/**
+ * Mortonコード（Z-order曲線上の位置）。
+ * 3次元の格子座標のビットを交互に並べることで、空間的に近い点が近いコードを持つようにする。
+ */
+
+/** 10bitの値のビットの間に2bitずつ0を挟む */
+inline uint32_t morton_expand_bits10(uint32_t v) {
+    v &= 0x3ffu;
+    v = (v * 0x00010001u) & 0xff0000ffu;
+    v = (v * 0x00000101u) & 0x0f00f00fu;
+    v = (v * 0x00000011u) & 0xc30c30c3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+/** 21bitの値のビットの間に2bitずつ0を挟む */
+inline uint64_t morton_expand_bits21(uint64_t v) {
+    v &= 0x1fffffull;
+    v = (v | v << 32) & 0x001f00000000ffffull;
+    v = (v | v << 16) & 0x001f0000ff0000ffull;
+    v = (v | v << 8)  & 0x100f00f00f00f00full;
+    v = (v | v << 4)  & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2)  & 0x1249249249249249ull;
+    return v;
+}
+
+/** [0, 1]^3に正規化した座標に対する30bitのMortonコード */
+inline uint32_t morton_code30(double x, double y, double z) {
+    auto quantize = [](double t) {
+        t = t < 0 ? 0 : (t > 1 ? 1 : t);
+        return uint32_t(t * 1023.0);
+    };
+    return (morton_expand_bits10(quantize(x)) << 2)
+         | (morton_expand_bits10(quantize(y)) << 1)
+         |  morton_expand_bits10(quantize(z));
+}
+
+/** [0, 1]^3に正規化した座標に対する63bitのMortonコード */
+inline uint64_t morton_code63(double x, double y, double z) {
+    auto quantize = [](double t) {
+        t = t < 0 ? 0 : (t > 1 ? 1 : t);
+        return uint64_t(t * 2097151.0);
+    };
+    return (morton_expand_bits21(quantize(x)) << 2)
+         | (morton_expand_bits21(quantize(y)) << 1)
+         |  morton_expand_bits21(quantize(z));
+}
+
+#endif
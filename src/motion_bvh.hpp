@@ -0,0 +1,194 @@
+#ifndef MOTION_BVH_H
+#define MOTION_BVH_H
+
+#include "rtweekend.hpp"
+
+#include "aabb.hpp"
+#include "flat_bvh.hpp"
+#include "hittable.hpp"
+#include "render_stats.hpp"
+
+#include <span>
+#include <type_traits>
+#include <vector>
+
+/**
+ * 時刻0と時刻1のバウンディングボックスを持つBVHのノード。
+ * 走査時はレイの時刻で2つの箱を線形補間する。並びは`flat_bvh_node`と同じ。
+ */
+struct motion_bvh_node {
+    aabb bbox0;
+    aabb bbox1;
+    // 葉: 最初のプリミティブの位置 / 内部ノード: 右の子の位置
+    int32_t offset = 0;
+    // 葉: プリミティブ数 / 内部ノード: 0
+    int32_t count = 0;
+    int32_t axis = 0;
+    int32_t padding = 0;
+
+    bool is_leaf() const { return count > 0; }
+
+    /** 時刻`time`の箱とレイの交差判定。`aabb`を作らずに補間しながらスラブ判定を行う */
+    bool hit_at(const ray& r, interval ray_t, double time) const {
+        const point3& ray_orig = r.origin();
+        const point3& ray_dir  = r.direction();
+
+        for (int32_t axis = 0; axis < 3; axis++) {
+            const interval& a = bbox0.axis_interval(axis);
+            const interval& b = bbox1.axis_interval(axis);
+            double t0 = (a.min + time * (b.min - a.min) - ray_orig[axis]) / ray_dir[axis];
+            double t1 = (a.max + time * (b.max - a.max) - ray_orig[axis]) / ray_dir[axis];
+            if (t0 > t1) { std::swap(t0, t1); }
+
+            if (t0 > ray_t.min) { ray_t.min = t0; }
+            if (t1 < ray_t.max) { ray_t.max = t1; }
+
+            if (ray_t.is_empty()) { return false; }
+        }
+        return true;
+    }
+
+    aabb bbox_at(double time) const {
+        auto lerp = [time](const interval& a, const interval& b) {
+            return interval(a.min + time * (b.min - a.min), a.max + time * (b.max - a.max));
+        };
+        return aabb(lerp(bbox0.x, bbox1.x), lerp(bbox0.y, bbox1.y), lerp(bbox0.z, bbox1.z));
+    }
+};
+
+static_assert(std::is_trivially_copyable_v<motion_bvh_node>);
+
+/**
+ * @brief 動く物体のためのBVH。
+ * 木の構造は`flat_bvh`と同じく動きの全体を覆う箱で作り、各ノードには時刻0と1で子を覆う箱を持たせる。
+ * 走査時の箱は動きの全体を覆う箱に含まれるので、同じ構造の`flat_bvh`より走査するノードが増えることはない。
+ *
+ * 各プリミティブは`bounding_box_at(t)`が時刻0と1の箱の線形補間に含まれる（線形に動く）必要がある。
+ */
+class motion_bvh : public hittable {
+    public:
+        motion_bvh(
+            std::vector<shared_ptr<hittable>> objects,
+            const bvh_layout& layout
+        ) {
+            primitives.reserve(layout.primitive_indices.size());
+            for (int32_t index : layout.primitive_indices) { primitives.push_back(objects[index]); }
+
+            nodes.resize(layout.nodes.size());
+            for (size_t i = 0; i < nodes.size(); i++) {
+                nodes[i].offset = layout.nodes[i].offset;
+                nodes[i].count = layout.nodes[i].count;
+                nodes[i].axis = layout.nodes[i].axis;
+            }
+            // 子は親より後ろにあるので、逆順に辿れば子の箱が先に決まる
+            for (size_t i = nodes.size(); i-- > 0;) {
+                motion_bvh_node& node = nodes[i];
+                if (node.is_leaf()) {
+                    node.bbox0 = node.bbox1 = aabb::empty;
+                    for (int32_t p = node.offset; p < node.offset + node.count; p++) {
+                        node.bbox0 = aabb(node.bbox0, primitives[p]->bounding_box_at(0));
+                        node.bbox1 = aabb(node.bbox1, primitives[p]->bounding_box_at(1));
+                    }
+                } else {
+                    const motion_bvh_node& left = nodes[i + 1];
+                    const motion_bvh_node& right = nodes[node.offset];
+                    node.bbox0 = aabb(left.bbox0, right.bbox0);
+                    node.bbox1 = aabb(left.bbox1, right.bbox1);
+                }
+            }
+
+            bbox = aabb::empty;
+            for (const auto& primitive : primitives) { bbox = aabb(bbox, primitive->bounding_box()); }
+        }
+
+        bool hit(
+            const ray& r,
+            interval ray_t,
+            hit_record& rec
+        ) const override {
+            int64_t visited = 0;
+            return traverse<false>(r, ray_t, rec, visited);
+        }
+
+        /** `hit`と同じだが、箱との交差判定を行ったノード数を`visited`に加える */
+        bool hit_counted(
+            const ray& r,
+            interval ray_t,
+            hit_record& rec,
+            int64_t& visited
+        ) const {
+            return traverse<true>(r, ray_t, rec, visited);
+        }
+
+        aabb bounding_box() const override { return bbox; }
+        aabb bounding_box_at(double time) const override {
+            return nodes.empty() ? aabb::empty : nodes[0].bbox_at(time);
+        }
+
+        std::span<const motion_bvh_node> node_array() const { return nodes; }
+        const std::vector<shared_ptr<hittable>>& primitive_array() const { return primitives; }
+
+    private:
+        std::vector<motion_bvh_node> nodes;
+        // 葉の並び順に並べ替えたプリミティブ
+        std::vector<shared_ptr<hittable>> primitives;
+        aabb bbox;
+
+        template<bool count_visits>
+        bool traverse(
+            const ray& r,
+            interval ray_t,
+            hit_record& rec,
+            int64_t& visited
+        ) const {
+            if (nodes.empty()) { return false; }
+            int32_t stack[bvh_max_depth];
+            int32_t stack_size = 0;
+            int32_t current = 0;
+            bool hit_anything = false;
+            const double time = r.time();
+
+            while (true) {
+                const motion_bvh_node& node = nodes[current];
+                if constexpr (count_visits) { visited++; }
+                render_stats::add(render_stats::counter::bvh_nodes_visited);
+                if (node.hit_at(r, ray_t, time)) {
+                    if (node.is_leaf()) {
+                        for (int32_t i = node.offset; i < node.offset + node.count; i++) {
+                            if (primitives[i]->hit(r, ray_t, rec)) {
+                                hit_anything = true;
+                                ray_t.max = rec.t;
+                            }
+                        }
+                    } else {
+                        if (r.direction()[node.axis] < 0) {
+                            stack[stack_size++] = current + 1;
+                            current = node.offset;
+                        } else {
+                            stack[stack_size++] = node.offset;
+                            current = current + 1;
+                        }
+                        continue;
+                    }
+                }
+                if (stack_size == 0) { break; }
+                current = stack[--stack_size];
+            }
+            return hit_anything;
+        }
+};
+
+/** 時刻0と1でバウンディングボックスが異なるプリミティブがあるか */
+inline bool has_moving_primitives(const std::vector<shared_ptr<hittable>>& objects) {
+    for (const auto& object : objects) {
+        aabb box0 = object->bounding_box_at(0);
+        aabb box1 = object->bounding_box_at(1);
+        for (int32_t axis = 0; axis < 3; axis++) {
+            if (box0.axis_interval(axis).min != box1.axis_interval(axis).min
+                or box0.axis_interval(axis).max != box1.axis_interval(axis).max) { return true; }
+        }
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "memory_tracker.hpp"
+
+/** 利用するワーカースレッド数（ハードウェアスレッド数） */
+inline int32_t hardware_threads() {
+    return std::max(1, int32_t(std::thread::hardware_concurrency()));
+}
+
+/**
+ * @brief [begin, end)を`grain`以上の大きさのチャンクに分け、複数のスレッドで`f(chunk_begin, chunk_end)`を呼ぶ。
+ * 呼び出し元のスレッドもチャンクを処理する。
+ */
+template<class F>
+void parallel_for_chunks(int64_t begin, int64_t end, int64_t grain, F&& f) {
+    int64_t n = end - begin;
+    if (n <= 0) { return; }
+    int64_t chunks = std::min<int64_t>(hardware_threads(), (n + grain - 1) / grain);
+    if (chunks <= 1) {
+        f(begin, end);
+        return;
+    }
+    std::vector<std::thread> workers;
+    workers.reserve(chunks - 1);
+    int64_t chunk_size = (n + chunks - 1) / chunks;
+    const auto tag = memory_tracker::current();
+    for (int64_t c = 1; c < chunks; c++) {
+        int64_t b = begin + c * chunk_size;
+        int64_t e = std::min(end, b + chunk_size);
+        if (b < e) {
+            workers.emplace_back([&f, b, e, tag] {
+                memory_tracker::scope scope(tag);
+                f(b, e);
+            });
+        }
+    }
+    f(begin, std::min(end, begin + chunk_size));
+    for (auto& worker : workers) { worker.join(); }
+}
+
+/** @brief [begin, end)の各要素について`f(i)`を並列に呼ぶ。 */
+template<class F>
+void parallel_for(int64_t begin, int64_t end, int64_t grain, F&& f) {
+    parallel_for_chunks(begin, end, grain, [&f](int64_t b, int64_t e) {
+        for (int64_t i = b; i < e; i++) { f(i); }
+    });
+}
+
+/**
+ * @brief 呼び出し元を含む`thread_count`個のスレッドで`f(worker_index)`を実行し、全てが終わるまで待つ。
+ * 仕事の分配は`f`に任せる（共有のカウンタから取り出すなど）。
+ * 各スレッドのメモリ確保は、呼び出し元と同じ用途に計上される（`parallel_for_chunks`・`task_limiter`も同様）。
+ */
+template<class F>
+void run_workers(int32_t thread_count, F&& f) {
+    std::vector<std::thread> workers;
+    workers.reserve(std::max(thread_count - 1, 0));
+    const auto tag = memory_tracker::current();
+    for (int32_t w = 1; w < thread_count; w++) {
+        workers.emplace_back([&f, w, tag] {
+            memory_tracker::scope scope(tag);
+            f(w);
+        });
+    }
+    f(0);
+    for (auto& worker : workers) { worker.join(); }
+}
+
+/**
+ * @brief 再帰的な分割統治を並列化するためのタスクの生成数の管理。
+ * 同時に走るタスクがハードウェアスレッド数を超えないよう、超える場合は呼び出し元で直接実行する。
+ */
+class task_limiter {
+    public:
+        task_limiter() : available(hardware_threads() - 1) {}
+
+        /** 空きがあれば`f`を別スレッドで開始し、なければその場で実行する。戻り値の`wait()`で完了を待つ。 */
+        template<class F>
+        std::future<void> spawn(F&& f) {
+            if (available.fetch_sub(1) > 0) {
+                return std::async(std::launch::async, [this, f = std::forward<F>(f), tag = memory_tracker::current()]() mutable {
+                    memory_tracker::scope scope(tag);
+                    f();
+                    available.fetch_add(1);
+                });
+            }
+            available.fetch_add(1);
+            f();
+            std::promise<void> done;
+            done.set_value();
+            return done.get_future();
+        }
+
+    private:
+        std::atomic<int32_t> available;
+};
+
+#endif
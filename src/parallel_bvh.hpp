@@ -0,0 +1,457 @@
+#ifndef PARALLEL_BVH_H
+#define PARALLEL_BVH_H
+
+#include "rtweekend.hpp"
+
+#include "aabb.hpp"
+#include "flat_bvh.hpp"
+#include "morton.hpp"
+#include "parallel.hpp"
+#include "radix_sort.hpp"
+
+#include <atomic>
+#include <bit>
+#include <future>
+#include <span>
+#include <vector>
+
+/** 並列ビルダが作る中間的な木のノード。構築後に`flatten_build_nodes`で深さ優先順に並べ直す。 */
+struct bvh_build_node {
+    aabb bbox;
+    // 内部ノードの子（葉では負）
+    int32_t left = -1;
+    int32_t right = -1;
+    // 葉: primitive_indices[first, first + count)
+    int32_t first = 0;
+    int32_t count = 0;
+    int32_t axis = 0;
+};
+
+inline void flatten_build_node(
+    const std::vector<bvh_build_node>& build_nodes,
+    int32_t index,
+    std::vector<flat_bvh_node>& nodes
+) {
+    const bvh_build_node& b = build_nodes[index];
+    int32_t node_index = int32_t(nodes.size());
+    nodes.emplace_back();
+    nodes[node_index].bbox = b.bbox;
+    if (b.left < 0) {
+        nodes[node_index].offset = b.first;
+        nodes[node_index].count = b.count;
+        return;
+    }
+    flatten_build_node(build_nodes, b.left, nodes);
+    nodes[node_index].offset = int32_t(nodes.size());
+    nodes[node_index].axis = b.axis;
+    flatten_build_node(build_nodes, b.right, nodes);
+}
+
+inline std::vector<flat_bvh_node> flatten_build_nodes(
+    const std::vector<bvh_build_node>& build_nodes,
+    int32_t root,
+    size_t node_count
+) {
+    std::vector<flat_bvh_node> nodes;
+    nodes.reserve(node_count);
+    flatten_build_node(build_nodes, root, nodes);
+    return nodes;
+}
+
+/**
+ * @brief ビン分割によるSAHでトップダウンに構築するビルダ。
+ * 大きな部分木はタスクとして並列に構築し、大きなノードのビン分けは区間を分けて並列に数える。
+ * 子のバウンディングボックスはビンの集計から求めるので、ノードごとに余分な走査をしない。
+ */
+class binned_bvh_builder {
+    public:
+        binned_bvh_builder(
+            std::span<const aabb> bounds,
+            int32_t max_leaf_size = 4,
+            int32_t bin_count = 16
+        ) :
+            bounds(bounds),
+            max_leaf_size(max_leaf_size),
+            bin_count(std::min(bin_count, max_bins))
+        {}
+
+        bvh_layout build() {
+            bvh_layout layout;
+            const auto n = int64_t(bounds.size());
+            layout.primitive_indices.resize(n);
+            if (n == 0) { return layout; }
+
+            centroids.resize(n);
+            build_nodes.resize(2 * n);
+            parallel_for(0, n, 1 << 14, [&](int64_t i) {
+                centroids[i] = bounds[i].centroid();
+                layout.primitive_indices[i] = int32_t(i);
+            });
+            indices = layout.primitive_indices.data();
+
+            // 根のバウンディングボックスと重心の範囲
+            std::vector<bin> partial(hardware_threads());
+            std::atomic<int32_t> next_partial{0};
+            parallel_for_chunks(0, n, 1 << 14, [&](int64_t b, int64_t e) {
+                bin& part = partial[next_partial.fetch_add(1)];
+                for (int64_t i = b; i < e; i++) { part.add(bounds[i], centroids[i]); }
+            });
+            bin root;
+            for (const bin& part : partial) { root.merge(part); }
+
+            node_count = 1;
+            build_recursive(0, 0, int32_t(n), root.bbox, root.centroid_bounds, 0);
+            layout.nodes = flatten_build_nodes(build_nodes, 0, node_count.load());
+            return layout;
+        }
+
+    private:
+        static constexpr int32_t max_bins = 16;
+        // このプリミティブ数以上の部分木は別タスクで構築する
+        static constexpr int32_t task_threshold = 1 << 12;
+        // このプリミティブ数以上のノードはビン分けを並列に行う
+        static constexpr int32_t parallel_binning_threshold = 1 << 16;
+        // この深さを超えたら中央値分割に切り替えて、木の深さを抑える
+        static constexpr int32_t median_split_depth = 64;
+
+        struct bin {
+            aabb bbox = aabb::empty;
+            aabb centroid_bounds = aabb::empty;
+            int32_t count = 0;
+
+            void add(const aabb& box, const point3& centroid) {
+                bbox = aabb(bbox, box);
+                centroid_bounds.x = interval(centroid_bounds.x, interval(centroid.x(), centroid.x()));
+                centroid_bounds.y = interval(centroid_bounds.y, interval(centroid.y(), centroid.y()));
+                centroid_bounds.z = interval(centroid_bounds.z, interval(centroid.z(), centroid.z()));
+                count++;
+            }
+            void merge(const bin& other) {
+                bbox = aabb(bbox, other.bbox);
+                centroid_bounds = aabb(centroid_bounds, other.centroid_bounds);
+                count += other.count;
+            }
+        };
+        using bin_array = std::array<bin, max_bins>;
+
+        std::span<const aabb> bounds;
+        int32_t max_leaf_size;
+        int32_t bin_count;
+        std::vector<point3> centroids;
+        int32_t* indices = nullptr;
+        std::vector<bvh_build_node> build_nodes;
+        std::atomic<int32_t> node_count{0};
+        task_limiter tasks;
+
+        static int32_t bin_of(const point3& centroid, int32_t axis, double origin, double scale, int32_t bins_used) {
+            auto b = int32_t((centroid[axis] - origin) * scale);
+            return std::clamp(b, 0, bins_used - 1);
+        }
+
+        bin_array fill_bins(int32_t start, int32_t end, int32_t axis, double origin, double scale, int32_t bins_used) {
+            auto fill = [&](int64_t b, int64_t e) {
+                bin_array bins;
+                for (int64_t i = b; i < e; i++) {
+                    int32_t index = indices[i];
+                    bins[bin_of(centroids[index], axis, origin, scale, bins_used)].add(bounds[index], centroids[index]);
+                }
+                return bins;
+            };
+            if (end - start < parallel_binning_threshold) { return fill(start, end); }
+
+            std::vector<bin_array> partial(hardware_threads());
+            std::atomic<int32_t> next_partial{0};
+            parallel_for_chunks(start, end, parallel_binning_threshold / 4, [&](int64_t b, int64_t e) {
+                partial[next_partial.fetch_add(1)] = fill(b, e);
+            });
+            bin_array bins;
+            for (const bin_array& part : partial) {
+                for (int32_t i = 0; i < bins_used; i++) { bins[i].merge(part[i]); }
+            }
+            return bins;
+        }
+
+        void make_leaf(int32_t node_index, int32_t start, int32_t end, const aabb& bbox) {
+            bvh_build_node& node = build_nodes[node_index];
+            node.bbox = bbox;
+            node.first = start;
+            node.count = end - start;
+        }
+
+        void build_recursive(
+            int32_t node_index,
+            int32_t start,
+            int32_t end,
+            const aabb& bbox,
+            const aabb& centroid_bounds,
+            int32_t depth
+        ) {
+            const int32_t n = end - start;
+            if (n <= 1) {
+                make_leaf(node_index, start, end, bbox);
+                return;
+            }
+
+            const int32_t axis = centroid_bounds.longest_axis();
+            const interval& extent = centroid_bounds.axis_interval(axis);
+            int32_t mid = -1;
+            bin left_side, right_side;
+
+            if (depth < median_split_depth and extent.size() > 0) {
+                // 小さなノードではビンの数をプリミティブ数まで減らして、ノードあたりの固定費を抑える
+                const int32_t bins_used = std::min(bin_count, n);
+                const double scale = bins_used / extent.size();
+                bin_array bins = fill_bins(start, end, axis, extent.min, scale, bins_used);
+
+                // 右側から累積して、各分割位置の右側の表面積と個数を求める
+                std::array<double, max_bins> right_cost;
+                bin accumulated;
+                for (int32_t i = bins_used - 1; i > 0; i--) {
+                    accumulated.merge(bins[i]);
+                    right_cost[i] = accumulated.bbox.surface_area() * accumulated.count;
+                }
+                int32_t best_split = -1;
+                double best_cost = infinity;
+                accumulated = bin{};
+                for (int32_t i = 1; i < bins_used; i++) {
+                    accumulated.merge(bins[i - 1]);
+                    if (accumulated.count == 0 or accumulated.count == n) { continue; }
+                    double cost = accumulated.bbox.surface_area() * accumulated.count + right_cost[i];
+                    if (cost < best_cost) {
+                        best_cost = cost;
+                        best_split = i;
+                    }
+                }
+
+                if (best_split > 0) {
+                    const double leaf_cost = n;
+                    const double split_cost = 1 + best_cost / bbox.surface_area();
+                    if (n <= max_leaf_size and leaf_cost <= split_cost) {
+                        make_leaf(node_index, start, end, bbox);
+                        return;
+                    }
+                    for (int32_t i = 0; i < bins_used; i++) {
+                        (i < best_split ? left_side : right_side).merge(bins[i]);
+                    }
+                    int32_t* middle = std::partition(indices + start, indices + end, [&](int32_t index) {
+                        return bin_of(centroids[index], axis, extent.min, scale, bins_used) < best_split;
+                    });
+                    mid = int32_t(middle - indices);
+                }
+            }
+
+            if (mid < 0) {
+                // 重心が一致しているか深すぎる場合は個数で二等分する
+                if (n <= max_leaf_size) {
+                    make_leaf(node_index, start, end, bbox);
+                    return;
+                }
+                mid = start + n / 2;
+                std::nth_element(indices + start, indices + mid, indices + end, [&](int32_t a, int32_t b) {
+                    return centroids[a][axis] < centroids[b][axis];
+                });
+                for (int32_t i = start; i < mid; i++) { left_side.add(bounds[indices[i]], centroids[indices[i]]); }
+                for (int32_t i = mid; i < end; i++) { right_side.add(bounds[indices[i]], centroids[indices[i]]); }
+            }
+
+            int32_t left = node_count.fetch_add(2);
+            int32_t right = left + 1;
+            bvh_build_node& node = build_nodes[node_index];
+            node.bbox = bbox;
+            node.left = left;
+            node.right = right;
+            node.axis = axis;
+
+            if (n >= task_threshold) {
+                auto left_task = tasks.spawn([=, this] {
+                    build_recursive(left, start, mid, left_side.bbox, left_side.centroid_bounds, depth + 1);
+                });
+                build_recursive(right, mid, end, right_side.bbox, right_side.centroid_bounds, depth + 1);
+                left_task.wait();
+            } else {
+                build_recursive(left, start, mid, left_side.bbox, left_side.centroid_bounds, depth + 1);
+                build_recursive(right, mid, end, right_side.bbox, right_side.centroid_bounds, depth + 1);
+            }
+        }
+};
+
+/**
+ * @brief Mortonコードに基づく線形BVH（LBVH, Karras 2012）のビルダ。
+ * 重心のMortonコードを並列基数ソートし、各内部ノードの範囲と分割位置をノードごとに独立に求めるため、
+ * 構築のすべての段階が並列化できる。木の質はSAHに劣るが、再構築は非常に速い。
+ *
+ * @tparam Code `uint32_t`なら30bit、`uint64_t`なら63bitのMortonコードを用いる。
+ */
+template<class Code>
+class lbvh_builder {
+    public:
+        lbvh_builder(std::span<const aabb> bounds, int32_t max_leaf_size = 2) :
+            bounds(bounds), max_leaf_size(max_leaf_size) {}
+
+        bvh_layout build() {
+            bvh_layout layout;
+            const auto n = int32_t(bounds.size());
+            if (n == 0) { return layout; }
+
+            // 重心の範囲で正規化してMortonコードを求める
+            std::vector<aabb> partial(hardware_threads(), aabb::empty);
+            std::atomic<int32_t> next_partial{0};
+            parallel_for_chunks(0, n, 1 << 14, [&](int64_t b, int64_t e) {
+                aabb& part = partial[next_partial.fetch_add(1)];
+                for (int64_t i = b; i < e; i++) {
+                    point3 c = bounds[i].centroid();
+                    part = aabb(part, aabb(interval(c.x(), c.x()), interval(c.y(), c.y()), interval(c.z(), c.z())));
+                }
+            });
+            aabb centroid_bounds = aabb::empty;
+            for (const aabb& part : partial) { centroid_bounds = aabb(centroid_bounds, part); }
+
+            codes.resize(n);
+            std::vector<int32_t> order(n);
+            const point3 origin{centroid_bounds.x.min, centroid_bounds.y.min, centroid_bounds.z.min};
+            const vec3 inv_extent{
+                1 / std::max(centroid_bounds.x.size(), 1e-300),
+                1 / std::max(centroid_bounds.y.size(), 1e-300),
+                1 / std::max(centroid_bounds.z.size(), 1e-300)
+            };
+            parallel_for(0, n, 1 << 14, [&](int64_t i) {
+                vec3 t = (bounds[i].centroid() - origin) * inv_extent;
+                codes[i] = encode(t);
+                order[i] = int32_t(i);
+            });
+            parallel_radix_sort(codes, order, code_bits);
+            layout.primitive_indices = std::move(order);
+
+            if (n == 1) {
+                flat_bvh_node leaf;
+                leaf.bbox = bounds[layout.primitive_indices[0]];
+                leaf.count = 1;
+                layout.nodes.push_back(leaf);
+                return layout;
+            }
+
+            // 内部ノード i は [0, n-1)、葉 i はソート後の i 番目のプリミティブ
+            internal.assign(n - 1, internal_node{});
+            leaf_parent.assign(n, -1);
+            parallel_for(0, n - 1, 1 << 12, [&](int64_t i) { build_internal(int32_t(i)); });
+
+            // 葉から根へ向かってバウンディングボックスを求める。
+            // 二つ目の子が到着したときに初めて親の箱を計算する。
+            std::vector<std::atomic<int32_t>> arrivals(n - 1);
+            parallel_for(0, n, 1 << 12, [&](int64_t leaf) {
+                int32_t node = leaf_parent[leaf];
+                while (node >= 0) {
+                    if (arrivals[node].fetch_add(1, std::memory_order_acq_rel) == 0) { break; }
+                    internal_node& in = internal[node];
+                    in.bbox = aabb(child_bounds(in.left, in.left_is_leaf, layout), child_bounds(in.right, in.right_is_leaf, layout));
+                    node = in.parent;
+                }
+            });
+
+            layout.nodes.reserve(2 * n);
+            flatten(0, false, layout);
+            return layout;
+        }
+
+    private:
+        static constexpr int32_t code_bits = sizeof(Code) == 4 ? 30 : 63;
+
+        struct internal_node {
+            aabb bbox;
+            int32_t left = 0;
+            int32_t right = 0;
+            bool left_is_leaf = false;
+            bool right_is_leaf = false;
+            int32_t parent = -1;
+            // ソート後の並びで、この部分木が持つプリミティブの範囲 [first, last]
+            int32_t first = 0;
+            int32_t last = 0;
+            int32_t split_bit = 0;
+        };
+
+        std::span<const aabb> bounds;
+        int32_t max_leaf_size;
+        std::vector<Code> codes;
+        std::vector<internal_node> internal;
+        std::vector<int32_t> leaf_parent;
+
+        static Code encode(const vec3& t) {
+            if constexpr (sizeof(Code) == 4) { return morton_code30(t.x(), t.y(), t.z()); }
+            else                             { return morton_code63(t.x(), t.y(), t.z()); }
+        }
+
+        /** ソート後のi番目とj番目のキーの共通接頭辞の長さ。同じコードは添字で区別する。 */
+        int32_t common_prefix(int32_t i, int32_t j) const {
+            if (j < 0 or j >= int32_t(codes.size())) { return -1; }
+            Code a = codes[i], b = codes[j];
+            if (a == b) { return int32_t(sizeof(Code) * 8) + std::countl_zero(uint32_t(i ^ j)); }
+            return std::countl_zero(Code(a ^ b));
+        }
+
+        void build_internal(int32_t i) {
+            // 範囲の伸びる向きを決める
+            const int32_t d = common_prefix(i, i + 1) > common_prefix(i, i - 1) ? 1 : -1;
+            const int32_t min_prefix = common_prefix(i, i - d);
+
+            // 範囲のもう一方の端を二分探索で求める
+            int32_t l_max = 2;
+            while (common_prefix(i, i + l_max * d) > min_prefix) { l_max *= 2; }
+            int32_t l = 0;
+            for (int32_t t = l_max / 2; t >= 1; t /= 2) {
+                if (common_prefix(i, i + (l + t) * d) > min_prefix) { l += t; }
+            }
+            const int32_t j = i + l * d;
+
+            // 範囲内で共通接頭辞が変わる位置（分割位置）を求める
+            const int32_t node_prefix = common_prefix(i, j);
+            int32_t s = 0;
+            int32_t t = l;
+            do {
+                t = (t + 1) >> 1;
+                if (common_prefix(i, i + (s + t) * d) > node_prefix) { s += t; }
+            } while (t > 1);
+            const int32_t gamma = i + s * d + std::min(d, 0);
+
+            internal_node& node = internal[i];
+            node.first = std::min(i, j);
+            node.last = std::max(i, j);
+            node.left = gamma;
+            node.right = gamma + 1;
+            node.left_is_leaf = (node.first == gamma);
+            node.right_is_leaf = (node.last == gamma + 1);
+            node.split_bit = node_prefix;
+            if (node.left_is_leaf) { leaf_parent[gamma] = i; } else { internal[gamma].parent = i; }
+            if (node.right_is_leaf) { leaf_parent[gamma + 1] = i; } else { internal[gamma + 1].parent = i; }
+        }
+
+        const aabb& child_bounds(int32_t child, bool is_leaf, const bvh_layout& layout) const {
+            return is_leaf ? bounds[layout.primitive_indices[child]] : internal[child].bbox;
+        }
+
+        void flatten(int32_t index, bool is_leaf, bvh_layout& layout) {
+            int32_t node_index = int32_t(layout.nodes.size());
+            layout.nodes.emplace_back();
+            if (is_leaf) {
+                layout.nodes[node_index].bbox = bounds[layout.primitive_indices[index]];
+                layout.nodes[node_index].offset = index;
+                layout.nodes[node_index].count = 1;
+                return;
+            }
+            const internal_node& node = internal[index];
+            layout.nodes[node_index].bbox = node.bbox;
+            // 小さな部分木は一つの葉にまとめる
+            if (node.last - node.first + 1 <= max_leaf_size) {
+                layout.nodes[node_index].offset = node.first;
+                layout.nodes[node_index].count = node.last - node.first + 1;
+                return;
+            }
+            flatten(node.left, node.left_is_leaf, layout);
+            layout.nodes[node_index].offset = int32_t(layout.nodes.size());
+            // 分割位置のビットから分割軸がわかる（コードは x, y, z の順に交互に並ぶ）
+            int32_t bit_from_top = node.split_bit - (int32_t(sizeof(Code) * 8) - code_bits);
+            layout.nodes[node_index].axis = (bit_from_top >= 0 and bit_from_top < code_bits) ? bit_from_top % 3 : 0;
+            flatten(node.right, node.right_is_leaf, layout);
+        }
+};
+
+#endif
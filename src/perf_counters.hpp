@@ -0,0 +1,202 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+/**
+ * Linuxの`perf_event_open`によるハードウェアカウンタ（サイクル、命令数、L1D・LLCミス、分岐予測ミス）の計測。
+ *
+ * カウンタはプロセス全体（`start`の後に作られたスレッドを含む）について数え、
+ * `phase`で囲んだ区間ごとの差分を名前ごとに合計する。子スレッドの値は、そのスレッドが終了した時点で加算される。
+ * カーネルやコンテナの設定でカウンタを開けないときは、その旨を表示して何も計測しない。
+ */
+namespace perf {
+    enum class event : int32_t { cycles, instructions, l1d_misses, llc_misses, branch_misses, count };
+    constexpr int32_t event_count = int32_t(event::count);
+
+    inline const char* event_name(event e) {
+        switch (e) {
+            case event::cycles:        return "cycles";
+            case event::instructions:  return "instructions";
+            case event::l1d_misses:    return "L1D misses";
+            case event::llc_misses:    return "LLC misses";
+            case event::branch_misses: return "branch misses";
+            case event::count:         break;
+        }
+        return "?";
+    }
+
+    struct sample {
+        std::array<double, event_count> values{};
+        double milliseconds = 0;
+    };
+
+    namespace detail {
+        struct phase_total {
+            std::string name;
+            sample total;
+            int64_t calls = 0;
+        };
+
+        inline bool active = false;
+        inline std::array<int, event_count> fds{-1, -1, -1, -1, -1};
+        inline std::mutex phases_mutex;
+        inline std::vector<phase_total> phases;
+
+#ifdef __linux__
+        inline int open_event(uint32_t type, uint64_t config) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = type;
+            attr.config = config;
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            return int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#endif
+
+        /** 現在のカウンタ値。多重化で計測されていなかった時間の分は比例で補う。開けなかったカウンタは負 */
+        inline sample read_now() {
+            sample s;
+            s.milliseconds = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+            for (int32_t i = 0; i < event_count; i++) {
+                s.values[i] = -1;
+#ifdef __linux__
+                if (fds[i] < 0) { continue; }
+                uint64_t data[3] = {0, 0, 0};
+                if (::read(fds[i], data, sizeof(data)) != ssize_t(sizeof(data))) { continue; }
+                s.values[i] = data[2] > 0 ? double(data[0]) * double(data[1]) / double(data[2]) : 0.0;
+#endif
+            }
+            return s;
+        }
+
+        inline void add_phase(const char* name, const sample& begin, const sample& end) {
+            std::lock_guard lock(phases_mutex);
+            phase_total* slot = nullptr;
+            for (auto& p : phases) {
+                if (p.name == name) { slot = &p; }
+            }
+            if (slot == nullptr) { slot = &phases.emplace_back(phase_total{name, {}, 0}); }
+            slot->calls++;
+            slot->total.milliseconds += end.milliseconds - begin.milliseconds;
+            for (int32_t i = 0; i < event_count; i++) {
+                if (begin.values[i] < 0 or end.values[i] < 0) { slot->total.values[i] = -1; }
+                else if (slot->total.values[i] >= 0) { slot->total.values[i] += end.values[i] - begin.values[i]; }
+            }
+        }
+    }
+
+    inline bool is_active() { return detail::active; }
+
+    /**
+     * @brief カウンタを開いて計測を始める。一つも開けなければ理由を表示してfalseを返す（以降の`phase`は何もしない）。
+     * 描画のスレッドを作る前に呼ぶこと。
+     */
+    inline bool start() {
+#ifdef __linux__
+        const std::array<std::pair<uint32_t, uint64_t>, event_count> configs{{
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        }};
+        int32_t opened = 0;
+        int last_error = 0;
+        for (int32_t i = 0; i < event_count; i++) {
+            detail::fds[i] = detail::open_event(configs[i].first, configs[i].second);
+            if (detail::fds[i] >= 0) { opened++; } else { last_error = errno; }
+        }
+        if (opened == 0) {
+            std::clog << "perf counters unavailable: " << std::strerror(last_error)
+                      << " (check /proc/sys/kernel/perf_event_paranoid)\n";
+            return false;
+        }
+        detail::active = true;
+        return true;
+#else
+        std::clog << "perf counters unavailable: perf_event_open is Linux only\n";
+        return false;
+#endif
+    }
+
+    /** スコープの間のカウンタの増分を`name`の区間として合計する */
+    class phase {
+        public:
+            explicit phase(const char* name) : name(name) {
+                if (is_active()) { begin = detail::read_now(); }
+            }
+            ~phase() {
+                if (is_active()) { detail::add_phase(name, begin, detail::read_now()); }
+            }
+            phase(const phase&) = delete;
+            phase& operator=(const phase&) = delete;
+
+        private:
+            const char* name;
+            sample begin;
+    };
+
+    /**
+     * @brief 区間ごとの計測結果を表示する。`ray_phase`の区間については`rays`本あたりのミス数も表示する。
+     * 区間は入れ子になりうる（シーンの構築はBVHの構築を含む）。
+     */
+    inline void print_report(std::ostream& out, const char* ray_phase, int64_t rays) {
+        if (not is_active()) { return; }
+        std::lock_guard lock(detail::phases_mutex);
+        auto value = [](double v) {
+            std::ostringstream s;
+            if (v < 0) { s << "-"; } else { s << std::fixed << std::setprecision(0) << v; }
+            return s.str();
+        };
+
+        out << "Hardware counters\n";
+        out << "  " << std::left << std::setw(14) << "phase" << std::right << std::setw(11) << "time[ms]";
+        for (int32_t i = 0; i < event_count; i++) { out << std::setw(16) << event_name(event(i)); }
+        out << std::setw(7) << "IPC" << '\n';
+        for (const auto& p : detail::phases) {
+            const sample& s = p.total;
+            out << "  " << std::left << std::setw(14) << p.name << std::right
+                << std::setw(11) << std::fixed << std::setprecision(1) << s.milliseconds;
+            for (int32_t i = 0; i < event_count; i++) { out << std::setw(16) << value(s.values[i]); }
+            double cycles = s.values[int32_t(event::cycles)];
+            double instructions = s.values[int32_t(event::instructions)];
+            if (cycles > 0 and instructions >= 0) { out << std::setw(7) << std::setprecision(2) << instructions / cycles; }
+            out << '\n';
+
+            if (p.name == ray_phase and rays > 0) {
+                out << "  " << std::left << std::setw(25) << "  per ray" << std::right;
+                for (int32_t i = 0; i < event_count; i++) {
+                    if (s.values[i] < 0) { out << std::setw(16) << "-"; }
+                    else { out << std::setw(16) << std::setprecision(3) << s.values[i] / double(rays); }
+                }
+                out << '\n';
+            }
+        }
+    }
+}
+
+#endif
@@ -6,6 +6,10 @@
 #include "aabb.hpp"
 #include "hittable.hpp"
 #include "hittable_list.hpp"
+#include "render_stats.hpp"
+
+#include <array>
+#include <type_traits>
 
 class plane_figure : public hittable {
     public:
@@ -30,8 +34,21 @@ class plane_figure : public hittable {
             bbox = aabb{box_diagnoal1, box_diagnoal2};
         }
         aabb bounding_box() const override { return bbox; }
+
+        /** `Q`と`u`, `v`が張る平行四辺形の4頂点（`Q`, `Q + u`, `Q + u + v`, `Q + v`） */
+        std::array<point3, 4> parallelogram() const { return {Q, Q + u, Q + u + v, Q + v}; }
         
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            return hit_as<plane_figure>(r, ray_t, rec);
+        }
+
+        /**
+         * @brief `hit`と同じ判定を、内側の判定を`Figure::is_interior`に固定して（仮想呼び出しなしに）行う。
+         * `Figure`はこのオブジェクトの実際の型でなければならない。
+         */
+        template<class Figure>
+        bool hit_as(const ray& r, interval ray_t, hit_record& rec) const {
+            render_stats::add(test_counter);
             double denom = dot(normal, r.direction());
             if (std::abs(denom) < 1e-8) { return false; }
 
@@ -43,7 +60,10 @@ class plane_figure : public hittable {
             double alpha = dot(w, cross(planar_hitpt_vector, v));
             double beta  = dot(w, cross(u, planar_hitpt_vector));
 
-            if (not is_interior(alpha, beta, rec)) { return false; }
+            bool interior;
+            if constexpr (std::is_same_v<Figure, plane_figure>) { interior = is_interior(alpha, beta, rec); }
+            else { interior = static_cast<const Figure&>(*this).Figure::is_interior(alpha, beta, rec); }
+            if (not interior) { return false; }
 
             rec.t = t;
             rec.p = intersection;
@@ -61,6 +81,8 @@ class plane_figure : public hittable {
         vec3 normal;
         vec3 w;
         double D;
+        // 統計で交差判定を数える種類
+        render_stats::counter test_counter = render_stats::counter::quad_tests;
 };
 
 class quad : public plane_figure {
@@ -97,6 +119,7 @@ class disk : public plane_figure {
             double r
         ): plane_figure(Q, u, v, mat), r(r)
         {
+            test_counter = render_stats::counter::disk_tests;
             set_bounding_box();
         }
         
@@ -122,7 +145,9 @@ class triangle : public plane_figure {
             const vec3& u,
             const vec3& v,
             shared_ptr<material> mat
-        ): plane_figure(Q, u, v, mat) {}
+        ): plane_figure(Q, u, v, mat) {
+            test_counter = render_stats::counter::triangle_tests;
+        }
         
         bool is_interior(double a, double b, hit_record& rec) const override {
             if (0 < a and 0 < b and a + b < 1) {
@@ -144,7 +169,9 @@ class ring : public plane_figure {
             double r_out,
             double r_in
         ): plane_figure(Q, u, v, mat), r_out(r_out), r_in(r_in)
-        {}
+        {
+            test_counter = render_stats::counter::ring_tests;
+        }
         
         bool is_interior(double a, double b, hit_record& rec) const override {
             a = (a - 0.5) * 2;
@@ -163,13 +190,14 @@ class ring : public plane_figure {
         double r_in;
 };
 
-inline shared_ptr<hittable_list>box(
-    const point3& a, 
-    const point3& b,
-    shared_ptr<material> mat
-) {
-    auto sides = make_shared<hittable_list>();
+/** 平行四辺形の起点と2辺 */
+struct quad_frame {
+    point3 Q;
+    vec3 u, v;
+};
 
+/** 対角の2頂点`a`と`b`で定まる直方体の6面 */
+inline std::array<quad_frame, 6> box_faces(const point3& a, const point3& b) {
     // 真反対の位置にあるボックス
     auto min = point3{
         std::min(a.x(), b.x()),
@@ -186,12 +214,23 @@ inline shared_ptr<hittable_list>box(
     vec3 dy = (max.y() - min.y()) * vec3{0, 1, 0};
     vec3 dz = (max.z() - min.z()) * vec3{0, 0, 1};
 
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), max.z()), dx, dy, mat));
-    sides->add(make_shared<quad>(point3(max.x(), min.y(), max.z()), -dz, dy, mat));
-    sides->add(make_shared<quad>(point3(max.x(), min.y(), min.z()), -dx, dy, mat));
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()), dz, dy, mat));
-    sides->add(make_shared<quad>(point3(min.x(), max.y(), max.z()), dx, -dz, mat));
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()), dx, dz, mat));
+    return {{
+        {point3(min.x(), min.y(), max.z()), dx, dy},
+        {point3(max.x(), min.y(), max.z()), -dz, dy},
+        {point3(max.x(), min.y(), min.z()), -dx, dy},
+        {point3(min.x(), min.y(), min.z()), dz, dy},
+        {point3(min.x(), max.y(), max.z()), dx, -dz},
+        {point3(min.x(), min.y(), min.z()), dx, dz},
+    }};
+}
+
+inline shared_ptr<hittable_list>box(
+    const point3& a, 
+    const point3& b,
+    shared_ptr<material> mat
+) {
+    auto sides = make_shared<hittable_list>();
+    for (const quad_frame& face : box_faces(a, b)) { sides->add(make_shared<quad>(face.Q, face.u, face.v, mat)); }
     return sides;
 }
 
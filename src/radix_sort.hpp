@@ -0,0 +1,73 @@
+#ifndef RADIX_SORT_H
+#define RADIX_SORT_H
+
+#include "parallel.hpp"
+
+#include <array>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief キーと値の組を、キーの下位`key_bits`ビットについて昇順に並べる並列LSD基数ソート（安定）。
+ * 1パスで8bitずつ処理し、各スレッドが受け持つ区間ごとのヒストグラムから書き込み位置を決める。
+ */
+template<class Key, class Value>
+void parallel_radix_sort(std::vector<Key>& keys, std::vector<Value>& values, int32_t key_bits) {
+    static_assert(std::is_unsigned_v<Key>);
+    constexpr int32_t radix_bits = 8;
+    constexpr int32_t radix = 1 << radix_bits;
+    const auto n = int64_t(keys.size());
+
+    std::vector<Key> keys_tmp(keys.size());
+    std::vector<Value> values_tmp(values.size());
+
+    const int64_t chunk_count = std::max<int64_t>(1, std::min<int64_t>(hardware_threads(), n / 4096));
+    const int64_t chunk_size = (n + chunk_count - 1) / std::max<int64_t>(chunk_count, 1);
+    std::vector<std::array<int64_t, radix>> histograms(chunk_count);
+
+    for (int32_t shift = 0; shift < key_bits; shift += radix_bits) {
+        auto digit = [shift](Key key) { return int32_t((key >> shift) & Key(radix - 1)); };
+
+        parallel_for(0, chunk_count, 1, [&](int64_t c) {
+            auto& histogram = histograms[c];
+            histogram.fill(0);
+            int64_t end = std::min(n, (c + 1) * chunk_size);
+            for (int64_t i = c * chunk_size; i < end; i++) { histogram[digit(keys[i])]++; }
+        });
+
+        // 全要素が同じ桁を持つパスは並びを変えないので飛ばす
+        bool trivial = false;
+        for (int32_t d = 0; d < radix; d++) {
+            int64_t total = 0;
+            for (const auto& histogram : histograms) { total += histogram[d]; }
+            if (total == n) { trivial = true; }
+            if (total != 0) { break; }
+        }
+        if (trivial) { continue; }
+
+        // 桁・チャンクの順に排他的累積和をとって書き込み開始位置にする
+        int64_t offset = 0;
+        for (int32_t d = 0; d < radix; d++) {
+            for (auto& histogram : histograms) {
+                int64_t count = histogram[d];
+                histogram[d] = offset;
+                offset += count;
+            }
+        }
+
+        parallel_for(0, chunk_count, 1, [&](int64_t c) {
+            auto& position = histograms[c];
+            int64_t end = std::min(n, (c + 1) * chunk_size);
+            for (int64_t i = c * chunk_size; i < end; i++) {
+                int64_t destination = position[digit(keys[i])]++;
+                keys_tmp[destination] = keys[i];
+                values_tmp[destination] = values[i];
+            }
+        });
+        keys.swap(keys_tmp);
+        values.swap(values_tmp);
+    }
+}
+
+#endif
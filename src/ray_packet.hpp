@@ -0,0 +1,233 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "rtweekend.hpp"
+
+#include "aabb.hpp"
+#include "bvh.hpp"
+#include "flat_bvh.hpp"
+#include "hittable.hpp"
+#include "hittable_list.hpp"
+#include "render_stats.hpp"
+#include "typed_bvh.hpp"
+
+#include <array>
+#include <bit>
+#include <span>
+
+/**
+ * @brief 最大`N`本（64本以下）のレイをまとめて交差判定するためのパケット。
+ *
+ * 箱との判定に使う始点と方向の逆数は軸ごとの配列（SoA）に持ち、全てのレイを同じループで調べる（コンパイラがSIMD化できる形）。
+ * 全てのレイの方向の符号が軸ごとに揃っていれば（隣接ピクセルのカメラレイなど）、始点と方向の逆数の範囲から
+ * 区間演算でパケット全体の入射・出射距離の範囲を求め、どのレイも当たらない箱を1回の判定で除く。
+ * `active`のビットが立っているレイだけを扱う。
+ */
+template<int32_t N>
+class ray_packet {
+    static_assert(0 < N and N <= 64);
+
+    public:
+        static constexpr int32_t size = N;
+
+        std::array<ray, N> rays;
+        // 当たったレイの交点と、それまでで最も近い交点の距離
+        std::array<hit_record, N> records;
+        std::array<double, N> t_max;
+        uint64_t active = 0;
+        uint64_t hits = 0;
+
+        // `set`しなかったレイは、どの箱にも当たらない値にしておく（`hit_mask`は全てのレイを同じループで調べるため）
+        explicit ray_packet(double t_min = 0.001) : t_min(t_min) { t_max.fill(-infinity); }
+
+        void set(int32_t k, const ray& r) {
+            rays[k] = r;
+            t_max[k] = infinity;
+            active |= uint64_t(1) << k;
+            for (int32_t axis = 0; axis < 3; axis++) {
+                origin[axis][k] = r.origin()[axis];
+                inv_direction[axis][k] = 1.0 / r.direction()[axis];
+            }
+        }
+
+        /** 全てのレイを`set`した後、区間演算の範囲を求める */
+        void finish_setup() {
+            coherent = active != 0;
+            for (int32_t axis = 0; axis < 3; axis++) {
+                origin_range[axis] = interval::empty;
+                inv_range[axis] = interval::empty;
+                for (int32_t k : bits(active)) {
+                    origin_range[axis] = interval(origin_range[axis], interval(origin[axis][k], origin[axis][k]));
+                    inv_range[axis] = interval(inv_range[axis], interval(inv_direction[axis][k], inv_direction[axis][k]));
+                }
+                // 方向の符号が混ざる軸（と、軸に平行なレイ）があれば区間演算は使わない
+                bool same_sign = inv_range[axis].min > 0 or inv_range[axis].max < 0;
+                coherent = coherent and same_sign and std::isfinite(inv_range[axis].min) and std::isfinite(inv_range[axis].max);
+            }
+        }
+
+        /** 区間演算で、パケットのどのレイも`box`に（`t_max`より手前で）当たらないことが分かるか */
+        bool misses_all(const aabb& box) const {
+            if (not coherent) { return false; }
+            double near_lower = t_min;
+            double far_upper = farthest_t_max;
+            for (int32_t axis = 0; axis < 3; axis++) {
+                const interval& slab = box.axis_interval(axis);
+                const bool positive = inv_range[axis].min > 0;
+                const double near_plane = positive ? slab.min : slab.max;
+                const double far_plane = positive ? slab.max : slab.min;
+                near_lower = std::max(near_lower, product_range(near_plane, axis).min);
+                far_upper = std::min(far_upper, product_range(far_plane, axis).max);
+            }
+            return near_lower > far_upper;
+        }
+
+        /** `mask`のレイのうち`box`に当たるもの（スラブ判定）のビット */
+        uint64_t hit_mask(const aabb& box, uint64_t mask) const {
+            std::array<double, N> t0, t1;
+            for (int32_t k = 0; k < N; k++) {
+                t0[k] = t_min;
+                t1[k] = t_max[k];
+            }
+            for (int32_t axis = 0; axis < 3; axis++) {
+                const interval& slab = box.axis_interval(axis);
+                const std::array<double, N>& o = origin[axis];
+                const std::array<double, N>& inv = inv_direction[axis];
+                for (int32_t k = 0; k < N; k++) {
+                    const double a = (slab.min - o[k]) * inv[k];
+                    const double b = (slab.max - o[k]) * inv[k];
+                    t0[k] = std::max(t0[k], std::min(a, b));
+                    t1[k] = std::min(t1[k], std::max(a, b));
+                }
+            }
+            uint64_t result = 0;
+            for (int32_t k = 0; k < N; k++) { result |= uint64_t(t0[k] < t1[k]) << k; }
+            return result & mask;
+        }
+
+        /** レイ`k`を1本のレイとして`object`と判定し、当たれば`t_max`と`records`を更新する */
+        void hit_single(const hittable& object, int32_t k) {
+            if (object.hit(rays[k], interval{t_min, t_max[k]}, records[k])) { record_hit(k); }
+        }
+
+        /** レイ`k`が`records[k]`で当たったことを記録する */
+        void record_hit(int32_t k) {
+            t_max[k] = records[k].t;
+            hits |= uint64_t(1) << k;
+            update_farthest();
+        }
+
+        /** 区間演算で使う、`active`のレイの`t_max`の最大値を求め直す */
+        void update_farthest() {
+            farthest_t_max = 0;
+            for (int32_t k : bits(active)) { farthest_t_max = std::max(farthest_t_max, t_max[k]); }
+        }
+
+        /** `mask`の立っているビットの位置を順に返す範囲 */
+        struct bit_range {
+            uint64_t mask;
+            struct iterator {
+                uint64_t rest;
+                int32_t operator*() const { return std::countr_zero(rest); }
+                iterator& operator++() { rest &= rest - 1; return *this; }
+                bool operator!=(const iterator& other) const { return rest != other.rest; }
+            };
+            iterator begin() const { return {mask}; }
+            iterator end() const { return {0}; }
+        };
+        static bit_range bits(uint64_t mask) { return {mask}; }
+
+        double min_t() const { return t_min; }
+
+    private:
+        double t_min;
+        double farthest_t_max = infinity;
+        std::array<std::array<double, N>, 3> origin{};
+        std::array<std::array<double, N>, 3> inv_direction{};
+        std::array<interval, 3> origin_range;
+        std::array<interval, 3> inv_range;
+        bool coherent = false;
+
+        /** 全てのレイについての (plane - origin) * inv_direction の範囲 */
+        interval product_range(double plane, int32_t axis) const {
+            const double d0 = plane - origin_range[axis].max;
+            const double d1 = plane - origin_range[axis].min;
+            const double i0 = inv_range[axis].min;
+            const double i1 = inv_range[axis].max;
+            const double p00 = d0 * i0, p01 = d0 * i1, p10 = d1 * i0, p11 = d1 * i1;
+            return interval(std::min(std::min(p00, p01), std::min(p10, p11)), std::max(std::max(p00, p01), std::max(p10, p11)));
+        }
+};
+
+/**
+ * @brief `flat_bvh_node`の並びをパケットで走査する。`hit_leaf(node, k)`で葉`node`をレイ`k`について調べる。
+ * 子は、区間演算で除けず1本以上のレイが箱に当たったときにだけ、そのレイの集合で辿る。
+ */
+template<int32_t N, class HitLeaf>
+void traverse_packet(std::span<const flat_bvh_node> nodes, ray_packet<N>& packet, uint64_t mask, HitLeaf&& hit_leaf) {
+    if (nodes.empty() or mask == 0) { return; }
+    struct entry {
+        int32_t node;
+        uint64_t mask;
+    };
+    entry stack[bvh_max_depth];
+    int32_t stack_size = 0;
+    entry current{0, mask};
+    // 子を辿る順は、最初の有効なレイの向きで決める
+    const vec3& direction = packet.rays[std::countr_zero(mask)].direction();
+
+    while (true) {
+        const flat_bvh_node& node = nodes[current.node];
+        render_stats::add(render_stats::counter::bvh_nodes_visited);
+        uint64_t m = packet.misses_all(node.bbox) ? 0 : packet.hit_mask(node.bbox, current.mask);
+        if (m != 0) {
+            if (node.is_leaf()) {
+                for (int32_t k : ray_packet<N>::bits(m)) { hit_leaf(node, k); }
+            } else {
+                if (direction[node.axis] < 0) {
+                    stack[stack_size++] = {current.node + 1, m};
+                    current = {node.offset, m};
+                } else {
+                    stack[stack_size++] = {node.offset, m};
+                    current = {current.node + 1, m};
+                }
+                continue;
+            }
+        }
+        if (stack_size == 0) { break; }
+        current = stack[--stack_size];
+    }
+}
+
+/**
+ * @brief `object`と`mask`のレイをパケットで判定する。
+ * リストと、`bvh_node`・`flat_bvh`・`typed_bvh`の内部ノードはパケットで辿り、
+ * それ以外（プリミティブ、平行移動や回転、`motion_bvh`など）は当たりうるレイを1本ずつ判定する。
+ */
+template<int32_t N>
+void hit_packet(const hittable& object, ray_packet<N>& packet, uint64_t mask) {
+    if (mask == 0) { return; }
+    if (auto list = dynamic_cast<const hittable_list*>(&object)) {
+        for (const auto& child : list->objects) { hit_packet(*child, packet, mask); }
+    } else if (auto node = dynamic_cast<const bvh_node*>(&object)) {
+        render_stats::add(render_stats::counter::bvh_nodes_visited);
+        if (packet.misses_all(node->bounding_box())) { return; }
+        mask = packet.hit_mask(node->bounding_box(), mask);
+        hit_packet(*node->left_child(), packet, mask);
+        if (node->right_child() != node->left_child()) { hit_packet(*node->right_child(), packet, mask); }
+    } else if (auto flat = dynamic_cast<const flat_bvh*>(&object)) {
+        traverse_packet(flat->node_array(), packet, mask, [&](const flat_bvh_node& leaf, int32_t k) {
+            interval ray_t{packet.min_t(), packet.t_max[k]};
+            if (flat->hit_leaf(leaf, packet.rays[k], ray_t, packet.records[k])) { packet.record_hit(k); }
+        });
+    } else if (auto typed = dynamic_cast<const typed_bvh*>(&object)) {
+        traverse_packet(typed->node_array(), packet, mask, [&](const flat_bvh_node& leaf, int32_t k) {
+            interval ray_t{packet.min_t(), packet.t_max[k]};
+            if (typed->hit_leaf(leaf, packet.rays[k], ray_t, packet.records[k])) { packet.record_hit(k); }
+        });
+    } else {
+        for (int32_t k : ray_packet<N>::bits(mask)) { packet.hit_single(object, k); }
+    }
+}
+
+#endif
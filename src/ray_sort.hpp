@@ -0,0 +1,45 @@
+#ifndef RAY_SORT_H
+#define RAY_SORT_H
+
+#include "rtweekend.hpp"
+
+#include "aabb.hpp"
+#include "morton.hpp"
+#include "radix_sort.hpp"
+
+#include <vector>
+
+/** 並べ替えのキーのビット数（上位3bitが方向の八分円、下位27bitが始点のMortonコード） */
+constexpr int32_t ray_sort_key_bits = 30;
+
+/**
+ * @brief 方向の八分円（各軸の符号）を上位に、`bounds`で正規化した始点の（各軸9bitの）Mortonコードを下位に並べたキー。
+ * 同じ向きに近い位置から出るレイほど近いキーを持つ。
+ */
+inline uint32_t ray_sort_key(const point3& origin, const vec3& direction, const aabb& bounds) {
+    const uint32_t octant = (direction.x() < 0 ? 4u : 0u) | (direction.y() < 0 ? 2u : 0u) | (direction.z() < 0 ? 1u : 0u);
+    auto normalize = [&](int32_t axis) {
+        const interval& range = bounds.axis_interval(axis);
+        return range.size() > 0 ? (origin[axis] - range.min) / range.size() : 0.0;
+    };
+    // 30bitのコードの上位27bit（各軸の上位9bit）だけを使う
+    const uint32_t morton = morton_code30(normalize(0), normalize(1), normalize(2)) >> 3;
+    return (octant << 27) | morton;
+}
+
+/**
+ * @brief 経路の添字`paths`を、始点`origins[path]`と方向`directions[path]`の`ray_sort_key`の順に（安定に）並べ替える。
+ * 始点の正規化には、並べる経路の始点全体を囲む箱を使う。
+ */
+inline void sort_rays(std::vector<int32_t>& paths, const std::vector<point3>& origins, const std::vector<vec3>& directions) {
+    if (paths.size() < 2) { return; }
+    aabb bounds = aabb::empty;
+    for (int32_t path : paths) { bounds = aabb(bounds, aabb(origins[path], origins[path])); }
+    std::vector<uint32_t> keys(paths.size());
+    for (size_t k = 0; k < paths.size(); k++) {
+        keys[k] = ray_sort_key(origins[paths[k]], directions[paths[k]], bounds);
+    }
+    parallel_radix_sort(keys, paths, ray_sort_key_bits);
+}
+
+#endif
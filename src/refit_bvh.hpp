@@ -0,0 +1,281 @@
+#ifndef REFIT_BVH_H
+#define REFIT_BVH_H
+
+#include "rtweekend.hpp"
+
+#include "bvh_build.hpp"
+#include "flat_bvh.hpp"
+#include "hittable.hpp"
+
+#include <chrono>
+#include <vector>
+
+/** `refit_bvh::update`で行った更新の種類 */
+enum class bvh_update_kind {
+    // 最初の構築
+    build,
+    // 木の形を保って箱だけを付け直した
+    refit,
+    // 箱を付け直したうえで、質の落ちた部分木だけを作り直した
+    partial_rebuild,
+    // 全体を作り直した
+    full_rebuild,
+};
+
+inline const char* bvh_update_name(bvh_update_kind kind) {
+    switch (kind) {
+        case bvh_update_kind::build:           return "build";
+        case bvh_update_kind::refit:           return "refit";
+        case bvh_update_kind::partial_rebuild: return "partial rebuild";
+        case bvh_update_kind::full_rebuild:    return "full rebuild";
+    }
+    return "?";
+}
+
+/** `refit_bvh::update`の結果 */
+struct bvh_update_report {
+    bvh_update_kind kind = bvh_update_kind::build;
+    double ms = 0;
+    // 更新後のSAHのコスト（`bvh_sah_cost`）と、それが全体を最後に構築した直後の何倍か
+    double sah = 0;
+    double degradation = 1;
+    // 作り直した部分木の数と、それらのプリミティブの数
+    int32_t rebuilt_subtrees = 0;
+    int64_t rebuilt_primitives = 0;
+};
+
+/**
+ * @brief フレームごとに動くプリミティブのBVHを、できるだけ木の形を保ったまま更新する。
+ *
+ * `update`に渡すプリミティブの数が前回と同じなら、`objects[i]`は前回の`objects[i]`が動いたものとみなし、
+ * 葉から根に向かって箱を付け直す（refit）。
+ * 部分木のSAHのコスト（部分木の根の表面積で正規化したもの）が、その部分木を構築した直後の`rebuild_threshold`倍を超えたら、
+ * そのような部分木のうち最も上にあるものだけをビルダで作り直す。根が超えたとき・プリミティブの数が変わったときは全体を作り直す。
+ * 更新後のBVHは`bvh()`で得る。これは次の`update`の後も使えるが、その間は前の構造をコピーして更新する。
+ */
+class refit_bvh {
+    public:
+        refit_bvh(bvh_builder builder, double rebuild_threshold) :
+            builder(builder), rebuild_threshold(rebuild_threshold)
+        {
+            // SBVHが参照を複製した箱は動いた後では意味を持たないので、複製しないビン分割を使う
+            if (builder == bvh_builder::recursive or builder == bvh_builder::sbvh) { this->builder = bvh_builder::binned; }
+        }
+
+        bvh_update_report update(const std::vector<shared_ptr<hittable>>& objects) {
+            auto begin = std::chrono::steady_clock::now();
+            bvh_update_report report;
+            const bool first = layout == nullptr;
+            current.reset();
+            bounds = primitive_bounds(objects);
+
+            if (first or layout->nodes.empty() or bounds.size() != size_t(layout->primitive_indices.size())) {
+                build_all();
+                report.kind = first ? bvh_update_kind::build : bvh_update_kind::full_rebuild;
+            } else {
+                // 前のBVHがまだ使われていれば、その構造は書き換えない
+                if (layout.use_count() > 1) { layout = make_shared<bvh_layout>(*layout); }
+                measure();
+                report.kind = bvh_update_kind::refit;
+                std::vector<int32_t> roots = degraded_subtrees();
+                if (not roots.empty() and roots.front() == 0) {
+                    build_all();
+                    report.kind = bvh_update_kind::full_rebuild;
+                } else if (not roots.empty() and rebuild_subtrees(roots, report)) {
+                    report.kind = bvh_update_kind::partial_rebuild;
+                } else if (not roots.empty()) {
+                    // 作り直した部分木が深すぎて走査スタックに収まらない
+                    build_all();
+                    report.kind = bvh_update_kind::full_rebuild;
+                }
+            }
+
+            current = make_shared<flat_bvh>(objects, layout, layout->nodes, layout->primitive_indices);
+            report.sah = costs.empty() ? 0 : costs[0];
+            report.degradation = root_built_cost > 0 ? report.sah / root_built_cost : 1;
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - begin;
+            report.ms = elapsed.count();
+            return report;
+        }
+
+        shared_ptr<flat_bvh> bvh() const { return current; }
+
+    private:
+        static constexpr int32_t batch_primitives = 64;
+
+        bvh_builder builder;
+        double rebuild_threshold;
+        shared_ptr<bvh_layout> layout;
+        shared_ptr<flat_bvh> current;
+        std::vector<aabb> bounds;
+        // 各ノードの部分木の、正規化したSAHのコストと、部分木を構築した直後のその値
+        std::vector<double> costs;
+        std::vector<double> built_costs;
+        double root_built_cost = 0;
+        // 各ノードの部分木が持つプリミティブの範囲`primitive_indices[first, first + count)`と、部分木のノードの範囲の終わり
+        std::vector<int32_t> subtree_first;
+        std::vector<int32_t> subtree_count;
+        std::vector<int32_t> subtree_end;
+        std::vector<int32_t> depths;
+
+        void build_all() {
+            layout = make_shared<bvh_layout>(build_bvh_layout(builder, bounds));
+            measure();
+            built_costs = costs;
+            root_built_cost = costs.empty() ? 0 : costs[0];
+        }
+
+        /**
+         * 子は親より後ろに並ぶので、後ろから順に箱を付け直し、部分木のコストと範囲を求める。
+         * 深さは前から順に求める。
+         */
+        void measure() {
+            std::vector<flat_bvh_node>& nodes = layout->nodes;
+            const auto n = nodes.size();
+            std::vector<double> sums(n);
+            costs.resize(n);
+            subtree_first.resize(n);
+            subtree_count.resize(n);
+            subtree_end.resize(n);
+            depths.resize(n);
+            for (auto i = int32_t(n) - 1; i >= 0; i--) {
+                flat_bvh_node& node = nodes[i];
+                if (node.is_leaf()) {
+                    node.bbox = aabb::empty;
+                    for (int32_t k = node.offset; k < node.offset + node.count; k++) {
+                        node.bbox = aabb(node.bbox, bounds[layout->primitive_indices[k]]);
+                    }
+                    sums[i] = node.bbox.surface_area() * node.count;
+                    subtree_first[i] = node.offset;
+                    subtree_count[i] = node.count;
+                    subtree_end[i] = i + 1;
+                } else {
+                    const int32_t left = i + 1;
+                    const int32_t right = node.offset;
+                    node.bbox = aabb(nodes[left].bbox, nodes[right].bbox);
+                    sums[i] = node.bbox.surface_area() + sums[left] + sums[right];
+                    subtree_first[i] = subtree_first[left];
+                    subtree_count[i] = subtree_count[left] + subtree_count[right];
+                    subtree_end[i] = subtree_end[right];
+                }
+                const double area = node.bbox.surface_area();
+                costs[i] = area > 0 ? sums[i] / area : node.count;
+            }
+            for (size_t i = 0; i < n; i++) {
+                if (i == 0) { depths[i] = 1; }
+                if (not nodes[i].is_leaf()) { depths[i + 1] = depths[nodes[i].offset] = depths[i] + 1; }
+            }
+        }
+
+        /**
+         * コストが構築直後の`rebuild_threshold`倍を超えた部分木のうち、祖先が超えていないものの根を深さ優先順に返す。
+         * 小さな部分木を1つずつ作り直すと呼び出しの手間が勝るので、そのような部分木を含む`batch_primitives`個以下の部分木はまとめて作り直す。
+         */
+        std::vector<int32_t> degraded_subtrees() const {
+            const std::vector<flat_bvh_node>& nodes = layout->nodes;
+            std::vector<uint8_t> contains_degraded(nodes.size());
+            for (auto i = int32_t(nodes.size()) - 1; i >= 0; i--) {
+                if (nodes[i].is_leaf()) { continue; }
+                contains_degraded[i] = costs[i] > rebuild_threshold * built_costs[i]
+                    or contains_degraded[i + 1] or contains_degraded[nodes[i].offset];
+            }
+            std::vector<int32_t> roots;
+            std::vector<int32_t> stack{0};
+            while (not stack.empty()) {
+                const int32_t i = stack.back();
+                stack.pop_back();
+                if (not contains_degraded[i]) { continue; }
+                if (costs[i] > rebuild_threshold * built_costs[i] or subtree_count[i] <= batch_primitives) {
+                    roots.push_back(i);
+                    continue;
+                }
+                stack.push_back(nodes[i].offset);
+                stack.push_back(i + 1);
+            }
+            return roots;
+        }
+
+        /**
+         * @brief 部分木`roots`（互いに重ならず、深さ優先順）を作り直し、ノード配列につなぎ直す。
+         * 作り直した部分木の葉は元の部分木と同じプリミティブの範囲を並べ替えて使う。
+         * @return 走査スタックの深さを超えるならfalse（何も変えない）
+         */
+        bool rebuild_subtrees(const std::vector<int32_t>& roots, bvh_update_report& report) {
+            const std::vector<flat_bvh_node>& nodes = layout->nodes;
+            std::vector<bvh_layout> subtrees(roots.size());
+            for (size_t r = 0; r < roots.size(); r++) {
+                const int32_t root = roots[r];
+                std::vector<aabb> sub_bounds(subtree_count[root]);
+                for (int32_t k = 0; k < subtree_count[root]; k++) {
+                    sub_bounds[k] = bounds[layout->primitive_indices[subtree_first[root] + k]];
+                }
+                subtrees[r] = build_bvh_layout(builder, sub_bounds);
+                if (depths[root] - 1 + max_depth(subtrees[r].nodes) > bvh_max_depth) { return false; }
+            }
+
+            // ノードを新しい配列に写し、元の位置から新しい位置への対応を作る
+            std::vector<flat_bvh_node> new_nodes;
+            std::vector<double> new_built_costs;
+            new_nodes.reserve(nodes.size());
+            new_built_costs.reserve(nodes.size());
+            std::vector<int32_t> remap(nodes.size(), -1);
+            std::vector<uint8_t> copied;
+            copied.reserve(nodes.size());
+            int32_t next = 0;
+            for (size_t r = 0; r <= roots.size(); r++) {
+                const int32_t until = r < roots.size() ? roots[r] : int32_t(nodes.size());
+                for (; next < until; next++) {
+                    remap[next] = int32_t(new_nodes.size());
+                    new_nodes.push_back(nodes[next]);
+                    new_built_costs.push_back(built_costs[next]);
+                    copied.push_back(1);
+                }
+                if (r == roots.size()) { break; }
+
+                const int32_t root = roots[r];
+                const int32_t first = subtree_first[root];
+                const auto base = int32_t(new_nodes.size());
+                remap[root] = base;
+                for (flat_bvh_node node : subtrees[r].nodes) {
+                    node.offset += node.is_leaf() ? first : base;
+                    new_nodes.push_back(node);
+                    new_built_costs.push_back(0);
+                    copied.push_back(0);
+                }
+                std::vector<int32_t> old_indices(
+                    layout->primitive_indices.begin() + first,
+                    layout->primitive_indices.begin() + first + subtree_count[root]);
+                for (size_t k = 0; k < old_indices.size(); k++) {
+                    layout->primitive_indices[first + k] = old_indices[subtrees[r].primitive_indices[k]];
+                }
+                report.rebuilt_subtrees++;
+                report.rebuilt_primitives += subtree_count[root];
+                next = subtree_end[root];
+            }
+            for (size_t i = 0; i < new_nodes.size(); i++) {
+                if (copied[i] and not new_nodes[i].is_leaf()) { new_nodes[i].offset = remap[new_nodes[i].offset]; }
+            }
+
+            layout->nodes = std::move(new_nodes);
+            measure();
+            // 作り直した部分木のコストを新しい基準にする
+            for (size_t i = 0; i < new_built_costs.size(); i++) {
+                if (not copied[i]) { new_built_costs[i] = costs[i]; }
+            }
+            built_costs = std::move(new_built_costs);
+            return true;
+        }
+
+        static int32_t max_depth(const std::vector<flat_bvh_node>& nodes) {
+            std::vector<int32_t> depth(nodes.size(), 1);
+            int32_t deepest = nodes.empty() ? 0 : 1;
+            for (size_t i = 0; i < nodes.size(); i++) {
+                if (nodes[i].is_leaf()) { continue; }
+                depth[i + 1] = depth[nodes[i].offset] = depth[i] + 1;
+                deepest = std::max(deepest, depth[i] + 1);
+            }
+            return deepest;
+        }
+};
+
+#endif
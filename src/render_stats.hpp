@@ -0,0 +1,185 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+#include <array>
+#include <cstdint>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+
+/**
+ * 描画の統計（レイ数、BVHの走査、プリミティブの交差判定、マテリアルごとのヒット数、パス長の分布）。
+ *
+ * 各スレッドはスレッドローカルなカウンタに加算し、仕事を終えたときに`flush`で全体の合計へまとめる。
+ * `RT_ENABLE_STATS`が定義されていなければ、計数の関数は空になりコードは生成されない。
+ */
+namespace render_stats {
+#ifdef RT_ENABLE_STATS
+    constexpr bool enabled = true;
+#else
+    constexpr bool enabled = false;
+#endif
+
+    enum class counter : int32_t {
+        primary_rays,
+        secondary_rays,
+        bvh_nodes_visited,
+        aabb_tests,
+        sphere_tests,
+        quad_tests,
+        triangle_tests,
+        disk_tests,
+        ring_tests,
+        box_tests,
+        medium_tests,
+        medium_scatters,
+        lambertian_hits,
+        metal_hits,
+        dielectric_hits,
+        diffuse_light_hits,
+        isotropic_hits,
+        other_material_hits,
+        count
+    };
+
+    inline const char* counter_name(counter c) {
+        switch (c) {
+            case counter::primary_rays:        return "primary rays";
+            case counter::secondary_rays:      return "secondary rays";
+            case counter::bvh_nodes_visited:   return "BVH nodes visited";
+            case counter::aabb_tests:          return "AABB tests";
+            case counter::sphere_tests:        return "sphere tests";
+            case counter::quad_tests:          return "quad tests";
+            case counter::triangle_tests:      return "triangle tests";
+            case counter::disk_tests:          return "disk tests";
+            case counter::ring_tests:          return "ring tests";
+            case counter::box_tests:           return "box tests";
+            case counter::medium_tests:        return "constant_medium tests";
+            case counter::medium_scatters:     return "constant_medium scatters";
+            case counter::lambertian_hits:     return "lambertian hits";
+            case counter::metal_hits:          return "metal hits";
+            case counter::dielectric_hits:     return "dielectric hits";
+            case counter::diffuse_light_hits:  return "diffuse_light hits";
+            case counter::isotropic_hits:      return "isotropic hits";
+            case counter::other_material_hits: return "other material hits";
+            case counter::count:               break;
+        }
+        return "?";
+    }
+
+    // パス長（1サンプルで追跡したレイの本数）の分布。これ以上の長さは最後の区間にまとめる
+    constexpr int32_t max_path_length = 64;
+
+    struct totals {
+        std::array<int64_t, size_t(counter::count)> counters{};
+        std::array<int64_t, max_path_length + 1> path_lengths{};
+
+        void merge(const totals& other) {
+            for (size_t i = 0; i < counters.size(); i++) { counters[i] += other.counters[i]; }
+            for (size_t i = 0; i < path_lengths.size(); i++) { path_lengths[i] += other.path_lengths[i]; }
+        }
+        int64_t operator[](counter c) const { return counters[size_t(c)]; }
+    };
+
+    namespace detail {
+        // 定数初期化されるので、アクセスに初期化の確認が入らない
+        inline thread_local constinit totals local{};
+        inline totals global{};
+        inline std::mutex global_mutex;
+    }
+
+    inline void add([[maybe_unused]] counter c, [[maybe_unused]] int64_t n = 1) {
+#ifdef RT_ENABLE_STATS
+        detail::local.counters[size_t(c)] += n;
+#endif
+    }
+
+    /** マテリアルへのヒットを数える。`hit_counter`の仮想呼び出しも統計が有効なときだけ行う */
+    template<class Material>
+    inline void add_material_hit([[maybe_unused]] const Material& mat) {
+#ifdef RT_ENABLE_STATS
+        add(mat.hit_counter());
+#endif
+    }
+
+    inline void record_path_length([[maybe_unused]] int64_t length) {
+#ifdef RT_ENABLE_STATS
+        detail::local.path_lengths[size_t(length < max_path_length ? length : max_path_length)]++;
+#endif
+    }
+
+    /** 呼び出したスレッドの、まだ`flush`していない計数。統計が無効なら0 */
+    inline int64_t local_count([[maybe_unused]] counter c) {
+#ifdef RT_ENABLE_STATS
+        return detail::local.counters[size_t(c)];
+#else
+        return 0;
+#endif
+    }
+
+    /** 呼び出したスレッドの、まだ`flush`していないプリミティブの交差判定の回数 */
+    inline int64_t local_primitive_tests() {
+        int64_t n = 0;
+        for (counter c : {counter::sphere_tests, counter::quad_tests, counter::triangle_tests,
+                          counter::disk_tests, counter::ring_tests, counter::box_tests, counter::medium_tests}) {
+            n += local_count(c);
+        }
+        return n;
+    }
+
+    /** 呼び出したスレッドのカウンタを全体の合計に加え、0に戻す */
+    inline void flush() {
+#ifdef RT_ENABLE_STATS
+        std::lock_guard lock(detail::global_mutex);
+        detail::global.merge(detail::local);
+        detail::local = totals{};
+#endif
+    }
+
+    /** これまでに`flush`された合計 */
+    inline totals collect() {
+        std::lock_guard lock(detail::global_mutex);
+        return detail::global;
+    }
+
+    inline void reset() {
+        std::lock_guard lock(detail::global_mutex);
+        detail::global = totals{};
+        detail::local = totals{};
+    }
+
+    /** 合計を表示する。`render_seconds`はMrays/sの計算に使う描画時間 */
+    inline void print_summary(std::ostream& out, const totals& t, double render_seconds) {
+        const int64_t rays = t[counter::primary_rays] + t[counter::secondary_rays];
+        auto per_ray = [rays](int64_t n) { return rays > 0 ? double(n) / double(rays) : 0.0; };
+
+        out << "Render statistics\n";
+        for (int32_t i = 0; i < int32_t(counter::count); i++) {
+            counter c = counter(i);
+            if (t[c] == 0) { continue; }
+            out << "  " << std::left << std::setw(26) << counter_name(c) << std::right
+                << std::setw(16) << t[c];
+            if (c != counter::primary_rays and c != counter::secondary_rays) {
+                out << std::setw(10) << std::fixed << std::setprecision(2) << per_ray(t[c]) << " /ray";
+            }
+            out << '\n';
+        }
+        if (render_seconds > 0) {
+            out << "  " << std::left << std::setw(26) << "Mrays/s" << std::right
+                << std::setw(16) << std::fixed << std::setprecision(3) << double(rays) / render_seconds / 1e6 << '\n';
+        }
+
+        int64_t paths = 0;
+        for (int64_t n : t.path_lengths) { paths += n; }
+        if (paths == 0) { return; }
+        out << "  path length histogram\n";
+        for (int32_t length = 0; length <= max_path_length; length++) {
+            int64_t n = t.path_lengths[length];
+            if (n == 0) { continue; }
+            out << "    " << std::setw(3) << length << (length == max_path_length ? "+" : " ")
+                << std::setw(14) << n << std::setw(8) << std::setprecision(1) << 100.0 * double(n) / double(paths) << "%\n";
+        }
+    }
+}
+
+#endif
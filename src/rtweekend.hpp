@@ -21,11 +21,17 @@ constexpr double pi = std::numbers::pi;
 inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180;
 }
+/**
+ * `random_double`などが使う乱数生成器。スレッドごとに独立していて、`seed`し直すと以降の乱数列を再現できる。
+ */
+inline std::mt19937& random_generator() {
+    thread_local std::mt19937 generator;
+    return generator;
+}
 /** Returns a random real in [0, 1) */
 inline double random_double() {
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
-    return distribution(generator);
+    std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    return distribution(random_generator());
 
 }
 inline double random_double(double min, double max) {
@@ -0,0 +1,474 @@
+#ifndef SBVH_H
+#define SBVH_H
+
+#include "rtweekend.hpp"
+
+#include "aabb.hpp"
+#include "axis_aligned.hpp"
+#include "flat_bvh.hpp"
+#include "hittable.hpp"
+#include "parallel_bvh.hpp"
+#include "quad.hpp"
+#include "sphere.hpp"
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <span>
+#include <vector>
+
+/** SBVHの参照。プリミティブ`primitive`の箱のうち、この参照が受け持つ部分を`bbox`に持つ */
+struct sbvh_reference {
+    aabb bbox;
+    int32_t primitive;
+};
+
+/**
+ * 参照`ref`のプリミティブのうち、`ref.bbox`の中で`axis`の座標が`slab`に入る部分を覆う箱を`part`に書く（なければ空の箱）。
+ * プリミティブを複数の葉に入れてはならない（`constant_medium`のように、判定を繰り返すと結果が変わる）ときはfalseを返す。
+ */
+using sbvh_clip_function = std::function<bool(const sbvh_reference& ref, int32_t axis, const interval& slab, aabb& part)>;
+
+/** `box`の`axis`の範囲を`range`との共通部分にしたもの（最小の厚みへの補正はしない） */
+inline aabb clip_box_axis(aabb box, int32_t axis, const interval& range) {
+    interval& target = axis == 0 ? box.x : axis == 1 ? box.y : box.z;
+    target = interval(std::max(target.min, range.min), std::min(target.max, range.max));
+    return box;
+}
+
+/** `a`と`b`の共通部分 */
+inline aabb clip_box(aabb box, const aabb& region) {
+    for (int32_t axis = 0; axis < 3; axis++) { box = clip_box_axis(box, axis, region.axis_interval(axis)); }
+    return box;
+}
+
+inline bool box_is_empty(const aabb& box) { return box.x.is_empty() or box.y.is_empty() or box.z.is_empty(); }
+
+/** 参照の箱そのものを切る。プリミティブの形を知らないときの既定の切り取り */
+inline bool clip_reference_box(const sbvh_reference& ref, int32_t axis, const interval& slab, aabb& part) {
+    part = clip_box_axis(ref.bbox, axis, slab);
+    return true;
+}
+
+/**
+ * @brief 凸多角形`polygon`のうち`axis`の座標が`slab`に入る部分を覆う箱（Sutherland–Hodgman法で2平面で切り取る）。
+ * 箱は`aabb`と同じく最小の厚みまで広げる。
+ */
+inline aabb clipped_polygon_bounds(std::span<const point3> polygon, int32_t axis, const interval& slab) {
+    std::array<point3, 8> current, next;
+    int32_t count = int32_t(polygon.size());
+    std::copy(polygon.begin(), polygon.end(), current.begin());
+    for (int32_t side = 0; side < 2 and count > 0; side++) {
+        const double plane = side == 0 ? slab.min : slab.max;
+        if (std::isinf(plane)) { continue; }
+        auto inside = [&](const point3& p) { return side == 0 ? p[axis] >= plane : p[axis] <= plane; };
+        int32_t kept = 0;
+        for (int32_t i = 0; i < count; i++) {
+            const point3& a = current[i];
+            const point3& b = current[(i + 1) % count];
+            if (inside(a)) { next[kept++] = a; }
+            if (inside(a) != inside(b)) {
+                point3 crossing = a + (plane - a[axis]) / (b[axis] - a[axis]) * (b - a);
+                crossing[axis] = plane;
+                next[kept++] = crossing;
+            }
+        }
+        std::swap(current, next);
+        count = kept;
+    }
+    if (count == 0) { return aabb::empty; }
+
+    std::array<interval, 3> axes;
+    for (int32_t i = 0; i < count; i++) {
+        for (int32_t k = 0; k < 3; k++) { axes[k] = interval(axes[k], interval(current[i][k], current[i][k])); }
+    }
+    return aabb(axes[0], axes[1], axes[2]);
+}
+
+/**
+ * @brief `objects`のプリミティブの形に沿って参照を切り取る関数。
+ * 三角形と平行四辺形は多角形を切り取った部分の箱（と参照の箱の共通部分）、
+ * 球・軸平行の長方形と直方体・円板と円環は参照の箱を切った箱にする。
+ * それ以外（媒質・インスタンス・入れ子のBVHなど）は複数の葉に入れない。
+ */
+inline sbvh_clip_function make_sbvh_clipper(const std::vector<shared_ptr<hittable>>& objects) {
+    // 多角形の頂点数（0: 箱で切る, -1: 切れない）と頂点
+    struct shape {
+        int32_t corners = -1;
+        std::array<point3, 4> polygon;
+    };
+    auto shapes = make_shared<std::vector<shape>>(objects.size());
+    for (size_t i = 0; i < objects.size(); i++) {
+        const hittable& object = *objects[i];
+        shape& s = (*shapes)[i];
+        if (auto figure = dynamic_cast<const plane_figure*>(&object)) {
+            s.polygon = figure->parallelogram();
+            if (dynamic_cast<const triangle*>(figure)) {
+                s.corners = 3;
+                s.polygon[2] = s.polygon[3];
+            } else {
+                s.corners = dynamic_cast<const quad*>(figure) ? 4 : 0;
+            }
+        } else if (dynamic_cast<const sphere*>(&object) or dynamic_cast<const aa_rect*>(&object) or dynamic_cast<const aa_box*>(&object)) {
+            s.corners = 0;
+        }
+    }
+    return [shapes](const sbvh_reference& ref, int32_t axis, const interval& slab, aabb& part) {
+        const shape& s = (*shapes)[ref.primitive];
+        if (s.corners < 0) { return false; }
+        if (s.corners == 0) { return clip_reference_box(ref, axis, slab, part); }
+        const aabb region = clip_box_axis(ref.bbox, axis, slab);
+        part = box_is_empty(region) ? aabb::empty : clip_box(clipped_polygon_bounds(std::span(s.polygon).first(s.corners), axis, slab), region);
+        return true;
+    };
+}
+
+/** 空間分割で増やしてよい参照の数の、プリミティブ数に対する割合の既定値 */
+constexpr double sbvh_default_budget = 0.3;
+
+/**
+ * @brief 空間分割を併用するSAHのビルダ（SBVH, Stich et al. 2009）。
+ *
+ * 各ノードで、重心のビン分割によるオブジェクト分割に加え、子の箱の重なりが大きいときは
+ * 平面をまたぐ参照を`clip`で切り取って両側に入れる空間分割も評価し、SAHのコストが小さい方を選ぶ。
+ * 空間分割では、またぐ参照ごとに片側へ寄せた方が安ければ切らずに寄せる（reference unsplitting）。
+ * 参照の総数は（プリミティブ数）×（1 + `budget`）を超えない。
+ * 同じプリミティブが複数の葉に現れるので、`primitive_indices`はプリミティブ数より長くなる。
+ * 1つの葉に同じプリミティブが2度入ることはない。構築は直列に行う。
+ */
+class sbvh_builder {
+    public:
+        sbvh_builder(
+            std::span<const aabb> bounds,
+            double budget = sbvh_default_budget,
+            sbvh_clip_function clip = clip_reference_box,
+            int32_t max_leaf_size = 4
+        ) :
+            bounds(bounds), budget(budget), clip(std::move(clip)), max_leaf_size(max_leaf_size) {}
+
+        bvh_layout build() {
+            bvh_layout layout;
+            const auto n = int64_t(bounds.size());
+            if (n == 0) { return layout; }
+
+            std::vector<sbvh_reference> references(n);
+            aabb root_box = aabb::empty;
+            for (int64_t i = 0; i < n; i++) {
+                references[i] = {bounds[i], int32_t(i)};
+                root_box = aabb(root_box, bounds[i]);
+            }
+            root_area = root_box.surface_area();
+            reference_count = n;
+            reference_limit = n + int64_t(budget * double(n));
+            // 切れるかを1度だけ調べておく
+            splittable.resize(n);
+            for (int64_t i = 0; i < n; i++) {
+                aabb part;
+                splittable[i] = clip(references[i], 0, interval::universe, part);
+            }
+
+            build_nodes.emplace_back();
+            build_recursive(0, std::move(references), 0);
+            layout.nodes = flatten_build_nodes(build_nodes, 0, build_nodes.size());
+            layout.primitive_indices = std::move(indices);
+            return layout;
+        }
+
+    private:
+        static constexpr int32_t object_bins = 16;
+        static constexpr int32_t spatial_bins = 16;
+        // 子の箱の重なりの表面積が根のこの割合を超えるノードでだけ空間分割を調べる
+        static constexpr double overlap_threshold = 1e-5;
+        // この深さを超えたら空間分割をしない
+        static constexpr int32_t spatial_split_depth = 48;
+        // この深さを超えたら個数で二等分して、木の深さを抑える
+        static constexpr int32_t median_split_depth = 64;
+
+        std::span<const aabb> bounds;
+        double budget;
+        sbvh_clip_function clip;
+        int32_t max_leaf_size;
+        double root_area = 0;
+        int64_t reference_count = 0;
+        int64_t reference_limit = 0;
+        std::vector<bvh_build_node> build_nodes;
+        std::vector<int32_t> indices;
+        std::vector<bool> splittable;
+
+        struct split {
+            double cost = infinity;
+            int32_t axis = 0;
+            // オブジェクト分割: 右側の最初のビン / 空間分割: 平面の位置
+            int32_t bin = 0;
+            double position = 0;
+            aabb left = aabb::empty;
+            aabb right = aabb::empty;
+        };
+
+        static double centroid(const sbvh_reference& ref, int32_t axis) {
+            const interval& range = ref.bbox.axis_interval(axis);
+            return (range.min + range.max) / 2;
+        }
+
+        /** 全ての軸について重心のビン分割を調べ、SAHのコスト（表面積×個数の和）が最小の分割を返す */
+        split find_object_split(const std::vector<sbvh_reference>& refs, const aabb& centroid_bounds) const {
+            split best;
+            const int32_t bins_used = std::min(object_bins, int32_t(refs.size()));
+            for (int32_t axis = 0; axis < 3; axis++) {
+                const interval& extent = centroid_bounds.axis_interval(axis);
+                if (extent.size() <= 0) { continue; }
+                const double scale = bins_used / extent.size();
+                std::array<aabb, object_bins> boxes;
+                std::array<int32_t, object_bins> counts{};
+                boxes.fill(aabb::empty);
+                for (const sbvh_reference& ref : refs) {
+                    const int32_t b = object_bin(ref, axis, extent.min, scale, bins_used);
+                    boxes[b] = aabb(boxes[b], ref.bbox);
+                    counts[b]++;
+                }
+                evaluate_bins(boxes, counts, counts, bins_used, axis, best, [&](int32_t i) {
+                    best.bin = i;
+                    best.position = extent.min + i / scale;
+                });
+            }
+            return best;
+        }
+
+        static int32_t object_bin(const sbvh_reference& ref, int32_t axis, double origin, double scale, int32_t bins_used) {
+            return std::clamp(int32_t((centroid(ref, axis) - origin) * scale), 0, bins_used - 1);
+        }
+
+        /**
+         * 全ての軸について、ノードの箱を等間隔に切る平面での空間分割を調べる。
+         * 参照はまたぐビンごとに`clip`で切り取って各ビンに入れ、入るビンと出るビンで数える。
+         */
+        split find_spatial_split(const std::vector<sbvh_reference>& refs, const aabb& bbox) const {
+            split best;
+            for (int32_t axis = 0; axis < 3; axis++) {
+                const interval& extent = bbox.axis_interval(axis);
+                if (extent.size() <= 0) { continue; }
+                const double width = extent.size() / spatial_bins;
+                auto bin_at = [&](double x) { return std::clamp(int32_t((x - extent.min) / width), 0, spatial_bins - 1); };
+                std::array<aabb, spatial_bins> boxes;
+                std::array<int32_t, spatial_bins> entries{}, exits{};
+                boxes.fill(aabb::empty);
+
+                for (const sbvh_reference& ref : refs) {
+                    if (not splittable[ref.primitive]) {
+                        // 切れない参照は重心のビンに丸ごと入れる
+                        const int32_t b = bin_at(centroid(ref, axis));
+                        boxes[b] = aabb(boxes[b], ref.bbox);
+                        entries[b]++;
+                        exits[b]++;
+                        continue;
+                    }
+                    const int32_t first = bin_at(ref.bbox.axis_interval(axis).min);
+                    const int32_t last = bin_at(ref.bbox.axis_interval(axis).max);
+                    for (int32_t b = first; b <= last; b++) {
+                        // 端のビンは参照の箱の端まで含める
+                        const interval slab(b == first ? -infinity : extent.min + b * width,
+                                            b == last ? infinity : extent.min + (b + 1) * width);
+                        aabb part;
+                        if (first == last) { part = ref.bbox; } else { clip(ref, axis, slab, part); }
+                        if (not box_is_empty(part)) { boxes[b] = aabb(boxes[b], part); }
+                    }
+                    entries[first]++;
+                    exits[last]++;
+                }
+                evaluate_bins(boxes, entries, exits, spatial_bins, axis, best, [&](int32_t i) {
+                    best.bin = i;
+                    best.position = extent.min + i * width;
+                });
+            }
+            return best;
+        }
+
+        /**
+         * ビン`i`の手前で分けたときのコスト（左の箱の表面積×`left_counts`の和 + 右の箱の表面積×`right_counts`の和）を求め、
+         * `best`より小さければ`best`を更新して`on_better(i)`を呼ぶ。
+         */
+        template<size_t Bins, class OnBetter>
+        static void evaluate_bins(
+            const std::array<aabb, Bins>& boxes,
+            const std::array<int32_t, Bins>& left_counts,
+            const std::array<int32_t, Bins>& right_counts,
+            int32_t bins_used,
+            int32_t axis,
+            split& best,
+            OnBetter&& on_better
+        ) {
+            std::array<aabb, Bins> right_boxes;
+            std::array<int32_t, Bins> right_totals{};
+            aabb accumulated = aabb::empty;
+            int32_t total = 0;
+            for (int32_t i = bins_used - 1; i > 0; i--) {
+                accumulated = aabb(accumulated, boxes[i]);
+                total += right_counts[i];
+                right_boxes[i] = accumulated;
+                right_totals[i] = total;
+            }
+            accumulated = aabb::empty;
+            total = 0;
+            for (int32_t i = 1; i < bins_used; i++) {
+                accumulated = aabb(accumulated, boxes[i - 1]);
+                total += left_counts[i - 1];
+                if (total == 0 or right_totals[i] == 0) { continue; }
+                const double cost = accumulated.surface_area() * total + right_boxes[i].surface_area() * right_totals[i];
+                if (cost < best.cost) {
+                    best.cost = cost;
+                    best.axis = axis;
+                    best.left = accumulated;
+                    best.right = right_boxes[i];
+                    on_better(i);
+                }
+            }
+        }
+
+        void make_leaf(int32_t node_index, const std::vector<sbvh_reference>& refs, const aabb& bbox) {
+            bvh_build_node& node = build_nodes[node_index];
+            node.bbox = bbox;
+            node.first = int32_t(indices.size());
+            node.count = int32_t(refs.size());
+            for (const sbvh_reference& ref : refs) { indices.push_back(ref.primitive); }
+        }
+
+        /** 空間分割の平面で参照を左右に分ける。平面をまたぐ参照は、切るか片側に寄せるかの安い方にする */
+        void partition_spatial(
+            const std::vector<sbvh_reference>& refs,
+            const split& s,
+            std::vector<sbvh_reference>& left,
+            std::vector<sbvh_reference>& right
+        ) {
+            std::vector<const sbvh_reference*> straddling;
+            aabb left_box = aabb::empty, right_box = aabb::empty;
+            for (const sbvh_reference& ref : refs) {
+                const interval& range = ref.bbox.axis_interval(s.axis);
+                if (range.max <= s.position) {
+                    left.push_back(ref);
+                    left_box = aabb(left_box, ref.bbox);
+                } else if (range.min >= s.position) {
+                    right.push_back(ref);
+                    right_box = aabb(right_box, ref.bbox);
+                } else {
+                    straddling.push_back(&ref);
+                }
+            }
+            for (const sbvh_reference* ref : straddling) {
+                aabb left_part, right_part;
+                const bool can_split = splittable[ref->primitive]
+                    and clip(*ref, s.axis, interval(-infinity, s.position), left_part)
+                    and clip(*ref, s.axis, interval(s.position, infinity), right_part);
+                const auto n_left = double(left.size());
+                const auto n_right = double(right.size());
+                const double to_left = aabb(left_box, ref->bbox).surface_area() * (n_left + 1) + right_box.surface_area() * n_right;
+                const double to_right = left_box.surface_area() * n_left + aabb(right_box, ref->bbox).surface_area() * (n_right + 1);
+                double duplicate = infinity;
+                if (can_split and not box_is_empty(left_part) and not box_is_empty(right_part) and reference_count < reference_limit) {
+                    duplicate = aabb(left_box, left_part).surface_area() * (n_left + 1)
+                              + aabb(right_box, right_part).surface_area() * (n_right + 1);
+                }
+                if (can_split and box_is_empty(right_part)) {
+                    left.push_back({left_part, ref->primitive});
+                    left_box = aabb(left_box, left_part);
+                } else if (can_split and box_is_empty(left_part)) {
+                    right.push_back({right_part, ref->primitive});
+                    right_box = aabb(right_box, right_part);
+                } else if (duplicate < to_left and duplicate < to_right) {
+                    left.push_back({left_part, ref->primitive});
+                    right.push_back({right_part, ref->primitive});
+                    left_box = aabb(left_box, left_part);
+                    right_box = aabb(right_box, right_part);
+                    reference_count++;
+                } else if (to_left <= to_right) {
+                    left.push_back(*ref);
+                    left_box = aabb(left_box, ref->bbox);
+                } else {
+                    right.push_back(*ref);
+                    right_box = aabb(right_box, ref->bbox);
+                }
+            }
+        }
+
+        void build_recursive(int32_t node_index, std::vector<sbvh_reference> refs, int32_t depth) {
+            const auto n = int32_t(refs.size());
+            aabb bbox = aabb::empty;
+            aabb centroid_bounds = aabb::empty;
+            for (const sbvh_reference& ref : refs) {
+                bbox = aabb(bbox, ref.bbox);
+                const point3 c = ref.bbox.centroid();
+                centroid_bounds = aabb(centroid_bounds, aabb(c, c));
+            }
+            if (n <= 1) {
+                make_leaf(node_index, refs, bbox);
+                return;
+            }
+
+            std::vector<sbvh_reference> left, right;
+            int32_t axis = centroid_bounds.longest_axis();
+            if (depth < median_split_depth) {
+                split object = find_object_split(refs, centroid_bounds);
+                split spatial;
+                const aabb overlap = clip_box_axis(clip_box_axis(clip_box_axis(
+                    object.left, 0, object.right.x), 1, object.right.y), 2, object.right.z);
+                if (depth < spatial_split_depth and reference_count < reference_limit and root_area > 0
+                    and (object.cost == infinity or
+                         (not box_is_empty(overlap) and overlap.surface_area() / root_area > overlap_threshold))) {
+                    spatial = find_spatial_split(refs, bbox);
+                }
+
+                const double best_cost = std::min(object.cost, spatial.cost);
+                if (best_cost < infinity) {
+                    const double leaf_cost = n;
+                    const double split_cost = 1 + best_cost / bbox.surface_area();
+                    if (n <= max_leaf_size and leaf_cost <= split_cost) {
+                        make_leaf(node_index, refs, bbox);
+                        return;
+                    }
+                    if (spatial.cost < object.cost) {
+                        partition_spatial(refs, spatial, left, right);
+                        axis = spatial.axis;
+                    } else {
+                        const double scale = std::min(object_bins, n) / centroid_bounds.axis_interval(object.axis).size();
+                        for (const sbvh_reference& ref : refs) {
+                            const int32_t b = object_bin(ref, object.axis, centroid_bounds.axis_interval(object.axis).min,
+                                                         scale, std::min(object_bins, n));
+                            (b < object.bin ? left : right).push_back(ref);
+                        }
+                        axis = object.axis;
+                    }
+                    if (left.empty() or right.empty()) {
+                        left.clear();
+                        right.clear();
+                    }
+                }
+            }
+
+            if (left.empty()) {
+                // 重心が一致しているか深すぎる場合は個数で二等分する
+                if (n <= max_leaf_size) {
+                    make_leaf(node_index, refs, bbox);
+                    return;
+                }
+                const int32_t mid = n / 2;
+                std::nth_element(refs.begin(), refs.begin() + mid, refs.end(), [&](const auto& a, const auto& b) {
+                    return centroid(a, axis) < centroid(b, axis);
+                });
+                left.assign(refs.begin(), refs.begin() + mid);
+                right.assign(refs.begin() + mid, refs.end());
+            }
+            refs.clear();
+            refs.shrink_to_fit();
+
+            const auto left_index = int32_t(build_nodes.size());
+            build_nodes.emplace_back();
+            build_nodes.emplace_back();
+            build_nodes[node_index].bbox = bbox;
+            build_nodes[node_index].left = left_index;
+            build_nodes[node_index].right = left_index + 1;
+            build_nodes[node_index].axis = axis;
+            build_recursive(left_index, std::move(left), depth + 1);
+            build_recursive(left_index + 1, std::move(right), depth + 1);
+        }
+};
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef SCENE_COMPILER_H
+#define SCENE_COMPILER_H
+
+#include "rtweekend.hpp"
+
+#include "axis_aligned.hpp"
+#include "bvh_build.hpp"
+#include "constant_medium.hpp"
+#include "hittable.hpp"
+#include "hittable_list.hpp"
+#include "memory_tracker.hpp"
+#include "quad.hpp"
+#include "scene_desc.hpp"
+#include "scene_loader.hpp"
+#include "sphere.hpp"
+
+#include <vector>
+
+/**
+ * 平行移動とY軸回りの回転を合成した変換 p ↦ R(angle) p + offset。
+ * 回転の向きは`rotate_y`と同じ。
+ */
+struct instance_transform {
+    // 度数法
+    double angle = 0;
+    vec3 offset{0, 0, 0};
+
+    bool has_rotation() const { return angle != 0; }
+    bool has_offset() const { return offset.length_squared() > 0; }
+
+    vec3 apply_vector(const vec3& p) const {
+        if (not has_rotation()) { return p; }
+        double radians = degrees_to_radians(angle);
+        double sin_theta = std::sin(radians);
+        double cos_theta = std::cos(radians);
+        return vec3{cos_theta * p[0] + sin_theta * p[2], p[1], -sin_theta * p[0] + cos_theta * p[2]};
+    }
+    point3 apply_point(const point3& p) const { return apply_vector(p) + offset; }
+
+    /** 子の座標系で`delta`だけ平行移動してからこの変換を行う変換 */
+    instance_transform translated(const vec3& delta) const { return {angle, apply_vector(delta) + offset}; }
+    /** 子の座標系で`degrees`だけ回転してからこの変換を行う変換 */
+    instance_transform rotated(double degrees) const { return {angle + degrees, offset}; }
+};
+
+/**
+ * @brief シーンの中間表現を、入れ子の`hittable_list`・`translate`・`rotate_y`・BVHを持たない
+ * プリミティブの並びに展開し、その全体に1つのBVHを構築する。
+ *
+ * 静的な平行移動と回転はプリミティブの頂点・中心に焼き込む。回転した`box`は6枚の`quad`に分解する。
+ * 焼き込めないもの（動く平行移動、UVを使うテクスチャを持つ回転した球）は、元の形状を変換のインスタンスで包んで1つのプリミティブとする。
+ * `constant_medium`は境界を同様に展開して作り直す。複数の親から参照される形状は、参照ごとに複製される。
+ * BVHのビルダが`recursive`（既定）のときは、代わりに`binned`を用いる。
+ * 座標の計算順序が変わるため、結果の画像は入れ子のまま描画したものと浮動小数点の誤差の範囲で異なりうる。
+ */
+class scene_compiler {
+    public:
+        scene_compiler(const scene_view& scene, scene_loader& loader, bvh_options bvh = {}) :
+            scene(scene), loader(loader), bvh(bvh)
+        {
+            // 大きさの異なるプリミティブが混ざる全体の木では中央値分割の質が大きく落ちるので、既定ではSAHで構築する
+            if (this->bvh.builder == bvh_builder::recursive) { this->bvh.builder = bvh_builder::binned; }
+        }
+
+        /** ワールド全体を展開したプリミティブの数（`compile_world`の後で有効） */
+        size_t primitive_count = 0;
+
+        /** ワールドを、変換を焼き込んだプリミティブの並びに展開する（媒質の境界の中にはBVHを作る） */
+        std::vector<shared_ptr<hittable>> compile_primitives() {
+            std::vector<shared_ptr<hittable>> leaves;
+            for (int32_t object : scene.world) { compile_object(object, instance_transform{}, leaves); }
+            return leaves;
+        }
+
+        /** 形状`object`に変換`xf`を施し、プリミティブの並びに展開して`leaves`に加える */
+        void compile_object(int32_t object, const instance_transform& xf, std::vector<shared_ptr<hittable>>& leaves) {
+            memory_tracker::scope memory(memory_tracker::tag::geometry);
+            compile(object, xf, leaves);
+        }
+
+        hittable_list compile_world() {
+            std::vector<shared_ptr<hittable>> leaves = compile_primitives();
+            primitive_count = leaves.size();
+            hittable_list world;
+            if (not leaves.empty()) { world.add(make_bvh(leaves, bvh, "flattened")); }
+            return world;
+        }
+
+    private:
+        scene_view scene;
+        scene_loader& loader;
+        bvh_options bvh;
+
+        void compile(int32_t index, const instance_transform& xf, std::vector<shared_ptr<hittable>>& leaves) {
+            const shape_desc& s = scene.shapes[index];
+            switch (s.kind) {
+                case shape_kind::sphere:
+                    if (xf.has_rotation() and material_uses_uv(s.material)) { break; }
+                    leaves.push_back(make_shared<sphere>(xf.apply_point(s.p0), s.a, loader.material_at(s.material)));
+                    return;
+                case shape_kind::moving_sphere:
+                    if (xf.has_rotation() and material_uses_uv(s.material)) { break; }
+                    leaves.push_back(make_shared<sphere>(
+                        xf.apply_point(s.p0), xf.apply_point(s.p1), s.a, loader.material_at(s.material)));
+                    return;
+                case shape_kind::quad:
+                    leaves.push_back(make_quad(
+                        xf.apply_point(s.p0), xf.apply_vector(s.p1), xf.apply_vector(s.p2), loader.material_at(s.material)));
+                    return;
+                case shape_kind::triangle:
+                    leaves.push_back(make_shared<triangle>(
+                        xf.apply_point(s.p0), xf.apply_vector(s.p1), xf.apply_vector(s.p2), loader.material_at(s.material)));
+                    return;
+                case shape_kind::disk:
+                    leaves.push_back(make_shared<disk>(
+                        xf.apply_point(s.p0), xf.apply_vector(s.p1), xf.apply_vector(s.p2), loader.material_at(s.material), s.a));
+                    return;
+                case shape_kind::ring:
+                    leaves.push_back(make_shared<ring>(
+                        xf.apply_point(s.p0), xf.apply_vector(s.p1), xf.apply_vector(s.p2),
+                        loader.material_at(s.material), s.a, s.b));
+                    return;
+                case shape_kind::box:
+                    if (not xf.has_rotation()) {
+                        leaves.push_back(make_box(s.p0 + xf.offset, s.p1 + xf.offset, loader.material_at(s.material)));
+                        return;
+                    }
+                    for (const quad_frame& face : box_faces(s.p0, s.p1)) {
+                        leaves.push_back(make_quad(
+                            xf.apply_point(face.Q), xf.apply_vector(face.u), xf.apply_vector(face.v),
+                            loader.material_at(s.material)));
+                    }
+                    return;
+                case shape_kind::list:
+                case shape_kind::bvh:
+                    for (int32_t child : scene.children_of(s)) { compile(child, xf, leaves); }
+                    return;
+                case shape_kind::translate:
+                    compile(scene.children[s.first_child], xf.translated(s.p0), leaves);
+                    return;
+                case shape_kind::rotate_y:
+                    compile(scene.children[s.first_child], xf.rotated(s.a), leaves);
+                    return;
+                case shape_kind::constant_medium: {
+                    std::vector<shared_ptr<hittable>> boundary;
+                    compile(scene.children[s.first_child], xf, boundary);
+                    if (boundary.empty()) { return; }
+                    auto shape = boundary.size() == 1 ? boundary[0] : make_bvh(boundary, bvh, "flattened_medium");
+                    leaves.push_back(make_shared<constant_medium>(shape, s.a, loader.texture_at(s.texture)));
+                    return;
+                }
+                case shape_kind::moving_translate:
+                    break;
+            }
+            leaves.push_back(instance(loader.shape(index), xf));
+        }
+
+        /** 焼き込めない形状を変換`xf`のインスタンスにする */
+        static shared_ptr<hittable> instance(shared_ptr<hittable> object, const instance_transform& xf) {
+            if (xf.has_rotation()) { object = make_shared<rotate_y>(object, xf.angle); }
+            if (xf.has_offset()) { object = make_shared<translate>(object, xf.offset); }
+            return object;
+        }
+
+        /** マテリアルの色がUV座標に依存する（画像テクスチャを含む）か */
+        bool material_uses_uv(int32_t index) const {
+            return index >= 0 and texture_uses_uv(scene.materials[index].texture);
+        }
+
+        bool texture_uses_uv(int32_t index) const {
+            if (index < 0) { return false; }
+            const texture_desc& t = scene.textures[index];
+            switch (t.kind) {
+                case texture_kind::image:   return true;
+                case texture_kind::checker: return texture_uses_uv(t.even) or texture_uses_uv(t.odd);
+                default:                    return false;
+            }
+        }
+};
+
+#endif
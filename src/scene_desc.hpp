@@ -0,0 +1,306 @@
+#ifndef SCENE_DESC_H
+#define SCENE_DESC_H
+
+#include "rtweekend.hpp"
+
+#include <span>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/**
+ * シーンの中間表現（IR）。
+ * テキスト・バイナリのシーンファイルと`world_setups`の双方がこの表現を介してやり取りする。
+ * 各レコードはPODであり、バイナリ形式ではファイル上のバイト列をそのまま参照できる。
+ * 子要素の参照は常に自分より小さい添字を指す（定義順＝トポロジカル順）。
+ */
+
+/** `camera`の公開パラメータと一対一に対応する設定値 */
+struct camera_desc {
+    double aspect_ratio = 1.0;
+    int32_t image_width = 100;
+    int32_t samples_per_pixel = 10;
+    int32_t max_depth = 10;
+    int32_t padding = 0;
+    color background;
+    double vfov = 90;
+    point3 lookfrom = {0, 0, 0};
+    point3 lookat   = {0, 0, -1};
+    vec3 vup        = {0, 1, 0};
+    double defocus_angle = 0;
+    double focus_dist = 10;
+};
+
+enum class texture_kind : int32_t { solid, checker, image, noise };
+
+struct texture_desc {
+    texture_kind kind = texture_kind::solid;
+    // checker: 偶数・奇数マスのテクスチャ
+    int32_t even = -1;
+    int32_t odd = -1;
+    // image: 文字列テーブル中のファイル名の位置
+    int32_t filename = -1;
+    // checker, noise: スケール
+    double scale = 1;
+    // solid: 色
+    color albedo;
+};
+
+enum class material_kind : int32_t { lambertian, metal, dielectric, diffuse_light, isotropic };
+
+struct material_desc {
+    material_kind kind = material_kind::lambertian;
+    // 負であれば`albedo`の単色を用いる
+    int32_t texture = -1;
+    color albedo;
+    double fuzz = 0;
+    double refraction_index = 1;
+};
+
+enum class shape_kind : int32_t {
+    sphere,
+    moving_sphere,
+    quad,
+    triangle,
+    disk,
+    ring,
+    box,
+    list,
+    bvh,
+    translate,
+    rotate_y,
+    constant_medium,
+    moving_translate
+};
+
+/**
+ * 形状・インスタンス・媒質のレコード。種類ごとのフィールドの用法は次の通り。
+ * - sphere:          p0 中心, a 半径
+ * - moving_sphere:   p0 t=0の中心, p1 t=1の中心, a 半径
+ * - quad, triangle:  p0 Q, p1 u, p2 v
+ * - disk:            p0 Q, p1 u, p2 v, a 半径
+ * - ring:            p0 Q, p1 u, p2 v, a 外径, b 内径
+ * - box:             p0, p1 対角の頂点
+ * - list, bvh:       children[first_child, first_child + child_count)
+ * - translate:       children[first_child] を p0 だけ平行移動
+ * - rotate_y:        children[first_child] を a 度だけY軸回転
+ * - constant_medium: children[first_child] を境界とする密度 a の媒質（位相関数のテクスチャは texture）
+ * - moving_translate: children[first_child] を t=0 で p0、t=1 で p1 だけ平行移動
+ */
+struct shape_desc {
+    shape_kind kind = shape_kind::sphere;
+    int32_t material = -1;
+    int32_t texture = -1;
+    int32_t first_child = 0;
+    int32_t child_count = 0;
+    int32_t padding = 0;
+    point3 p0, p1, p2;
+    double a = 0;
+    double b = 0;
+};
+
+static_assert(std::is_trivially_copyable_v<camera_desc>);
+static_assert(std::is_trivially_copyable_v<texture_desc>);
+static_assert(std::is_trivially_copyable_v<material_desc>);
+static_assert(std::is_trivially_copyable_v<shape_desc>);
+
+/** 所有権を持たないシーンの参照。`scene_desc`とメモリマップしたバイナリファイルのいずれからも作れる。 */
+struct scene_view {
+    camera_desc camera;
+    std::span<const texture_desc> textures;
+    std::span<const material_desc> materials;
+    std::span<const shape_desc> shapes;
+    std::span<const int32_t> children;
+    std::span<const int32_t> world;
+    std::span<const char> strings;
+
+    std::span<const int32_t> children_of(const shape_desc& s) const {
+        return children.subspan(s.first_child, s.child_count);
+    }
+    const char* string_at(int32_t offset) const { return strings.data() + offset; }
+};
+
+/**
+ * @brief シーンを組み立てるためのビルダ兼コンテナ。
+ * 各メソッドは追加したレコードの添字を返し、それを他のレコードから参照する。
+ */
+class scene_desc {
+    public:
+        camera_desc camera;
+        std::vector<texture_desc> textures;
+        std::vector<material_desc> materials;
+        std::vector<shape_desc> shapes;
+        std::vector<int32_t> children;
+        std::vector<int32_t> world;
+        std::vector<char> strings;
+
+        scene_view view() const {
+            return scene_view{camera, textures, materials, shapes, children, world, strings};
+        }
+
+        // Textures
+        int32_t solid_color(const color& albedo) {
+            texture_desc t;
+            t.kind = texture_kind::solid;
+            t.albedo = albedo;
+            return push(textures, t);
+        }
+        int32_t checker_texture(double scale, int32_t even, int32_t odd) {
+            texture_desc t;
+            t.kind = texture_kind::checker;
+            t.scale = scale;
+            t.even = even;
+            t.odd = odd;
+            return push(textures, t);
+        }
+        int32_t checker_texture(double scale, const color& c1, const color& c2) {
+            return checker_texture(scale, solid_color(c1), solid_color(c2));
+        }
+        int32_t image_texture(const std::string& filename) {
+            texture_desc t;
+            t.kind = texture_kind::image;
+            t.filename = add_string(filename);
+            return push(textures, t);
+        }
+        int32_t noise_texture(double scale) {
+            texture_desc t;
+            t.kind = texture_kind::noise;
+            t.scale = scale;
+            return push(textures, t);
+        }
+
+        // Materials
+        int32_t lambertian(const color& albedo)      { return textured_material(material_kind::lambertian, -1, albedo); }
+        int32_t lambertian(int32_t tex)              { return textured_material(material_kind::lambertian, tex, {}); }
+        int32_t diffuse_light(const color& emit)     { return textured_material(material_kind::diffuse_light, -1, emit); }
+        int32_t diffuse_light(int32_t tex)           { return textured_material(material_kind::diffuse_light, tex, {}); }
+        int32_t isotropic(const color& albedo)       { return textured_material(material_kind::isotropic, -1, albedo); }
+        int32_t isotropic(int32_t tex)               { return textured_material(material_kind::isotropic, tex, {}); }
+        int32_t metal(const color& albedo, double fuzz) {
+            material_desc m;
+            m.kind = material_kind::metal;
+            m.albedo = albedo;
+            m.fuzz = fuzz;
+            return push(materials, m);
+        }
+        int32_t dielectric(double refraction_index) {
+            material_desc m;
+            m.kind = material_kind::dielectric;
+            m.refraction_index = refraction_index;
+            return push(materials, m);
+        }
+
+        // Primitives
+        int32_t sphere(const point3& center, double radius, int32_t mat) {
+            shape_desc s = primitive(shape_kind::sphere, mat);
+            s.p0 = center;
+            s.a = radius;
+            return push(shapes, s);
+        }
+        int32_t sphere(const point3& center1, const point3& center2, double radius, int32_t mat) {
+            shape_desc s = primitive(shape_kind::moving_sphere, mat);
+            s.p0 = center1;
+            s.p1 = center2;
+            s.a = radius;
+            return push(shapes, s);
+        }
+        int32_t quad(const point3& Q, const vec3& u, const vec3& v, int32_t mat) {
+            return planar(shape_kind::quad, Q, u, v, mat, 0, 0);
+        }
+        int32_t triangle(const point3& Q, const vec3& u, const vec3& v, int32_t mat) {
+            return planar(shape_kind::triangle, Q, u, v, mat, 0, 0);
+        }
+        int32_t disk(const point3& Q, const vec3& u, const vec3& v, int32_t mat, double r) {
+            return planar(shape_kind::disk, Q, u, v, mat, r, 0);
+        }
+        int32_t ring(const point3& Q, const vec3& u, const vec3& v, int32_t mat, double r_out, double r_in) {
+            return planar(shape_kind::ring, Q, u, v, mat, r_out, r_in);
+        }
+        int32_t box(const point3& a, const point3& b, int32_t mat) {
+            shape_desc s = primitive(shape_kind::box, mat);
+            s.p0 = a;
+            s.p1 = b;
+            return push(shapes, s);
+        }
+
+        // Aggregates and instances
+        int32_t list(const std::vector<int32_t>& objects) { return aggregate(shape_kind::list, objects); }
+        int32_t bvh(const std::vector<int32_t>& objects)  { return aggregate(shape_kind::bvh, objects); }
+        int32_t translate(int32_t object, const vec3& offset) {
+            shape_desc s = aggregate_of(shape_kind::translate, {object});
+            s.p0 = offset;
+            return push(shapes, s);
+        }
+        int32_t translate(int32_t object, const vec3& offset1, const vec3& offset2) {
+            shape_desc s = aggregate_of(shape_kind::moving_translate, {object});
+            s.p0 = offset1;
+            s.p1 = offset2;
+            return push(shapes, s);
+        }
+        int32_t rotate_y(int32_t object, double angle) {
+            shape_desc s = aggregate_of(shape_kind::rotate_y, {object});
+            s.a = angle;
+            return push(shapes, s);
+        }
+        int32_t constant_medium(int32_t boundary, double density, int32_t tex) {
+            shape_desc s = aggregate_of(shape_kind::constant_medium, {boundary});
+            s.a = density;
+            s.texture = tex;
+            return push(shapes, s);
+        }
+        int32_t constant_medium(int32_t boundary, double density, const color& albedo) {
+            return constant_medium(boundary, density, solid_color(albedo));
+        }
+
+        /** ワールド直下に形状を追加する */
+        void add(int32_t shape) { world.push_back(shape); }
+
+        int32_t add_string(const std::string& s) {
+            auto offset = int32_t(strings.size());
+            strings.insert(strings.end(), s.begin(), s.end());
+            strings.push_back('\0');
+            return offset;
+        }
+
+    private:
+        template<class T>
+        static int32_t push(std::vector<T>& records, const T& record) {
+            records.push_back(record);
+            return int32_t(records.size() - 1);
+        }
+        int32_t textured_material(material_kind kind, int32_t tex, const color& albedo) {
+            material_desc m;
+            m.kind = kind;
+            m.texture = tex;
+            m.albedo = albedo;
+            return push(materials, m);
+        }
+        static shape_desc primitive(shape_kind kind, int32_t mat) {
+            shape_desc s;
+            s.kind = kind;
+            s.material = mat;
+            return s;
+        }
+        int32_t planar(shape_kind kind, const point3& Q, const vec3& u, const vec3& v, int32_t mat, double a, double b) {
+            shape_desc s = primitive(kind, mat);
+            s.p0 = Q;
+            s.p1 = u;
+            s.p2 = v;
+            s.a = a;
+            s.b = b;
+            return push(shapes, s);
+        }
+        shape_desc aggregate_of(shape_kind kind, const std::vector<int32_t>& objects) {
+            shape_desc s;
+            s.kind = kind;
+            s.first_child = int32_t(children.size());
+            s.child_count = int32_t(objects.size());
+            children.insert(children.end(), objects.begin(), objects.end());
+            return s;
+        }
+        int32_t aggregate(shape_kind kind, const std::vector<int32_t>& objects) {
+            return push(shapes, aggregate_of(kind, objects));
+        }
+};
+
+#endif
@@ -0,0 +1,665 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "rtweekend.hpp"
+#include "mapped_file.hpp"
+#include "scene_desc.hpp"
+
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * シーンファイルの読み書き。
+ *
+ * テキスト形式は1行1レコードで、`#`以降はコメントとして無視する。
+ * 空白や`#`を含むファイル名は`"`で囲み、中の`"`と`\`は`\`でエスケープする。
+ * 名前による参照は、その名前が先に定義されている必要がある。
+ *
+ *     camera <key> <value...>
+ *     texture <name> solid <r> <g> <b>
+ *     texture <name> checker <scale> <even> <odd>
+ *     texture <name> image <filename>
+ *     texture <name> noise <scale>
+ *     material <name> lambertian|diffuse_light|isotropic (<r> <g> <b> | <texture>)
+ *     material <name> metal <r> <g> <b> <fuzz>
+ *     material <name> dielectric <refraction_index>
+ *     shape <name> sphere <center> <radius> <material>
+ *     shape <name> moving_sphere <center1> <center2> <radius> <material>
+ *     shape <name> quad|triangle <Q> <u> <v> <material>
+ *     shape <name> disk <Q> <u> <v> <radius> <material>
+ *     shape <name> ring <Q> <u> <v> <r_out> <r_in> <material>
+ *     shape <name> box <a> <b> <material>
+ *     shape <name> list|bvh <shape>...
+ *     shape <name> translate <shape> <offset>
+ *     shape <name> moving_translate <shape> <offset1> <offset2>
+ *     shape <name> rotate_y <shape> <degrees>
+ *     shape <name> constant_medium <boundary> <density> <texture>
+ *     world <shape>...
+ *
+ * ベクトルは3つの数値で表す。
+ * バイナリ形式はヘッダと各レコード配列をそのまま並べたもので、`mapped_scene`でメモリマップして読み込む。
+ */
+
+namespace scene_file {
+
+    // Text format
+    // --------------------------
+
+    inline std::string format_double(double x) {
+        char buf[32];
+        auto result = std::to_chars(buf, buf + sizeof(buf), x);
+        return std::string(buf, result.ptr);
+    }
+
+    inline std::string format_vec3(const vec3& v) {
+        return format_double(v.x()) + " " + format_double(v.y()) + " " + format_double(v.z());
+    }
+
+    inline const char* texture_kind_name(texture_kind kind) {
+        switch (kind) {
+            case texture_kind::solid:   return "solid";
+            case texture_kind::checker: return "checker";
+            case texture_kind::image:   return "image";
+            case texture_kind::noise:   return "noise";
+        }
+        return "?";
+    }
+
+    inline const char* material_kind_name(material_kind kind) {
+        switch (kind) {
+            case material_kind::lambertian:    return "lambertian";
+            case material_kind::metal:         return "metal";
+            case material_kind::dielectric:    return "dielectric";
+            case material_kind::diffuse_light: return "diffuse_light";
+            case material_kind::isotropic:     return "isotropic";
+        }
+        return "?";
+    }
+
+    inline const char* shape_kind_name(shape_kind kind) {
+        switch (kind) {
+            case shape_kind::sphere:          return "sphere";
+            case shape_kind::moving_sphere:   return "moving_sphere";
+            case shape_kind::quad:            return "quad";
+            case shape_kind::triangle:        return "triangle";
+            case shape_kind::disk:            return "disk";
+            case shape_kind::ring:            return "ring";
+            case shape_kind::box:             return "box";
+            case shape_kind::list:            return "list";
+            case shape_kind::bvh:             return "bvh";
+            case shape_kind::translate:       return "translate";
+            case shape_kind::rotate_y:        return "rotate_y";
+            case shape_kind::constant_medium: return "constant_medium";
+            case shape_kind::moving_translate: return "moving_translate";
+        }
+        return "?";
+    }
+
+    /** ファイル名などの文字列を1つのトークンとして書く。必要なときだけ`"`で囲む */
+    inline bool write_string(std::ostream& out, const std::string& s) {
+        if (s.find_first_of("\n\r") != std::string::npos) {
+            std::cerr << "ERROR: Cannot write '" << s << "' in the text format (it contains a line break).\n";
+            return false;
+        }
+        const bool plain = not s.empty() and s.find_first_of(" \t\v\f#\"\\") == std::string::npos;
+        if (plain) { out << s; }
+        else       { out << std::quoted(s); }
+        return true;
+    }
+
+    /** `"`で囲まれた部分を除いて、`#`以降のコメントを取り除く */
+    inline void strip_comment(std::string& line) {
+        bool quoted = false;
+        for (size_t i = 0; i < line.size(); i++) {
+            if (quoted and line[i] == '\\') { i++; }
+            else if (line[i] == '"') { quoted = not quoted; }
+            else if (not quoted and line[i] == '#') {
+                line.resize(i);
+                return;
+            }
+        }
+    }
+
+    /** テキスト形式で書く。書けない文字列があれば`std::cerr`に報告して`false`を返す */
+    inline bool write_text(std::ostream& out, const scene_view& scene) {
+        auto tex = [](int32_t i) { return "t" + std::to_string(i); };
+        auto mat = [](int32_t i) { return "m" + std::to_string(i); };
+        auto shp = [](int32_t i) { return "s" + std::to_string(i); };
+
+        const camera_desc& c = scene.camera;
+        out << "camera aspect_ratio " << format_double(c.aspect_ratio) << '\n';
+        out << "camera image_width " << c.image_width << '\n';
+        out << "camera samples_per_pixel " << c.samples_per_pixel << '\n';
+        out << "camera max_depth " << c.max_depth << '\n';
+        out << "camera background " << format_vec3(c.background) << '\n';
+        out << "camera vfov " << format_double(c.vfov) << '\n';
+        out << "camera lookfrom " << format_vec3(c.lookfrom) << '\n';
+        out << "camera lookat " << format_vec3(c.lookat) << '\n';
+        out << "camera vup " << format_vec3(c.vup) << '\n';
+        out << "camera defocus_angle " << format_double(c.defocus_angle) << '\n';
+        out << "camera focus_dist " << format_double(c.focus_dist) << '\n';
+
+        for (size_t i = 0; i < scene.textures.size(); i++) {
+            const texture_desc& t = scene.textures[i];
+            out << "texture " << tex(int32_t(i)) << ' ' << texture_kind_name(t.kind) << ' ';
+            switch (t.kind) {
+                case texture_kind::solid:   out << format_vec3(t.albedo); break;
+                case texture_kind::checker: out << format_double(t.scale) << ' ' << tex(t.even) << ' ' << tex(t.odd); break;
+                case texture_kind::image:
+                    if (not write_string(out, scene.string_at(t.filename))) { return false; }
+                    break;
+                case texture_kind::noise:   out << format_double(t.scale); break;
+            }
+            out << '\n';
+        }
+
+        for (size_t i = 0; i < scene.materials.size(); i++) {
+            const material_desc& m = scene.materials[i];
+            out << "material " << mat(int32_t(i)) << ' ' << material_kind_name(m.kind) << ' ';
+            switch (m.kind) {
+                case material_kind::metal:      out << format_vec3(m.albedo) << ' ' << format_double(m.fuzz); break;
+                case material_kind::dielectric: out << format_double(m.refraction_index); break;
+                default:
+                    if (m.texture >= 0) { out << tex(m.texture); }
+                    else                { out << format_vec3(m.albedo); }
+                    break;
+            }
+            out << '\n';
+        }
+
+        for (size_t i = 0; i < scene.shapes.size(); i++) {
+            const shape_desc& s = scene.shapes[i];
+            out << "shape " << shp(int32_t(i)) << ' ' << shape_kind_name(s.kind);
+            switch (s.kind) {
+                case shape_kind::sphere:
+                    out << ' ' << format_vec3(s.p0) << ' ' << format_double(s.a) << ' ' << mat(s.material);
+                    break;
+                case shape_kind::moving_sphere:
+                    out << ' ' << format_vec3(s.p0) << ' ' << format_vec3(s.p1) << ' ' << format_double(s.a) << ' ' << mat(s.material);
+                    break;
+                case shape_kind::quad:
+                case shape_kind::triangle:
+                case shape_kind::disk:
+                case shape_kind::ring:
+                    out << ' ' << format_vec3(s.p0) << ' ' << format_vec3(s.p1) << ' ' << format_vec3(s.p2);
+                    if (s.kind == shape_kind::disk or s.kind == shape_kind::ring) { out << ' ' << format_double(s.a); }
+                    if (s.kind == shape_kind::ring) { out << ' ' << format_double(s.b); }
+                    out << ' ' << mat(s.material);
+                    break;
+                case shape_kind::box:
+                    out << ' ' << format_vec3(s.p0) << ' ' << format_vec3(s.p1) << ' ' << mat(s.material);
+                    break;
+                case shape_kind::list:
+                case shape_kind::bvh:
+                    for (int32_t child : scene.children_of(s)) { out << ' ' << shp(child); }
+                    break;
+                case shape_kind::translate:
+                    out << ' ' << shp(scene.children[s.first_child]) << ' ' << format_vec3(s.p0);
+                    break;
+                case shape_kind::moving_translate:
+                    out << ' ' << shp(scene.children[s.first_child]) << ' ' << format_vec3(s.p0) << ' ' << format_vec3(s.p1);
+                    break;
+                case shape_kind::rotate_y:
+                    out << ' ' << shp(scene.children[s.first_child]) << ' ' << format_double(s.a);
+                    break;
+                case shape_kind::constant_medium:
+                    out << ' ' << shp(scene.children[s.first_child]) << ' ' << format_double(s.a) << ' ' << tex(s.texture);
+                    break;
+            }
+            out << '\n';
+        }
+
+        out << "world";
+        for (int32_t object : scene.world) { out << ' ' << shp(object); }
+        out << '\n';
+        return true;
+    }
+
+    /** テキスト形式の1行をトークンごとに読み進める */
+    class line_reader {
+        public:
+            line_reader(const std::string& line, int32_t line_number) : in(line), line_number(line_number) {}
+
+            bool next(std::string& token) { return bool(in >> token); }
+            /** `"`で囲まれていれば、囲みとエスケープを外して読む */
+            bool next_string(std::string& token) { return bool(in >> std::quoted(token)); }
+            bool has_more() {
+                in >> std::ws;
+                return not in.eof();
+            }
+            bool at_end() {
+                std::string rest;
+                return not (in >> rest);
+            }
+            bool read_double(double& x) {
+                std::string token;
+                if (not next(token)) { return fail("expected a number"); }
+                char* end = nullptr;
+                x = std::strtod(token.c_str(), &end);
+                if (end == token.c_str() or *end != '\0') { return fail("invalid number '" + token + "'"); }
+                return true;
+            }
+            bool read_int(int32_t& x) {
+                std::string token;
+                if (not next(token)) { return fail("expected an integer"); }
+                const char* last = token.data() + token.size();
+                auto [end, error] = std::from_chars(token.data(), last, x);
+                if (error == std::errc::result_out_of_range) { return fail("integer '" + token + "' is out of range"); }
+                if (error != std::errc{} or end != last) { return fail("invalid integer '" + token + "'"); }
+                return true;
+            }
+            bool read_positive_int(int32_t& x) {
+                if (not read_int(x)) { return false; }
+                return x > 0 or fail("expected a positive integer, got " + std::to_string(x));
+            }
+            bool read_vec3(vec3& v) {
+                return read_double(v[0]) and read_double(v[1]) and read_double(v[2]);
+            }
+            bool read_ref(const std::unordered_map<std::string, int32_t>& names, int32_t& index, const char* what) {
+                std::string token;
+                if (not next(token)) { return fail(std::string("expected a ") + what + " name"); }
+                auto it = names.find(token);
+                if (it == names.end()) { return fail(std::string("undefined ") + what + " '" + token + "'"); }
+                index = it->second;
+                return true;
+            }
+            /** 次のトークンが数値であれば`true`を返す（読み進めない） */
+            bool peek_is_number() {
+                auto position = in.tellg();
+                std::string token;
+                bool is_number = false;
+                if (in >> token) {
+                    char* end = nullptr;
+                    std::strtod(token.c_str(), &end);
+                    is_number = (end != token.c_str() and *end == '\0');
+                }
+                in.clear();
+                in.seekg(position);
+                return is_number;
+            }
+            bool fail(const std::string& message) {
+                std::cerr << "ERROR: line " << line_number << ": " << message << '\n';
+                return false;
+            }
+
+        private:
+            std::istringstream in;
+            int32_t line_number;
+    };
+
+    inline bool parse_camera(line_reader& line, camera_desc& c) {
+        std::string key;
+        if (not line.next(key)) { return line.fail("expected a camera parameter"); }
+        if (key == "aspect_ratio")      { return line.read_double(c.aspect_ratio); }
+        if (key == "image_width")       { return line.read_positive_int(c.image_width); }
+        if (key == "samples_per_pixel") { return line.read_positive_int(c.samples_per_pixel); }
+        if (key == "max_depth")         { return line.read_positive_int(c.max_depth); }
+        if (key == "background")        { return line.read_vec3(c.background); }
+        if (key == "vfov")              { return line.read_double(c.vfov); }
+        if (key == "lookfrom")          { return line.read_vec3(c.lookfrom); }
+        if (key == "lookat")            { return line.read_vec3(c.lookat); }
+        if (key == "vup")               { return line.read_vec3(c.vup); }
+        if (key == "defocus_angle")     { return line.read_double(c.defocus_angle); }
+        if (key == "focus_dist")        { return line.read_double(c.focus_dist); }
+        return line.fail("unknown camera parameter '" + key + "'");
+    }
+
+    /**
+     * @brief テキスト形式のシーンを読み込む。
+     * 文法エラーがあれば`std::cerr`に行番号付きで報告し、`std::nullopt`を返す。
+     */
+    inline std::optional<scene_desc> read_text(std::istream& in) {
+        scene_desc scene;
+        std::unordered_map<std::string, int32_t> texture_names, material_names, shape_names;
+
+        std::string raw_line;
+        int32_t line_number = 0;
+        while (std::getline(in, raw_line)) {
+            line_number++;
+            strip_comment(raw_line);
+
+            line_reader line{raw_line, line_number};
+            std::string directive;
+            if (not line.next(directive)) { continue; }
+
+            if (directive == "camera") {
+                if (not parse_camera(line, scene.camera)) { return std::nullopt; }
+            } else if (directive == "world") {
+                int32_t object;
+                while (line.has_more()) {
+                    if (not line.read_ref(shape_names, object, "shape")) { return std::nullopt; }
+                    scene.add(object);
+                }
+                continue;
+            } else if (directive == "texture" or directive == "material" or directive == "shape") {
+                std::string name, kind;
+                if (not line.next(name) or not line.next(kind)) { line.fail("expected a name and a kind"); return std::nullopt; }
+                bool ok = true;
+                int32_t index = -1;
+
+                if (directive == "texture") {
+                    if (kind == "solid") {
+                        color c;
+                        ok = line.read_vec3(c);
+                        index = scene.solid_color(c);
+                    } else if (kind == "checker") {
+                        double scale;
+                        int32_t even, odd;
+                        ok = line.read_double(scale)
+                            and line.read_ref(texture_names, even, "texture")
+                            and line.read_ref(texture_names, odd, "texture");
+                        index = scene.checker_texture(scale, even, odd);
+                    } else if (kind == "image") {
+                        std::string filename;
+                        ok = line.next_string(filename) or line.fail("expected a filename");
+                        index = scene.image_texture(filename);
+                    } else if (kind == "noise") {
+                        double scale;
+                        ok = line.read_double(scale);
+                        index = scene.noise_texture(scale);
+                    } else {
+                        ok = line.fail("unknown texture kind '" + kind + "'");
+                    }
+                    texture_names[name] = index;
+                } else if (directive == "material") {
+                    if (kind == "lambertian" or kind == "diffuse_light" or kind == "isotropic") {
+                        material_desc m;
+                        m.kind = kind == "lambertian"    ? material_kind::lambertian
+                               : kind == "diffuse_light" ? material_kind::diffuse_light
+                               :                           material_kind::isotropic;
+                        if (line.peek_is_number()) { ok = line.read_vec3(m.albedo); }
+                        else                       { ok = line.read_ref(texture_names, m.texture, "texture"); }
+                        scene.materials.push_back(m);
+                        index = int32_t(scene.materials.size() - 1);
+                    } else if (kind == "metal") {
+                        color albedo;
+                        double fuzz;
+                        ok = line.read_vec3(albedo) and line.read_double(fuzz);
+                        index = scene.metal(albedo, fuzz);
+                    } else if (kind == "dielectric") {
+                        double refraction_index;
+                        ok = line.read_double(refraction_index);
+                        index = scene.dielectric(refraction_index);
+                    } else {
+                        ok = line.fail("unknown material kind '" + kind + "'");
+                    }
+                    material_names[name] = index;
+                } else {
+                    point3 p0, p1, p2;
+                    double a = 0, b = 0;
+                    int32_t mat = -1, child = -1, tex = -1;
+                    if (kind == "sphere") {
+                        ok = line.read_vec3(p0) and line.read_double(a) and line.read_ref(material_names, mat, "material");
+                        index = scene.sphere(p0, a, mat);
+                    } else if (kind == "moving_sphere") {
+                        ok = line.read_vec3(p0) and line.read_vec3(p1) and line.read_double(a)
+                            and line.read_ref(material_names, mat, "material");
+                        index = scene.sphere(p0, p1, a, mat);
+                    } else if (kind == "quad" or kind == "triangle") {
+                        ok = line.read_vec3(p0) and line.read_vec3(p1) and line.read_vec3(p2)
+                            and line.read_ref(material_names, mat, "material");
+                        index = kind == "quad" ? scene.quad(p0, p1, p2, mat) : scene.triangle(p0, p1, p2, mat);
+                    } else if (kind == "disk") {
+                        ok = line.read_vec3(p0) and line.read_vec3(p1) and line.read_vec3(p2)
+                            and line.read_double(a) and line.read_ref(material_names, mat, "material");
+                        index = scene.disk(p0, p1, p2, mat, a);
+                    } else if (kind == "ring") {
+                        ok = line.read_vec3(p0) and line.read_vec3(p1) and line.read_vec3(p2)
+                            and line.read_double(a) and line.read_double(b)
+                            and line.read_ref(material_names, mat, "material");
+                        index = scene.ring(p0, p1, p2, mat, a, b);
+                    } else if (kind == "box") {
+                        ok = line.read_vec3(p0) and line.read_vec3(p1) and line.read_ref(material_names, mat, "material");
+                        index = scene.box(p0, p1, mat);
+                    } else if (kind == "list" or kind == "bvh") {
+                        std::vector<int32_t> objects;
+                        while (ok and line.has_more()) {
+                            ok = line.read_ref(shape_names, child, "shape");
+                            objects.push_back(child);
+                        }
+                        index = kind == "list" ? scene.list(objects) : scene.bvh(objects);
+                    } else if (kind == "translate") {
+                        ok = line.read_ref(shape_names, child, "shape") and line.read_vec3(p0);
+                        index = scene.translate(child, p0);
+                    } else if (kind == "moving_translate") {
+                        ok = line.read_ref(shape_names, child, "shape") and line.read_vec3(p0) and line.read_vec3(p1);
+                        index = scene.translate(child, p0, p1);
+                    } else if (kind == "rotate_y") {
+                        ok = line.read_ref(shape_names, child, "shape") and line.read_double(a);
+                        index = scene.rotate_y(child, a);
+                    } else if (kind == "constant_medium") {
+                        ok = line.read_ref(shape_names, child, "shape") and line.read_double(a)
+                            and line.read_ref(texture_names, tex, "texture");
+                        index = scene.constant_medium(child, a, tex);
+                    } else {
+                        ok = line.fail("unknown shape kind '" + kind + "'");
+                    }
+                    shape_names[name] = index;
+                }
+                if (not ok) { return std::nullopt; }
+            } else {
+                line.fail("unknown directive '" + directive + "'");
+                return std::nullopt;
+            }
+            if (not line.at_end()) {
+                line.fail("unexpected trailing tokens");
+                return std::nullopt;
+            }
+        }
+        return scene;
+    }
+
+    // Binary format
+    // --------------------------
+
+    constexpr char binary_magic[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+    constexpr uint32_t binary_version = 1;
+
+    /** ファイル先頭からのバイトオフセットと要素数 */
+    struct binary_section {
+        uint64_t offset;
+        uint64_t count;
+    };
+
+    struct binary_header {
+        char magic[8];
+        uint32_t version;
+        // エンディアンの検出用
+        uint32_t byte_order;
+        camera_desc camera;
+        binary_section textures, materials, shapes, children, world, strings;
+    };
+
+    inline bool is_binary(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        char magic[sizeof(binary_magic)] = {};
+        in.read(magic, sizeof(magic));
+        return in and std::memcmp(magic, binary_magic, sizeof(magic)) == 0;
+    }
+
+    inline bool write_binary(const std::string& path, const scene_view& scene) {
+        constexpr uint64_t alignment = 16;
+        binary_header header{};
+        std::memcpy(header.magic, binary_magic, sizeof(binary_magic));
+        header.version = binary_version;
+        header.byte_order = 0x01020304;
+        header.camera = scene.camera;
+
+        uint64_t cursor = sizeof(binary_header);
+        auto layout = [&](binary_section& section, auto records) {
+            cursor = (cursor + alignment - 1) / alignment * alignment;
+            section.offset = cursor;
+            section.count = records.size();
+            cursor += records.size_bytes();
+        };
+        layout(header.textures, scene.textures);
+        layout(header.materials, scene.materials);
+        layout(header.shapes, scene.shapes);
+        layout(header.children, scene.children);
+        layout(header.world, scene.world);
+        layout(header.strings, scene.strings);
+
+        std::ofstream out(path, std::ios::binary);
+        if (not out) {
+            std::cerr << "ERROR: Could not open '" << path << "' for writing.\n";
+            return false;
+        }
+        uint64_t written = 0;
+        auto emit = [&](const binary_section& section, const void* data, uint64_t size) {
+            static const char zeros[alignment] = {};
+            out.write(zeros, std::streamsize(section.offset - written));
+            out.write(static_cast<const char*>(data), std::streamsize(size));
+            written = section.offset + size;
+        };
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        written = sizeof(header);
+        emit(header.textures, scene.textures.data(), scene.textures.size_bytes());
+        emit(header.materials, scene.materials.data(), scene.materials.size_bytes());
+        emit(header.shapes, scene.shapes.data(), scene.shapes.size_bytes());
+        emit(header.children, scene.children.data(), scene.children.size_bytes());
+        emit(header.world, scene.world.data(), scene.world.size_bytes());
+        emit(header.strings, scene.strings.data(), scene.strings.size_bytes());
+        return bool(out);
+    }
+
+    /** @brief バイナリ形式のシーンファイルをメモリマップし、コピーせずに参照する。 */
+    class mapped_scene {
+        public:
+            bool open(const std::string& path) {
+                if (not file.open(path)) {
+                    std::cerr << "ERROR: Could not map scene file '" << path << "'.\n";
+                    return false;
+                }
+                data = file.data();
+                if (file.size() < sizeof(binary_header) or not validate()) {
+                    std::cerr << "ERROR: '" << path << "' is not a valid binary scene file.\n";
+                    file.close();
+                    data = nullptr;
+                    return false;
+                }
+                return true;
+            }
+
+            scene_view view() const {
+                const binary_header& header = *reinterpret_cast<const binary_header*>(data);
+                return scene_view{
+                    header.camera,
+                    section<texture_desc>(header.textures),
+                    section<material_desc>(header.materials),
+                    section<shape_desc>(header.shapes),
+                    section<int32_t>(header.children),
+                    section<int32_t>(header.world),
+                    section<char>(header.strings)
+                };
+            }
+
+        private:
+            mapped_file file;
+            const char* data = nullptr;
+
+            template<class T>
+            std::span<const T> section(const binary_section& s) const {
+                return {reinterpret_cast<const T*>(data + s.offset), size_t(s.count)};
+            }
+
+            bool validate() const {
+                const binary_header& header = *reinterpret_cast<const binary_header*>(data);
+                if (std::memcmp(header.magic, binary_magic, sizeof(binary_magic)) != 0) { return false; }
+                if (header.version != binary_version or header.byte_order != 0x01020304) { return false; }
+                auto fits = [&](const binary_section& s, size_t record_size) {
+                    return s.offset <= file.size() and s.count <= (file.size() - s.offset) / record_size;
+                };
+                if (not (fits(header.textures, sizeof(texture_desc))
+                    and fits(header.materials, sizeof(material_desc))
+                    and fits(header.shapes, sizeof(shape_desc))
+                    and fits(header.children, sizeof(int32_t))
+                    and fits(header.world, sizeof(int32_t))
+                    and fits(header.strings, sizeof(char)))) { return false; }
+                // テキスト形式の`parse_camera`と同じく、画像の幅・サンプル数・反射回数は正でなければならない
+                const camera_desc& camera = header.camera;
+                if (camera.image_width <= 0 or camera.samples_per_pixel <= 0 or camera.max_depth <= 0) { return false; }
+                // 参照がすべて範囲内であることを確かめておけば、以降のアクセスでは検査を省ける
+                scene_view scene = view();
+                auto valid = [](int32_t i, size_t n) { return 0 <= i and size_t(i) < n; };
+                // 種類は列挙の最後の値までに限る（未知の種類では組み立てた物体やテクスチャが空になる）
+                auto known = [](auto kind, auto last) { return 0 <= int32_t(kind) and int32_t(kind) <= int32_t(last); };
+                for (size_t i = 0; i < scene.textures.size(); i++) {
+                    const texture_desc& t = scene.textures[i];
+                    if (not known(t.kind, texture_kind::noise)) { return false; }
+                    // 形状の子と同じく、チェッカーのマスは自分より前のテクスチャだけを指す（循環した参照で再帰が止まらなくなるのを防ぐ）
+                    if (t.kind == texture_kind::checker and not (valid(t.even, i) and valid(t.odd, i))) { return false; }
+                    if (t.kind == texture_kind::image and not valid(t.filename, scene.strings.size())) { return false; }
+                }
+                for (const material_desc& m : scene.materials) {
+                    if (not known(m.kind, material_kind::isotropic)) { return false; }
+                    if (m.texture >= 0 and not valid(m.texture, scene.textures.size())) { return false; }
+                }
+                for (size_t i = 0; i < scene.shapes.size(); i++) {
+                    const shape_desc& s = scene.shapes[i];
+                    if (not known(s.kind, shape_kind::moving_translate)) { return false; }
+                    // プリミティブの形状はマテリアルを必ず持つ（`scene_loader::material_at`は負の番号を検査しない）
+                    bool has_material = s.kind == shape_kind::sphere or s.kind == shape_kind::moving_sphere
+                        or s.kind == shape_kind::quad or s.kind == shape_kind::triangle or s.kind == shape_kind::disk
+                        or s.kind == shape_kind::ring or s.kind == shape_kind::box;
+                    if (has_material and not valid(s.material, scene.materials.size())) { return false; }
+                    if (s.material >= 0 and not valid(s.material, scene.materials.size())) { return false; }
+                    if (s.texture >= 0 and not valid(s.texture, scene.textures.size())) { return false; }
+                    if (s.first_child < 0 or s.child_count < 0
+                        or size_t(s.first_child) + size_t(s.child_count) > scene.children.size()) { return false; }
+                    bool is_instance = s.kind == shape_kind::translate or s.kind == shape_kind::moving_translate
+                        or s.kind == shape_kind::rotate_y or s.kind == shape_kind::constant_medium;
+                    if (is_instance and s.child_count != 1) { return false; }
+                    if (s.kind == shape_kind::constant_medium and s.texture < 0) { return false; }
+                    for (int32_t child : scene.children_of(s)) {
+                        if (not valid(child, i)) { return false; }
+                    }
+                }
+                for (int32_t object : scene.world) {
+                    if (not valid(object, scene.shapes.size())) { return false; }
+                }
+                return scene.strings.empty() or scene.strings.back() == '\0';
+            }
+    };
+
+    /** テキスト・バイナリのどちらの形式で読み込んだシーンも同じように参照できるようにする */
+    class loaded_scene {
+        public:
+            bool open(const std::string& path) {
+                if (is_binary(path)) { return mapped.open(path); }
+                std::ifstream in(path);
+                if (not in) {
+                    std::cerr << "ERROR: Could not open scene file '" << path << "'.\n";
+                    return false;
+                }
+                text = read_text(in);
+                return text.has_value();
+            }
+            scene_view view() const { return text ? text->view() : mapped.view(); }
+
+        private:
+            std::optional<scene_desc> text;
+            mapped_scene mapped;
+    };
+
+    /** 拡張子が`.rtsb`であればバイナリ形式、そうでなければテキスト形式で書き出す */
+    inline bool write(const std::string& path, const scene_view& scene) {
+        if (path.size() >= 5 and path.compare(path.size() - 5, 5, ".rtsb") == 0) {
+            return write_binary(path, scene);
+        }
+        std::ofstream out(path);
+        if (not out) {
+            std::cerr << "ERROR: Could not open '" << path << "' for writing.\n";
+            return false;
+        }
+        return write_text(out, scene) and bool(out);
+    }
+}
+
+#endif
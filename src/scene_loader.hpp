@@ -0,0 +1,160 @@
+#ifndef SCENE_LOADER_H
+#define SCENE_LOADER_H
+
+#include "rtweekend.hpp"
+
+#include "axis_aligned.hpp"
+#include "bvh_build.hpp"
+#include "camera.hpp"
+#include "constant_medium.hpp"
+#include "hittable.hpp"
+#include "hittable_list.hpp"
+#include "material.hpp"
+#include "memory_tracker.hpp"
+#include "quad.hpp"
+#include "scene_desc.hpp"
+#include "sphere.hpp"
+#include "texture.hpp"
+
+#include <string>
+#include <vector>
+
+/**
+ * @brief シーンの中間表現から、レンダリングに用いる`hittable`・`material`・`texture`を組み立てる。
+ * 同じ添字のレコードは一度だけ生成され、参照元の間で共有される。
+ * `bvh`の構築方法（ビルダ・ディスクキャッシュ）は`bvh`で指定する。
+ */
+class scene_loader {
+    public:
+        scene_loader(const scene_view& scene, bvh_options bvh = {}) :
+            scene(scene),
+            bvh(bvh),
+            textures(scene.textures.size()),
+            materials(scene.materials.size()),
+            shapes(scene.shapes.size())
+        {}
+
+        camera make_camera() const {
+            camera cam;
+            apply_camera(scene.camera, cam);
+            return cam;
+        }
+
+        /** `c`の視点・画角・画像の大きさなどを`cam`に設定する。描画方法（スレッド数・積分器など）の設定は変えない */
+        static void apply_camera(const camera_desc& c, camera& cam) {
+            cam.aspect_ratio      = c.aspect_ratio;
+            cam.image_width       = c.image_width;
+            cam.samples_per_pixel = c.samples_per_pixel;
+            cam.max_depth         = c.max_depth;
+            cam.background        = c.background;
+            cam.vfov              = c.vfov;
+            cam.lookfrom          = c.lookfrom;
+            cam.lookat            = c.lookat;
+            cam.vup               = c.vup;
+            cam.defocus_angle     = c.defocus_angle;
+            cam.focus_dist        = c.focus_dist;
+        }
+
+        /** ワールド直下の形状をまとめたリスト */
+        hittable_list make_world() {
+            hittable_list world;
+            for (int32_t object : scene.world) { world.add(shape(object)); }
+            return world;
+        }
+
+        shared_ptr<texture> texture_at(int32_t index) {
+            auto& slot = textures[index];
+            if (slot) { return slot; }
+            memory_tracker::scope memory(memory_tracker::tag::textures);
+            const texture_desc& t = scene.textures[index];
+            switch (t.kind) {
+                case texture_kind::solid:
+                    slot = make_shared<solid_color>(t.albedo);
+                    break;
+                case texture_kind::checker:
+                    slot = make_shared<checker_texture>(t.scale, texture_at(t.even), texture_at(t.odd));
+                    break;
+                case texture_kind::image:
+                    slot = make_shared<image_texture>(scene.string_at(t.filename));
+                    break;
+                case texture_kind::noise:
+                    slot = make_shared<noise_texture>(t.scale);
+                    break;
+            }
+            return slot;
+        }
+
+        shared_ptr<material> material_at(int32_t index) {
+            auto& slot = materials[index];
+            if (slot) { return slot; }
+            memory_tracker::scope memory(memory_tracker::tag::materials);
+            const material_desc& m = scene.materials[index];
+            auto albedo_texture = [&]() -> shared_ptr<texture> {
+                if (m.texture >= 0) { return texture_at(m.texture); }
+                return make_shared<solid_color>(m.albedo);
+            };
+            switch (m.kind) {
+                case material_kind::lambertian:    slot = make_shared<lambertian>(albedo_texture()); break;
+                case material_kind::metal:         slot = make_shared<metal>(m.albedo, m.fuzz); break;
+                case material_kind::dielectric:    slot = make_shared<dielectric>(m.refraction_index); break;
+                case material_kind::diffuse_light: slot = make_shared<diffuse_light>(albedo_texture()); break;
+                case material_kind::isotropic:     slot = make_shared<isotropic>(albedo_texture()); break;
+            }
+            return slot;
+        }
+
+        shared_ptr<hittable> shape(int32_t index) {
+            auto& slot = shapes[index];
+            if (slot) { return slot; }
+            memory_tracker::scope memory(memory_tracker::tag::geometry);
+            slot = build_shape(index, scene.shapes[index]);
+            return slot;
+        }
+
+    private:
+        scene_view scene;
+        bvh_options bvh;
+        std::vector<shared_ptr<texture>> textures;
+        std::vector<shared_ptr<material>> materials;
+        std::vector<shared_ptr<hittable>> shapes;
+
+        shared_ptr<hittable> build_shape(int32_t index, const shape_desc& s) {
+            switch (s.kind) {
+                case shape_kind::sphere:
+                    return make_shared<sphere>(s.p0, s.a, material_at(s.material));
+                case shape_kind::moving_sphere:
+                    return make_shared<sphere>(s.p0, s.p1, s.a, material_at(s.material));
+                case shape_kind::quad:
+                    return make_quad(s.p0, s.p1, s.p2, material_at(s.material));
+                case shape_kind::triangle:
+                    return make_shared<triangle>(s.p0, s.p1, s.p2, material_at(s.material));
+                case shape_kind::disk:
+                    return make_shared<disk>(s.p0, s.p1, s.p2, material_at(s.material), s.a);
+                case shape_kind::ring:
+                    return make_shared<ring>(s.p0, s.p1, s.p2, material_at(s.material), s.a, s.b);
+                case shape_kind::box:
+                    return make_box(s.p0, s.p1, material_at(s.material));
+                case shape_kind::list: {
+                    auto list = make_shared<hittable_list>();
+                    for (int32_t child : scene.children_of(s)) { list->add(shape(child)); }
+                    return list;
+                }
+                case shape_kind::bvh: {
+                    std::vector<shared_ptr<hittable>> objects;
+                    for (int32_t child : scene.children_of(s)) { objects.push_back(shape(child)); }
+                    return make_bvh(objects, bvh, "s" + std::to_string(index));
+                }
+                case shape_kind::translate:
+                    return make_shared<translate>(shape(scene.children[s.first_child]), s.p0);
+                case shape_kind::moving_translate:
+                    return make_shared<translate>(shape(scene.children[s.first_child]), s.p0, s.p1);
+                case shape_kind::rotate_y:
+                    return make_shared<rotate_y>(shape(scene.children[s.first_child]), s.a);
+                case shape_kind::constant_medium:
+                    return make_shared<constant_medium>(shape(scene.children[s.first_child]), s.a, texture_at(s.texture));
+            }
+            return nullptr;
+        }
+};
+
+#endif
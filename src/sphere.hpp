@@ -2,6 +2,7 @@
 #define SPHERE_H
 
 #include "hittable.hpp"
+#include "render_stats.hpp"
 
 class sphere : public hittable {
     private:
@@ -54,6 +55,7 @@ class sphere : public hittable {
             hit_record& rec
         ) const override
         {
+            render_stats::add(render_stats::counter::sphere_tests);
             const point3 center = is_moving ? sphere_center(r.time()) : center1;
             const vec3 oc = center - r.origin();
             const double a = r.direction().length_squared();
@@ -79,6 +81,12 @@ class sphere : public hittable {
         }
 
         aabb bounding_box() const override { return bbox; }
+        aabb bounding_box_at(double time) const override {
+            if (not is_moving) { return bbox; }
+            auto rvec = radius * vec3(1, 1, 1);
+            point3 center = sphere_center(time);
+            return aabb(center - rvec, center + rvec);
+        }
 
         /**
          * @brief Get uv coordinate in the sphere which includes `p`
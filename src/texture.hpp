@@ -2,22 +2,40 @@
 #define TEXTURE_H
 
 #include "rtweekend.hpp"
+#include "memory_tracker.hpp"
 #include "perlin.hpp"
 #include "external/rtw_stb_image.hpp"
 
+/** 組み込みのテクスチャの種類。`texture_value`はこれで分岐して、仮想呼び出しを経ずに色を求める */
+enum class texture_type : int32_t { custom, solid, checker, image, noise };
+
 class texture {
     public:
+    /** 組み込み以外のテクスチャは`custom`のまま派生し、`value`を仮想呼び出しで評価される */
+    texture() : type(texture_type::custom) {}
     virtual ~texture() = default;
     virtual color value(
         double u,
         double v,
         const point3& p
     ) const = 0;
+
+    const texture_type type;
+
+    private:
+    // 種類の値は`texture_value`が`static_cast`する先を決めるので、組み込みのクラスだけが設定できる
+    friend class solid_color;
+    friend class checker_texture;
+    friend class image_texture;
+    friend class noise_texture;
+    explicit texture(texture_type type) : type(type) {}
 };
 
-class solid_color : public texture {
+inline color texture_value(const texture& tex, double u, double v, const point3& p);
+
+class solid_color final : public texture {
     public:
-        solid_color(const color& albedo) : albedo(albedo) {}
+        solid_color(const color& albedo) : texture(texture_type::solid), albedo(albedo) {}
         solid_color(double red, double green, double blue) :
             solid_color(color{red, green, blue})
         {}
@@ -33,13 +51,14 @@ class solid_color : public texture {
         color albedo;
 };
 
-class checker_texture : public texture {
+class checker_texture final : public texture {
     public:
         checker_texture(
             double scale,
             shared_ptr<texture> even,
             shared_ptr<texture> odd
         ):
+            texture(texture_type::checker),
             inv_scale(1.0 / scale),
             even(even), odd(odd)
         {}
@@ -61,7 +80,7 @@ class checker_texture : public texture {
             auto z_integer = int(std::floor(inv_scale * p.z()));
 
             bool is_even = (x_integer + y_integer + z_integer) % 2 == 0;
-            return is_even ? even->value(u, v, p) : odd->value(u, v, p);
+            return texture_value(is_even ? *even : *odd, u, v, p);
         }
     private:
         double inv_scale;
@@ -69,9 +88,14 @@ class checker_texture : public texture {
         shared_ptr<texture> odd;
 };
 
-class image_texture : public texture {
+class image_texture final : public texture {
     public:
-        image_texture(const char* filename) : image(filename) {}
+        image_texture(const char* filename) : texture(texture_type::image), image(filename) {
+            memory_tracker::add_external(memory_tracker::tag::textures, float_data_bytes());
+        }
+        ~image_texture() {
+            memory_tracker::add_external(memory_tracker::tag::textures, -float_data_bytes());
+        }
         color value(
             double u,
             double v,
@@ -91,11 +115,16 @@ class image_texture : public texture {
         }
     private:
         rtw_image image;
+
+        /** stb_imageが`malloc`で確保した浮動小数点の画素（`operator new`を通らないので別に計上する） */
+        int64_t float_data_bytes() const {
+            return int64_t(image.width()) * image.height() * 3 * int64_t(sizeof(float));
+        }
 };
 
-class noise_texture : public texture {
+class noise_texture final : public texture {
     public:
-        noise_texture(double scale) : scale(scale) {}
+        noise_texture(double scale) : texture(texture_type::noise), scale(scale) {}
         color value(
             [[maybe_unused]] double u,
             [[maybe_unused]] double v,
@@ -110,5 +139,19 @@ class noise_texture : public texture {
         double scale;
 };
 
+/**
+ * @brief `tex`の色を求める。組み込みのテクスチャは種類で分岐して派生クラスの`value`を直接（インライン展開できる形で）呼び、
+ * それ以外は仮想呼び出しに任せる。
+ */
+inline color texture_value(const texture& tex, double u, double v, const point3& p) {
+    switch (tex.type) {
+        case texture_type::solid:   return static_cast<const solid_color&>(tex).solid_color::value(u, v, p);
+        case texture_type::checker: return static_cast<const checker_texture&>(tex).checker_texture::value(u, v, p);
+        case texture_type::image:   return static_cast<const image_texture&>(tex).image_texture::value(u, v, p);
+        case texture_type::noise:   return static_cast<const noise_texture&>(tex).noise_texture::value(u, v, p);
+        case texture_type::custom:  break;
+    }
+    return tex.value(u, v, p);
+}
 
 #endif
\ No newline at end of file
@@ -0,0 +1,186 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * 描画のタイムライン（シーンの構築、BVHの構築、各タイル、出力）を記録し、
+ * Chromeのtrace event形式のJSON（Perfettoやabout:tracingで表示できる）として書き出す。
+ *
+ * 各スレッドは自分専用のリングバッファにロックを取らずに書き込む。バッファは固定長で、溢れると古いイベントから上書きする。
+ * スレッドが終わるとバッファは空きに戻り、後から記録を始めたスレッドが（同じ名前のものを優先して）使い回す。
+ * 描画のたびにワーカースレッドを作り直しても、メモリ使用量は（同時に記録するスレッド数の最大）×（容量）で抑えられる。
+ * `start`を呼ぶまでは何も記録しない。
+ */
+namespace tracer {
+    struct event {
+        // 文字列リテラルなど、書き出すまで有効な名前
+        const char* name;
+        int64_t start_ns;
+        int64_t duration_ns;
+        // 負なら引数なし
+        int64_t arg;
+    };
+
+    namespace detail {
+        using clock_type = std::chrono::steady_clock;
+
+        struct thread_buffer {
+            std::string name;
+            // `set_thread_name`で付けた名前（なければ空）。空いたバッファを使い回すときに同じ名前のものを優先する
+            std::string requested_name;
+            int32_t id = 0;
+            // 記録中のスレッドが使っている（`buffers_mutex`で守る）
+            bool in_use = false;
+            std::vector<event> events;
+            // これまでに書き込んだイベントの総数（バッファの容量を超えうる）
+            std::atomic<uint64_t> written{0};
+        };
+
+        inline std::atomic<bool> enabled{false};
+        inline size_t capacity = 0;
+        inline clock_type::time_point origin;
+        inline std::mutex buffers_mutex;
+        // スレッドが終わってもバッファとそのイベントは`buffers`が持ち続け、次のスレッドに貸す
+        inline std::vector<std::unique_ptr<thread_buffer>> buffers;
+        inline thread_local thread_buffer* local = nullptr;
+        inline thread_local std::string pending_name;
+
+        /** スレッドの終了時に、そのスレッドが使っていたバッファを空きに戻す */
+        struct buffer_lease {
+            ~buffer_lease() {
+                if (local == nullptr) { return; }
+                std::lock_guard lock(buffers_mutex);
+                local->in_use = false;
+                local = nullptr;
+            }
+        };
+        inline thread_local buffer_lease lease;
+
+        inline int64_t now_ns() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - origin).count();
+        }
+
+        inline thread_buffer& local_buffer() {
+            if (local == nullptr) {
+                std::lock_guard lock(buffers_mutex);
+                thread_buffer* reused = nullptr;
+                for (const auto& buffer : buffers) {
+                    if (buffer->in_use) { continue; }
+                    if (reused == nullptr or buffer->requested_name == pending_name) { reused = buffer.get(); }
+                    if (buffer->requested_name == pending_name) { break; }
+                }
+                if (reused == nullptr) {
+                    auto buffer = std::make_unique<thread_buffer>();
+                    buffer->id = int32_t(buffers.size());
+                    buffer->events.resize(capacity);
+                    reused = buffer.get();
+                    buffers.push_back(std::move(buffer));
+                }
+                if (reused->name.empty() or reused->requested_name != pending_name) {
+                    reused->requested_name = pending_name;
+                    reused->name = pending_name.empty() ? "thread " + std::to_string(reused->id) : pending_name;
+                }
+                reused->in_use = true;
+                local = reused;
+                // スレッドの終了時に`lease`のデストラクタが呼ばれるよう、このスレッドで構築しておく
+                (void)&lease;
+            }
+            return *local;
+        }
+
+        inline void record(const event& e) {
+            thread_buffer& buffer = local_buffer();
+            uint64_t index = buffer.written.load(std::memory_order_relaxed);
+            buffer.events[index % capacity] = e;
+            buffer.written.store(index + 1, std::memory_order_release);
+        }
+    }
+
+    inline bool is_enabled() { return detail::enabled.load(std::memory_order_relaxed); }
+
+    /** 記録を始める。`events_per_thread`は各スレッドのリングバッファに残すイベント数 */
+    inline void start(size_t events_per_thread = 1 << 16) {
+        std::lock_guard lock(detail::buffers_mutex);
+        detail::capacity = std::max<size_t>(events_per_thread, 1);
+        detail::origin = detail::clock_type::now();
+        detail::enabled.store(true);
+    }
+
+    /** 呼び出したスレッドの名前を設定する。そのスレッドで最初のイベントを記録する前に呼ぶこと */
+    inline void set_thread_name(const std::string& name) {
+        detail::pending_name = name;
+        if (detail::local != nullptr) {
+            std::lock_guard lock(detail::buffers_mutex);
+            detail::local->name = name;
+            detail::local->requested_name = name;
+        }
+    }
+
+    /** スコープの開始から終了までを1つの区間として記録する */
+    class span {
+        public:
+            explicit span(const char* name, int64_t arg = -1) :
+                name(name), arg(arg), start_ns(is_enabled() ? detail::now_ns() : -1) {}
+            ~span() {
+                if (start_ns >= 0) { detail::record({name, start_ns, detail::now_ns() - start_ns, arg}); }
+            }
+            span(const span&) = delete;
+            span& operator=(const span&) = delete;
+
+        private:
+            const char* name;
+            int64_t arg;
+            int64_t start_ns;
+    };
+
+    /**
+     * @brief 記録したイベントをChromeのtrace event形式で書き出す。
+     * 記録中のスレッドがあってもよいが、書き出しの途中で上書きされたイベントは欠けることがある。
+     */
+    inline bool write_chrome_trace(const std::string& path) {
+        std::ofstream out(path);
+        if (not out) {
+            std::cerr << "ERROR: Could not write trace file '" << path << "'.\n";
+            return false;
+        }
+        std::lock_guard lock(detail::buffers_mutex);
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        out << std::fixed << std::setprecision(3);
+        bool first = true;
+        auto separator = [&] {
+            if (not first) { out << ",\n"; }
+            first = false;
+        };
+        for (const auto& buffer : detail::buffers) {
+            separator();
+            out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->id
+                << ", \"args\": {\"name\": \"" << buffer->name << "\"}}";
+
+            const uint64_t written = buffer->written.load(std::memory_order_acquire);
+            const uint64_t kept = std::min<uint64_t>(written, detail::capacity);
+            for (uint64_t i = written - kept; i < written; i++) {
+                const event& e = buffer->events[i % detail::capacity];
+                separator();
+                out << "{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->id
+                    << ", \"ts\": " << e.start_ns / 1000.0 << ", \"dur\": " << e.duration_ns / 1000.0;
+                if (e.arg >= 0) { out << ", \"args\": {\"index\": " << e.arg << "}"; }
+                out << "}";
+            }
+        }
+        out << "\n]}\n";
+        return bool(out);
+    }
+}
+
+#endif
@@ -0,0 +1,253 @@
+#ifndef TYPED_BVH_H
+#define TYPED_BVH_H
+
+#include "rtweekend.hpp"
+
+#include "aabb.hpp"
+#include "axis_aligned.hpp"
+#include "constant_medium.hpp"
+#include "flat_bvh.hpp"
+#include "hittable.hpp"
+#include "quad.hpp"
+#include "render_stats.hpp"
+#include "sphere.hpp"
+
+#include <algorithm>
+#include <span>
+#include <typeinfo>
+#include <vector>
+
+/** `primitive_store`が種類ごとの配列に分けて持つプリミティブの種類 */
+enum class primitive_type : int32_t { sphere, quad, triangle, aa_rect, aa_box, medium, other, count };
+constexpr int32_t primitive_type_count = int32_t(primitive_type::count);
+
+inline const char* primitive_type_name(primitive_type type) {
+    switch (type) {
+        case primitive_type::sphere:   return "sphere";
+        case primitive_type::quad:     return "quad";
+        case primitive_type::triangle: return "triangle";
+        case primitive_type::aa_rect:  return "aa_rect";
+        case primitive_type::aa_box:   return "aa_box";
+        case primitive_type::medium:   return "constant_medium";
+        case primitive_type::other:    return "other";
+        case primitive_type::count:    break;
+    }
+    return "?";
+}
+
+/** 葉が持つ、同じ種類のプリミティブの連続した範囲（種類ごとの配列の`[begin, begin + count)`） */
+struct primitive_run {
+    primitive_type type;
+    int32_t begin;
+    int32_t count;
+};
+
+/**
+ * @brief プリミティブを種類ごとに値で並べた配列。
+ * 組み込みの種類（の、派生でない実際の型）はここにコピーされ、それ以外は`others`に`shared_ptr`のまま入る。
+ */
+struct primitive_store {
+    std::vector<sphere> spheres;
+    std::vector<quad> quads;
+    std::vector<triangle> triangles;
+    std::vector<aa_rect> rects;
+    std::vector<aa_box> boxes;
+    std::vector<constant_medium> media;
+    std::vector<shared_ptr<hittable>> others;
+
+    static primitive_type type_of(const hittable& object) {
+        const std::type_info& type = typeid(object);
+        if (type == typeid(sphere))          { return primitive_type::sphere; }
+        if (type == typeid(quad))            { return primitive_type::quad; }
+        if (type == typeid(triangle))        { return primitive_type::triangle; }
+        if (type == typeid(aa_rect))         { return primitive_type::aa_rect; }
+        if (type == typeid(aa_box))          { return primitive_type::aa_box; }
+        if (type == typeid(constant_medium)) { return primitive_type::medium; }
+        return primitive_type::other;
+    }
+
+    /** `object`を`type_of(*object)`の配列の末尾に加える */
+    void add(const shared_ptr<hittable>& object) {
+        switch (type_of(*object)) {
+            case primitive_type::sphere:   spheres.push_back(static_cast<const sphere&>(*object)); break;
+            case primitive_type::quad:     quads.push_back(static_cast<const quad&>(*object)); break;
+            case primitive_type::triangle: triangles.push_back(static_cast<const triangle&>(*object)); break;
+            case primitive_type::aa_rect:  rects.push_back(static_cast<const aa_rect&>(*object)); break;
+            case primitive_type::aa_box:   boxes.push_back(static_cast<const aa_box&>(*object)); break;
+            case primitive_type::medium:   media.push_back(static_cast<const constant_medium&>(*object)); break;
+            default:                       others.push_back(object); break;
+        }
+    }
+
+    int32_t size(primitive_type type) const {
+        switch (type) {
+            case primitive_type::sphere:   return int32_t(spheres.size());
+            case primitive_type::quad:     return int32_t(quads.size());
+            case primitive_type::triangle: return int32_t(triangles.size());
+            case primitive_type::aa_rect:  return int32_t(rects.size());
+            case primitive_type::aa_box:   return int32_t(boxes.size());
+            case primitive_type::medium:   return int32_t(media.size());
+            default:                       return int32_t(others.size());
+        }
+    }
+
+    const hittable& at(primitive_type type, int32_t index) const {
+        switch (type) {
+            case primitive_type::sphere:   return spheres[index];
+            case primitive_type::quad:     return quads[index];
+            case primitive_type::triangle: return triangles[index];
+            case primitive_type::aa_rect:  return rects[index];
+            case primitive_type::aa_box:   return boxes[index];
+            case primitive_type::medium:   return media[index];
+            default:                       return *others[index];
+        }
+    }
+};
+
+/**
+ * @brief プリミティブを種類ごとの連続した配列に持つBVH。
+ *
+ * ノードの並びは`flat_bvh`と同じだが、葉の`offset`と`count`はプリミティブではなく`primitive_run`の範囲を指す。
+ * 葉の中のプリミティブは種類ごとにまとめられ、走査は種類ごとに1回だけ分岐して、
+ * その範囲を派生クラスの`hit`を直接呼ぶ（インライン展開できる）ループで調べる。
+ * 葉の中での判定順が種類順になるので、`constant_medium`を含むシーンでは乱数の消費順が変わり、ノイズの出方が変わる。
+ */
+class typed_bvh : public hittable {
+    public:
+        typed_bvh(const std::vector<shared_ptr<hittable>>& objects, const bvh_layout& layout) : nodes(layout.nodes) {
+            std::vector<shared_ptr<hittable>> leaf;
+            for (flat_bvh_node& node : nodes) {
+                if (not node.is_leaf()) { continue; }
+                leaf.clear();
+                for (int32_t i = node.offset; i < node.offset + node.count; i++) {
+                    leaf.push_back(objects[layout.primitive_indices[i]]);
+                }
+                std::stable_sort(leaf.begin(), leaf.end(), [](const auto& a, const auto& b) {
+                    return primitive_store::type_of(*a) < primitive_store::type_of(*b);
+                });
+
+                node.offset = int32_t(runs.size());
+                for (const auto& object : leaf) {
+                    primitive_type type = primitive_store::type_of(*object);
+                    if (runs.size() == size_t(node.offset) or runs.back().type != type) {
+                        runs.push_back({type, store.size(type), 0});
+                    }
+                    store.add(object);
+                    runs.back().count++;
+                }
+                node.count = int32_t(runs.size()) - node.offset;
+            }
+            bbox = nodes.empty() ? aabb::empty : nodes[0].bbox;
+        }
+
+        bool hit(
+            const ray& r,
+            interval ray_t,
+            hit_record& rec
+        ) const override {
+            if (nodes.empty()) { return false; }
+            int32_t stack[bvh_max_depth];
+            int32_t stack_size = 0;
+            int32_t current = 0;
+            bool hit_anything = false;
+
+            while (true) {
+                const flat_bvh_node& node = nodes[current];
+                render_stats::add(render_stats::counter::bvh_nodes_visited);
+                if (node.bbox.hit(r, ray_t)) {
+                    if (node.is_leaf()) {
+                        if (hit_leaf(node, r, ray_t, rec)) { hit_anything = true; }
+                    } else {
+                        // レイの向きから見て手前側の子を先に調べる
+                        if (r.direction()[node.axis] < 0) {
+                            stack[stack_size++] = current + 1;
+                            current = node.offset;
+                        } else {
+                            stack[stack_size++] = node.offset;
+                            current = current + 1;
+                        }
+                        continue;
+                    }
+                }
+                if (stack_size == 0) { break; }
+                current = stack[--stack_size];
+            }
+            return hit_anything;
+        }
+
+        aabb bounding_box() const override { return bbox; }
+        aabb bounding_box_at(double time) const override {
+            aabb box = aabb::empty;
+            for (const primitive_run& run : runs) {
+                for (int32_t i = run.begin; i < run.begin + run.count; i++) {
+                    box = aabb(box, store.at(run.type, i).bounding_box_at(time));
+                }
+            }
+            return box;
+        }
+
+        std::span<const flat_bvh_node> node_array() const { return nodes; }
+        std::span<const primitive_run> run_array() const { return runs; }
+        const primitive_store& primitives() const { return store; }
+
+        /** 葉`node`の各範囲を調べ、当たるたびに`ray_t.max`を縮める */
+        bool hit_leaf(const flat_bvh_node& node, const ray& r, interval& ray_t, hit_record& rec) const {
+            bool hit_anything = false;
+            for (int32_t i = node.offset; i < node.offset + node.count; i++) {
+                if (hit_run(runs[i], r, ray_t, rec)) { hit_anything = true; }
+            }
+            return hit_anything;
+        }
+
+    private:
+        std::vector<flat_bvh_node> nodes;
+        std::vector<primitive_run> runs;
+        primitive_store store;
+        aabb bbox;
+
+        /** `run`の範囲を調べ、当たるたびに`ray_t.max`を縮める */
+        bool hit_run(const primitive_run& run, const ray& r, interval& ray_t, hit_record& rec) const {
+            switch (run.type) {
+                case primitive_type::sphere:   return hit_each(store.spheres, run, r, ray_t, rec);
+                case primitive_type::quad:     return hit_each(store.quads, run, r, ray_t, rec);
+                case primitive_type::triangle: return hit_each(store.triangles, run, r, ray_t, rec);
+                case primitive_type::aa_rect:  return hit_each(store.rects, run, r, ray_t, rec);
+                case primitive_type::aa_box:   return hit_each(store.boxes, run, r, ray_t, rec);
+                case primitive_type::medium:   return hit_each(store.media, run, r, ray_t, rec);
+                default:                       return hit_each(store.others, run, r, ray_t, rec);
+            }
+        }
+
+        template<class Primitive>
+        static bool hit_each(
+            const std::vector<Primitive>& items,
+            const primitive_run& run,
+            const ray& r,
+            interval& ray_t,
+            hit_record& rec
+        ) {
+            bool hit_anything = false;
+            for (int32_t i = run.begin; i < run.begin + run.count; i++) {
+                if (hit_one(items[i], r, ray_t, rec)) {
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+            }
+            return hit_anything;
+        }
+
+        // 型ごとの交差判定。派生クラスの関数を修飾して呼び、仮想呼び出しを避ける
+        static bool hit_one(const sphere& s, const ray& r, interval ray_t, hit_record& rec) { return s.sphere::hit(r, ray_t, rec); }
+        static bool hit_one(const quad& q, const ray& r, interval ray_t, hit_record& rec) { return q.hit_as<quad>(r, ray_t, rec); }
+        static bool hit_one(const triangle& t, const ray& r, interval ray_t, hit_record& rec) { return t.hit_as<triangle>(r, ray_t, rec); }
+        static bool hit_one(const aa_rect& a, const ray& r, interval ray_t, hit_record& rec) { return a.aa_rect::hit(r, ray_t, rec); }
+        static bool hit_one(const aa_box& b, const ray& r, interval ray_t, hit_record& rec) { return b.aa_box::hit(r, ray_t, rec); }
+        static bool hit_one(const constant_medium& m, const ray& r, interval ray_t, hit_record& rec) {
+            return m.constant_medium::hit(r, ray_t, rec);
+        }
+        static bool hit_one(const shared_ptr<hittable>& object, const ray& r, interval ray_t, hit_record& rec) {
+            return object->hit(r, ray_t, rec);
+        }
+};
+
+#endif
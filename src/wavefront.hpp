@@ -0,0 +1,263 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "rtweekend.hpp"
+
+#include "hittable.hpp"
+#include "material.hpp"
+#include "parallel.hpp"
+#include "ray_sort.hpp"
+#include "render_stats.hpp"
+#include "tracer.hpp"
+
+#include <array>
+#include <atomic>
+#include <barrier>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * @brief 波面（wavefront）方式の経路追跡で、1バッチの経路の状態を段をまたいで保持するキュー。
+ * 経路ごとの値は種類ごとの配列（SoA）に持つ。交差の結果はマテリアルの評価にそのまま渡すため`hit_record`の配列にする。
+ */
+struct path_queue {
+    // 次に追跡するレイ
+    std::vector<point3> origins;
+    std::vector<vec3> directions;
+    std::vector<double> times;
+    // カメラからここまでの減衰の積と、これまでに集めた放射輝度
+    std::vector<color> throughputs;
+    std::vector<color> radiances;
+    // 追跡したレイの本数
+    std::vector<int32_t> lengths;
+    std::vector<hit_record> hits;
+    std::vector<uint8_t> hit_flags;
+
+    // 追跡中の経路の位置。`shade_order`は当たった経路をマテリアルの種類順に並べたもの
+    std::vector<int32_t> active;
+    std::vector<int32_t> shade_order;
+
+    void resize(size_t size) {
+        origins.resize(size);
+        directions.resize(size);
+        times.resize(size);
+        throughputs.resize(size);
+        radiances.resize(size);
+        lengths.resize(size);
+        hits.resize(size);
+        hit_flags.resize(size);
+        active.reserve(size);
+        shade_order.resize(size);
+    }
+
+    ray ray_at(int32_t path) const { return ray{origins[path], directions[path], times[path]}; }
+    void set_ray(int32_t path, const ray& r) {
+        origins[path] = r.origin();
+        directions[path] = r.direction();
+        times[path] = r.time();
+    }
+};
+
+/**
+ * @brief `camera::ray_color`の再帰と同じ経路を、多数の経路について段ごとにまとめて進める積分器。
+ *
+ * バッチの経路を、生成 → （延長: 交差判定 → マテリアルの種類ごとのシェーディング → 光源への接続）を反射回数だけ繰り返し → 蓄積、
+ * の順に処理する。各段はバッチを固定の大きさのブロックに分けて複数のスレッドで処理する。
+ * スレッドは`run`の間だけ1度作り、段ごとに`std::barrier`で仕事を渡して待たせておく（段ごとにスレッドを作り直さない）。
+ * このレンダラーは光源を直接サンプリングしない（次イベント推定がない）ので、接続の段でするべき仕事はなく、段の区切りだけを置いている。
+ * `sort_secondary_rays`なら、散乱したレイの交差判定の前に経路を方向の八分円と始点のMortonコードの順に並べ替え、
+ * 続けて調べるレイがBVHの同じ部分を辿るようにする。
+ * 乱数はブロックごとに（バッチ・反射回数・段・ブロックの番号から決まる種で）初期化するので、結果はスレッド数によらない。
+ * ただし乱数を使う順序が再帰とは異なるので、同じシーンでも再帰の結果とはノイズの出方が異なる。
+ */
+class wavefront_integrator {
+    public:
+        /** 1つのスレッドがまとめて処理する経路の数 */
+        static constexpr int32_t block_size = 256;
+
+        wavefront_integrator(const hittable& world, const color& background, int32_t max_depth, int32_t thread_count) :
+            world(world), background(background), max_depth(max_depth), thread_count(thread_count) {}
+
+        bool sort_secondary_rays = false;
+
+        /**
+         * @brief `thread_count`個のスレッドを用意して、呼び出し元のスレッドで`f()`を実行し、全てが終わるまで待つ。
+         * `f`の中で呼んだ`trace_batch`の各段は、用意したスレッドで分けて処理する。
+         */
+        template<class F>
+        void run(F&& f) {
+            std::barrier sync(thread_count);
+            stage_sync = &sync;
+            run_workers(thread_count, [&](int32_t worker) {
+                if (worker == 0) {
+                    f();
+                    // 空の仕事で待っているスレッドを終わらせる
+                    stage_work = nullptr;
+                    sync.arrive_and_wait();
+                } else {
+                    tracer::set_thread_name("worker " + std::to_string(worker));
+                    while (true) {
+                        sync.arrive_and_wait();
+                        if (not stage_work) { break; }
+                        (*stage_work)();
+                        sync.arrive_and_wait();
+                    }
+                }
+                render_stats::flush();
+            });
+            stage_sync = nullptr;
+        }
+
+        /**
+         * @brief 経路`[first, first + count)`を1バッチとして追跡する。`run`の外で呼ぶと全ての段を呼び出し元のスレッドだけで処理する。
+         * `camera_ray(k)`は経路`k`の最初のレイを返し、`finish(k, radiance)`は経路`k`の結果を受け取る。
+         * `finish`は複数のスレッドから並行に呼ばれる。
+         * @return 追跡したレイの本数
+         */
+        template<class CameraRay, class Finish>
+        int64_t trace_batch(int64_t first, int32_t count, CameraRay&& camera_ray, Finish&& finish) {
+            batch++;
+            queue.resize(size_t(count));
+
+            {
+                tracer::span span("wavefront generate", count);
+                for_each_block(count, stage::generate, 0, [&](int32_t path) {
+                    queue.set_ray(path, camera_ray(first + path));
+                    queue.throughputs[path] = color{1, 1, 1};
+                    queue.radiances[path] = color{0, 0, 0};
+                    queue.lengths[path] = 0;
+                });
+                queue.active.resize(size_t(count));
+                for (int32_t path = 0; path < count; path++) { queue.active[path] = path; }
+            }
+
+            int64_t traced = 0;
+            for (int32_t depth = max_depth - 1; depth > 0 and not queue.active.empty(); depth--) {
+                traced += int64_t(queue.active.size());
+                if (sort_secondary_rays and depth < max_depth - 1) {
+                    tracer::span span("wavefront ray sort", int64_t(queue.active.size()));
+                    sort_rays(queue.active, queue.origins, queue.directions);
+                }
+                extend(depth);
+                sort_by_material();
+                shade(depth);
+                connect();
+            }
+
+            {
+                tracer::span span("wavefront accumulate", count);
+                for_each_block(count, stage::accumulate, 0, [&](int32_t path) {
+                    render_stats::record_path_length(queue.lengths[path]);
+                    finish(first + path, queue.radiances[path]);
+                });
+            }
+            return traced;
+        }
+
+    private:
+        enum class stage : int32_t { generate, extend, shade, accumulate };
+
+        const hittable& world;
+        color background;
+        int32_t max_depth;
+        int32_t thread_count;
+        path_queue queue;
+        int64_t batch = 0;
+        // `run`の間の、段の開始と終了で全スレッドがそろうための区切りと、その段の仕事
+        std::barrier<>* stage_sync = nullptr;
+        const std::function<void()>* stage_work = nullptr;
+
+        /** 交差判定。外れた経路は背景を加えて終える */
+        void extend(int32_t depth) {
+            tracer::span span("wavefront extend", int64_t(queue.active.size()));
+            const bool primary = depth == max_depth - 1;
+            for_each_active(queue.active, stage::extend, depth, [&](int32_t path) {
+                render_stats::add(primary ? render_stats::counter::primary_rays : render_stats::counter::secondary_rays);
+                queue.lengths[path]++;
+                hit_record& rec = queue.hits[path];
+                queue.hit_flags[path] = world.hit(queue.ray_at(path), interval{0.001, infinity}, rec);
+                if (not queue.hit_flags[path]) { queue.radiances[path] += queue.throughputs[path] * background; }
+            });
+        }
+
+        /** 当たった経路を、マテリアルの種類ごとにまとまるよう（種類の中では元の順に）`shade_order`に並べる */
+        void sort_by_material() {
+            tracer::span span("wavefront sort", int64_t(queue.active.size()));
+            constexpr int32_t type_count = int32_t(material_type::isotropic) + 1;
+            std::array<int32_t, type_count + 1> offsets{};
+            for (int32_t path : queue.active) {
+                if (queue.hit_flags[path]) { offsets[int32_t(queue.hits[path].mat->type) + 1]++; }
+            }
+            for (int32_t t = 0; t < type_count; t++) { offsets[t + 1] += offsets[t]; }
+            const int32_t hit_count = offsets[type_count];
+            for (int32_t path : queue.active) {
+                if (queue.hit_flags[path]) { queue.shade_order[offsets[int32_t(queue.hits[path].mat->type)]++] = path; }
+            }
+            queue.active.assign(queue.shade_order.begin(), queue.shade_order.begin() + hit_count);
+        }
+
+        /** マテリアルを評価し、放射を加えて、散乱した経路のレイと減衰を更新する。散乱しなかった経路は終える */
+        void shade(int32_t depth) {
+            tracer::span span("wavefront shade", int64_t(queue.active.size()));
+            for_each_active(queue.active, stage::shade, depth, [&](int32_t path) {
+                const hit_record& rec = queue.hits[path];
+                render_stats::add_material_hit(*rec.mat);
+                queue.radiances[path] += queue.throughputs[path] * material_emitted(*rec.mat, rec.u, rec.v, rec.p);
+                color attenuation;
+                ray scattered;
+                queue.hit_flags[path] = material_scatter(*rec.mat, queue.ray_at(path), rec, attenuation, scattered);
+                if (queue.hit_flags[path]) {
+                    queue.throughputs[path] = queue.throughputs[path] * attenuation;
+                    queue.set_ray(path, scattered);
+                }
+            });
+            std::erase_if(queue.active, [&](int32_t path) { return not queue.hit_flags[path]; });
+        }
+
+        /** 光源への接続（シャドウレイ）の段。次イベント推定を行わないので何もしない */
+        void connect() {}
+
+        /** `queue.active`の各経路について`f(path)`を呼ぶ */
+        template<class F>
+        void for_each_active(const std::vector<int32_t>& paths, stage s, int32_t depth, F&& f) {
+            for_each_block(int32_t(paths.size()), s, depth, [&](int32_t k) { f(paths[k]); });
+        }
+
+        /**
+         * @brief `[0, count)`を`block_size`ずつのブロックに分け、空いたスレッドが順にブロックを取って`f(k)`を呼ぶ。
+         * 乱数はブロックごとに番号から決まる種で初期化する。
+         */
+        template<class F>
+        void for_each_block(int32_t count, stage s, int32_t depth, F&& f) {
+            const int32_t blocks = (count + block_size - 1) / block_size;
+            std::atomic<int32_t> next_block = 0;
+            const std::function<void()> work = [&] {
+                for (int32_t b = next_block++; b < blocks; b = next_block++) {
+                    random_generator().seed(block_seed(s, depth, b));
+                    const int32_t end = std::min(count, (b + 1) * block_size);
+                    for (int32_t k = b * block_size; k < end; k++) { f(k); }
+                }
+            };
+            if (not stage_sync) {
+                work();
+                return;
+            }
+            // 待っているスレッドに段の仕事を渡し、呼び出し元も一緒に処理して、全員が終えるまで待つ
+            stage_work = &work;
+            stage_sync->arrive_and_wait();
+            work();
+            stage_sync->arrive_and_wait();
+        }
+
+        std::mt19937::result_type block_seed(stage s, int32_t depth, int32_t block) const {
+            uint64_t x = uint64_t(batch) * 0x9E3779B97F4A7C15ull;
+            x ^= (uint64_t(depth) << 40) ^ (uint64_t(s) << 32) ^ uint64_t(block);
+            // splitmix64の最後の混ぜ合わせ
+            x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+            x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+            return std::mt19937::result_type(x ^ (x >> 31));
+        }
+};
+
+#endif
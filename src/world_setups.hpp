@@ -3,50 +3,53 @@
 
 #include "rtweekend.hpp"
 
-#include "hittable.hpp"
-#include "hittable_list.hpp"
-#include "sphere.hpp"
-#include "material.hpp"
-#include "constant_medium.hpp"
+#include "scene_desc.hpp"
 
-hittable_list world_setup1() {
-    // World
-    hittable_list world;
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// 組み込みのシーン。`main --export`でシーンファイルに書き出して用いる。
+
+scene_desc world_setup1() {
+    scene_desc scene;
 
     //material
-    auto material_ground = make_shared<lambertian>(color(0.8, 0.8, 0.0));
-    auto material_center = make_shared<lambertian>(color(0.1, 0.2, 0.5));
-    auto material_left   = make_shared<dielectric>(1.50 / 1.00);
-    auto material_bubble   = make_shared<dielectric>(1.00 / 1.50);
-    auto material_right  = make_shared<metal>(color(0.8, 0.6, 0.2), 0.0);
-
-    world.add(make_shared<sphere>(point3( 0.0, -100.5, -1.0), 100.0, material_ground));
-    world.add(make_shared<sphere>(point3( 0.0,    0.0, -1.2),   0.5, material_center));
-    world.add(make_shared<sphere>(point3(-1.0,    0.0, -1.0),   0.5, material_left));
-    world.add(make_shared<sphere>(point3(-1.0,    0.0, -1.0),   0.4, material_bubble));
-    world.add(make_shared<sphere>(point3( 1.0,    0.0, -1.0),   0.5, material_right));
-    return world;
+    auto material_ground = scene.lambertian(color(0.8, 0.8, 0.0));
+    auto material_center = scene.lambertian(color(0.1, 0.2, 0.5));
+    auto material_left   = scene.dielectric(1.50 / 1.00);
+    auto material_bubble   = scene.dielectric(1.00 / 1.50);
+    auto material_right  = scene.metal(color(0.8, 0.6, 0.2), 0.0);
+
+    scene.add(scene.sphere(point3( 0.0, -100.5, -1.0), 100.0, material_ground));
+    scene.add(scene.sphere(point3( 0.0,    0.0, -1.2),   0.5, material_center));
+    scene.add(scene.sphere(point3(-1.0,    0.0, -1.0),   0.5, material_left));
+    scene.add(scene.sphere(point3(-1.0,    0.0, -1.0),   0.4, material_bubble));
+    scene.add(scene.sphere(point3( 1.0,    0.0, -1.0),   0.5, material_right));
+    return scene;
 }
 
-hittable_list world_setup_fov_test() {
-    hittable_list world;
+scene_desc world_setup_fov_test() {
+    scene_desc scene;
 
     double R = std::cos(pi / 4);
-    auto material_left = make_shared<lambertian>(color{0, 0, 1});
-    auto material_right = make_shared<lambertian>(color{1, 0, 0});
+    auto material_left = scene.lambertian(color{0, 0, 1});
+    auto material_right = scene.lambertian(color{1, 0, 0});
 
-    world.add(make_shared<sphere>(point3{-R, 0, -1}, R, material_left));
-    world.add(make_shared<sphere>(point3{R, 0, -1}, R, material_right));
+    scene.add(scene.sphere(point3{-R, 0, -1}, R, material_left));
+    scene.add(scene.sphere(point3{R, 0, -1}, R, material_right));
 
-    return world;
+    return scene;
 }
 
 
-void bouncing_spheres() {
-    hittable_list world;
-    auto checker = make_shared<checker_texture>(0.32, color{0.2, 0.3, 0.1}, color{0.9, 0.9, 0.9});
-    auto ground_material = make_shared<lambertian>(checker);
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
+scene_desc bouncing_spheres() {
+    scene_desc scene;
+    std::vector<int32_t> world;
+    auto checker = scene.checker_texture(0.32, color{0.2, 0.3, 0.1}, color{0.9, 0.9, 0.9});
+    auto ground_material = scene.lambertian(checker);
+    world.push_back(scene.sphere(point3(0, -1000, 0), 1000, ground_material));
 
     for (int32_t a = -11; a < 11; a++) {
         for (int32_t b = -11; b < 11; b++) {
@@ -54,43 +57,43 @@ void bouncing_spheres() {
             point3 center = point3{static_cast<double>(a), 0.2, static_cast<double>(b)} + 0.9*point3{random_double(), 0, random_double()};
 
             if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-                shared_ptr<material> sphere_material;
+                int32_t sphere_material;
 
                 if (choose_mat < 0.8) {
                     // diffuse
                     auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
+                    sphere_material = scene.lambertian(albedo);
                     auto center2 = center + vec3{0, random_double(0, 0.5), 0};
-                    world.add(make_shared<sphere>(center, center2, 0.2, sphere_material));
+                    world.push_back(scene.sphere(center, center2, 0.2, sphere_material));
                 } else if (choose_mat < 0.95) {
                     // metal
                     auto albedo = color::random(0.5, 1);
                     auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                    sphere_material = scene.metal(albedo, fuzz);
+                    world.push_back(scene.sphere(center, 0.2, sphere_material));
                 } else {
                     // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                    sphere_material = scene.dielectric(1.5);
+                    world.push_back(scene.sphere(center, 0.2, sphere_material));
                 }
             }
         }
     }
 
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-    auto material1_alpha = make_shared<dielectric>(1.0 / 1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 0.8, material1_alpha));
-    
-    auto material2 = make_shared<lambertian>(color{0.4, 0.2, 0.1});
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+    auto material1 = scene.dielectric(1.5);
+    world.push_back(scene.sphere(point3(0, 1, 0), 1.0, material1));
+    auto material1_alpha = scene.dielectric(1.0 / 1.5);
+    world.push_back(scene.sphere(point3(0, 1, 0), 0.8, material1_alpha));
+
+    auto material2 = scene.lambertian(color{0.4, 0.2, 0.1});
+    world.push_back(scene.sphere(point3(-4, 1, 0), 1.0, material2));
 
-    auto material3 = make_shared<metal>(color{0.7, 0.6, 0.5}, 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-    
-    world = hittable_list(make_shared<bvh_node>(world));
+    auto material3 = scene.metal(color{0.7, 0.6, 0.5}, 0.0);
+    world.push_back(scene.sphere(point3(4, 1, 0), 1.0, material3));
 
-    camera cam;
+    scene.add(scene.bvh(world));
+
+    camera_desc& cam = scene.camera;
     cam.aspect_ratio    = 16.0 / 9.0;
     cam.image_width     = 640;
     cam.samples_per_pixel = 300;
@@ -105,17 +108,17 @@ void bouncing_spheres() {
     cam.defocus_angle = 0.6;
     cam.focus_dist = 10.0;
 
-    cam.render(world);
+    return scene;
 }
 
-void checkered_spheres() {
-    hittable_list world;
+scene_desc checkered_spheres() {
+    scene_desc scene;
 
-    auto checker = make_shared<checker_texture>(0.32, color{0.2, 0.3, 0.1}, color{0.9, 0.9, 0.9});
-    world.add(make_shared<sphere>(point3(0,-10, 0), 10, make_shared<lambertian>(checker)));
-    world.add(make_shared<sphere>(point3(0, 10, 0), 10, make_shared<lambertian>(checker)));
+    auto checker = scene.checker_texture(0.32, color{0.2, 0.3, 0.1}, color{0.9, 0.9, 0.9});
+    scene.add(scene.sphere(point3(0,-10, 0), 10, scene.lambertian(checker)));
+    scene.add(scene.sphere(point3(0, 10, 0), 10, scene.lambertian(checker)));
 
-    camera cam;
+    camera_desc& cam = scene.camera;
 
     cam.aspect_ratio      = 16.0 / 9.0;
     cam.image_width       = 400;
@@ -130,15 +133,16 @@ void checkered_spheres() {
 
     cam.defocus_angle = 0;
 
-    cam.render(world);
+    return scene;
 }
 
-void earth() {
-    auto earth_texture = make_shared<image_texture>("earthmap.jpg");
-    auto earth_surface = make_shared<lambertian>(earth_texture);
-    auto globe = make_shared<sphere>(point3(0,0,0), 2, earth_surface);
+scene_desc earth() {
+    scene_desc scene;
+    auto earth_texture = scene.image_texture("earthmap.jpg");
+    auto earth_surface = scene.lambertian(earth_texture);
+    auto globe = scene.sphere(point3(0,0,0), 2, earth_surface);
 
-    camera cam;
+    camera_desc& cam = scene.camera;
 
     cam.aspect_ratio      = 16.0 / 9.0;
     cam.image_width       = 400;
@@ -153,17 +157,18 @@ void earth() {
 
     cam.defocus_angle = 0;
 
-    cam.render(hittable_list(globe));
+    scene.add(globe);
+    return scene;
 }
 
-void perlin_spheres() {
-    hittable_list world;
-    auto pertext = make_shared<noise_texture>(4.0);
-    world.add(make_shared<sphere>(point3{0, -1000, 0}, 1000, make_shared<lambertian>(pertext)));
-    world.add(make_shared<sphere>(point3{0, 2, 0}, 2, make_shared<lambertian>(pertext)));
+scene_desc perlin_spheres() {
+    scene_desc scene;
+    auto pertext = scene.noise_texture(4.0);
+    scene.add(scene.sphere(point3{0, -1000, 0}, 1000, scene.lambertian(pertext)));
+    scene.add(scene.sphere(point3{0, 2, 0}, 2, scene.lambertian(pertext)));
+
 
-    
-    camera cam;
+    camera_desc& cam = scene.camera;
 
     cam.aspect_ratio      = 16.0 / 9.0;
     cam.image_width       = 400;
@@ -178,27 +183,27 @@ void perlin_spheres() {
 
     cam.defocus_angle = 0;
 
-    cam.render(world);
+    return scene;
 }
 
-void quads() {
-    hittable_list world;
+scene_desc quads() {
+    scene_desc scene;
 
     // Materials
-    auto left_red     = make_shared<lambertian>(color(1.0, 0.2, 0.2));
-    auto back_green   = make_shared<lambertian>(color(0.2, 1.0, 0.2));
-    auto right_blue   = make_shared<lambertian>(color(0.2, 0.2, 1.0));
-    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
-    auto lower_teal   = make_shared<lambertian>(color(0.2, 0.8, 0.8));
+    auto left_red     = scene.lambertian(color(1.0, 0.2, 0.2));
+    auto back_green   = scene.lambertian(color(0.2, 1.0, 0.2));
+    auto right_blue   = scene.lambertian(color(0.2, 0.2, 1.0));
+    auto upper_orange = scene.lambertian(color(1.0, 0.5, 0.0));
+    auto lower_teal   = scene.lambertian(color(0.2, 0.8, 0.8));
 
     // Quads
-    world.add(make_shared<triangle>(point3(-3,-2, 5), vec3(0, 0,-4), vec3(0, 4, 0), left_red));
-    world.add(make_shared<quad>(point3(-2,-2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
-    world.add(make_shared<triangle>(point3( 3,2, 5), vec3(0, 0, -4), vec3(0, -4, 0), right_blue));
-    world.add(make_shared<ring>(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange, 2, 1));
-    world.add(make_shared<disk>(point3(-2,-3, 5), vec3(4, 0, 0), vec3(0, 0,-4), lower_teal, 2));
+    scene.add(scene.triangle(point3(-3,-2, 5), vec3(0, 0,-4), vec3(0, 4, 0), left_red));
+    scene.add(scene.quad(point3(-2,-2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
+    scene.add(scene.triangle(point3( 3,2, 5), vec3(0, 0, -4), vec3(0, -4, 0), right_blue));
+    scene.add(scene.ring(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange, 2, 1));
+    scene.add(scene.disk(point3(-2,-3, 5), vec3(4, 0, 0), vec3(0, 0,-4), lower_teal, 2));
 
-    camera cam;
+    camera_desc& cam = scene.camera;
 
     cam.aspect_ratio      = 1.0;
     cam.image_width       = 400;
@@ -213,21 +218,21 @@ void quads() {
 
     cam.defocus_angle = 0;
 
-    cam.render(world);
+    return scene;
 }
 
-void simple_light() {
-    hittable_list world;
+scene_desc simple_light() {
+    scene_desc scene;
 
-    auto pertext = make_shared<noise_texture>(4);
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(pertext)));
-    world.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<lambertian>(pertext)));
+    auto pertext = scene.noise_texture(4);
+    scene.add(scene.sphere(point3(0,-1000,0), 1000, scene.lambertian(pertext)));
+    scene.add(scene.sphere(point3(0,2,0), 2, scene.lambertian(pertext)));
 
-    auto difflight = make_shared<diffuse_light>(12*color(1,1,1));
-    world.add(make_shared<sphere>(point3(0,7,0), 2, difflight));
-    world.add(make_shared<quad>(point3(3,1,-2), vec3(2,0,0), vec3(0,2,0), difflight));
+    auto difflight = scene.diffuse_light(12*color(1,1,1));
+    scene.add(scene.sphere(point3(0,7,0), 2, difflight));
+    scene.add(scene.quad(point3(3,1,-2), vec3(2,0,0), vec3(0,2,0), difflight));
 
-    camera cam;
+    camera_desc& cam = scene.camera;
 
     cam.aspect_ratio      = 16.0 / 9.0;
     cam.image_width       = 400;
@@ -242,36 +247,36 @@ void simple_light() {
 
     cam.defocus_angle = 0;
 
-    cam.render(world);
+    return scene;
 }
 
-void cornell_smoke() {
-     hittable_list world;
+scene_desc cornell_smoke() {
+    scene_desc scene;
 
-    auto red   = make_shared<lambertian>(color(.65, .05, .05));
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    auto green = make_shared<lambertian>(color(.12, .45, .15));
-    auto light = make_shared<diffuse_light>(color(7, 7, 7));
+    auto red   = scene.lambertian(color(.65, .05, .05));
+    auto white = scene.lambertian(color(.73, .73, .73));
+    auto green = scene.lambertian(color(.12, .45, .15));
+    auto light = scene.diffuse_light(color(7, 7, 7));
 
-    world.add(make_shared<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
-    world.add(make_shared<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
-    world.add(make_shared<quad>(point3(113,554,127), vec3(330,0,0), vec3(0,0,305), light));
-    world.add(make_shared<quad>(point3(0,555,0), vec3(555,0,0), vec3(0,0,555), white));
-    world.add(make_shared<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
-    world.add(make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
+    scene.add(scene.quad(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
+    scene.add(scene.quad(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
+    scene.add(scene.quad(point3(113,554,127), vec3(330,0,0), vec3(0,0,305), light));
+    scene.add(scene.quad(point3(0,555,0), vec3(555,0,0), vec3(0,0,555), white));
+    scene.add(scene.quad(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
+    scene.add(scene.quad(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
 
-    shared_ptr<hittable> box1 = box(point3(0,0,0), point3(165,330,165), white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265,0,295));
+    int32_t box1 = scene.box(point3(0,0,0), point3(165,330,165), white);
+    box1 = scene.rotate_y(box1, 15);
+    box1 = scene.translate(box1, vec3(265,0,295));
 
-    shared_ptr<hittable> box2 = box(point3(0,0,0), point3(165,165,165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130,0,65));
+    int32_t box2 = scene.box(point3(0,0,0), point3(165,165,165), white);
+    box2 = scene.rotate_y(box2, -18);
+    box2 = scene.translate(box2, vec3(130,0,65));
 
-    world.add(make_shared<constant_medium>(box1, 0.01, color(0,0,0)));
-    world.add(make_shared<constant_medium>(box2, 0.01, color(1,1,1)));
+    scene.add(scene.constant_medium(box1, 0.01, color(0,0,0)));
+    scene.add(scene.constant_medium(box2, 0.01, color(1,1,1)));
 
-    camera cam;
+    camera_desc& cam = scene.camera;
 
     cam.aspect_ratio      = 1.0;
     cam.image_width       = 300;
@@ -286,34 +291,34 @@ void cornell_smoke() {
 
     cam.defocus_angle = 0;
 
-    cam.render(world);
+    return scene;
 }
 
-void cornell_box() {
-    hittable_list world;
-    auto red = make_shared<lambertian>(color{.65, .05, .05});
-    auto white = make_shared<lambertian>(color{.73, .73, .73});
-    auto green = make_shared<lambertian>(color{.12, .45, .15});
-    auto light = make_shared<diffuse_light>(color{15, 15, 15});
-
-    world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
-    world.add(make_shared<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
-    world.add(make_shared<quad>(point3(343, 554, 332), vec3(-130,0,0), vec3(0,0,-105), light));
-    world.add(make_shared<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
-    world.add(make_shared<quad>(point3(555,555,555), vec3(-555,0,0), vec3(0,0,-555), white));
-    world.add(make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
-
-    shared_ptr<hittable> box1 = box(point3(0,0,0), point3(165,330,165), white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265,0,295));
-    world.add(box1);
-    
-    shared_ptr<hittable> box2 = box(point3(0,0,0), point3(165,165,165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130,0,65));
-    world.add(box2);
-
-    camera cam;
+scene_desc cornell_box() {
+    scene_desc scene;
+    auto red = scene.lambertian(color{.65, .05, .05});
+    auto white = scene.lambertian(color{.73, .73, .73});
+    auto green = scene.lambertian(color{.12, .45, .15});
+    auto light = scene.diffuse_light(color{15, 15, 15});
+
+    scene.add(scene.quad(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
+    scene.add(scene.quad(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
+    scene.add(scene.quad(point3(343, 554, 332), vec3(-130,0,0), vec3(0,0,-105), light));
+    scene.add(scene.quad(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
+    scene.add(scene.quad(point3(555,555,555), vec3(-555,0,0), vec3(0,0,-555), white));
+    scene.add(scene.quad(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
+
+    int32_t box1 = scene.box(point3(0,0,0), point3(165,330,165), white);
+    box1 = scene.rotate_y(box1, 15);
+    box1 = scene.translate(box1, vec3(265,0,295));
+    scene.add(box1);
+
+    int32_t box2 = scene.box(point3(0,0,0), point3(165,165,165), white);
+    box2 = scene.rotate_y(box2, -18);
+    box2 = scene.translate(box2, vec3(130,0,65));
+    scene.add(box2);
+
+    camera_desc& cam = scene.camera;
 
     cam.aspect_ratio      = 1.0;
     cam.image_width       = 600;
@@ -328,16 +333,17 @@ void cornell_box() {
 
     cam.defocus_angle = 0;
 
-    cam.render(world);
+    return scene;
 }
 
-void final_scene(
+scene_desc final_scene(
     int32_t image_width,
     int32_t samples_per_pixel,
     int32_t max_depth
 ) {
-    hittable_list boxes1;
-    auto ground = make_shared<lambertian>(color{0.48, 0.83, 0.53});
+    scene_desc scene;
+    std::vector<int32_t> boxes1;
+    auto ground = scene.lambertian(color{0.48, 0.83, 0.53});
 
     int32_t box_per_side = 20;
     for (int32_t i = 0; i < box_per_side; i++) {
@@ -353,52 +359,51 @@ void final_scene(
                 random_double(1, 101),
                 p1.z() + w
             };
-            boxes1.add(box(p1, p2, ground));
+            boxes1.push_back(scene.box(p1, p2, ground));
         }
     }
 
-    hittable_list world;
-    world.add(make_shared<bvh_node>(boxes1));
+    scene.add(scene.bvh(boxes1));
 
-    auto light = make_shared<diffuse_light>(color{7, 7, 7});
-    world.add(make_shared<quad>(point3{123, 554, 147}, vec3{300, 0, 0}, vec3{0, 0, 265}, light));
+    auto light = scene.diffuse_light(color{7, 7, 7});
+    scene.add(scene.quad(point3{123, 554, 147}, vec3{300, 0, 0}, vec3{0, 0, 265}, light));
 
     point3 center1 = {400, 400, 400};
     point3 center2 = center1 + vec3{30, 0, 0};
-    auto sphere_material = make_shared<lambertian>(color{0.7, 0.3, 0.1});
-    world.add(make_shared<sphere>(center1, center2, 50, sphere_material));
+    auto sphere_material = scene.lambertian(color{0.7, 0.3, 0.1});
+    scene.add(scene.sphere(center1, center2, 50, sphere_material));
 
-    world.add(make_shared<sphere>(point3{260, 150, 45}, 50, make_shared<dielectric>(1.5)));
-    world.add(make_shared<sphere>(
-        point3(0, 150, 145), 50, make_shared<metal>(color(0.8, 0.8, 0.9), 1.0)
+    scene.add(scene.sphere(point3{260, 150, 45}, 50, scene.dielectric(1.5)));
+    scene.add(scene.sphere(
+        point3(0, 150, 145), 50, scene.metal(color(0.8, 0.8, 0.9), 1.0)
     ));
 
-    auto boundary = make_shared<sphere>(point3(360,150,145), 70, make_shared<dielectric>(1.5));
-    world.add(boundary);
-    world.add(make_shared<constant_medium>(boundary, 0.2, color{0.2, 0.4, 0.9}));
-    boundary = make_shared<sphere>(
-        point3(0, 0, 0), 5000, make_shared<dielectric>(1.5)
+    auto boundary = scene.sphere(point3(360,150,145), 70, scene.dielectric(1.5));
+    scene.add(boundary);
+    scene.add(scene.constant_medium(boundary, 0.2, color{0.2, 0.4, 0.9}));
+    boundary = scene.sphere(
+        point3(0, 0, 0), 5000, scene.dielectric(1.5)
     );
-    world.add(make_shared<constant_medium>(boundary, 0.0001, color{1,1,1}));
+    scene.add(scene.constant_medium(boundary, 0.0001, color{1,1,1}));
 
-    auto emat = make_shared<lambertian>(make_shared<image_texture>("earthmap.jpg"));
-    world.add(make_shared<sphere>(point3{400, 200, 400}, 100, emat));
-    auto pertext = make_shared<noise_texture>(0.2);
-    world.add(make_shared<sphere>(point3(220, 280, 300), 80, make_shared<lambertian>(pertext)));
+    auto emat = scene.lambertian(scene.image_texture("earthmap.jpg"));
+    scene.add(scene.sphere(point3{400, 200, 400}, 100, emat));
+    auto pertext = scene.noise_texture(0.2);
+    scene.add(scene.sphere(point3(220, 280, 300), 80, scene.lambertian(pertext)));
 
-    hittable_list boxes2;
-    auto white = make_shared<lambertian>(color{0.73, 0.73, 0.73});
+    std::vector<int32_t> boxes2;
+    auto white = scene.lambertian(color{0.73, 0.73, 0.73});
     int32_t ns = 1000;
     for (int32_t j = 0; j < ns; j++) {
-        boxes2.add(make_shared<sphere>(point3::random(0, 165), 10, white));
+        boxes2.push_back(scene.sphere(point3::random(0, 165), 10, white));
     }
 
-    world.add(make_shared<translate>(
-        make_shared<rotate_y>(make_shared<bvh_node>(boxes2), 15),
+    scene.add(scene.translate(
+        scene.rotate_y(scene.bvh(boxes2), 15),
         vec3(-100, 270, 395)
     ));
 
-    camera cam;
+    camera_desc& cam = scene.camera;
     cam.aspect_ratio = 1.0;
     cam.image_width = image_width;
     cam.samples_per_pixel = samples_per_pixel;
@@ -412,8 +417,23 @@ void final_scene(
 
     cam.defocus_angle = 0;
 
-    cam.render(world);
+    return scene;
+}
+
+/** `main --export`で書き出せる組み込みシーンの一覧 */
+inline std::vector<std::pair<std::string, std::function<scene_desc()>>> builtin_scenes() {
+    return {
+        {"bouncing_spheres",  bouncing_spheres},
+        {"checkered_spheres", checkered_spheres},
+        {"earth",             earth},
+        {"perlin_spheres",    perlin_spheres},
+        {"quads",             quads},
+        {"simple_light",      simple_light},
+        {"cornell_box",       cornell_box},
+        {"cornell_smoke",     cornell_smoke},
+        {"final_scene",       [] { return final_scene(600, 5000, 30); }},
+    };
 }
 
 
-#endif
\ No newline at end of file
+#endif